@@ -0,0 +1,63 @@
+// Back_L5/cpp/bench/bench_bp128_decode.cpp
+// Скорость распаковки BP128-блоков по ядрам (scalar / sse41 / avx2) и ширинам.
+//
+// Usage: bench_bp128_decode [n_blocks]   (default: 200000 => 25.6M значений)
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "l5/posting_codec.h"
+
+namespace {
+
+using l5::bp128::Kernel;
+
+double mvals_per_sec(const std::vector<unsigned char>& buf, size_t n_blocks, unsigned b,
+                     bool delta, Kernel k, uint64_t& sink) {
+    const size_t stride = l5::bp128::packed_bytes(b);
+    uint32_t out[l5::bp128::kBlock];
+    const auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n_blocks; ++i) {
+        const unsigned char* p = buf.data() + i * stride;
+        if (delta) l5::bp128::unpack_delta(p, b, (uint32_t)i, out, k);
+        else l5::bp128::unpack(p, b, (uint32_t)i, out, k);
+        sink += out[i & (l5::bp128::kBlock - 1)];
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    const double sec = std::chrono::duration<double>(t1 - t0).count();
+    return (double)(n_blocks * l5::bp128::kBlock) / sec / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t n_blocks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    std::mt19937 rng(42);
+    uint64_t sink = 0;
+
+    for (unsigned b : {4u, 8u, 12u, 17u, 24u, 32u}) {
+        const size_t stride = l5::bp128::packed_bytes(b);
+        std::vector<unsigned char> buf(n_blocks * stride + l5::bp128::kTailPad);
+        uint32_t v[l5::bp128::kBlock];
+        for (size_t i = 0; i < n_blocks; ++i) {
+            for (auto& x : v) x = b == 32 ? rng() : rng() & ((1u << b) - 1);
+            l5::bp128::pack(v, l5::bp128::kBlock, b, buf.data() + i * stride);
+        }
+
+        for (bool delta : {false, true}) {
+            std::cout << "b=" << b << (delta ? " delta" : " for  ");
+            for (Kernel k : {Kernel::Scalar, Kernel::Sse41, Kernel::Avx2}) {
+                if (!l5::bp128::kernel_supported(k)) continue;
+                std::cout << " " << l5::bp128::kernel_name(k) << "_mvals_s="
+                          << mvals_per_sec(buf, n_blocks, b, delta, k, sink);
+            }
+            std::cout << "\n";
+        }
+    }
+
+    if (sink == 42) std::cout << "";
+    return 0;
+}
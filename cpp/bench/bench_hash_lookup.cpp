@@ -0,0 +1,133 @@
+// Back_L5/cpp/bench/bench_hash_lookup.cpp
+// Сравнение lookup по хэшу: полный lower_bound/upper_bound (как было в
+// range_for_hash_safe) против HashDirectory (radix по старшим битам + branchless).
+//
+// Usage: bench_hash_lookup [n_postings ...]   (default: 10M 100M 1B)
+// Память: 16 байт на posting (1B => ~16 GiB + директория).
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "l5/format.h"
+#include "l5/hash_directory.h"
+#include "l5/mapped_segment.h"
+
+namespace {
+
+struct Layout {
+    std::vector<unsigned char> bytes;
+    l5::PostingsView view;
+    std::vector<uint64_t> present; // сэмпл существующих хэшей
+};
+
+// ~2 postings на уникальный хэш (типичный сегмент), записи по 16 байт как на диске
+Layout make_postings(uint64_t n, std::mt19937_64& rng) {
+    std::vector<uint64_t> hs((size_t)n);
+    for (uint64_t i = 0; i < n;) {
+        const uint64_t h = rng();
+        const uint64_t rep = 1 + (rng() & 3) / 2; // 1..2
+        for (uint64_t k = 0; k < rep && i < n; ++k) hs[(size_t)i++] = h;
+    }
+    std::sort(hs.begin(), hs.end());
+
+    Layout L;
+    L.bytes.resize((size_t)n * l5::POSTING9_BYTES);
+    for (uint64_t i = 0; i < n; ++i) {
+        unsigned char* p = L.bytes.data() + (size_t)i * l5::POSTING9_BYTES;
+        const uint32_t did = (uint32_t)(i & 0xFFFFF);
+        const uint32_t pos = (uint32_t)(i & 0xFFF);
+        std::memcpy(p, &hs[(size_t)i], 8);
+        std::memcpy(p + 8, &did, 4);
+        std::memcpy(p + 12, &pos, 4);
+    }
+    L.view = l5::PostingsView(L.bytes.data(), (size_t)n);
+
+    L.present.reserve(1u << 20);
+    for (size_t i = 0; i < (1u << 20); ++i) L.present.push_back(hs[(size_t)(rng() % n)]);
+    return L;
+}
+
+// как было: std::lower_bound + std::upper_bound по всему массиву
+std::pair<size_t, size_t> range_full(const l5::PostingsView& v, uint64_t h) {
+    size_t lo = 0, n = v.size();
+    while (n > 0) {
+        const size_t half = n / 2;
+        if (v.h(lo + half) < h) { lo += half + 1; n -= half + 1; }
+        else n = half;
+    }
+    const size_t l = lo;
+    n = v.size() - l;
+    while (n > 0) {
+        const size_t half = n / 2;
+        if (!(h < v.h(lo + half))) { lo += half + 1; n -= half + 1; }
+        else n = half;
+    }
+    return {l, lo};
+}
+
+template <class F>
+double ns_per_lookup(const std::vector<uint64_t>& qs, uint64_t& sink, F&& f) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t h : qs) {
+        auto [l, r] = f(h);
+        sink += (uint64_t)(r - l) + l;
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / (double)qs.size();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<uint64_t> sizes;
+    for (int i = 1; i < argc; ++i) sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty()) sizes = {10'000'000ull, 100'000'000ull, 1'000'000'000ull};
+
+    std::mt19937_64 rng(42);
+    uint64_t sink = 0;
+
+    for (uint64_t n : sizes) {
+        Layout L = make_postings(n, rng);
+
+        // запросы: половина существующих хэшей, половина случайных (промахи)
+        std::vector<uint64_t> qs;
+        qs.reserve(2u << 20);
+        for (uint64_t h : L.present) qs.push_back(h);
+        for (size_t i = 0; i < L.present.size(); ++i) qs.push_back(rng());
+        std::shuffle(qs.begin(), qs.end(), rng);
+
+        const auto tb0 = std::chrono::steady_clock::now();
+        l5::HashDirectory dir;
+        dir.build(L.view);
+        const auto tb1 = std::chrono::steady_clock::now();
+
+        // проверка корректности
+        for (size_t i = 0; i < 10000; ++i) {
+            if (range_full(L.view, qs[i]) != dir.range(L.view, qs[i])) {
+                std::cerr << "MISMATCH at n=" << n << "\n";
+                return 2;
+            }
+        }
+
+        const double full_ns = ns_per_lookup(qs, sink, [&](uint64_t h) { return range_full(L.view, h); });
+        const double dir_ns = ns_per_lookup(qs, sink, [&](uint64_t h) { return dir.range(L.view, h); });
+
+        std::cout << "n_postings=" << n
+                  << " dir_bits=" << dir.bits()
+                  << " dir_mib=" << (double)dir.bytes() / (1024.0 * 1024.0)
+                  << " dir_build_ms="
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(tb1 - tb0).count()
+                  << " full_bsearch_ns=" << full_ns
+                  << " directory_ns=" << dir_ns
+                  << " speedup=" << (full_ns / dir_ns) << "\n";
+    }
+
+    if (sink == 42) std::cout << "";
+    return 0;
+}
@@ -0,0 +1,231 @@
+// Back_L5/cpp/bench/bench_search_stages.cpp
+// Stage A/B search_in_segment на длинных запросах (10k+ шинглов):
+// как было (range_for_hash дважды + unordered_set кандидатов + unordered_map точек)
+// против одного прохода (ranges запоминаются в Stage A, slot-массив кандидатов).
+//
+// Usage: bench_search_stages [n_docs] [query_tokens]   (default: 20000 20000)
+// Корпус синтетический, строится во временный каталог и удаляется.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "l5/builder.h"
+#include "l5/query.h"
+#include "l5/search_segment.h"
+#include "l5/segment_cache.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Point {
+    uint32_t qpos;
+    uint32_t dpos;
+};
+
+std::vector<uint32_t> pick_candidates(std::vector<uint32_t>& hits, const l5::SearchOptions& opt) {
+    std::vector<uint32_t> cand;
+    for (uint32_t did = 0; did < (uint32_t)hits.size(); ++did) {
+        if (hits[did] >= opt.min_hits) cand.push_back(did);
+    }
+    const uint32_t topN = std::min<uint32_t>(opt.candidates_topn, (uint32_t)cand.size());
+    if (cand.size() > topN) {
+        std::nth_element(cand.begin(), cand.begin() + topN, cand.end(),
+                         [&](uint32_t a, uint32_t b) { return hits[a] > hits[b]; });
+        cand.resize(topN);
+    }
+    return cand;
+}
+
+// как было: lookup на каждый хэш в обеих стадиях, кандидаты в хэш-контейнерах
+uint64_t two_pass(const l5::MappedSegment& seg, uint32_t n_docs, const l5::QueryShingles& q,
+                  const l5::SearchOptions& opt) {
+    std::vector<uint32_t> hits(n_docs, 0);
+    for (const auto& qi : q.items) {
+        auto [l, r] = seg.range_for_hash(qi.h);
+        if (r == l || r - l > opt.max_postings_per_hash) continue;
+        seg.add_hits(l, r, hits.data(), n_docs);
+    }
+    const std::vector<uint32_t> cand = pick_candidates(hits, opt);
+
+    std::unordered_set<uint32_t> cand_set(cand.begin(), cand.end());
+    std::unordered_map<uint32_t, std::vector<Point>> points_by_doc;
+    std::vector<uint32_t> dids;
+    for (const auto& qi : q.items) {
+        auto [l, r] = seg.range_for_hash(qi.h);
+        if (r == l || r - l > opt.max_postings_per_hash) continue;
+        dids.resize(r - l);
+        seg.decode_dids(l, r, dids.data());
+        for (size_t i = l; i < r; ++i) {
+            const uint32_t did = dids[i - l];
+            if (did >= n_docs || cand_set.find(did) == cand_set.end()) continue;
+            const uint32_t dpos = seg.pos_at(i);
+            auto& vec = points_by_doc[did];
+            for (uint32_t qp : qi.qpos) vec.push_back(Point{qp, dpos});
+        }
+    }
+
+    uint64_t n_points = 0;
+    for (const auto& kv : points_by_doc) n_points += kv.second.size();
+    return n_points;
+}
+
+// как сейчас в search_in_segment
+uint64_t single_pass(const l5::MappedSegment& seg, uint32_t n_docs, const l5::QueryShingles& q,
+                     const l5::SearchOptions& opt) {
+    struct QRange {
+        size_t l;
+        size_t r;
+        uint32_t item;
+    };
+    std::vector<QRange> ranges;
+    ranges.reserve(q.items.size());
+
+    std::vector<uint32_t> hits(n_docs, 0);
+    for (uint32_t k = 0; k < (uint32_t)q.items.size(); ++k) {
+        auto [l, r] = seg.range_for_hash(q.items[k].h);
+        if (r == l || r - l > opt.max_postings_per_hash) continue;
+        ranges.push_back(QRange{l, r, k});
+        seg.add_hits(l, r, hits.data(), n_docs);
+    }
+    const std::vector<uint32_t> cand = pick_candidates(hits, opt);
+
+    std::fill(hits.begin(), hits.end(), 0u);
+    for (uint32_t i = 0; i < (uint32_t)cand.size(); ++i) hits[cand[i]] = i + 1;
+
+    std::vector<std::vector<Point>> points_by_slot(cand.size());
+    std::vector<uint32_t> dids;
+    for (const auto& rg : ranges) {
+        dids.resize(rg.r - rg.l);
+        seg.decode_dids(rg.l, rg.r, dids.data());
+        for (size_t i = rg.l; i < rg.r; ++i) {
+            const uint32_t did = dids[i - rg.l];
+            if (did >= n_docs || hits[did] == 0) continue;
+            const uint32_t dpos = seg.pos_at(i);
+            auto& vec = points_by_slot[hits[did] - 1];
+            for (uint32_t qp : q.items[rg.item].qpos) vec.push_back(Point{qp, dpos});
+        }
+    }
+
+    uint64_t n_points = 0;
+    for (const auto& v : points_by_slot) n_points += v.size();
+    return n_points;
+}
+
+std::string word(std::mt19937& rng, uint32_t vocab) {
+    return "w" + std::to_string(rng() % vocab);
+}
+
+// документы из случайных слов; половина копирует фрагмент более раннего документа
+void write_corpus(const fs::path& p, uint32_t n_docs, std::vector<std::vector<std::string>>& docs,
+                  std::mt19937& rng) {
+    std::ofstream out(p);
+    docs.resize(n_docs);
+    for (uint32_t d = 0; d < n_docs; ++d) {
+        auto& w = docs[d];
+        for (int i = 0; i < 400; ++i) w.push_back(word(rng, 20000));
+        if (d > 0 && (rng() & 1)) {
+            const auto& src = docs[rng() % d];
+            const size_t from = rng() % 200, at = rng() % 200;
+            std::copy(src.begin() + (long)from, src.begin() + (long)from + 150, w.begin() + (long)at);
+        }
+        std::string text;
+        for (const auto& s : w) text += s + " ";
+        out << "{\"doc_id\":\"d" << d << "\",\"text\":\"" << text << "\"}\n";
+    }
+}
+
+template <class F>
+double us_per_query(const std::vector<l5::QueryShingles>& qs, int reps, uint64_t& sink, F&& f) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) {
+        for (const auto& q : qs) sink += f(q);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / (double)(reps * qs.size());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const uint32_t n_docs = argc > 1 ? (uint32_t)std::strtoul(argv[1], nullptr, 10) : 20000;
+    const uint32_t q_tokens = argc > 2 ? (uint32_t)std::strtoul(argv[2], nullptr, 10) : 20000;
+
+    std::mt19937 rng(42);
+    const fs::path root = fs::temp_directory_path() / ("l5_bench_" + std::to_string((uint64_t)std::time(nullptr)));
+    fs::create_directories(root);
+
+    std::vector<std::vector<std::string>> docs;
+    write_corpus(root / "corpus.jsonl", n_docs, docs, rng);
+
+    l5::BuildOptions bopt;
+    bopt.segment_name = "s";
+    l5::build_segment_jsonl(root / "corpus.jsonl", root / "out", bopt);
+
+    l5::LoadedSegment ls;
+    std::string err;
+    if (!l5::load_segment(root / "out" / "s", ls, &err)) {
+        std::cerr << "load_segment: " << err << "\n";
+        return 1;
+    }
+    const uint32_t n = std::min<uint32_t>(ls.seg.n_docs(), (uint32_t)ls.docinfo.size());
+
+    // запрос: куски документов корпуса вперемешку со случайными словами
+    std::vector<l5::QueryShingles> qs;
+    for (int k = 0; k < 8; ++k) {
+        std::string text;
+        for (uint32_t t = 0; t < q_tokens;) {
+            if (rng() % 3 == 0) {
+                const auto& src = docs[rng() % docs.size()];
+                for (size_t i = 0; i < 120; ++i) text += src[i] + " ";
+                t += 120;
+            } else {
+                for (int i = 0; i < 40; ++i) text += word(rng, 20000) + " ";
+                t += 40;
+            }
+        }
+        qs.push_back(l5::build_query_shingles(text, true, ls.seg.hash_scheme()));
+    }
+
+    l5::SearchOptions opt;
+    uint64_t sink = 0;
+    for (const auto& q : qs) {
+        if (two_pass(ls.seg, n, q, opt) != single_pass(ls.seg, n, q, opt)) {
+            std::cerr << "MISMATCH\n";
+            return 2;
+        }
+    }
+
+    const int reps = 5;
+    const double old_us = us_per_query(qs, reps, sink, [&](const l5::QueryShingles& q) {
+        return two_pass(ls.seg, n, q, opt);
+    });
+    const double new_us = us_per_query(qs, reps, sink, [&](const l5::QueryShingles& q) {
+        return single_pass(ls.seg, n, q, opt);
+    });
+    const double full_us = us_per_query(qs, reps, sink, [&](const l5::QueryShingles& q) {
+        return (uint64_t)l5::search_in_segment(ls.seg, ls.docinfo, q, opt).size();
+    });
+
+    std::cout << "n_docs=" << n
+              << " query_hashes=" << qs[0].items.size()
+              << " two_pass_us=" << old_us
+              << " single_pass_us=" << new_us
+              << " speedup=" << (old_us / new_us)
+              << " search_in_segment_us=" << full_us << "\n";
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+    if (sink == 42) std::cout << "";
+    return 0;
+}
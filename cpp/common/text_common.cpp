@@ -3,6 +3,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <string_view>
 
 namespace {
@@ -130,15 +133,9 @@ static inline uint32_t to_lower_ru_kz(uint32_t cp) {
     return cp;
 }
 
-} // namespace
-
-void normalize_for_shingles_simple_to(std::string_view s, std::string& out) {
-    out.clear();
-    out.reserve(s.size());
-
-    bool prev_space = true;
-
-    for (size_t i = 0; i < s.size();) {
+// scalar: s[i..] дописывается в out; prev_space — был ли последним выведен пробел (или начало)
+static void normalize_scalar_from(std::string_view s, size_t i, bool& prev_space, std::string& out) {
+    for (; i < s.size();) {
         const unsigned char b = (unsigned char)s[i];
 
         // ASCII fast path
@@ -201,10 +198,293 @@ void normalize_for_shingles_simple_to(std::string_view s, std::string& out) {
 
         i += d.len;
     }
+}
+
+} // namespace
+
+
+// --------------------
+// SIMD: побайтная классификация блока по соседям.
+// Байт сохраняется, если это ASCII [A-Za-z0-9] или часть пары lead D0..D4 + cont
+// (2-байтная кириллица 0x400..0x52F; lead D0..D4 всегда граница символа для
+// скалярного декодера). Всё остальное (пунктуация, пробелы, прочий UTF-8, битые
+// последовательности) — разделитель; подряд идущие разделители => один пробел.
+// Это ровно то, что делает скалярный проход, поэтому fallback нужен только для хвоста.
+// --------------------
+#if defined(__x86_64__) || defined(__i386__)
+#define L5_TEXT_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef L5_TEXT_X86
+namespace {
+
+// для 8 бит маски: индексы выбранных байт подряд (pshufb)
+struct CompactTable {
+    alignas(16) uint64_t idx[256];
+    CompactTable() {
+        for (unsigned m = 0; m < 256; ++m) {
+            uint64_t v = 0;
+            unsigned k = 0;
+            for (unsigned b = 0; b < 8; ++b) {
+                if (m & (1u << b)) v |= (uint64_t)b << (8 * k++);
+            }
+            for (; k < 8; ++k) v |= (uint64_t)0x80 << (8 * k);
+            idx[m] = v;
+        }
+    }
+};
+
+static const CompactTable& compact_table() {
+    static const CompactTable t;
+    return t;
+}
+
+// 32 байта блока: vals — уже преобразованные байты (разделители = ' '), keep — маска
+// сохраняемых, len — сколько байт блока обработано. Пишет в out, двигает его.
+__attribute__((target("ssse3")))
+static void emit_block(const unsigned char* vals, uint32_t keep, unsigned len, bool& prev_space, char*& out) {
+    const uint32_t valid = len == 32 ? 0xFFFFFFFFu : ((1u << len) - 1);
+    const uint32_t sep = ~keep & valid;
+    const uint32_t sep_prev = (sep << 1) | (prev_space ? 1u : 0u);
+    const uint32_t emit = (keep | (sep & ~sep_prev)) & valid;
+    prev_space = (sep >> (len - 1)) & 1u;
+
+    const CompactTable& t = compact_table();
+    for (unsigned g = 0; g < 4; ++g) {
+        const unsigned m = (emit >> (8 * g)) & 0xFF;
+        const __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(vals + 8 * g));
+        const __m128i sh = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&t.idx[m]));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(x, sh));
+        out += __builtin_popcount(m);
+    }
+}
+
+// Классификация одного вектора. cur — байты блока, prv/nxt — те же, сдвинутые
+// на байт назад/вперёд. keep: ASCII alnum | lead D0..D4 + cont | cont после такого lead
+// (у D4 только cont <= AF: 0x500..0x52F). vals: lower (to_lower_ru_kz по байтам пары),
+// разделители = ' '. Ниже две копии одной схемы: SSE4.2 (16 байт) и AVX2 (32 байта).
+
+__attribute__((target("sse4.2")))
+static inline __m128i eq128(__m128i x, unsigned char c) {
+    return _mm_cmpeq_epi8(x, _mm_set1_epi8((char)c));
+}
 
+// unsigned lo <= x <= hi
+__attribute__((target("sse4.2")))
+static inline __m128i in_range128(__m128i x, unsigned char lo, unsigned char hi) {
+    const __m128i d = _mm_sub_epi8(x, _mm_set1_epi8((char)lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)(hi - lo))), d);
+}
+
+__attribute__((target("sse4.2")))
+static inline void classify128(__m128i prv, __m128i cur, __m128i nxt, __m128i& keep, __m128i& vals) {
+    const __m128i upper = in_range128(cur, 'A', 'Z');
+    const __m128i low = _mm_add_epi8(cur, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    const __m128i alnum = _mm_or_si128(in_range128(low, '0', '9'), in_range128(low, 'a', 'z'));
+
+    const __m128i lead = _mm_andnot_si128(_mm_and_si128(eq128(cur, 0xD4), in_range128(nxt, 0xB0, 0xBF)),
+                                          _mm_and_si128(in_range128(cur, 0xD0, 0xD4), in_range128(nxt, 0x80, 0xBF)));
+    const __m128i cont = _mm_andnot_si128(_mm_and_si128(eq128(prv, 0xD4), in_range128(cur, 0xB0, 0xBF)),
+                                          _mm_and_si128(in_range128(prv, 0xD0, 0xD4), in_range128(cur, 0x80, 0xBF)));
+    keep = _mm_or_si128(alnum, _mm_or_si128(lead, cont));
+
+    // D0 xx: 90..9F +0x20, A0..AF -0x20, 81/86 (Ё, І) +0x10; lead D0 -> D1 для A0..AF/81/86
+    const __m128i c0 = _mm_and_si128(cont, eq128(prv, 0xD0));
+    const __m128i io = _mm_or_si128(eq128(cur, 0x81), eq128(cur, 0x86));
+    __m128i delta = _mm_and_si128(upper, _mm_set1_epi8(0x20));
+    delta = _mm_or_si128(delta, _mm_and_si128(_mm_and_si128(c0, in_range128(cur, 0x90, 0x9F)), _mm_set1_epi8(0x20)));
+    delta = _mm_or_si128(delta, _mm_and_si128(_mm_and_si128(c0, in_range128(cur, 0xA0, 0xAF)), _mm_set1_epi8((char)0xE0)));
+    delta = _mm_or_si128(delta, _mm_and_si128(_mm_and_si128(c0, io), _mm_set1_epi8(0x10)));
+
+    // +1: lead D0 -> D1; казахские пары D2 xx / D3 xx (верхний регистр — чётный cont)
+    const __m128i nio = _mm_or_si128(in_range128(nxt, 0xA0, 0xAF), _mm_or_si128(eq128(nxt, 0x81), eq128(nxt, 0x86)));
+    const __m128i kz2 = _mm_or_si128(_mm_or_si128(_mm_or_si128(eq128(cur, 0x92), eq128(cur, 0x9A)),
+                                                  _mm_or_si128(eq128(cur, 0xA2), eq128(cur, 0xAE))),
+                                     _mm_or_si128(eq128(cur, 0xB0), eq128(cur, 0xBA)));
+    const __m128i kz3 = _mm_or_si128(eq128(cur, 0x98), eq128(cur, 0xA8));
+    __m128i plus1 = _mm_and_si128(_mm_and_si128(lead, eq128(cur, 0xD0)), nio);
+    plus1 = _mm_or_si128(plus1, _mm_and_si128(_mm_and_si128(cont, eq128(prv, 0xD2)), kz2));
+    plus1 = _mm_or_si128(plus1, _mm_and_si128(_mm_and_si128(cont, eq128(prv, 0xD3)), kz3));
+    delta = _mm_or_si128(delta, _mm_and_si128(plus1, _mm_set1_epi8(0x01)));
+
+    vals = _mm_blendv_epi8(_mm_set1_epi8(' '), _mm_add_epi8(cur, delta), keep);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i eq256(__m256i x, unsigned char c) {
+    return _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)c));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i in_range256(__m256i x, unsigned char lo, unsigned char hi) {
+    const __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8((char)lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8((char)(hi - lo))), d);
+}
+
+__attribute__((target("avx2")))
+static inline void classify256(__m256i prv, __m256i cur, __m256i nxt, __m256i& keep, __m256i& vals) {
+    const __m256i upper = in_range256(cur, 'A', 'Z');
+    const __m256i low = _mm256_add_epi8(cur, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    const __m256i alnum = _mm256_or_si256(in_range256(low, '0', '9'), in_range256(low, 'a', 'z'));
+
+    if (_mm256_movemask_epi8(cur) == 0) {
+        // чистый ASCII
+        keep = alnum;
+        vals = _mm256_blendv_epi8(_mm256_set1_epi8(' '), low, keep);
+        return;
+    }
+
+    const __m256i lead = _mm256_andnot_si256(_mm256_and_si256(eq256(cur, 0xD4), in_range256(nxt, 0xB0, 0xBF)),
+                                             _mm256_and_si256(in_range256(cur, 0xD0, 0xD4), in_range256(nxt, 0x80, 0xBF)));
+    const __m256i cont = _mm256_andnot_si256(_mm256_and_si256(eq256(prv, 0xD4), in_range256(cur, 0xB0, 0xBF)),
+                                             _mm256_and_si256(in_range256(prv, 0xD0, 0xD4), in_range256(cur, 0x80, 0xBF)));
+    keep = _mm256_or_si256(alnum, _mm256_or_si256(lead, cont));
+
+    const __m256i c0 = _mm256_and_si256(cont, eq256(prv, 0xD0));
+    const __m256i io = _mm256_or_si256(eq256(cur, 0x81), eq256(cur, 0x86));
+    __m256i delta = _mm256_and_si256(upper, _mm256_set1_epi8(0x20));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(_mm256_and_si256(c0, in_range256(cur, 0x90, 0x9F)), _mm256_set1_epi8(0x20)));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(_mm256_and_si256(c0, in_range256(cur, 0xA0, 0xAF)), _mm256_set1_epi8((char)0xE0)));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(_mm256_and_si256(c0, io), _mm256_set1_epi8(0x10)));
+
+    const __m256i nio = _mm256_or_si256(in_range256(nxt, 0xA0, 0xAF), _mm256_or_si256(eq256(nxt, 0x81), eq256(nxt, 0x86)));
+    const __m256i kz2 = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(eq256(cur, 0x92), eq256(cur, 0x9A)),
+                                                        _mm256_or_si256(eq256(cur, 0xA2), eq256(cur, 0xAE))),
+                                        _mm256_or_si256(eq256(cur, 0xB0), eq256(cur, 0xBA)));
+    const __m256i kz3 = _mm256_or_si256(eq256(cur, 0x98), eq256(cur, 0xA8));
+    __m256i plus1 = _mm256_and_si256(_mm256_and_si256(lead, eq256(cur, 0xD0)), nio);
+    plus1 = _mm256_or_si256(plus1, _mm256_and_si256(_mm256_and_si256(cont, eq256(prv, 0xD2)), kz2));
+    plus1 = _mm256_or_si256(plus1, _mm256_and_si256(_mm256_and_si256(cont, eq256(prv, 0xD3)), kz3));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(plus1, _mm256_set1_epi8(0x01)));
+
+    vals = _mm256_blendv_epi8(_mm256_set1_epi8(' '), _mm256_add_epi8(cur, delta), keep);
+}
+
+// lead в последнем байте блока: его cont в следующем блоке => этот байт отдаём следующему
+static inline unsigned block_len(const unsigned char* b, uint32_t keep) {
+    return ((keep >> 31) & 1u) && b[31] >= 0xD0 ? 31 : 32;
+}
+
+// блоки [i, i + 32) пока i + 32 < n (nxt читает s[i + 32]); возвращает, где остановились
+__attribute__((target("sse4.2")))
+static size_t normalize_blocks_sse42(const unsigned char* s, size_t n, bool& prev_space, char*& out) {
+    alignas(16) unsigned char vals[32];
+    size_t i = 0;
+    while (i + 33 <= n) {
+        const unsigned char* b = s + i;
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16));
+        const __m128i prv_lo = _mm_insert_epi8(_mm_slli_si128(lo, 1), i ? (char)b[-1] : 0, 0);
+        const __m128i prv_hi = _mm_alignr_epi8(hi, lo, 15);
+
+        __m128i k0, k1, v0, v1;
+        classify128(prv_lo, lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 1)), k0, v0);
+        classify128(prv_hi, hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 17)), k1, v1);
+        _mm_store_si128(reinterpret_cast<__m128i*>(vals), v0);
+        _mm_store_si128(reinterpret_cast<__m128i*>(vals + 16), v1);
+
+        const uint32_t keep = (uint32_t)_mm_movemask_epi8(k0) | ((uint32_t)_mm_movemask_epi8(k1) << 16);
+        const unsigned len = block_len(b, keep);
+        emit_block(vals, keep, len, prev_space, out);
+        i += len;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t normalize_blocks_avx2(const unsigned char* s, size_t n, bool& prev_space, char*& out) {
+    alignas(32) unsigned char vals[32];
+    size_t i = 0;
+    while (i + 33 <= n) {
+        const unsigned char* b = s + i;
+        const __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+        const __m256i nxt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 1));
+        // cur со сдвигом на байт назад через границу 128-битных половин; b[-1] (или 0) в байт 0
+        const __m256i lo_lane = _mm256_permute2x128_si256(cur, cur, 0x08);
+        const __m256i prv = _mm256_insert_epi8(_mm256_alignr_epi8(cur, lo_lane, 15), i ? (char)b[-1] : 0, 0);
+
+        __m256i k, v;
+        classify256(prv, cur, nxt, k, v);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(vals), v);
+
+        const uint32_t keep = (uint32_t)_mm256_movemask_epi8(k);
+        const unsigned len = block_len(b, keep);
+        emit_block(vals, keep, len, prev_space, out);
+        i += len;
+    }
+    return i;
+}
+
+} // namespace
+#endif // L5_TEXT_X86
+
+bool normalize_kernel_supported(NormalizeKernel k) {
+    switch (k) {
+    case NormalizeKernel::Scalar: return true;
+#ifdef L5_TEXT_X86
+    case NormalizeKernel::Sse42: return __builtin_cpu_supports("sse4.2");
+    case NormalizeKernel::Avx2: return __builtin_cpu_supports("avx2");
+#else
+    default: return false;
+#endif
+    }
+    return false;
+}
+
+const char* normalize_kernel_name(NormalizeKernel k) {
+    switch (k) {
+    case NormalizeKernel::Scalar: return "scalar";
+    case NormalizeKernel::Sse42: return "sse42";
+    case NormalizeKernel::Avx2: return "avx2";
+    }
+    return "scalar";
+}
+
+NormalizeKernel normalize_active_kernel() {
+    static const NormalizeKernel k = [] {
+        NormalizeKernel cap = NormalizeKernel::Avx2;
+        if (const char* e = std::getenv("PLAGIO_NORMALIZE_SIMD")) {
+            if (std::strcmp(e, "scalar") == 0) cap = NormalizeKernel::Scalar;
+            else if (std::strcmp(e, "sse42") == 0) cap = NormalizeKernel::Sse42;
+        }
+        if (cap == NormalizeKernel::Avx2 && normalize_kernel_supported(NormalizeKernel::Avx2)) return NormalizeKernel::Avx2;
+        if (cap != NormalizeKernel::Scalar && normalize_kernel_supported(NormalizeKernel::Sse42)) return NormalizeKernel::Sse42;
+        return NormalizeKernel::Scalar;
+    }();
+    return k;
+}
+
+void normalize_for_shingles_simple_to(std::string_view s, std::string& out, NormalizeKernel k) {
+    out.clear();
+    bool prev_space = true;
+    size_t i = 0;
+
+#ifdef L5_TEXT_X86
+    if (k != NormalizeKernel::Scalar && normalize_kernel_supported(k) && s.size() >= 33) {
+        // блоки пишут по 8 байт с запасом: выход не длиннее входа
+        out.resize(s.size() + 32);
+        char* dst = &out[0];
+        const auto* src = reinterpret_cast<const unsigned char*>(s.data());
+        i = k == NormalizeKernel::Avx2 ? normalize_blocks_avx2(src, s.size(), prev_space, dst)
+                                       : normalize_blocks_sse42(src, s.size(), prev_space, dst);
+        out.resize((size_t)(dst - out.data()));
+    } else {
+        out.reserve(s.size());
+    }
+#else
+    (void)k;
+    out.reserve(s.size());
+#endif
+
+    normalize_scalar_from(s, i, prev_space, out);
     if (!out.empty() && out.back() == ' ') out.pop_back();
 }
 
+void normalize_for_shingles_simple_to(std::string_view s, std::string& out) {
+    normalize_for_shingles_simple_to(s, out, normalize_active_kernel());
+}
+
 std::string normalize_for_shingles_simple(std::string_view s) {
     std::string out;
     normalize_for_shingles_simple_to(s, out);
@@ -304,20 +584,276 @@ uint64_t hash_shingle_token_hashes(const std::vector<uint64_t>& token_hashes,
     return h;
 }
 
+// --------------------
+// simhash128: v0[i] = (#токенов с битом i) * 2 - N, lo — то же для th ^ kSimhashXor,
+// т.е. по тем же счётчикам (бит i в xor => единиц N - ones[i]). Считаем единицы по
+// битам: 8-битные счётчики на 255 токенов, затем сброс в 64-битные.
+// --------------------
+static constexpr uint64_t kSimhashXor = 0xD6E8FEB86659FD93ULL;
+static constexpr size_t kSimhashFlush = 255;
+
+static std::pair<uint64_t, uint64_t> simhash_from_ones(const uint64_t* ones, uint64_t n) {
+    uint64_t hi = 0, lo = 0;
+    for (int i = 0; i < 64; ++i) {
+        const uint64_t o = ones[i];
+        const uint64_t ob = ((kSimhashXor >> i) & 1ULL) ? n - o : o;
+        if (2 * o > n) hi |= 1ULL << i;
+        if (2 * ob > n) lo |= 1ULL << i;
+    }
+    return {hi, lo};
+}
+
+// байт b -> 8 байт по 0/1 (бит k в байт k)
+struct BitSpreadTable {
+    uint64_t t[256];
+    BitSpreadTable() {
+        for (unsigned b = 0; b < 256; ++b) {
+            uint64_t v = 0;
+            for (unsigned k = 0; k < 8; ++k) v |= (uint64_t)((b >> k) & 1u) << (8 * k);
+            t[b] = v;
+        }
+    }
+};
+
+static void count_bits_scalar(const uint64_t* th, size_t n, uint64_t* ones) {
+    static const BitSpreadTable spread;
+    for (size_t i0 = 0; i0 < n; i0 += kSimhashFlush) {
+        const size_t i1 = std::min(n, i0 + kSimhashFlush);
+        uint64_t acc[8] = {}; // acc[j], байт k — бит 8j + k
+        for (size_t i = i0; i < i1; ++i) {
+            const uint64_t a = th[i];
+            for (int j = 0; j < 8; ++j) acc[j] += spread.t[(a >> (8 * j)) & 0xFF];
+        }
+        for (int j = 0; j < 8; ++j) {
+            for (int k = 0; k < 8; ++k) ones[8 * j + k] += (acc[j] >> (8 * k)) & 0xFF;
+        }
+    }
+}
+
+#ifdef L5_TEXT_X86
+// бит i хэша -> байт i двух векторов (pshufb размножает байт хэша на 8, and + cmpeq выделяет бит)
+__attribute__((target("avx2")))
+static void count_bits_avx2(const uint64_t* th, size_t n, uint64_t* ones) {
+    const __m256i shuf_lo = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                             2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i shuf_hi = _mm256_setr_epi8(4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5,
+                                             6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7);
+    const __m256i bit = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+
+    alignas(32) uint8_t c[64];
+    for (size_t i0 = 0; i0 < n; i0 += kSimhashFlush) {
+        const size_t i1 = std::min(n, i0 + kSimhashFlush);
+        __m256i c_lo = _mm256_setzero_si256();
+        __m256i c_hi = _mm256_setzero_si256();
+        for (size_t i = i0; i < i1; ++i) {
+            const __m256i x = _mm256_set1_epi64x((long long)th[i]);
+            const __m256i lo = _mm256_and_si256(_mm256_shuffle_epi8(x, shuf_lo), bit);
+            const __m256i hi = _mm256_and_si256(_mm256_shuffle_epi8(x, shuf_hi), bit);
+            c_lo = _mm256_sub_epi8(c_lo, _mm256_cmpeq_epi8(lo, bit)); // -(-1) = +1
+            c_hi = _mm256_sub_epi8(c_hi, _mm256_cmpeq_epi8(hi, bit));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(c), c_lo);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(c + 32), c_hi);
+        for (int k = 0; k < 64; ++k) ones[k] += c[k];
+    }
+}
+#endif
+
+bool simhash_kernel_supported(SimhashKernel k) {
+    switch (k) {
+    case SimhashKernel::Scalar: return true;
+#ifdef L5_TEXT_X86
+    case SimhashKernel::Avx2: return __builtin_cpu_supports("avx2");
+#else
+    default: return false;
+#endif
+    }
+    return false;
+}
+
+SimhashKernel simhash_active_kernel() {
+    static const SimhashKernel k = [] {
+        const char* e = std::getenv("PLAGIO_SIMHASH_SIMD");
+        if (e && std::strcmp(e, "scalar") == 0) return SimhashKernel::Scalar;
+        return simhash_kernel_supported(SimhashKernel::Avx2) ? SimhashKernel::Avx2 : SimhashKernel::Scalar;
+    }();
+    return k;
+}
+
+std::pair<uint64_t, uint64_t> simhash128_token_hashes(const std::vector<uint64_t>& token_hashes, SimhashKernel k) {
+    uint64_t ones[64] = {};
+#ifdef L5_TEXT_X86
+    if (k == SimhashKernel::Avx2 && simhash_kernel_supported(k)) {
+        count_bits_avx2(token_hashes.data(), token_hashes.size(), ones);
+        return simhash_from_ones(ones, token_hashes.size());
+    }
+#endif
+    (void)k;
+    count_bits_scalar(token_hashes.data(), token_hashes.size(), ones);
+    return simhash_from_ones(ones, token_hashes.size());
+}
+
 std::pair<uint64_t, uint64_t> simhash128_token_hashes(const std::vector<uint64_t>& token_hashes) {
-    int v0[64] = {0};
-    int v1[64] = {0};
+    return simhash128_token_hashes(token_hashes, simhash_active_kernel());
+}
 
-    for (uint64_t th : token_hashes) {
-        uint64_t a = th;
-        uint64_t b = th ^ 0xD6E8FEB86659FD93ULL;
+// по схеме wyhash (final4, The Unlicense); токены почти всегда <= 16 байт => два умножения
+static constexpr uint64_t kWySecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+static constexpr uint64_t kWySeed = 0x9E3779B97F4A7C15ULL;
 
-        for (int i = 0; i < 64; ++i) v0[i] += ((a >> i) & 1ULL) ? 1 : -1;
-        for (int i = 0; i < 64; ++i) v1[i] += ((b >> i) & 1ULL) ? 1 : -1;
+static inline void wy_mum(uint64_t& a, uint64_t& b) {
+    const __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+}
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(a, b);
+    return a ^ b;
+}
+static inline uint64_t wy_r8(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+static inline uint64_t wy_r4(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+static inline uint64_t wy_r3(const unsigned char* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static inline uint64_t wyhash_bytes(const unsigned char* p, size_t len) {
+    uint64_t seed = kWySeed ^ wy_mix(kWySeed ^ kWySecret[0], kWySecret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ kWySecret[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ kWySecret[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ kWySecret[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ kWySecret[1], wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
     }
+    a ^= kWySecret[1];
+    b ^= seed;
+    wy_mum(a, b);
+    return wy_mix(a ^ kWySecret[0] ^ len, b ^ kWySecret[1]);
+}
 
-    uint64_t hi = 0, lo = 0;
-    for (int i = 0; i < 64; ++i) if (v0[i] > 0) hi |= (1ULL << i);
-    for (int i = 0; i < 64; ++i) if (v1[i] > 0) lo |= (1ULL << i);
-    return {hi, lo};
+uint64_t hash_token_bytes(std::string_view tok, TokenHash kind) {
+    if (kind == TokenHash::Wyhash) return wyhash_bytes(reinterpret_cast<const unsigned char*>(tok.data()), tok.size());
+    uint64_t h = fnv1a64_init();
+    for (char c : tok) h = fnv1a64_mix(h, (unsigned char)c);
+    return h;
+}
+
+// первый ' ' в [c, e) или e; по 8 байт (SWAR: нулевой байт в w ^ 0x20..20)
+static inline const char* find_space(const char* c, const char* e) {
+    while (e - c >= 8) {
+        uint64_t w;
+        std::memcpy(&w, c, 8);
+        w ^= 0x2020202020202020ULL;
+        const uint64_t z = (w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL;
+        if (z) return c + (__builtin_ctzll(z) >> 3);
+        c += 8;
+    }
+    while (c < e && *c != ' ') ++c;
+    return c;
+}
+
+// rolling: H(pos) = sum th[pos + j] * B^(K-1-j) mod 2^64; сдвиг окна —
+// H = (H - th[pos] * B^(K-1)) * B + th[pos + K]. Младшие биты H зависят только
+// от младших бит токенов => наружу отдаём H через биективный finalizer (splitmix64).
+static constexpr uint64_t kRollingBase = 0x9E3779B97F4A7C15ULL; // нечётное
+
+static inline uint64_t rolling_finalize(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+uint64_t hash_shingle_rolling(const std::vector<uint64_t>& token_hashes, int pos, int K) {
+    uint64_t h = 0;
+    for (int i = pos; i < pos + K; ++i) h = h * kRollingBase + token_hashes[(size_t)i];
+    return rolling_finalize(h);
+}
+
+void hash_text_shingles(std::string_view norm,
+                        const ShingleHashParams& p,
+                        std::vector<uint64_t>& token_hashes,
+                        std::vector<uint64_t>& shingle_hashes) {
+    token_hashes.clear();
+    shingle_hashes.clear();
+
+    const size_t K = (size_t)std::max(1, p.k);
+    const size_t step = (size_t)std::max(1, p.step);
+    const size_t max_tokens = p.max_tokens ? p.max_tokens : SIZE_MAX;
+    const size_t max_shingles = p.max_shingles ? p.max_shingles : SIZE_MAX;
+    const bool rolling = p.shingle == ShingleHash::Rolling;
+    const bool wy = p.token == TokenHash::Wyhash;
+    size_t next_pos = 0; // позиция следующего шингла
+
+    uint64_t base_k = 1; // B^K: вклад уходящего из окна токена
+    for (size_t i = 0; i < K; ++i) base_k *= kRollingBase;
+    uint64_t roll = 0;
+
+    const char* c = norm.data();
+    const char* const e = c + norm.size();
+    while (c < e && token_hashes.size() < max_tokens) {
+        while (c < e && *c == ' ') ++c;
+        if (c == e) break;
+
+        uint64_t h;
+        if (wy) {
+            const char* t = c;
+            c = find_space(c, e);
+            h = wyhash_bytes(reinterpret_cast<const unsigned char*>(t), (size_t)(c - t));
+        } else {
+            h = fnv1a64_init();
+            while (c < e && *c != ' ') h = fnv1a64_mix(h, (unsigned char)*c++);
+        }
+        token_hashes.push_back(h);
+
+        const size_t n = token_hashes.size();
+        if (rolling) {
+            roll = roll * kRollingBase + h;
+            if (n > K) roll -= token_hashes[n - 1 - K] * base_k;
+        }
+
+        // шингл [next_pos, next_pos + K) закрылся этим токеном; хэши токенов ещё в L1
+        if (n == next_pos + K && shingle_hashes.size() < max_shingles) {
+            shingle_hashes.push_back(rolling ? rolling_finalize(roll)
+                                             : hash_shingle_token_hashes(token_hashes, (int)next_pos, (int)K));
+            next_pos += step;
+        }
+    }
 }
@@ -21,6 +21,15 @@ std::string normalize_for_shingles_simple(std::string_view s);
 // То же самое, но пишет в out (reuse capacity, без лишних аллокаций)
 void normalize_for_shingles_simple_to(std::string_view s, std::string& out);
 
+// Реализации normalize_for_shingles_simple_to (результат побайтно одинаковый):
+// блоки по 32 байта SSE4.2/AVX2 + scalar на хвост. По умолчанию лучшая для CPU;
+// PLAGIO_NORMALIZE_SIMD=scalar|sse42|avx2 ограничивает выбор.
+enum class NormalizeKernel { Scalar, Sse42, Avx2 };
+NormalizeKernel normalize_active_kernel();
+bool normalize_kernel_supported(NormalizeKernel k);
+const char* normalize_kernel_name(NormalizeKernel k);
+void normalize_for_shingles_simple_to(std::string_view s, std::string& out, NormalizeKernel k);
+
 // Токенизация по пробелам
 void tokenize_spans(const std::string& s, std::vector<TokenSpan>& out);
 
@@ -47,3 +56,49 @@ uint64_t hash_shingle_token_hashes(const std::vector<uint64_t>& token_hashes,
                                    int K);
 
 std::pair<uint64_t, uint64_t> simhash128_token_hashes(const std::vector<uint64_t>& token_hashes);
+
+// Реализации simhash128_token_hashes (результат одинаковый): счётчики единиц по битам,
+// scalar — через таблицу байт -> 8 байт, AVX2 — 64 бита токена за 8 инструкций.
+// PLAGIO_SIMHASH_SIMD=scalar отключает AVX2.
+enum class SimhashKernel { Scalar, Avx2 };
+SimhashKernel simhash_active_kernel();
+bool simhash_kernel_supported(SimhashKernel k);
+std::pair<uint64_t, uint64_t> simhash128_token_hashes(const std::vector<uint64_t>& token_hashes, SimhashKernel k);
+
+// --------------------
+// Нормализованный текст -> хэши токенов -> хэши шинглов за один проход по байтам
+// (без TokenSpan). Результат тот же, что tokenize_spans + hash_tokens_bytes_spans +
+// hash_shingle_token_hashes. Общий путь для builder и build_query_shingles.
+// --------------------
+
+// Хэш токена (id = token_hash в заголовке V3)
+enum class TokenHash : uint32_t {
+    Fnv1a = 0,  // FNV-1a 64, байт за байтом (hash_tokens_bytes_spans)
+    Wyhash = 1, // wyhash-подобный: 4/8-байтные чтения + 128-битное умножение
+};
+
+uint64_t hash_token_bytes(std::string_view tok, TokenHash kind);
+
+// Хэш шингла по K хэшам токенов (id = shingle_hash в заголовке V3)
+enum class ShingleHash : uint32_t {
+    Combine = 0, // hash_shingle_token_hashes: K комбинаций на каждую позицию
+    Rolling = 1, // полином по хэшам токенов mod 2^64 + finalizer: O(1) на позицию
+};
+
+// Rolling-хэш шингла [pos, pos + K) без скольжения (эталон для проверок)
+uint64_t hash_shingle_rolling(const std::vector<uint64_t>& token_hashes, int pos, int K);
+
+struct ShingleHashParams {
+    int k{9};
+    TokenHash token{TokenHash::Fnv1a};
+    ShingleHash shingle{ShingleHash::Combine};
+    size_t max_tokens{0};   // 0 = без лимита; лишние токены отбрасываются
+    int step{1};            // шинглы на позициях 0, step, 2*step, ...
+    size_t max_shingles{0}; // 0 = без лимита
+};
+
+// token_hashes: все токены (<= max_tokens); shingle_hashes[j] — шингл на позиции j*step
+void hash_text_shingles(std::string_view norm,
+                        const ShingleHashParams& p,
+                        std::vector<uint64_t>& token_hashes,
+                        std::vector<uint64_t>& shingle_hashes);
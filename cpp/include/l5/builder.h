@@ -4,6 +4,8 @@
 #include <filesystem>
 #include <string>
 
+#include "l5/format.h"
+
 namespace l5 {
 
 struct BuildOptions {
@@ -27,6 +29,28 @@ struct BuildOptions {
 
     // sorting budget (builder process RAM cap)
     uint64_t ram_limit_bytes{512ull * 1024ull * 1024ull}; // 512 MiB
+
+    // index_native.bin layout: FORMAT_V3 (hash dictionary + SoA did/pos) or FORMAT_V2
+    uint32_t format_version{FORMAT_V3};
+    // V3 only: POSTING_CODEC_BP128 (128-value blocks, bit-packed) or POSTING_CODEC_RAW
+    uint32_t posting_codec{POSTING_CODEC_BP128};
+    // V3 only: хэши токенов и шинглов (FNV1A + COMBINE — как V2)
+    uint32_t token_hash{TOKEN_HASH_WYHASH};
+    uint32_t shingle_hash{SHINGLE_HASH_ROLLING};
+
+    // index_native_docids.json рядом с index_native.docinfo: поиск читает только
+    // бинарный docinfo, json — экспорт для внешних инструментов
+    bool docids_json{true};
+
+    // index_native.bloom: Bloom-фильтр хэшей сегмента (бит на хэш); 0 => не писать
+    uint32_t bloom_bits_per_key{10};
+
+    // index_native.df: DF top df_max_entries хэшей (0 => не писать, stop-hash нет) и
+    // stop-hash — df на перцентиле stop_df_percentile среди хэшей сегмента, но >= stop_min_df.
+    // По тем же правилам пересчитывается level5_stop_hashes.df всего out_root.
+    uint32_t df_max_entries{1u << 16};
+    double stop_df_percentile{99.99};
+    uint32_t stop_min_df{64};
 };
 
 struct BuildStats {
@@ -0,0 +1,73 @@
+// Back_L5/cpp/include/l5/compactor.h
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "l5/docinfo.h"
+#include "l5/format.h"
+#include "l5/manifest.h"
+#include "l5/posting_codec.h"
+
+namespace l5 {
+
+struct CompactOptions {
+    std::string segment_name; // if empty => auto ("seg_<utc>_c")
+
+    // выходной сегмент; схема хэшей — общая схема входов (перехэширования нет)
+    uint32_t format_version{FORMAT_V3};
+    uint32_t posting_codec{POSTING_CODEC_BP128};
+
+    // как в BuildOptions
+    uint32_t bloom_bits_per_key{10};
+    uint32_t df_max_entries{1u << 16};
+    double stop_df_percentile{99.99};
+    uint32_t stop_min_df{64};
+
+    // как BuildOptions::docids_json
+    bool docids_json{true};
+
+    // удалить каталоги входов после замены в манифесте
+    bool remove_inputs{true};
+};
+
+struct CompactStats {
+    std::string segment_name; // пусто, если удалены все документы (новый сегмент не пишется)
+    std::filesystem::path seg_dir;
+    std::vector<std::string> inputs;
+    uint64_t docs_in{0};
+    uint64_t docs_out{0};
+    uint64_t post9_in{0};
+    uint64_t post9_out{0};
+    std::string built_at_utc;
+};
+
+// true => документ удаляется из результата (tombstone)
+using CompactDropFn = std::function<bool(const DocInfo&)>;
+
+// Слияние сегментов манифеста в один без повторной токенизации: документы входов
+// по порядку (did перенумеровываются монотонно; удалённые по index_native.deleted
+// входа или по drop пропускаются), postings — k-way merge уже отсортированных
+// (h,did,pos). Входы заменяются новым сегментом в манифесте атомарно (на месте
+// первого входа); до замены поиск видит только старые сегменты. Ошибки => L5Exception.
+CompactStats compact_segments(const std::filesystem::path& out_root,
+                              const std::vector<std::string>& segment_names,
+                              const CompactOptions& opt,
+                              const CompactDropFn& drop = nullptr);
+
+// Size-tiered: ярус сегмента по числу postings (stats.k9 манифеста) —
+// 0 ниже base_post9, дальше +1 на каждые tier_ratio раз.
+struct TieredCompactionPolicy {
+    uint32_t min_segments{4};  // сливать, когда в ярусе столько сегментов; 0 => выключено
+    uint32_t max_segments{32}; // не больше за одно слияние
+    uint64_t base_post9{1ull << 20};
+    double tier_ratio{4.0};
+};
+
+// Имена сегментов для слияния (порядок манифеста): самый нижний ярус, в котором
+// набралось min_segments; пусто — сливать нечего.
+std::vector<std::string> pick_tiered_compaction(const Manifest& m, const TieredCompactionPolicy& p);
+
+} // namespace l5
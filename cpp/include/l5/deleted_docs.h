@@ -0,0 +1,49 @@
+// Back_L5/cpp/include/l5/deleted_docs.h
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace l5 {
+
+// Битмап удалённых did сегмента (index_native.deleted рядом с index_native.bin).
+// Размер фиксируется при загрузке (n_docs); биты атомарны — delete_doc ставит
+// их на месте, пока сегмент в кэше и по нему идут запросы (relaxed: пропущенный
+// только что удалённый did отфильтрует tombstone-проверка сервиса).
+class DeletedDocs {
+public:
+    void reset(uint32_t n_docs);
+
+    bool test(uint32_t did) const {
+        const size_t w = did >> 6;
+        return w < n_words_ && ((words_[w].load(std::memory_order_relaxed) >> (did & 63)) & 1u);
+    }
+    // true, если did не был удалён
+    bool set(uint32_t did);
+
+    bool any() const { return count_.load(std::memory_order_relaxed) != 0; }
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint32_t n_docs() const { return n_docs_; }
+    size_t bytes() const { return n_words_ * sizeof(uint64_t); }
+
+    // bool + err, как у остальных читателей; нет файла => ничего не удалено
+    bool read_file(const std::filesystem::path& p, uint32_t n_docs, std::string* err);
+    bool write_file(const std::filesystem::path& p, std::string* err) const;
+
+private:
+    uint32_t n_docs_{0};
+    size_t n_words_{0};
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    std::atomic<uint64_t> count_{0};
+};
+
+// Пометить dids сегмента seg_dir удалёнными в del и сохранить index_native.deleted
+// (tmp + атомарная замена). Вызовы для одного сегмента сериализует вызывающий.
+bool mark_deleted(const std::filesystem::path& seg_dir, DeletedDocs& del,
+                  const std::vector<uint32_t>& dids, std::string* err);
+
+} // namespace l5
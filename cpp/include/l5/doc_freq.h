@@ -0,0 +1,117 @@
+// Back_L5/cpp/include/l5/doc_freq.h
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "l5/format.h"
+#include "l5/manifest.h"
+
+namespace l5 {
+
+// DF хэша = число различных did, в которых он встречается.
+struct DfEntry {
+    uint64_t h;
+    uint32_t df;
+};
+
+// Потоковый DF по postings в порядке (h,did,pos) — как их получает SegmentWriter.
+// Хранит только top max_entries хэшей по DF с df >= 2 (остальные — df 1 или
+// ниже хранимых); память O(max_entries) при любом размере сегмента.
+class DfCounter {
+public:
+    static constexpr size_t kDefaultMaxEntries = 1u << 16;
+
+    explicit DfCounter(size_t max_entries = kDefaultMaxEntries) : max_(max_entries) {}
+
+    void add(uint64_t h, uint32_t did) {
+        if (!has_ || h != h_) {
+            flush();
+            has_ = true;
+            h_ = h;
+            did_ = did;
+            df_ = 1;
+            ++n_hashes_;
+        } else if (did != did_) {
+            did_ = did;
+            ++df_;
+        }
+    }
+
+    // после последнего add: entries по убыванию df (при равных — по возрастанию h)
+    std::vector<DfEntry> finish();
+
+    uint64_t n_hashes() const { return n_hashes_; }
+
+private:
+    void flush();
+
+    size_t max_;
+    uint32_t floor_{2}; // меньшие df в top max_ уже не попадут
+    bool has_{false};
+    uint64_t h_{0};
+    uint32_t did_{0};
+    uint32_t df_{0};
+    uint64_t n_hashes_{0};
+    std::vector<DfEntry> e_;
+};
+
+// index_native.df (сегмент) и level5_stop_hashes.df (out_root, слияние сегментов).
+// Stop-hash = entries с df >= stop_df; entries отсортированы по убыванию df,
+// поэтому stop-hash — их префикс.
+struct DfTable {
+    HashScheme scheme;      // хэши сравнимы только внутри одной схемы
+    uint64_t n_docs{0};
+    uint64_t n_hashes{0};   // всего различных хэшей (в entries — только top по DF)
+    uint32_t stop_df{0};    // 0 => stop-hash нет
+    std::vector<DfEntry> entries;
+
+    size_t n_stop() const {
+        size_t n = 0;
+        while (stop_df > 0 && n < entries.size() && entries[n].df >= stop_df) ++n;
+        return n;
+    }
+};
+
+// Порог stop-hash: df хэша на перцентиле percentile среди всех n_hashes (sorted —
+// по убыванию df), но не ниже min_df. 0 => перцентиль не выделяет ни одного хэша.
+uint32_t stop_df_threshold(const std::vector<DfEntry>& sorted, uint64_t n_hashes,
+                           double percentile, uint32_t min_df);
+
+// bool + err, как у остальных читателей; stop_only => entries только stop-префикс
+bool write_df_file(const std::filesystem::path& p, const DfTable& t, std::string* err);
+bool read_df_file(const std::filesystem::path& p, DfTable& t, std::string* err, bool stop_only = false);
+
+// Stop-hash одного сегмента или out_root (обычно тысячи): отбрасываются до lookup'а в словаре.
+class StopHashes {
+public:
+    void assign(const DfTable& t);
+
+    bool contains(uint64_t h) const { return std::binary_search(h_.begin(), h_.end(), h); }
+    bool empty() const { return h_.empty(); }
+    size_t size() const { return h_.size(); }
+    size_t bytes() const { return h_.capacity() * sizeof(uint64_t); }
+    const HashScheme& scheme() const { return scheme_; }
+
+private:
+    HashScheme scheme_;
+    std::vector<uint64_t> h_; // по возрастанию
+};
+
+// Список boilerplate out_root: DF из index_native.df сегментов манифеста со схемой
+// scheme суммируются по хэшу (приближённо: учтены только хранимые top-DF хэши
+// сегментов), stop-hash выбираются по тем же правилам; файл хранит только их.
+bool merge_org_stop_hashes(const std::filesystem::path& out_root,
+                           const Manifest& m,
+                           const HashScheme& scheme,
+                           double percentile,
+                           uint32_t min_df,
+                           std::string* err);
+
+// level5_stop_hashes.df out_root; нет файла => пустой
+bool load_org_stop_hashes(const std::filesystem::path& out_root, StopHashes& out, std::string* err);
+
+} // namespace l5
@@ -0,0 +1,137 @@
+// Back_L5/cpp/include/l5/docinfo_store.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "l5/docinfo.h"
+
+namespace l5 {
+
+// index_native.docinfo: DocInfo сегмента в бинарном виде.
+//   header (32): magic "L5DI", version, n_docs, n_pool, heap_bytes, reserved
+//   heap (heap_bytes, выровнен до 8)
+//   docs[n_docs] (16): u64 off, u32 org, u32 meta
+//   pool[n_pool] (16): u64 off, u32 len, u32 reserved
+// Запись документа в heap: [u32 len][bytes] x 5 — doc_id, external_id,
+// source_path, source_name, preview_text. organization_id и meta_path
+// одинаковы у множества документов и лежат один раз в pool (индексы org/meta).
+inline constexpr uint32_t DOCINFO_VERSION = 1;
+inline constexpr size_t DOCINFO_HEADER_BYTES = 32;
+inline constexpr size_t DOCINFO_REC_BYTES = 16;
+
+// index_native.docidx: doc_id -> did того же сегмента.
+//   header (24): magic "L5DX", version, n, bits, reserved
+//   dir[(1 << bits) + 1] u32 — начало корзины по старшим bits хэша doc_id
+//   h[n] u64 (с выравнивания 8), затем did[n] u32; записи по (h, did)
+// Хэш — hash_token_bytes(Wyhash); совпавший хэш сверяется с doc_id из docinfo.
+inline constexpr uint32_t DOCIDX_VERSION = 1;
+inline constexpr size_t DOCIDX_HEADER_BYTES = 24;
+
+// Потоковая запись index_native.docinfo (и index_native.docidx) в порядке did.
+// Ошибки => L5Exception.
+class DocInfoWriter {
+public:
+    DocInfoWriter(const std::filesystem::path& path, const std::filesystem::path& docidx_path);
+
+    DocInfoWriter(const DocInfoWriter&) = delete;
+    DocInfoWriter& operator=(const DocInfoWriter&) = delete;
+
+    void add(std::string_view doc_id, std::string_view organization_id, std::string_view external_id,
+             std::string_view source_path, std::string_view source_name, std::string_view meta_path,
+             std::string_view preview_text);
+    void add(const DocInfo& d) {
+        add(d.doc_id, d.organization_id, d.external_id, d.source_path, d.source_name, d.meta_path, d.preview_text);
+    }
+
+    // таблицы + заголовок, затем docidx; после finish() добавлять нельзя
+    void finish();
+
+    uint32_t n_docs() const { return (uint32_t)(docs_.size() / DOCINFO_REC_BYTES); }
+
+private:
+    uint32_t intern(std::string_view s);
+    void put_str(std::string_view s);
+
+    void write_docidx();
+
+    std::filesystem::path path_;
+    std::filesystem::path docidx_path_;
+    std::ofstream out_;
+    uint64_t heap_bytes_{0};
+    std::vector<unsigned char> docs_;
+    std::vector<std::string> pool_;
+    std::unordered_map<std::string, uint32_t> pool_ids_;
+    std::vector<std::pair<uint64_t, uint32_t>> ids_; // (хэш doc_id, did)
+};
+
+// DocInfo сегмента для поиска: mmap index_native.docinfo (открытие O(1), строки
+// декодируются только для итоговых hit'ов). Сегменты без .docinfo (старые сборки)
+// читаются из index_native_docids.json в память — API тот же.
+class DocInfoStore {
+public:
+    DocInfoStore() = default;
+    ~DocInfoStore();
+
+    DocInfoStore(const DocInfoStore&) = delete;
+    DocInfoStore& operator=(const DocInfoStore&) = delete;
+    DocInfoStore(DocInfoStore&& o) noexcept;
+    DocInfoStore& operator=(DocInfoStore&& o) noexcept;
+
+    size_t size() const { return map_ ? n_docs_ : json_.size(); }
+    bool empty() const { return size() == 0; }
+    bool is_mapped() const { return map_ != nullptr; }
+
+    // did < size(); external_id пустой => doc_id (как в load_docids_json)
+    DocInfo get(uint32_t did) const;
+    // без материализации остальных полей
+    std::string_view doc_id(uint32_t did) const;
+
+    // все did с данным doc_id по возрастанию: через index_native.docidx, если
+    // он есть (O(1) на корзину), иначе перебором сегмента (старые сборки)
+    void find(std::string_view doc_id, std::vector<uint32_t>& dids) const;
+    bool has_docidx() const { return idx_map_ != nullptr; }
+
+    // оценка для бюджета кэша: mapping или heap распарсенного json
+    uint64_t bytes() const;
+
+    // полная проверка смещений и docidx (validator); открытие их не трогает
+    bool check(std::string* err) const;
+
+    void close();
+
+private:
+    friend bool open_docinfo(const std::filesystem::path& seg_dir, DocInfoStore& out, std::string* err);
+
+    std::string_view pool_str(uint32_t idx) const;
+
+    void* map_{nullptr};
+    size_t map_len_{0};
+    const unsigned char* heap_{nullptr};
+    uint64_t heap_bytes_{0};
+    const unsigned char* docs_{nullptr};
+    const unsigned char* pool_{nullptr};
+    uint32_t n_docs_{0};
+    uint32_t n_pool_{0};
+
+    void* idx_map_{nullptr};
+    size_t idx_len_{0};
+    const unsigned char* idx_dir_{nullptr};
+    const unsigned char* idx_h_{nullptr};
+    const unsigned char* idx_did_{nullptr};
+    uint32_t idx_n_{0};
+    uint32_t idx_bits_{0};
+
+    std::vector<DocInfo> json_;
+};
+
+// index_native.docinfo (+ index_native.docidx, если есть), иначе index_native_docids.json
+bool open_docinfo(const std::filesystem::path& seg_dir, DocInfoStore& out, std::string* err);
+
+} // namespace l5
@@ -1,6 +1,7 @@
 // Back_L5/cpp/include/l5/format.h
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
@@ -10,6 +11,9 @@ namespace l5 {
 
 constexpr int K_SHINGLE = 9;
 
+constexpr uint32_t FORMAT_V2 = 2;
+constexpr uint32_t FORMAT_V3 = 3;
+
 struct HeaderV2 {
     char     magic[4];      // "PLAG"
     uint32_t version;       // 2
@@ -30,10 +34,89 @@ struct Posting9 {
     uint32_t pos;
 };
 
+// Размеры записей на диске (по полям, без padding).
+constexpr size_t HEADER_V2_BYTES = 4 + 4 + 4 + 8 + 8; // 28
+constexpr size_t DOCMETA_BYTES   = 4 + 8 + 8;         // 20
+constexpr size_t POSTING9_BYTES  = 8 + 4 + 4;         // 16
+
+// V3: словарь уникальных h отдельно от (did,pos).
+//
+//   [header, header_bytes]  поля ниже + нули (резерв под новые поля)
+//   docmeta  n_docs * 20
+//   hashes   n_hashes * u64, строго возрастают
+//   starts   ceil(n_post9/64) * u64: бит j = 1 <=> posting j первый для своего h
+//   select   ceil(n_hashes/64) * u64: позиция каждого 64-го установленного бита
+//   did      n_post9 * u32 } внутри диапазона h отсортированы по (did,pos)
+//   pos      n_post9 * u32 }   (posting_codec = RAW)
+//   blkmeta  ceil(n_post9/128) * 24 } вместо did/pos при posting_codec = BP128
+//   blkdata  упакованные блоки       } (см. l5/posting_codec.h)
+//
+// Диапазон postings хэша i = [select1(i), select1(i+1)) по starts. Смещения
+// хранятся битмапом (1 бит на posting), а не массивом: на реальных корпусах
+// хэши повторяются редко, и массив u32/u64 съел бы всю экономию.
+// Все секции выровнены на 64 байта; смещения секций — от начала файла.
+constexpr size_t HEADER_V3_BYTES = 128;
+constexpr size_t V3_SECTION_ALIGN = 64;
+
+// Идентификаторы алгоритмов (0 = исходные; неизвестный id => сегмент не читается)
+constexpr uint32_t POSTING_CODEC_RAW = 0;   // did/pos как u32 SoA
+constexpr uint32_t POSTING_CODEC_BP128 = 1; // блоки по 128: FOR/delta + bit-packing
+constexpr uint32_t TOKEN_HASH_FNV1A = 0;     // V2 — всегда он
+constexpr uint32_t TOKEN_HASH_WYHASH = 1;    // по 4/8 байт за чтение
+constexpr uint32_t SHINGLE_HASH_COMBINE = 0; // V2 — всегда он
+constexpr uint32_t SHINGLE_HASH_ROLLING = 1; // полиномиальный rolling, O(1) на шингл
+
+// Как из текста получаются хэши шинглов сегмента. Запрос хэшируется под схему
+// каждого сегмента; simhash в docmeta сравним только между сегментами одного token_hash.
+struct HashScheme {
+    uint32_t token_hash{TOKEN_HASH_FNV1A};
+    uint32_t shingle_hash{SHINGLE_HASH_COMBINE};
+
+    bool operator==(const HashScheme& o) const {
+        return token_hash == o.token_hash && shingle_hash == o.shingle_hash;
+    }
+};
+
+struct HeaderV3 {
+    char     magic[4];       // "PLAG"
+    uint32_t version;        // 3
+    uint32_t header_bytes;   // >= 112; читатель пропускает незнакомый хвост
+    uint32_t n_docs;
+    uint64_t n_post9;
+    uint64_t n_hashes;
+    uint64_t docmeta_off;
+    uint64_t hashes_off;
+    uint64_t starts_off;
+    uint64_t select_off;
+    uint64_t did_off;
+    uint64_t pos_off;
+    uint32_t posting_codec;
+    uint32_t token_hash;
+    uint32_t shingle_hash;
+    uint32_t flags;          // 0
+    uint64_t block_meta_off; // BP128
+    uint64_t block_data_off; // BP128
+};
+
+// Известные поля V3 (остальное до header_bytes — нули)
+constexpr size_t HEADER_V3_FIELDS_BYTES = 16 + 8 * 8 + 4 * 4 + 2 * 8; // 112
+
+inline uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
 // Важно: на диск/с диска пишем/читаем ПО ПОЛЯМ, не sizeof(struct).
 bool read_header_v2(std::ifstream& in, HeaderV2& out);
 bool write_header_v2(std::ofstream& out, const HeaderV2& h);
 
+// То же, но из памяти (mmap): n = доступные байты начиная с p.
+bool parse_header_v2(const unsigned char* p, size_t n, HeaderV2& out);
+
+// Версия по первым 8 байтам ("PLAG" + version), 0 если не наш файл.
+uint32_t peek_format_version(const unsigned char* p, size_t n);
+
+bool parse_header_v3(const unsigned char* p, size_t n, HeaderV3& out);
+// Пишет ровно h.header_bytes байт (хвост нулями).
+bool write_header_v3(std::ofstream& out, const HeaderV3& h);
+
 std::string utc_now_compact();
 
 bool atomic_replace_file_best_effort(const std::filesystem::path& tmp,
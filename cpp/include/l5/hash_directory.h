@@ -0,0 +1,111 @@
+// Back_L5/cpp/include/l5/hash_directory.h
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace l5 {
+
+// Radix-директория над отсортированным массивом хэшей:
+// dir[b] = первый индекс с (h >> shift) >= b, b = старшие bits бит хэша.
+// Поиск = 1 чтение директории + branchless lower/upper_bound внутри бакета
+// (в среднем ~8-16 записей) вместо ~27 промахов бинарного поиска по всему массиву.
+class HashDirectory {
+public:
+    static constexpr unsigned kMinBits = 8;
+    static constexpr unsigned kMaxBits = 24;
+
+    // ~8-16 записей на бакет, bits in [kMinBits, kMaxBits]
+    static unsigned auto_bits(uint64_t n) {
+        unsigned lg = 0;
+        while (lg < 63 && (1ull << (lg + 1)) <= n) ++lg;
+        const unsigned b = lg > 3 ? lg - 3 : 0;
+        return std::min(kMaxBits, std::max(kMinBits, b));
+    }
+
+    // View: size(), uint64_t h(size_t i). bits == 0 => auto_bits(size()).
+    template <class View>
+    void build(const View& v, unsigned bits = 0) {
+        const size_t n = v.size();
+        if (bits == 0) bits = auto_bits(n);
+        bits = std::min(kMaxBits, std::max(1u, bits));
+
+        bits_ = bits;
+        shift_ = 64 - bits;
+        const size_t buckets = (size_t)1 << bits;
+        dir_.assign(buckets + 1, (uint64_t)n);
+
+        // границы бакетов монотонны: galloping вперёд от предыдущей границы,
+        // обращения к памяти идут почти последовательно
+        size_t prev = 0;
+        for (size_t b = 0; b < buckets; ++b) {
+            const uint64_t key = (uint64_t)b << shift_;
+            size_t lo = prev, step = 1, hi = prev;
+            while (hi < n && v.h(hi) < key) {
+                lo = hi + 1;
+                hi += step;
+                step <<= 1;
+            }
+            if (hi > n) hi = n;
+            while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (v.h(mid) < key) lo = mid + 1;
+                else hi = mid;
+            }
+            dir_[b] = (uint64_t)lo;
+            prev = lo;
+        }
+        dir_[buckets] = (uint64_t)n;
+    }
+
+    bool empty() const { return dir_.empty(); }
+    unsigned bits() const { return bits_; }
+    size_t bytes() const { return dir_.size() * sizeof(uint64_t); }
+
+    std::pair<size_t, size_t> bucket(uint64_t h) const {
+        const size_t b = (size_t)(h >> shift_);
+        return {(size_t)dir_[b], (size_t)dir_[b + 1]};
+    }
+
+    // [l, r) записей с хэшем == h
+    template <class View>
+    std::pair<size_t, size_t> range(const View& v, uint64_t h) const {
+        const auto [lo, hi] = bucket(h);
+        const size_t l = lower_bound_branchless(v, lo, hi, h);
+        const size_t r = upper_bound_branchless(v, l, hi, h);
+        return {l, r};
+    }
+
+    template <class View>
+    static size_t lower_bound_branchless(const View& v, size_t lo, size_t hi, uint64_t key) {
+        size_t base = lo, len = hi - lo;
+        if (len == 0) return lo;
+        while (len > 1) {
+            const size_t half = len / 2;
+            base = (v.h(base + half) < key) ? base + half : base;
+            len -= half;
+        }
+        return base + (size_t)(v.h(base) < key);
+    }
+
+    template <class View>
+    static size_t upper_bound_branchless(const View& v, size_t lo, size_t hi, uint64_t key) {
+        size_t base = lo, len = hi - lo;
+        if (len == 0) return lo;
+        while (len > 1) {
+            const size_t half = len / 2;
+            base = (v.h(base + half) <= key) ? base + half : base;
+            len -= half;
+        }
+        return base + (size_t)(v.h(base) <= key);
+    }
+
+private:
+    unsigned bits_{0};
+    unsigned shift_{64};
+    std::vector<uint64_t> dir_;
+};
+
+} // namespace l5
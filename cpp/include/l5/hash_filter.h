@@ -0,0 +1,77 @@
+// Back_L5/cpp/include/l5/hash_filter.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace l5 {
+
+class MappedSegment;
+
+// Blocked (split-block) Bloom filter над различными хэшами сегмента.
+// Блок = 256 бит = 8 слов по 32 бита; хэш ставит по одному биту в каждом слове
+// блока => проверка = одна кэш-линия. ~10 бит на ключ => ~1% ложных срабатываний.
+// На диске: index_native.bloom рядом с index_native.bin (необязательный файл).
+class HashFilter {
+public:
+    static constexpr uint32_t kWords = 8;
+    static constexpr uint32_t kDefaultBitsPerKey = 10;
+
+    // пустой фильтр; may_contain() на пустом фильтре не вызывают (см. empty())
+    void init(uint64_t n_keys, uint32_t bits_per_key = kDefaultBitsPerKey);
+    void add(uint64_t h);
+
+    bool may_contain(uint64_t h) const {
+        const uint64_t x = mix(h);
+        const uint32_t* blk = &words_[block_of(x) * kWords];
+        const uint32_t key = (uint32_t)x;
+        uint32_t miss = 0;
+        for (uint32_t i = 0; i < kWords; ++i) miss |= ~blk[i] & bit_of(key, i);
+        return miss == 0;
+    }
+
+    void prefetch(uint64_t h) const {
+        __builtin_prefetch(&words_[block_of(mix(h)) * kWords]);
+    }
+
+    bool empty() const { return words_.empty(); }
+    uint64_t n_keys() const { return n_keys_; }
+    uint64_t n_blocks() const { return words_.size() / kWords; }
+    size_t bytes() const { return words_.size() * sizeof(uint32_t); }
+
+    // index_native.bloom: bool + err, как у остальных читателей
+    bool write_file(const std::filesystem::path& p, std::string* err) const;
+    bool read_file(const std::filesystem::path& p, std::string* err);
+
+private:
+    // shingle-хэши — комбинация FNV, перемешиваем (finalizer splitmix64)
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+    size_t block_of(uint64_t x) const {
+        return (size_t)(((x >> 32) * (uint64_t)(words_.size() / kWords)) >> 32);
+    }
+    static uint32_t bit_of(uint32_t key, uint32_t i) {
+        static constexpr uint32_t kSalt[kWords] = {
+            0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+            0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+        };
+        return 1u << ((key * kSalt[i]) >> 27);
+    }
+
+    uint64_t n_keys_{0};
+    std::vector<uint32_t> words_;
+};
+
+// Фильтр по всем различным хэшам сегмента (словарь V3 / postings V2).
+void build_hash_filter(const MappedSegment& seg, HashFilter& out,
+                       uint32_t bits_per_key = HashFilter::kDefaultBitsPerKey);
+
+} // namespace l5
@@ -27,4 +27,10 @@ struct Manifest {
 Manifest load_manifest(const std::filesystem::path& out_root);
 bool append_segment_to_manifest(const std::filesystem::path& out_root, const SegmentEntry& e);
 
+// Записи с именами из remove_names убираются, add (если не null) встаёт на место
+// первой убранной (нет таких — в конец). Как и append: tmp + атомарная замена.
+bool replace_segments_in_manifest(const std::filesystem::path& out_root,
+                                  const std::vector<std::string>& remove_names,
+                                  const SegmentEntry* add);
+
 } // namespace l5
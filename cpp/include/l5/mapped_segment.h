@@ -0,0 +1,352 @@
+// Back_L5/cpp/include/l5/mapped_segment.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "l5/deleted_docs.h"
+#include "l5/doc_freq.h"
+#include "l5/format.h"
+#include "l5/hash_directory.h"
+#include "l5/hash_filter.h"
+#include "l5/posting_codec.h"
+
+namespace l5 {
+
+struct MapOptions {
+    // MAP_POPULATE: префолтим все страницы при открытии (открытие перестаёт быть O(1)).
+    bool populate{false};
+    // MADV_HUGEPAGE: best-effort (для file-backed mapping зависит от ядра/FS).
+    bool huge_pages{false};
+    // MADV_RANDOM для postings (бинарный поиск) + MADV_WILLNEED для header/docmeta.
+    bool advise{true};
+};
+
+// Read-only view над упакованными записями на диске.
+// Смещения записей не выровнены (28 + 20*n_docs), поэтому читаем через memcpy —
+// компилятор превращает это в обычные unaligned load.
+class DocMetaView {
+public:
+    DocMetaView() = default;
+    DocMetaView(const unsigned char* base, size_t n) : base_(base), n_(n) {}
+
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+
+    uint32_t tok_len(size_t i) const {
+        uint32_t v;
+        std::memcpy(&v, base_ + i * DOCMETA_BYTES, sizeof(v));
+        return v;
+    }
+
+    DocMeta operator[](size_t i) const {
+        const unsigned char* p = base_ + i * DOCMETA_BYTES;
+        DocMeta dm{};
+        std::memcpy(&dm.tok_len, p, sizeof(dm.tok_len));
+        std::memcpy(&dm.simhash_hi, p + 4, sizeof(dm.simhash_hi));
+        std::memcpy(&dm.simhash_lo, p + 12, sizeof(dm.simhash_lo));
+        return dm;
+    }
+
+private:
+    const unsigned char* base_{nullptr};
+    size_t n_{0};
+};
+
+// (did,pos) postings. V2: упакованные записи (h,did,pos) по 16 байт;
+// V3: два u32-массива (SoA), h хранится только в словаре (HashesView).
+class PostingsView {
+public:
+    PostingsView() = default;
+    PostingsView(const unsigned char* base, size_t n)
+        : h_(base), did_(base + 8), pos_(base + 12), stride_(POSTING9_BYTES), n_(n) {}
+
+    static PostingsView soa(const unsigned char* did, const unsigned char* pos, size_t n) {
+        PostingsView v;
+        v.did_ = did;
+        v.pos_ = pos;
+        v.stride_ = sizeof(uint32_t);
+        v.n_ = n;
+        return v;
+    }
+
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+    bool has_h() const { return h_ != nullptr; }
+
+    // только V2 (has_h())
+    uint64_t h(size_t i) const {
+        uint64_t v;
+        std::memcpy(&v, h_ + i * stride_, sizeof(v));
+        return v;
+    }
+    void prefetch_h(size_t i) const { __builtin_prefetch(h_ + i * stride_); }
+    uint32_t did(size_t i) const {
+        uint32_t v;
+        std::memcpy(&v, did_ + i * stride_, sizeof(v));
+        return v;
+    }
+    uint32_t pos(size_t i) const {
+        uint32_t v;
+        std::memcpy(&v, pos_ + i * stride_, sizeof(v));
+        return v;
+    }
+
+    // h = 0, если h не хранится рядом с posting (V3)
+    Posting9 operator[](size_t i) const {
+        Posting9 p{};
+        if (h_) p.h = h(i);
+        p.did = did(i);
+        p.pos = pos(i);
+        return p;
+    }
+
+private:
+    const unsigned char* h_{nullptr};
+    const unsigned char* did_{nullptr};
+    const unsigned char* pos_{nullptr};
+    size_t stride_{0};
+    size_t n_{0};
+};
+
+// V3: отсортированные уникальные h.
+class HashesView {
+public:
+    HashesView() = default;
+    HashesView(const unsigned char* base, size_t n) : base_(base), n_(n) {}
+
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+
+    uint64_t h(size_t i) const {
+        uint64_t v;
+        std::memcpy(&v, base_ + i * sizeof(uint64_t), sizeof(v));
+        return v;
+    }
+    void prefetch_h(size_t i) const { __builtin_prefetch(base_ + i * sizeof(uint64_t)); }
+
+private:
+    const unsigned char* base_{nullptr};
+    size_t n_{0};
+};
+
+// V3: битмап начал диапазонов + позиция каждой 64-й единицы.
+// select(k) = позиция k-й единицы (k == ones() => n_bits): от сэмпла сканируем
+// не больше 63 единиц, popcount по словам + select внутри слова. Открытие O(1):
+// сэмплы проверяет валидатор (check_samples), а select сам не выходит за секцию —
+// сэмпл за n_bits и скан за последнее слово дают n_bits (неверный диапазон, а не
+// чтение за mapping).
+class StartsView {
+public:
+    static constexpr size_t kSampleRate = 64;
+
+    StartsView() = default;
+    StartsView(const unsigned char* words, size_t n_bits, const unsigned char* samples, size_t n_ones)
+        : words_(words), samples_(samples), n_bits_(n_bits), n_ones_(n_ones) {}
+
+    size_t bits() const { return n_bits_; }
+    size_t ones() const { return n_ones_; }
+
+    uint64_t word(size_t w) const {
+        uint64_t v;
+        std::memcpy(&v, words_ + w * sizeof(uint64_t), sizeof(v));
+        return v;
+    }
+
+    size_t select(size_t k) const {
+        if (k >= n_ones_) return n_bits_;
+
+        uint64_t p;
+        std::memcpy(&p, samples_ + (k / kSampleRate) * sizeof(uint64_t), sizeof(p));
+        if (p >= n_bits_) return n_bits_;
+        unsigned r = (unsigned)(k % kSampleRate);
+
+        size_t w = (size_t)(p >> 6);
+        uint64_t x = word(w) & (~0ull << (p & 63));
+        const size_t n_words = (n_bits_ + 63) / 64;
+        while (true) {
+            const unsigned c = (unsigned)__builtin_popcountll(x);
+            if (r < c) return w * 64 + select_in_word(x, r);
+            r -= c;
+            if (++w >= n_words) return n_bits_;
+            x = word(w);
+        }
+    }
+
+    // сэмплы строго возрастают, < bits() и указывают на единицы битмапа
+    bool check_samples() const {
+        const size_t n_samples = (n_ones_ + kSampleRate - 1) / kSampleRate;
+        uint64_t prev = 0;
+        for (size_t i = 0; i < n_samples; ++i) {
+            uint64_t p;
+            std::memcpy(&p, samples_ + i * sizeof(uint64_t), sizeof(p));
+            if (p >= n_bits_ || (i > 0 && p <= prev) || !((word((size_t)(p >> 6)) >> (p & 63)) & 1)) return false;
+            prev = p;
+        }
+        return true;
+    }
+
+    // позиция r-й (с нуля) единицы в x; требует r < popcount(x)
+    static unsigned select_in_word(uint64_t x, unsigned r) {
+        unsigned pos = 0;
+        for (unsigned w = 32; w; w >>= 1) {
+            const uint64_t lo = x & ((1ull << w) - 1);
+            const unsigned c = (unsigned)__builtin_popcountll(lo);
+            if (r >= c) {
+                r -= c;
+                x >>= w;
+                pos += w;
+            } else {
+                x = lo;
+            }
+        }
+        return pos;
+    }
+
+private:
+    const unsigned char* words_{nullptr};
+    const unsigned char* samples_{nullptr};
+    size_t n_bits_{0};
+    size_t n_ones_{0};
+};
+
+class MappedSegment;
+
+bool map_segment_bin(const std::filesystem::path& seg_dir,
+                     MappedSegment& out,
+                     std::string* err,
+                     const MapOptions& opt = MapOptions{});
+
+// index_native.bin, отображённый в память (mmap, read-only, MAP_SHARED).
+// Открытие O(1): никаких копий, память = page cache (общий между процессами).
+// Читает V2 и V3 (RAW и BP128); поиск работает через range_for_hash +
+// decode_*/add_hits, которые не зависят от кодека postings.
+class MappedSegment {
+public:
+    MappedSegment() = default;
+    ~MappedSegment();
+
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+    MappedSegment(MappedSegment&& o) noexcept;
+    MappedSegment& operator=(MappedSegment&& o) noexcept;
+
+    const std::filesystem::path& seg_dir() const { return seg_dir_; }
+    // общие поля (version = реальная версия файла, 2 или 3)
+    const HeaderV2& header() const { return header_; }
+    // V3-only поля (нули для V2)
+    const HeaderV3& header_v3() const { return header3_; }
+
+    uint32_t version() const { return header_.version; }
+    uint32_t n_docs() const { return header_.n_docs; }
+    uint64_t n_post9() const { return header_.n_post9; }
+
+    const DocMetaView& docmeta() const { return docmeta_; }
+    // несжатые postings (V2 и V3 RAW); для BP128 пуст — см. blocks()
+    const PostingsView& postings() const { return postings_; }
+    const BlockPostingsView& blocks() const { return blocks_; }
+    uint32_t posting_codec() const { return header3_.posting_codec; }
+    // схема хэшей: запрос к сегменту хэшируется так же (V2 — FNV1A + COMBINE)
+    HashScheme hash_scheme() const { return HashScheme{header3_.token_hash, header3_.shingle_hash}; }
+
+    // V3: словарь хэшей и начала диапазонов (пустые для V2)
+    const HashesView& hashes() const { return hashes_; }
+    const StartsView& starts() const { return starts_; }
+
+    size_t mapped_bytes() const { return map_len_; }
+    bool is_open() const { return map_ != nullptr; }
+
+    // Radix-директория по старшим битам h (V2: по postings, V3: по словарю).
+    // Строится отдельно от открытия
+    // (open остаётся O(1)); кэш сегментов строит её при загрузке.
+    void build_hash_directory(unsigned bits = 0);
+    const HashDirectory& hash_directory() const { return dir_; }
+
+    // Bloom-фильтр хэшей из index_native.bloom (нет файла => пустой, true).
+    // Как и директория, грузится отдельно от открытия. false — файл битый или от
+    // другой сборки (err); фильтр остаётся пустым, сегмент пригоден без него.
+    bool load_hash_filter(std::string* err);
+    const HashFilter& hash_filter() const { return filter_; }
+
+    // Stop-hash сегмента из index_native.df (нет файла => пустой, true). false —
+    // битый файл или другая схема (err); stop-hash пуст, сегмент пригоден без них.
+    bool load_stop_hashes(std::string* err);
+    const StopHashes& stop_hashes() const { return stop_; }
+
+    // Удалённые did из index_native.deleted (нет файла => ни одного). Объект общий:
+    // delete_doc помечает did через deleted_docs() у сегмента, уже лежащего в кэше.
+    bool load_deleted(std::string* err);
+    const DeletedDocs& deleted() const {
+        static const DeletedDocs kNone;
+        return deleted_ ? *deleted_ : kNone;
+    }
+    const std::shared_ptr<DeletedDocs>& deleted_docs() const { return deleted_; }
+
+    // [l, r) postings с данным h: через директорию, если построена, иначе бинарный поиск
+    std::pair<size_t, size_t> range_for_hash(uint64_t h) const;
+
+    // То же для n хэшей по возрастанию: один проход по словарю (V3) / postings (V2)
+    // галопом от предыдущей позиции, с prefetch на несколько хэшей вперёд.
+    // Выгоднее range_for_hash, когда хэшей много относительно размера словаря.
+    void ranges_for_sorted_hashes(const uint64_t* hs, size_t n, std::pair<size_t, size_t>* out) const;
+
+    // записей в структуре, по которой ищется h (V3: словарь, V2: postings)
+    size_t lookup_size() const { return version() == FORMAT_V3 ? hashes_.size() : postings_.size(); }
+
+    // did/pos postings [l, r) в out[0 .. r-l) для любого кодека
+    void decode_dids(size_t l, size_t r, uint32_t* out) const {
+        if (posting_codec() == POSTING_CODEC_BP128) return blocks_.decode_dids(l, r, out);
+        for (size_t i = l; i < r; ++i) *out++ = postings_.did(i);
+    }
+    void decode_pos(size_t l, size_t r, uint32_t* out) const {
+        if (posting_codec() == POSTING_CODEC_BP128) return blocks_.decode_pos(l, r, out);
+        for (size_t i = l; i < r; ++i) *out++ = postings_.pos(i);
+    }
+    uint32_t pos_at(size_t i) const {
+        return posting_codec() == POSTING_CODEC_BP128 ? blocks_.pos(i) : postings_.pos(i);
+    }
+
+    // Stage A: ++hits[did] для postings [l, r), did < n_hits (BP128 — без промежуточного буфера)
+    void add_hits(size_t l, size_t r, uint32_t* hits, uint32_t n_hits) const {
+        if (posting_codec() == POSTING_CODEC_BP128) return blocks_.add_hits(l, r, hits, n_hits);
+        for (size_t i = l; i < r; ++i) {
+            const uint32_t did = postings_.did(i);
+            if (did < n_hits) ++hits[did];
+        }
+    }
+
+    void close();
+
+private:
+    friend bool map_segment_bin(const std::filesystem::path& seg_dir,
+                                MappedSegment& out,
+                                std::string* err,
+                                const MapOptions& opt);
+
+    bool attach_v2(const unsigned char* base, size_t file_len,
+                   const std::filesystem::path& bin, std::string* err);
+    bool attach_v3(const unsigned char* base, size_t file_len,
+                   const std::filesystem::path& bin, std::string* err);
+
+    std::filesystem::path seg_dir_;
+    HeaderV2 header_{};
+    HeaderV3 header3_{};
+    DocMetaView docmeta_;
+    PostingsView postings_;
+    BlockPostingsView blocks_;
+    HashesView hashes_;
+    StartsView starts_;
+    HashDirectory dir_;
+    HashFilter filter_;
+    StopHashes stop_;
+    std::shared_ptr<DeletedDocs> deleted_;
+
+    void* map_{nullptr};
+    size_t map_len_{0};
+};
+
+} // namespace l5
@@ -0,0 +1,56 @@
+// Back_L5/cpp/include/l5/near_dup.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace l5 {
+
+class DocMetaView;
+
+struct NearDupOptions {
+    uint32_t max_hamming{3}; // <= 7 — точный ответ (см. NearDupIndex), больше — приближённый
+    size_t topk{50};
+    uint32_t max_tokens{100000}; // как BuildOptions::max_tokens_per_doc (simhash текста-запроса)
+    uint32_t max_parallel_segments{0};
+};
+
+struct NearDupMatch {
+    uint32_t did;
+    uint32_t hamming;
+};
+
+// LSH по 128-битному simhash из docmeta: 8 полос по 16 бит, на полосу — did,
+// отсортированные по значению полосы (counting sort). Документы на расстоянии
+// <= 7 бит совпадают с запросом хотя бы в одной полосе (pigeonhole) => для
+// max_hamming <= 7 ответ точный; дальше находятся только совпавшие по полосе.
+// Postings не читаются: кандидаты проверяются по simhash из docmeta.
+class NearDupIndex {
+public:
+    static constexpr uint32_t kBands = 8;
+    static constexpr uint32_t kBandBits = 16;
+
+    void build(const DocMetaView& dm);
+
+    // out — did с hamming(simhash, (hi, lo)) <= max_hamming, по возрастанию did
+    void find(const DocMetaView& dm, uint64_t hi, uint64_t lo, uint32_t max_hamming,
+              std::vector<NearDupMatch>& out) const;
+
+    size_t n_docs() const { return n_docs_; }
+    size_t bytes() const {
+        size_t b = 0;
+        for (uint32_t i = 0; i < kBands; ++i) b += keys_[i].capacity() * sizeof(uint16_t) + dids_[i].capacity() * sizeof(uint32_t);
+        return b;
+    }
+
+    static uint16_t band(uint64_t hi, uint64_t lo, uint32_t b) {
+        return (uint16_t)((b < kBands / 2 ? hi : lo) >> ((b % (kBands / 2)) * kBandBits));
+    }
+
+private:
+    size_t n_docs_{0};
+    std::vector<uint16_t> keys_[kBands]; // отсортированные значения полосы
+    std::vector<uint32_t> dids_[kBands]; // did в том же порядке
+};
+
+} // namespace l5
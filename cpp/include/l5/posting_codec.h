@@ -0,0 +1,138 @@
+// Back_L5/cpp/include/l5/posting_codec.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace l5 {
+
+// BP128: postings V3 блоками по 128 (в порядке (h,did,pos), без выравнивания
+// на диапазоны h). На блок — BlockMeta (24 байта) + упакованные did и pos.
+//
+//   did: FOR (did - min) или, если внутри блока нет начала нового h,
+//        delta (did[i] - did[i-1], блок целиком в одном отсортированном списке).
+//   pos: FOR (pos - min).
+//
+// Упаковка горизонтальная: значение i занимает биты [i*b, i*b + b) (LE),
+// блок = 16*b байт всегда (хвост последнего блока — нули). Декодеры читают до
+// kTailPad байт за концом блока, писатель дописывает их нулями.
+namespace bp128 {
+
+constexpr size_t kBlock = 128;
+constexpr size_t kMetaBytes = 24;
+constexpr size_t kTailPad = 16;
+constexpr unsigned kSimdMaxBits = 25; // SIMD: b + сдвиг (<= 7) помещаются в u32
+
+struct BlockMeta {
+    uint64_t data_off{0}; // от начала секции данных
+    uint32_t did_base{0};
+    uint32_t pos_base{0};
+    uint8_t  did_bits{0};
+    uint8_t  pos_bits{0};
+    uint8_t  did_delta{0};
+};
+
+inline BlockMeta read_meta(const unsigned char* p) {
+    BlockMeta m;
+    std::memcpy(&m.data_off, p, 8);
+    std::memcpy(&m.did_base, p + 8, 4);
+    std::memcpy(&m.pos_base, p + 12, 4);
+    m.did_bits = p[16];
+    m.pos_bits = p[17];
+    m.did_delta = p[18];
+    return m;
+}
+
+void write_meta(const BlockMeta& m, unsigned char* p); // ровно kMetaBytes
+
+inline size_t packed_bytes(unsigned b) { return 16 * (size_t)b; }
+
+inline unsigned bits_for(uint32_t v) { return v ? 32u - (unsigned)__builtin_clz(v) : 0u; }
+
+// n <= 128 значений по b бит -> 16*b байт (хвост нулями)
+void pack(const uint32_t* in, size_t n, unsigned b, unsigned char* out);
+
+// Одно значение без распаковки блока (FOR): base + биты [i*b, i*b + b)
+inline uint32_t extract(const unsigned char* in, unsigned b, uint32_t base, size_t i) {
+    if (b == 0) return base;
+    const size_t bit = i * b;
+    uint64_t w;
+    std::memcpy(&w, in + (bit >> 3), sizeof(w));
+    return base + (uint32_t)((w >> (bit & 7)) & ((1ull << b) - 1));
+}
+
+enum class Kernel { Scalar, Sse41, Avx2 };
+
+// Лучшее, что есть на CPU; PLAGIO_POSTING_SIMD=scalar|sse41|avx2 ограничивает выбор.
+Kernel active_kernel();
+bool kernel_supported(Kernel k);
+const char* kernel_name(Kernel k);
+
+// 128 значений: out[i] = base + packed[i]
+void unpack(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out, Kernel k);
+inline void unpack(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out) {
+    unpack(in, b, base, out, active_kernel());
+}
+
+// 128 значений delta-блока: out[0] = base, out[i] = out[i-1] + packed[i]
+void unpack_delta(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out, Kernel k);
+inline void unpack_delta(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out) {
+    unpack_delta(in, b, base, out, active_kernel());
+}
+
+// Кодирует n <= 128 postings блока. inner_start: внутри блока (не в позиции 0)
+// начинается новый h => delta для did запрещена.
+void encode_block(const uint32_t* did, const uint32_t* pos, size_t n, bool inner_start,
+                  BlockMeta& meta, std::vector<unsigned char>& data);
+
+} // namespace bp128
+
+// Read-only view над BP128-секциями V3 (meta: n_blocks * 24, data: упакованные блоки).
+// data_bytes — от начала data до конца файла. Открытие проверяет только последний
+// блок (O(1)); meta() сверяет каждый блок с data_bytes при чтении: битый блок
+// декодируется как пустой (did_base = pos_base = 0, 0 бит), а не читает за mapping.
+// Полную проверку блоков делает валидатор (stored_meta).
+class BlockPostingsView {
+public:
+    BlockPostingsView() = default;
+    BlockPostingsView(const unsigned char* meta, const unsigned char* data, size_t n, uint64_t data_bytes)
+        : meta_(meta), data_(data), n_(n), data_bytes_(data_bytes) {}
+
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+    size_t blocks() const { return (n_ + bp128::kBlock - 1) / bp128::kBlock; }
+    uint64_t data_bytes() const { return data_bytes_; }
+
+    bp128::BlockMeta meta(size_t blk) const {
+        const bp128::BlockMeta m = stored_meta(blk);
+        if (m.did_bits > 32 || m.pos_bits > 32) return bp128::BlockMeta{};
+        const uint64_t need = bp128::packed_bytes(m.did_bits) + bp128::packed_bytes(m.pos_bits) + bp128::kTailPad;
+        if (need > data_bytes_ || m.data_off > data_bytes_ - need) return bp128::BlockMeta{};
+        return m;
+    }
+    // как в файле, без проверки (валидатор)
+    bp128::BlockMeta stored_meta(size_t blk) const { return bp128::read_meta(meta_ + blk * bp128::kMetaBytes); }
+    const unsigned char* data(const bp128::BlockMeta& m) const { return data_ + m.data_off; }
+
+    uint32_t did(size_t i) const;
+    uint32_t pos(size_t i) const {
+        const bp128::BlockMeta m = meta(i / bp128::kBlock);
+        const unsigned char* p = data(m) + bp128::packed_bytes(m.did_bits);
+        return bp128::extract(p, m.pos_bits, m.pos_base, i % bp128::kBlock);
+    }
+
+    void decode_dids(size_t l, size_t r, uint32_t* out) const;
+    void decode_pos(size_t l, size_t r, uint32_t* out) const;
+
+    // ++hits[did] для postings [l, r), did < n_hits
+    void add_hits(size_t l, size_t r, uint32_t* hits, uint32_t n_hits) const;
+
+private:
+    const unsigned char* meta_{nullptr};
+    const unsigned char* data_{nullptr};
+    size_t n_{0};
+    uint64_t data_bytes_{0};
+};
+
+} // namespace l5
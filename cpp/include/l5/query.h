@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include "l5/format.h"
+
 namespace l5 {
 
 struct QueryHash {
@@ -16,6 +18,9 @@ struct QueryShingles {
     uint32_t total_shingles{0};   // общее число шинглов (с повторами)
 };
 
-QueryShingles build_query_shingles(const std::string& query_text, bool text_is_normalized);
+// scheme — схема сегмента (MappedSegment::hash_scheme()): у сегментов разных
+// схем одни и те же шинглы имеют разные хэши
+QueryShingles build_query_shingles(const std::string& query_text, bool text_is_normalized,
+                                   const HashScheme& scheme);
 
 } // namespace l5
@@ -12,11 +12,13 @@ namespace l5 {
 
 struct SegmentData {
     std::filesystem::path seg_dir;
-    HeaderV2 header{};
+    HeaderV2 header{}; // общие поля; header.version = 2 или 3
     std::vector<DocMeta> docmeta;
     std::vector<Posting9> postings9;
 };
 
+// Полная копия сегмента в heap (для инструментов). Поиск работает на MappedSegment.
+// V2 и V3 читаются одинаково: postings9 всегда развёрнуты в (h,did,pos).
 bool load_segment_bin(const std::filesystem::path& seg_dir, SegmentData& out, std::string* err);
 
 // Теперь читаем массив DocInfo (новый формат) + поддерживаем старый (array of strings)
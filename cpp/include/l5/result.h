@@ -45,9 +45,38 @@ struct Hit {
 struct SearchResult {
     std::string query;
     uint64_t segments_scanned{0};
+
+    // Bloom-фильтры сегментов: сегменты, где не прошёл ни один хэш запроса,
+    // и lookup'ы хэшей (всего / отсеяно фильтром) по всем сегментам
+    uint64_t segments_skipped{0};
+    uint64_t hash_lookups{0};
+    uint64_t hash_lookups_skipped{0};
     std::vector<Hit> hits;
 };
 
 nlohmann::json to_json(const SearchResult& r);
 
+// Near-duplicates по simhash (без postings)
+struct NearDupHit {
+    std::string doc_id;
+    uint32_t hamming{0}; // различающихся бит из 128
+
+    std::string organization_id;
+    std::string external_id;
+    std::string meta_path;
+    std::string source_path;
+    std::string source_name;
+};
+
+struct NearDupResult {
+    std::string doc_id;       // запрос по документу; пусто => по тексту
+    bool doc_found{true};     // документ-запрос найден хотя бы в одном сегменте
+    uint32_t max_hamming{0};
+    uint64_t segments_scanned{0};
+    uint64_t candidates{0};   // прошли проверку расстояния (до слияния по doc_id)
+    std::vector<NearDupHit> hits; // по возрастанию hamming
+};
+
+nlohmann::json to_json(const NearDupResult& r);
+
 } // namespace l5
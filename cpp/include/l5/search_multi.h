@@ -1,10 +1,15 @@
 // Back_L5/cpp/include/l5/search_multi.h
 #pragma once
+#include <cstddef>
 #include <filesystem>
+#include <functional>
 #include <string>
+#include <vector>
 
+#include "l5/near_dup.h"
 #include "l5/result.h"
 #include "l5/search_segment.h"
+#include "l5/segment_cache.h"
 
 namespace l5 {
 
@@ -13,4 +18,71 @@ SearchResult search_out_root(const std::filesystem::path& out_root,
                             bool query_is_normalized,
                             const SearchOptions& opt);
 
+// То же, но манифест и сегменты берутся из долгоживущего cache (scope = org_id).
+SearchResult search_out_root(const std::filesystem::path& out_root,
+                            const std::string& query,
+                            bool query_is_normalized,
+                            const SearchOptions& opt,
+                            SegmentCache& cache,
+                            const std::string& scope);
+
+// Пакетный поиск: запросы идут проходами по opt.batch_queries_per_pass, за проход
+// каждый сегмент загружается и обходится один раз для всех запросов прохода
+// (общие хэши запросов декодируются один раз). Результат i == search_out_root(queries[i]).
+std::vector<SearchResult> search_batch(const std::filesystem::path& out_root,
+                                       const std::vector<std::string>& queries,
+                                       bool query_is_normalized,
+                                       const SearchOptions& opt);
+
+// on_result(i, r) вызывается по возрастанию i сразу после прохода с i-м запросом
+// (можно стримить, не дожидаясь всего пакета).
+using BatchResultFn = std::function<void(size_t, SearchResult&&)>;
+
+void search_batch(const std::filesystem::path& out_root,
+                  const std::vector<std::string>& queries,
+                  bool query_is_normalized,
+                  const SearchOptions& opt,
+                  SegmentCache& cache,
+                  const std::string& scope,
+                  const BatchResultFn& on_result);
+
+// Near-duplicates по 128-битному simhash (NearDupIndex сегментов, postings не читаются):
+// документы с hamming <= opt.max_hamming, лучший hamming на doc_id.
+// По тексту: simhash считается так же, как builder (нормализация, max_tokens).
+NearDupResult near_duplicates_text(const std::filesystem::path& out_root,
+                                   const std::string& text,
+                                   bool text_is_normalized,
+                                   const NearDupOptions& opt);
+
+NearDupResult near_duplicates_text(const std::filesystem::path& out_root,
+                                   const std::string& text,
+                                   bool text_is_normalized,
+                                   const NearDupOptions& opt,
+                                   SegmentCache& cache,
+                                   const std::string& scope);
+
+// По документу индекса (сам документ в ответ не входит); doc_found=false — doc_id нет ни в одном сегменте.
+NearDupResult near_duplicates_doc(const std::filesystem::path& out_root,
+                                  const std::string& doc_id,
+                                  const NearDupOptions& opt);
+
+NearDupResult near_duplicates_doc(const std::filesystem::path& out_root,
+                                  const std::string& doc_id,
+                                  const NearDupOptions& opt,
+                                  SegmentCache& cache,
+                                  const std::string& scope);
+
+// Удаление doc_id из поиска без пересборки: его did во всех сегментах out_root
+// помечаются в index_native.deleted и, если сегмент уже в cache, в его битмапе —
+// Stage A их больше не выбирает. Сегменты не загружаются: did ищутся по docidx.
+// marked — число помеченных did. false — docinfo сегмента не открылся / битмап не
+// записался (err), остальные сегменты всё равно помечены.
+// Вызовы для одного out_root сериализует вызывающий.
+bool mark_doc_deleted(const std::filesystem::path& out_root,
+                      const std::string& doc_id,
+                      SegmentCache& cache,
+                      const std::string& scope,
+                      uint64_t* marked,
+                      std::string* err);
+
 } // namespace l5
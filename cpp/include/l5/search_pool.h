@@ -0,0 +1,59 @@
+// Back_L5/cpp/include/l5/search_pool.h
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace l5 {
+
+// Общий пул потоков для поиска: фиксированное число воркеров,
+// у каждого своя очередь; свободный воркер ворует задачи у соседей.
+class SearchPool {
+public:
+    explicit SearchPool(unsigned threads);
+    ~SearchPool();
+
+    SearchPool(const SearchPool&) = delete;
+    SearchPool& operator=(const SearchPool&) = delete;
+
+    unsigned size() const { return (unsigned)threads_.size(); }
+
+    // fn(i) для i in [0, n), не больше max_parallel исполнителей (включая вызывающий поток).
+    // Вызывающий поток тоже работает => нет дедлока при вложенных вызовах / занятом пуле.
+    // Первое исключение из fn пробрасывается после завершения.
+    void parallel_for(size_t n, unsigned max_parallel, const std::function<void(size_t)>& fn);
+
+    // process-wide пул: PLAGIO_SEARCH_THREADS или hardware_concurrency
+    static SearchPool& shared();
+
+private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mu;
+        std::deque<Task> q;
+    };
+
+    void submit(Task t);
+    bool pop_local(size_t w, Task& out);
+    bool steal(size_t w, Task& out);
+    void worker_loop(size_t w);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex sleep_mu_;
+    std::condition_variable cv_;
+    size_t pending_{0}; // guarded by sleep_mu_
+    bool stop_{false};  // guarded by sleep_mu_
+
+    std::atomic<size_t> rr_{0};
+};
+
+} // namespace l5
@@ -1,12 +1,14 @@
 // Back_L5/cpp/include/l5/search_segment.h
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <utility>
 #include <vector>
 
-#include "l5/reader.h"
+#include "l5/mapped_segment.h"
 #include "l5/query.h"
 #include "l5/result.h"
-#include "l5/docinfo.h"
+#include "l5/docinfo_store.h"
 
 namespace l5 {
 
@@ -21,11 +23,68 @@ struct SearchOptions {
     uint32_t max_spans_per_doc{10};
 
     double alpha{0.60};
+
+    // merge-join хэшей запроса со словарём сегмента (галоп по отсортированным h),
+    // если на хэш запроса в среднем <= merge_join_max_gap записей словаря;
+    // 0 => всегда независимые lookup'ы
+    uint32_t merge_join_max_gap{4096};
+
+    // проверять хэши Bloom-фильтром сегмента (index_native.bloom) до lookup'а
+    bool use_hash_filter{true};
+
+    // отбрасывать stop-hash (index_native.df сегмента и level5_stop_hashes.df out_root)
+    // до lookup'а; в отличие от max_postings_per_hash порог выбран по DF при сборке
+    bool use_stop_hashes{false};
+
+    // search_batch: запросов на один проход по сегментам (память ~ их общим postings)
+    uint32_t batch_queries_per_pass{64};
+
+    // fan-out по сегментам в общем SearchPool: 0 => auto (размер пула), 1 => последовательно
+    uint32_t max_parallel_segments{0};
 };
 
-std::vector<Hit> search_in_segment(const SegmentData& seg,
-                                  const std::vector<DocInfo>& docinfo,
+std::vector<Hit> search_in_segment(const MappedSegment& seg,
+                                  const DocInfoStore& docinfo,
                                   const QueryShingles& q,
                                   const SearchOptions& opt);
 
+// Bloom-фильтр (и stop-hash) сегмента на одном запросе: хэшей запроса и сколько
+// из них отсеяно без lookup'а (skipped == hashes => сегмент пропущен целиком).
+struct HashFilterStats {
+    uint64_t hashes{0};
+    uint64_t skipped{0};
+};
+
+// Двухфазный поиск по многим сегментам (search_out_root): Stage A каждого
+// сегмента отдельно, spans — только для кандидатов, прошедших глобальный отбор.
+struct SegmentCandidates {
+    std::vector<uint32_t> items;                   // q.items с непустым диапазоном (не stop-hash)
+    std::vector<std::pair<size_t, size_t>> ranges; // их диапазоны postings
+    std::vector<uint32_t> dids;                    // top candidates_topn по hits, как в search_in_segment
+    std::vector<double> c_upper;                   // верхняя граница C для dids[i]; < 0 => spans не будет
+    HashFilterStats filter;
+};
+
+SegmentCandidates collect_candidates(const MappedSegment& seg,
+                                     const DocInfoStore& docinfo,
+                                     const QueryShingles& q,
+                                     const SearchOptions& opt);
+
+// Stage B для sc.dids[i], i из which: Hit'ы как у search_in_segment для тех же did.
+std::vector<Hit> verify_candidates(const MappedSegment& seg,
+                                   const DocInfoStore& docinfo,
+                                   const QueryShingles& q,
+                                   const SearchOptions& opt,
+                                   const SegmentCandidates& sc,
+                                   const std::vector<uint32_t>& which);
+
+// Пакет запросов по одному сегменту: найденные диапазоны всех запросов
+// объединяются, did каждого уникального диапазона декодируются один раз и
+// раздаются запросам. out[i] == search_in_segment(seg, docinfo, qs[i], opt).
+std::vector<std::vector<Hit>> search_in_segment_batch(const MappedSegment& seg,
+                                                      const DocInfoStore& docinfo,
+                                                      const std::vector<QueryShingles>& qs,
+                                                      const SearchOptions& opt,
+                                                      std::vector<HashFilterStats>* filter_stats = nullptr);
+
 } // namespace l5
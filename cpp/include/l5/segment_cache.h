@@ -0,0 +1,114 @@
+// Back_L5/cpp/include/l5/segment_cache.h
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "l5/docinfo_store.h"
+#include "l5/manifest.h"
+#include "l5/mapped_segment.h"
+#include "l5/near_dup.h"
+
+namespace l5 {
+
+// Сегмент, готовый к поиску: mmap index_native.bin + docinfo (mmap или старый json).
+struct LoadedSegment {
+    std::string segment_name;
+    MappedSegment seg;
+    DocInfoStore docinfo;
+    NearDupIndex near_dup; // полосы simhash из docmeta
+
+    uint64_t bytes{0}; // оценка для бюджета кэша (mapping'и + heap near_dup и т.п.)
+};
+
+// hash_directory: radix-директория окупается только на повторных запросах —
+// одноразовая загрузка (поиск без кэша) обходится бинарным поиском.
+// near_dup: полосы simhash нужны только near-dup запросам; без них near_dup пуст.
+bool load_segment(const std::filesystem::path& seg_dir,
+                  LoadedSegment& out,
+                  std::string* err,
+                  bool hash_directory = true,
+                  bool near_dup = true);
+
+struct SegmentCacheStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    uint64_t load_failures{0};
+    uint64_t manifest_hits{0};
+    uint64_t manifest_loads{0};
+
+    uint64_t entries{0};
+    uint64_t bytes{0};
+    uint64_t budget_bytes{0};
+};
+
+// Долгоживущий кэш сегментов (process-wide), ключ = (scope, segment_name, built_at_utc).
+// scope обычно = org_id. LRU-вытеснение по бюджету bytes.
+// Вытесненный сегмент живёт, пока его держат текущие запросы (shared_ptr).
+class SegmentCache {
+public:
+    explicit SegmentCache(uint64_t budget_bytes);
+
+    // nullptr => сегмент не загрузился (err заполнен)
+    std::shared_ptr<const LoadedSegment> get(const std::string& scope,
+                                             const std::filesystem::path& out_root,
+                                             const SegmentEntry& e,
+                                             std::string* err);
+
+    // только уже загруженный сегмент (nullptr, если его нет): без загрузки, LRU и статистики
+    std::shared_ptr<const LoadedSegment> peek(const std::string& scope, const SegmentEntry& e) const;
+
+    // Манифест кэшируется по (mtime, size) файла level5_manifest.json.
+    Manifest manifest(const std::filesystem::path& out_root);
+
+    // level5_stop_hashes.df out_root — так же по (mtime, size); нет файла / ошибка => пустой
+    std::shared_ptr<const StopHashes> org_stop_hashes(const std::filesystem::path& out_root);
+
+    void invalidate_scope(const std::string& scope);
+    // после compaction: входы удалены с диска, mmap держал бы их место
+    void invalidate_segments(const std::string& scope, const std::vector<std::string>& segment_names);
+    void clear();
+
+    void set_budget(uint64_t budget_bytes);
+    SegmentCacheStats stats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const LoadedSegment> seg;
+        std::list<std::string>::iterator lru_it;
+        std::string scope;
+    };
+
+    struct ManifestEntry {
+        std::filesystem::file_time_type mtime{};
+        uintmax_t size{0};
+        Manifest m;
+    };
+
+    struct StopEntry {
+        std::filesystem::file_time_type mtime{};
+        uintmax_t size{0};
+        std::shared_ptr<const StopHashes> stop;
+    };
+
+    void evict_locked();
+
+    mutable std::mutex mu_;
+    uint64_t budget_bytes_{0};
+    uint64_t bytes_{0};
+
+    std::list<std::string> lru_; // front = most recently used
+    std::unordered_map<std::string, Entry> map_;
+    std::unordered_map<std::string, ManifestEntry> manifests_;
+    std::unordered_map<std::string, StopEntry> org_stops_;
+
+    SegmentCacheStats st_;
+};
+
+} // namespace l5
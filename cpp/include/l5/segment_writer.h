@@ -0,0 +1,136 @@
+// Back_L5/cpp/include/l5/segment_writer.h
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "l5/doc_freq.h"
+#include "l5/format.h"
+#include "l5/posting_codec.h"
+
+namespace l5 {
+
+// Потоковая запись index_native.bin (V2 или V3).
+// docmeta подаются по порядку did, postings — строго по (h,did,pos) (между
+// вызовами тоже). Секции копятся во временных файлах tmp_dir и склеиваются в
+// finish(): размеры секций заранее неизвестны. Ошибки => L5Exception.
+// posting_codec и hash_scheme учитываются только для V3 (V2 — RAW и FNV1A + COMBINE).
+class SegmentWriter {
+public:
+    SegmentWriter(const std::filesystem::path& bin_path,
+                  const std::filesystem::path& tmp_dir,
+                  uint32_t version = FORMAT_V3,
+                  uint32_t posting_codec = POSTING_CODEC_BP128,
+                  HashScheme hash_scheme = HashScheme{TOKEN_HASH_WYHASH, SHINGLE_HASH_ROLLING});
+    ~SegmentWriter(); // best effort: удаляет временные секции
+
+    SegmentWriter(const SegmentWriter&) = delete;
+    SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+    // DF хэшей по ходу add_postings (top max_entries, см. DfCounter); до первого add_postings
+    void count_doc_freq(size_t max_entries) {
+        df_on_ = max_entries > 0;
+        df_ = DfCounter(max_entries);
+    }
+
+    void add_docmeta(const DocMeta& dm);
+    void add_postings(const Posting9* p, size_t n);
+
+    // пишет bin_path целиком; после finish() добавлять нельзя
+    void finish();
+
+    uint32_t version() const { return version_; }
+    uint32_t posting_codec() const { return codec_; }
+    const HashScheme& hash_scheme() const { return scheme_; }
+    uint32_t n_docs() const { return n_docs_; }
+    uint64_t n_post9() const { return n_post9_; }
+    uint64_t n_hashes() const { return n_hashes_; }
+
+    // после finish() с count_doc_freq: DF сегмента (stop_df не выбран — это делает вызывающий)
+    DfTable doc_freq() const { return df_table_; }
+
+private:
+    struct Section {
+        std::filesystem::path path;
+        std::ofstream out;
+        std::vector<unsigned char> buf;
+        uint64_t bytes{0};
+
+        void open(const std::filesystem::path& p);
+        void put(const void* data, size_t n) {
+            const auto* c = static_cast<const unsigned char*>(data);
+            buf.insert(buf.end(), c, c + n);
+            bytes += n;
+            if (buf.size() >= (1u << 20)) flush();
+        }
+        void flush();
+        void close();
+    };
+
+    void append_section(std::ofstream& out, Section& s, uint64_t off, uint64_t& cur);
+    void flush_block();
+
+    std::filesystem::path bin_path_;
+    uint32_t version_{FORMAT_V3};
+    uint32_t codec_{POSTING_CODEC_RAW};
+    HashScheme scheme_;
+    bool finished_{false};
+
+    uint32_t n_docs_{0};
+    uint64_t n_post9_{0};
+    uint64_t n_hashes_{0};
+
+    bool has_last_{false};
+    Posting9 last_{};
+
+    bool df_on_{false};
+    DfCounter df_{0};
+    DfTable df_table_;
+    uint64_t start_word_{0}; // текущее слово битмапа starts
+
+    // BP128: текущий блок
+    uint32_t blk_did_[bp128::kBlock];
+    uint32_t blk_pos_[bp128::kBlock];
+    size_t blk_n_{0};
+    bool blk_inner_start_{false};
+    std::vector<unsigned char> blk_buf_;
+
+    Section docmeta_;
+    Section post9_;  // V2
+    Section hashes_; // V3
+    Section starts_;
+    Section select_;
+    Section did_;     // RAW
+    Section pos_;
+    Section blkmeta_; // BP128
+    Section blkdata_;
+};
+
+// Сайдкары готового сегмента (index_native.bloom, index_native.df): общие для
+// сборки и компакции. 0 в bloom_bits_per_key / df_max_entries => файл не пишется.
+struct SidecarOptions {
+    uint32_t bloom_bits_per_key{10};
+    uint32_t df_max_entries{1u << 16};
+    double stop_df_percentile{99.99};
+    uint32_t stop_min_df{64};
+};
+
+// После finish() и atomic replace index_native.bin в seg_dir; DF — из writer
+// (count_doc_freq). Ошибки => L5Exception.
+void write_segment_sidecars(const std::filesystem::path& seg_dir, const SegmentWriter& writer,
+                            const SidecarOptions& opt);
+
+// Каталог сегмента удаляется при выходе из области, если не выставлен keep
+// (исключение до публикации в манифесте не оставляет полусобранный сегмент).
+struct SegCleanupOnFail {
+    std::filesystem::path p;
+    bool keep{false};
+    ~SegCleanupOnFail() {
+        if (keep) return;
+        std::error_code ec;
+        std::filesystem::remove_all(p, ec);
+    }
+};
+
+} // namespace l5
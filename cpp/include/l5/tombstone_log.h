@@ -0,0 +1,30 @@
+// Back_L5/cpp/include/l5/tombstone_log.h
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace l5 {
+
+// tombstones.log org (пишет сервис, читают сервис и l5_compact --tombstones):
+//   header (8): magic "L5TB", u32 version
+//   записи [u32 len][doc_id] в порядке удаления
+// Запись дописывается одним append'ом без fsync: падение посреди него оставляет
+// оборванный хвост — читатель останавливается на последней целой записи.
+inline constexpr uint32_t TOMBSTONE_LOG_VERSION = 1;
+inline constexpr size_t TOMBSTONE_LOG_HEADER_BYTES = 8;
+
+void write_tombstone_log_header(std::ostream& out);
+void write_tombstone_record(std::ostream& out, std::string_view doc_id);
+
+// doc_ids — записи по порядку (с повторами, если они есть в файле); valid_bytes —
+// конец последней целой записи (файл не трогается: обрезает хвост вызывающий).
+// Файл короче заголовка, совпадающий с его началом, — true и valid_bytes = 0
+// (заголовок не дописан). false — не открылся или чужой заголовок (err).
+bool read_tombstone_log(const std::filesystem::path& p, std::vector<std::string>& doc_ids,
+                        uint64_t* valid_bytes, std::string* err);
+
+} // namespace l5
@@ -11,13 +11,17 @@
 #include <mutex>
 #include <algorithm>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "httplib.h"
 #include <nlohmann/json.hpp>
 
 #include "service.h"
 #include "l5/result.h"
+#include "l5/docinfo_store.h"
 #include "l5/format.h"
+#include "l5/mapped_segment.h"
 
 #include "storage.h"
 #include "extractor.h"
@@ -62,60 +66,48 @@ static void reply_json(httplib::Response& res, int status, const json& j) {
 static std::mutex g_admin_mu;
 
 // ---- helpers for debug index view ----
-static bool read_docmeta_by_did(const fs::path& bin_path,
+// V2 and V3 (mmap, header + one docmeta record touched)
+static bool read_docmeta_by_did(const fs::path& seg_dir,
                                 uint32_t did,
                                 l5::HeaderV2& hdr_out,
+                                uint64_t& n_hashes_out,
                                 l5::DocMeta& dm_out,
                                 std::string& err) {
-  std::ifstream in(bin_path, std::ios::binary);
-  if (!in) { err = "cannot open " + bin_path.string(); return false; }
-
-  l5::HeaderV2 h{};
-  if (!l5::read_header_v2(in, h)) { err = "invalid header in " + bin_path.string(); return false; }
-  if (did >= h.n_docs) { err = "did out of range"; return false; }
-
-  // header bytes: 4+4+4+8+8 = 28
-  constexpr std::streamoff HDR_BYTES = 4 + 4 + 4 + 8 + 8;
-  // docmeta bytes: tok_len(4) + hi(8) + lo(8) = 20
-  constexpr std::streamoff DOCMETA_BYTES = 4 + 8 + 8;
-
-  const std::streamoff off = HDR_BYTES + (std::streamoff)did * DOCMETA_BYTES;
-  in.seekg(off, std::ios::beg);
-  if (!in) { err = "seek failed"; return false; }
-
-  l5::DocMeta dm{};
-  in.read(reinterpret_cast<char*>(&dm.tok_len), sizeof(dm.tok_len));
-  in.read(reinterpret_cast<char*>(&dm.simhash_hi), sizeof(dm.simhash_hi));
-  in.read(reinterpret_cast<char*>(&dm.simhash_lo), sizeof(dm.simhash_lo));
-  if (!in) { err = "read docmeta failed"; return false; }
-
-  hdr_out = h;
-  dm_out = dm;
+  l5::MapOptions mo;
+  mo.advise = false;
+  l5::MappedSegment seg;
+  if (!l5::map_segment_bin(seg_dir, seg, &err, mo)) return false;
+  if (did >= seg.n_docs()) { err = "did out of range"; return false; }
+
+  hdr_out = seg.header();
+  n_hashes_out = seg.header_v3().n_hashes;
+  dm_out = seg.docmeta()[did];
   return true;
 }
 
-static std::optional<json> find_docinfo_entry_with_did(const fs::path& docids_json,
+// docidx сегмента: корзина по хэшу doc_id + одна запись docinfo (без чтения всего json)
+static std::optional<json> find_docinfo_entry_with_did(const fs::path& seg_dir,
                                                        const std::string& doc_id,
                                                        uint32_t& did_out,
                                                        std::string& err) {
-  std::ifstream in(docids_json);
-  if (!in) { err = "cannot open " + docids_json.string(); return std::nullopt; }
-
-  json j;
-  try { in >> j; } catch (...) { err = "failed parsing " + docids_json.string(); return std::nullopt; }
-  if (!j.is_array()) { err = "docids json is not array"; return std::nullopt; }
-
-  for (size_t i = 0; i < j.size(); ++i) {
-    if (!j[i].is_object()) continue;
-    const std::string id = j[i].value("doc_id", "");
-    if (id == doc_id) {
-      did_out = (uint32_t)i;
-      return j[i];
-    }
-  }
-
-  err = "doc_id not found in docids.json";
-  return std::nullopt;
+  l5::DocInfoStore ds;
+  if (!l5::open_docinfo(seg_dir, ds, &err)) return std::nullopt;
+
+  std::vector<uint32_t> dids;
+  ds.find(doc_id, dids);
+  if (dids.empty()) { err = "doc_id not found in segment docinfo"; return std::nullopt; }
+
+  did_out = dids[0];
+  const l5::DocInfo di = ds.get(did_out);
+  return json{
+    {"doc_id", di.doc_id},
+    {"organization_id", di.organization_id},
+    {"external_id", di.external_id},
+    {"source_path", di.source_path},
+    {"source_name", di.source_name},
+    {"meta_path", di.meta_path},
+    {"preview_text", di.preview_text}
+  };
 }
 
 // ---- helpers for text extraction endpoint ----
@@ -266,6 +258,35 @@ static bool parse_bool_str(const std::string& v, bool defv) {
   return defv;
 }
 
+// search options from /search and /search_batch json body (missing => defaults)
+static l5::SearchOptions search_options_from_json(const json& j) {
+  l5::SearchOptions opt;
+  opt.topk = j.value("topk", opt.topk);
+  opt.candidates_topn = j.value("candidates_topn", opt.candidates_topn);
+  opt.min_hits = j.value("min_hits", opt.min_hits);
+  opt.max_postings_per_hash = j.value("max_postings_per_hash", opt.max_postings_per_hash);
+  opt.span_min_len = j.value("span_min_len", opt.span_min_len);
+  opt.span_gap = j.value("span_gap", opt.span_gap);
+  opt.max_spans_per_doc = j.value("max_spans_per_doc", opt.max_spans_per_doc);
+  opt.alpha = j.value("alpha", opt.alpha);
+  opt.max_parallel_segments = j.value("max_parallel_segments", opt.max_parallel_segments);
+  opt.merge_join_max_gap = j.value("merge_join_max_gap", opt.merge_join_max_gap);
+  opt.batch_queries_per_pass = j.value("batch_queries_per_pass", opt.batch_queries_per_pass);
+  opt.use_hash_filter = j.value("use_hash_filter", opt.use_hash_filter);
+  opt.use_stop_hashes = j.value("use_stop_hashes", opt.use_stop_hashes);
+  return opt;
+}
+
+static l5::NearDupOptions near_dup_options_from_json(const json& j) {
+  l5::NearDupOptions opt;
+  opt.max_hamming = j.value("max_hamming", opt.max_hamming);
+  opt.topk = j.value("topk", opt.topk);
+  opt.max_tokens = j.value("max_tokens", opt.max_tokens);
+  opt.max_parallel_segments = j.value("max_parallel_segments", opt.max_parallel_segments);
+  if (opt.max_hamming > 128) throw std::invalid_argument("max_hamming must be <= 128");
+  return opt;
+}
+
 // try read param from multipart form or query params
 static std::optional<std::string> get_param_any(const httplib::Request& req, const char* key) {
   if (req.has_param(key)) return req.get_param_value(key);
@@ -287,6 +308,8 @@ int main(int argc, char** argv) {
   constexpr size_t MAX_ZIP_UPLOAD_BYTES = 512ull * 1024 * 1024; // 512MB
   constexpr size_t MAX_JSON_BODY_BYTES  = 1ull * 1024 * 1024;   // 1MB
   constexpr size_t MAX_QUERY_BYTES      = 256ull * 1024;        // 256KB
+  constexpr size_t MAX_BATCH_BODY_BYTES = 64ull * 1024 * 1024;  // 64MB (search_batch)
+  constexpr size_t MAX_BATCH_QUERIES    = 1000;
 
   // Debug endpoint hard cap
   constexpr size_t MAX_DEBUG_TEXT_BYTES_DEFAULT = 8ull * 1024 * 1024;   // 8 MiB
@@ -411,15 +434,7 @@ int main(int argc, char** argv) {
       // IMPORTANT: do NOT normalize query inside core
       const bool query_is_normalized = true;
 
-      l5::SearchOptions opt;
-      opt.topk = j.value("topk", opt.topk);
-      opt.candidates_topn = j.value("candidates_topn", opt.candidates_topn);
-      opt.min_hits = j.value("min_hits", opt.min_hits);
-      opt.max_postings_per_hash = j.value("max_postings_per_hash", opt.max_postings_per_hash);
-      opt.span_min_len = j.value("span_min_len", opt.span_min_len);
-      opt.span_gap = j.value("span_gap", opt.span_gap);
-      opt.max_spans_per_doc = j.value("max_spans_per_doc", opt.max_spans_per_doc);
-      opt.alpha = j.value("alpha", opt.alpha);
+      const l5::SearchOptions opt = search_options_from_json(j);
 
       auto r = svc.search(org_id, query, query_is_normalized, opt);
       reply_json(res, 200, l5::to_json(r));
@@ -430,6 +445,139 @@ int main(int argc, char** argv) {
     }
   });
 
+  // Near-duplicates по 128-битному simhash документов (LSH-полосы, без postings):
+  // дешёвая проверка перед /search.
+  // POST /v1/orgs/{org}/near_duplicates
+  //   {"doc_id": "<doc_id | external_id>"} или {"text": "...", "text_is_normalized": true},
+  //   опции: max_hamming (3; <= 7 — точно), topk (50)
+  // Ответ: {"max_hamming": N, "segments_scanned": N, "candidates": N, "hits": [{"doc_id", "hamming", ...}]}
+  app.Post(R"(/v1/orgs/([^/]+)/near_duplicates)", [&](const httplib::Request& req, httplib::Response& res) {
+    try {
+      std::string org_id = req.matches[1];
+
+      if (req.body.size() > MAX_JSON_BODY_BYTES) {
+        reply_json(res, 413, {{"error","json body too large"}, {"max_bytes", (uint64_t)MAX_JSON_BODY_BYTES}});
+        return;
+      }
+
+      json j;
+      try {
+        j = json::parse(req.body);
+      } catch (...) {
+        reply_json(res, 400, {{"error","invalid json"}}); return;
+      }
+
+      const l5::NearDupOptions opt = near_dup_options_from_json(j);
+      const std::string doc_id = j.value("doc_id", "");
+      const std::string text = j.value("text", "");
+
+      if (!doc_id.empty()) {
+        auto r = svc.near_duplicates_doc(org_id, doc_id, opt);
+        if (!r.doc_found) { reply_json(res, 404, {{"error","document not found"}, {"doc_id", doc_id}}); return; }
+        reply_json(res, 200, l5::to_json(r));
+        return;
+      }
+
+      if (text.empty()) { reply_json(res, 400, {{"error","doc_id or text is required"}}); return; }
+      if (text.size() > MAX_QUERY_BYTES) {
+        reply_json(res, 413, {{"error","text too large"}, {"max_bytes", (uint64_t)MAX_QUERY_BYTES}});
+        return;
+      }
+
+      auto r = svc.near_duplicates_text(org_id, text, j.value("text_is_normalized", true), opt);
+      reply_json(res, 200, l5::to_json(r));
+    } catch (const std::invalid_argument& e) {
+      reply_json(res, 400, {{"error", e.what()}});
+    } catch (const std::exception& e) {
+      reply_json(res, 500, {{"error", e.what()}});
+    }
+  });
+
+  // Batch search: много запросов за один обход сегментов (union хэшей, postings
+  // декодируются один раз на проход по batch_queries_per_pass запросов).
+  // POST /v1/orgs/{org}/search_batch
+  //   {"queries": ["...", {"id": "sub-17", "query": "..."}, ...], <опции как у /search>}
+  // Ответ 200 application/x-ndjson, строка на запрос в порядке queries, по мере готовности:
+  //   {"index": i, "id": "...", "query": "...", "segments_scanned": N, "hits": [...]}
+  // Ошибка посреди потока => последняя строка {"error": "..."}.
+  app.Post(R"(/v1/orgs/([^/]+)/search_batch)", [&](const httplib::Request& req, httplib::Response& res) {
+    try {
+      std::string org_id = req.matches[1];
+
+      if (req.body.size() > MAX_BATCH_BODY_BYTES) {
+        reply_json(res, 413, {{"error","json body too large"}, {"max_bytes", (uint64_t)MAX_BATCH_BODY_BYTES}});
+        return;
+      }
+
+      json j;
+      try {
+        j = json::parse(req.body);
+      } catch (...) {
+        reply_json(res, 400, {{"error","invalid json"}}); return;
+      }
+
+      if (!j.contains("queries") || !j["queries"].is_array() || j["queries"].empty()) {
+        reply_json(res, 400, {{"error","queries must be a non-empty array"}}); return;
+      }
+      if (j["queries"].size() > MAX_BATCH_QUERIES) {
+        reply_json(res, 413, {{"error","too many queries"}, {"max_queries", (uint64_t)MAX_BATCH_QUERIES}});
+        return;
+      }
+
+      auto queries = std::make_shared<std::vector<std::string>>();
+      auto ids = std::make_shared<std::vector<std::string>>();
+      for (const auto& e : j["queries"]) {
+        std::string q, id;
+        if (e.is_string()) {
+          q = e.get<std::string>();
+        } else if (e.is_object()) {
+          q = e.value("query", "");
+          id = e.value("id", "");
+        }
+        if (q.empty()) {
+          reply_json(res, 400, {{"error","query is empty"}, {"index", queries->size()}}); return;
+        }
+        if (q.size() > MAX_QUERY_BYTES) {
+          reply_json(res, 413, {{"error","query too large"}, {"index", queries->size()},
+                                {"max_bytes", (uint64_t)MAX_QUERY_BYTES}});
+          return;
+        }
+        queries->push_back(std::move(q));
+        ids->push_back(std::move(id));
+      }
+
+      // IMPORTANT: do NOT normalize query inside core
+      const bool query_is_normalized = true;
+      const l5::SearchOptions opt = search_options_from_json(j);
+
+      res.status = 200;
+      res.set_chunked_content_provider(
+        "application/x-ndjson",
+        [&svc, org_id, queries, ids, opt, query_is_normalized](size_t, httplib::DataSink& sink) {
+          auto write_line = [&](const json& line) {
+            const std::string s = line.dump() + "\n";
+            if (!sink.write(s.data(), s.size())) throw std::runtime_error("client disconnected");
+          };
+          try {
+            svc.search_batch(org_id, *queries, query_is_normalized, opt, [&](size_t i, l5::SearchResult&& r) {
+              json line = l5::to_json(r);
+              line["index"] = i;
+              if (!(*ids)[i].empty()) line["id"] = (*ids)[i];
+              write_line(line);
+            });
+          } catch (const std::exception& e) {
+            try { write_line({{"error", e.what()}}); } catch (...) { return false; }
+          }
+          sink.done();
+          return true;
+        });
+    } catch (const std::invalid_argument& e) {
+      reply_json(res, 400, {{"error", e.what()}});
+    } catch (const std::exception& e) {
+      reply_json(res, 500, {{"error", e.what()}});
+    }
+  });
+
   // List documents
   app.Get(R"(/v1/orgs/([^/]+)/documents)", [&](const httplib::Request& req, httplib::Response& res) {
     try {
@@ -514,12 +662,11 @@ int main(int argc, char** argv) {
       }
 
       const fs::path seg_dir = index_root / row.last_segment;
-      const auto docids_path = seg_dir / "index_native_docids.json";
       const auto bin_path    = seg_dir / "index_native.bin";
 
       uint32_t did = 0;
       std::string err;
-      auto docinfo_opt = find_docinfo_entry_with_did(docids_path, row.doc_id, did, err);
+      auto docinfo_opt = find_docinfo_entry_with_did(seg_dir, row.doc_id, did, err);
       if (!docinfo_opt) {
         reply_json(res, 500, {{"error","failed reading docids"}, {"detail", err}, {"seg_dir", seg_dir.string()}});
         return;
@@ -533,8 +680,9 @@ int main(int argc, char** argv) {
       }
 
       l5::HeaderV2 h{};
+      uint64_t n_hashes = 0;
       l5::DocMeta dm{};
-      if (!read_docmeta_by_did(bin_path, did, h, dm, err)) {
+      if (!read_docmeta_by_did(seg_dir, did, h, n_hashes, dm, err)) {
         reply_json(res, 500, {{"error","failed reading docmeta"}, {"detail", err}, {"bin", bin_path.string()}});
         return;
       }
@@ -556,7 +704,8 @@ int main(int argc, char** argv) {
           {"version", h.version},
           {"n_docs", h.n_docs},
           {"n_post9", h.n_post9},
-          {"n_post13", h.n_post13}
+          {"n_post13", h.n_post13},
+          {"n_hashes", n_hashes}
         }},
         {"note", "Full text is not stored in segment; only preview_text + postings/docmeta. Use /debug/normalized_text to re-extract full text from file."}
       };
@@ -701,6 +850,7 @@ int main(int argc, char** argv) {
       }
 
       std::lock_guard<std::mutex> lk(g_admin_mu);
+      svc.drop_all_caches();
 
       const fs::path orgs_dir = fs::path(data_root) / "orgs";
       std::error_code ec;
@@ -764,6 +914,7 @@ int main(int argc, char** argv) {
       }
 
       std::lock_guard<std::mutex> lk(g_admin_mu);
+      svc.drop_org_cache(org_id);
 
       const fs::path org_dir  = fs::path(data_root) / "orgs" / org_id;
       const fs::path orgs_dir = fs::path(data_root) / "orgs";
@@ -798,6 +949,66 @@ int main(int argc, char** argv) {
     }
   });
 
+  // ADMIN: compaction org вручную
+  // POST /v1/orgs/{org}/admin/compact  body: {"all": true} — все сегменты; иначе size-tiered выбор
+  app.Post(R"(/v1/orgs/([^/]+)/admin/compact)", [&](const httplib::Request& req, httplib::Response& res) {
+    try {
+      std::string org_id = req.matches[1];
+      bool all = false;
+
+      if (!req.body.empty()) {
+        if (req.body.size() > MAX_JSON_BODY_BYTES) {
+          reply_json(res, 413, {{"error","json body too large"}, {"max_bytes",(uint64_t)MAX_JSON_BODY_BYTES}});
+          return;
+        }
+        json j;
+        try { j = json::parse(req.body); }
+        catch (...) { reply_json(res, 400, {{"error","invalid json"}}); return; }
+        all = j.value("all", false);
+      }
+
+      if (org_id.find("..") != std::string::npos) {
+        reply_json(res, 400, {{"error","bad org_id"}});
+        return;
+      }
+
+      const auto cs = svc.compact_org(org_id, all);
+      reply_json(res, 200, {
+        {"compacted", !cs.inputs.empty()},
+        {"segment_name", cs.segment_name},
+        {"inputs", cs.inputs},
+        {"docs_in", cs.docs_in},
+        {"docs_out", cs.docs_out},
+        {"post9_in", cs.post9_in},
+        {"post9_out", cs.post9_out},
+        {"built_at_utc", cs.built_at_utc}
+      });
+    } catch (const std::exception& e) {
+      reply_json(res, 500, {{"error", e.what()}});
+    }
+  });
+
+  // ADMIN: segment cache counters
+  // GET /v1/admin/cache_stats
+  app.Get(R"(/v1/admin/cache_stats)", [&](const httplib::Request&, httplib::Response& res) {
+    try {
+      const auto cs = svc.segment_cache_stats();
+      reply_json(res, 200, {
+        {"hits", cs.hits},
+        {"misses", cs.misses},
+        {"evictions", cs.evictions},
+        {"load_failures", cs.load_failures},
+        {"manifest_hits", cs.manifest_hits},
+        {"manifest_loads", cs.manifest_loads},
+        {"entries", cs.entries},
+        {"bytes", cs.bytes},
+        {"budget_bytes", cs.budget_bytes}
+      });
+    } catch (const std::exception& e) {
+      reply_json(res, 500, {{"error", e.what()}});
+    }
+  });
+
   const char* host = "0.0.0.0";
   int port = 8088;
   std::cout << "L5 service data_root=" << data_root << " listen " << host << ":" << port << "\n";
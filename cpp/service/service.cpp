@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <cctype>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -14,6 +15,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
+#include <iostream>
 #include <memory>
 #include <random>
 #include <sstream>
@@ -37,6 +39,9 @@ constexpr uint64_t ZIP_MAX_TOTAL_UNCOMPRESSED_BYTES = 10ull * 1024 * 1024 * 1024
 constexpr unsigned  PLAGIO_BUILD_THREADS_DEFAULT = 20u;
 constexpr uint64_t  PLAGIO_SORT_RAM_BYTES_DEFAULT = (100ull << 30); // 100 GiB
 
+// ---- segment cache: RAM budget for mapped segments + parsed docids ----
+constexpr uint64_t  PLAGIO_SEGMENT_CACHE_BYTES_DEFAULT = (16ull << 30); // 16 GiB
+
 // ---- parallel soffice conversion knobs ----
 constexpr unsigned  PLAGIO_CONVERT_PROCS_FALLBACK = 20u;   // default cap (will min with hw)
 constexpr unsigned  PLAGIO_CONVERT_BATCH_DEFAULT  = 200u; // files per one soffice invocation
@@ -59,6 +64,15 @@ static uint64_t env_u64(const char* k, uint64_t defv) {
   return (uint64_t)v;
 }
 
+static double env_f64(const char* k, double defv) {
+  const char* s = std::getenv(k);
+  if (!s || !*s) return defv;
+  char* end = nullptr;
+  double v = std::strtod(s, &end);
+  if (!end || *end != '\0' || !std::isfinite(v)) return defv;
+  return v;
+}
+
 static void ensure_dirs(const fs::path& p) {
   std::error_code ec;
   fs::create_directories(p, ec);
@@ -296,15 +310,55 @@ static void soffice_convert_parallel(const fs::path& conv_src,
 
 // -------------------- L5Service --------------------
 
-L5Service::L5Service(fs::path data_root) : data_root_(std::move(data_root)) {
+L5Service::L5Service(fs::path data_root)
+    : data_root_(std::move(data_root)),
+      seg_cache_(env_u64("PLAGIO_SEGMENT_CACHE_BYTES", PLAGIO_SEGMENT_CACHE_BYTES_DEFAULT)) {
   ensure_dirs(data_root_);
   ensure_dirs(data_root_ / "orgs");
+
+  // size-tiered compaction; PLAGIO_COMPACT_MIN_SEGMENTS=0 => выключена
+  compact_policy_.min_segments = env_u32("PLAGIO_COMPACT_MIN_SEGMENTS", compact_policy_.min_segments);
+  compact_policy_.max_segments = env_u32("PLAGIO_COMPACT_MAX_SEGMENTS", compact_policy_.max_segments);
+  compact_policy_.base_post9 = env_u64("PLAGIO_COMPACT_BASE_POSTINGS", compact_policy_.base_post9);
+  // дробный (напр. 2.5); <= 1.0 не разводит уровни => значение по умолчанию
+  const double tier_ratio = env_f64("PLAGIO_COMPACT_TIER_RATIO", compact_policy_.tier_ratio);
+  if (tier_ratio > 1.0) {
+    compact_policy_.tier_ratio = tier_ratio;
+  } else {
+    std::cerr << "PLAGIO_COMPACT_TIER_RATIO=" << tier_ratio << " ignored: must be > 1.0\n";
+  }
+  if (compact_policy_.min_segments > 0) {
+    compact_thread_ = std::thread([this] { compact_loop(); });
+  }
+}
+
+L5Service::~L5Service() {
+  {
+    std::lock_guard<std::mutex> lk(compact_mu_);
+    compact_stop_ = true;
+  }
+  compact_cv_.notify_all();
+  if (compact_thread_.joinable()) compact_thread_.join();
 }
 
 fs::path L5Service::org_root(const std::string& org) const { return data_root_ / "orgs" / org; }
 fs::path L5Service::org_index_root(const std::string& org) const { return org_root(org) / "index"; }
 fs::path L5Service::org_sqlite(const std::string& org) const { return org_root(org) / "meta.sqlite"; }
-fs::path L5Service::org_tombstones(const std::string& org) const { return org_root(org) / "tombstones.jsonl"; }
+fs::path L5Service::org_tombstones(const std::string& org) const { return org_root(org) / "tombstones.log"; }
+fs::path L5Service::org_tombstones_legacy(const std::string& org) const { return org_root(org) / "tombstones.jsonl"; }
+
+std::shared_ptr<Tombstones> L5Service::tombstones_for(const std::string& org) {
+  std::shared_ptr<Tombstones> ts;
+  {
+    std::lock_guard<std::mutex> lk(tombs_mu_);
+    auto& slot = tombs_[org];
+    if (!slot) slot = std::make_shared<Tombstones>(org_tombstones(org), org_tombstones_legacy(org));
+    ts = slot;
+  }
+  // replay лога — вне tombs_mu_: другие org не ждут; эту org ждут на once-флаге
+  ts->ensure_loaded();
+  return ts;
+}
 fs::path L5Service::org_uploads_dir(const std::string& org) const { return org_root(org) / "uploads"; }
 
 std::string L5Service::utc_now_iso() {
@@ -663,6 +717,17 @@ IngestZipResult L5Service::ingest_zip_build_segment(const std::string& org_id,
   // 100 GiB RAM for postings sort
   opt.ram_limit_bytes = env_u64("PLAGIO_SORT_RAM_BYTES", PLAGIO_SORT_RAM_BYTES_DEFAULT);
 
+  // 3 = hash dictionary + SoA did/pos; 2 = old layout (readers support both)
+  opt.format_version = env_u32("PLAGIO_INDEX_FORMAT", l5::FORMAT_V3);
+  // 1 = BP128 blocks, 0 = raw u32 did/pos
+  opt.posting_codec = env_u32("PLAGIO_POSTING_CODEC", l5::POSTING_CODEC_BP128);
+  // 1 = wyhash tokens / rolling shingles; 0 = FNV-1a / per-position combine (V2 scheme)
+  opt.token_hash = env_u32("PLAGIO_TOKEN_HASH", l5::TOKEN_HASH_WYHASH);
+  opt.shingle_hash = env_u32("PLAGIO_SHINGLE_HASH", l5::SHINGLE_HASH_ROLLING);
+  // DF table + stop hashes (segment and org-level boilerplate); 0 entries = off
+  opt.df_max_entries = env_u32("PLAGIO_DF_MAX_ENTRIES", opt.df_max_entries);
+  opt.stop_min_df = env_u32("PLAGIO_STOP_MIN_DF", opt.stop_min_df);
+
   const fs::path out_root = org_index_root(org_id);
 
   // serialize build per-org shard (manifest / segment creation)
@@ -672,30 +737,160 @@ IngestZipResult L5Service::ingest_zip_build_segment(const std::string& org_id,
   }
 
   st.update_last_segment(org_id, doc_ids_for_segment, out.build.segment_name);
+  request_compaction(org_id);
   return out;
 }
 
-l5::SearchResult L5Service::search(const std::string& org_id,
-                                   const std::string& query,
-                                   bool query_is_normalized,
-                                   const l5::SearchOptions& opt) {
+l5::CompactOptions L5Service::compact_options() const {
+  // выход compaction — в том же формате, что и новые сегменты ingest_zip
+  l5::CompactOptions opt;
+  opt.format_version = env_u32("PLAGIO_INDEX_FORMAT", l5::FORMAT_V3);
+  opt.posting_codec = env_u32("PLAGIO_POSTING_CODEC", l5::POSTING_CODEC_BP128);
+  opt.df_max_entries = env_u32("PLAGIO_DF_MAX_ENTRIES", opt.df_max_entries);
+  opt.stop_min_df = env_u32("PLAGIO_STOP_MIN_DF", opt.stop_min_df);
+  return opt;
+}
+
+l5::CompactStats L5Service::compact_org(const std::string& org_id, bool all) {
   const fs::path out_root = org_index_root(org_id);
+  l5::CompactStats cs;
 
-  Tombstones ts(org_tombstones(org_id));
+  // как build: манифест и сегменты org меняет один писатель
+  std::lock_guard<std::mutex> lk(build_mu_for(org_id));
+
+  const l5::Manifest m = l5::load_manifest(out_root);
+  std::vector<std::string> names;
+  if (all) {
+    for (const auto& e : m.segments) names.push_back(e.segment_name);
+  } else {
+    names = l5::pick_tiered_compaction(m, compact_policy_);
+  }
+  if (names.empty()) return cs;
+
+  auto ts = tombstones_for(org_id);
+  const size_t n_tomb = ts->size();
+
+  cs = l5::compact_segments(out_root, names, compact_options(),
+                            [&](const l5::DocInfo& d) { return ts->contains(d.doc_id); });
+  seg_cache_.invalidate_segments(org_id, cs.inputs);
+
+  // удалённые во время слияния помечены только во входах: переносим в новый сегмент
+  if (!cs.segment_name.empty()) {
+    std::lock_guard<std::mutex> tlk(tomb_mu_for(org_id));
+    for (const auto& doc_id : ts->since(n_tomb)) {
+      std::string err;
+      if (!l5::mark_doc_deleted(out_root, doc_id, seg_cache_, org_id, nullptr, &err)) {
+        std::cerr << "mark deleted failed org=" << org_id << " doc_id=" << doc_id << ": " << err << "\n";
+      }
+    }
+  }
+
+  Storage st(org_sqlite(org_id).string());
+  st.init();
+  st.reassign_segments(org_id, cs.inputs, cs.segment_name);
+  return cs;
+}
+
+void L5Service::request_compaction(const std::string& org_id) {
+  if (!compact_thread_.joinable()) return;
   {
-    std::lock_guard<std::mutex> lk(tomb_mu_for(org_id));
-    ts.load();
+    std::lock_guard<std::mutex> lk(compact_mu_);
+    if (std::find(compact_queue_.begin(), compact_queue_.end(), org_id) != compact_queue_.end()) return;
+    compact_queue_.push_back(org_id);
   }
+  compact_cv_.notify_one();
+}
 
-  auto res = l5::search_out_root(out_root, query, query_is_normalized, opt);
+void L5Service::compact_loop() {
+  while (true) {
+    std::string org_id;
+    {
+      std::unique_lock<std::mutex> lk(compact_mu_);
+      compact_cv_.wait(lk, [&] { return compact_stop_ || !compact_queue_.empty(); });
+      if (compact_stop_) return;
+      org_id = std::move(compact_queue_.front());
+      compact_queue_.pop_front();
+    }
 
-  std::vector<l5::Hit> filtered;
+    // ярус может набраться снова после слияния нижнего — до тех пор, пока есть что сливать
+    try {
+      while (!compact_org(org_id, false).inputs.empty()) {
+        std::lock_guard<std::mutex> lk(compact_mu_);
+        if (compact_stop_) return;
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "compaction failed org=" << org_id << ": " << e.what() << "\n";
+    }
+  }
+}
+
+template <class Result>
+static void drop_tombstoned(const Tombstones& ts, Result& res) {
+  if (ts.empty()) return;
+  std::vector<typename decltype(res.hits)::value_type> filtered;
   filtered.reserve(res.hits.size());
   for (auto& h : res.hits) {
     if (ts.contains(h.doc_id)) continue;
     filtered.push_back(std::move(h));
   }
   res.hits = std::move(filtered);
+}
+
+l5::SearchResult L5Service::search(const std::string& org_id,
+                                   const std::string& query,
+                                   bool query_is_normalized,
+                                   const l5::SearchOptions& opt) {
+  const fs::path out_root = org_index_root(org_id);
+
+  const auto ts = tombstones_for(org_id);
+
+  auto res = l5::search_out_root(out_root, query, query_is_normalized, opt, seg_cache_, org_id);
+  drop_tombstoned(*ts, res);
+  return res;
+}
+
+void L5Service::search_batch(const std::string& org_id,
+                             const std::vector<std::string>& queries,
+                             bool query_is_normalized,
+                             const l5::SearchOptions& opt,
+                             const l5::BatchResultFn& on_result) {
+  const fs::path out_root = org_index_root(org_id);
+
+  const auto ts = tombstones_for(org_id);
+
+  l5::search_batch(out_root, queries, query_is_normalized, opt, seg_cache_, org_id,
+                   [&](size_t i, l5::SearchResult&& r) {
+                     drop_tombstoned(*ts, r);
+                     on_result(i, std::move(r));
+                   });
+}
+
+l5::NearDupResult L5Service::near_duplicates_doc(const std::string& org_id,
+                                                 const std::string& key,
+                                                 const l5::NearDupOptions& opt) {
+  std::string doc_id = key;
+  {
+    Storage st(org_sqlite(org_id).string());
+    st.init();
+    auto row = st.get_by_doc_or_external(org_id, key);
+    if (row) doc_id = row->doc_id;
+  }
+
+  const auto ts = tombstones_for(org_id);
+
+  auto res = l5::near_duplicates_doc(org_index_root(org_id), doc_id, opt, seg_cache_, org_id);
+  drop_tombstoned(*ts, res);
+  return res;
+}
+
+l5::NearDupResult L5Service::near_duplicates_text(const std::string& org_id,
+                                                  const std::string& text,
+                                                  bool text_is_normalized,
+                                                  const l5::NearDupOptions& opt) {
+  const auto ts = tombstones_for(org_id);
+
+  auto res = l5::near_duplicates_text(org_index_root(org_id), text, text_is_normalized, opt, seg_cache_, org_id);
+  drop_tombstoned(*ts, res);
   return res;
 }
 
@@ -709,13 +904,35 @@ void L5Service::delete_doc(const std::string& org_id, const std::string& key) {
 
   {
     std::lock_guard<std::mutex> lk(tomb_mu_for(org_id));
-    Tombstones ts(org_tombstones(org_id));
-    ts.append(row->doc_id);
+    tombstones_for(org_id)->append(row->doc_id);
+
+    // deleted-битмапы сегментов: Stage A пропускает did; tombstones остаются
+    // страховкой (сегмент не загрузился, запрос уже шёл по старому битмапу)
+    std::string err;
+    if (!l5::mark_doc_deleted(org_index_root(org_id), row->doc_id, seg_cache_, org_id, nullptr, &err)) {
+      std::cerr << "mark deleted failed org=" << org_id << " doc_id=" << row->doc_id << ": " << err << "\n";
+    }
   }
 
   st.mark_deleted(org_id, key, utc_now_iso());
 }
 
+l5::SegmentCacheStats L5Service::segment_cache_stats() const {
+  return seg_cache_.stats();
+}
+
+void L5Service::drop_org_cache(const std::string& org_id) {
+  seg_cache_.invalidate_scope(org_id);
+  std::lock_guard<std::mutex> lk(tombs_mu_);
+  tombs_.erase(org_id);
+}
+
+void L5Service::drop_all_caches() {
+  seg_cache_.clear();
+  std::lock_guard<std::mutex> lk(tombs_mu_);
+  tombs_.clear();
+}
+
 std::vector<DocRow> L5Service::list_docs(const std::string& org_id, int limit, int offset) {
   Storage st(org_sqlite(org_id).string());
   st.init();
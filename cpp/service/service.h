@@ -1,13 +1,19 @@
 #pragma once
 
 #include <array>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "l5/builder.h"
+#include "l5/compactor.h"
 #include "l5/search_multi.h"
 #include "storage.h"
 #include "tombstone.h"
@@ -36,6 +42,7 @@ struct IngestZipResult {
 class L5Service {
 public:
   explicit L5Service(std::filesystem::path data_root);
+  ~L5Service(); // останавливает фоновую compaction
 
   UploadResult ingest_file(const std::string& org_id,
                            const std::string& filename,
@@ -55,25 +62,67 @@ public:
                           bool query_is_normalized,
                           const l5::SearchOptions& opt);
 
+  // Пакет запросов: один обход сегментов на проход, результаты (без tombstones)
+  // отдаются в on_result по порядку запросов по мере готовности.
+  void search_batch(const std::string& org_id,
+                    const std::vector<std::string>& queries,
+                    bool query_is_normalized,
+                    const l5::SearchOptions& opt,
+                    const l5::BatchResultFn& on_result);
+
+  // Near-duplicates по simhash (без postings); документы в tombstones отбрасываются.
+  // key — doc_id или external_id; doc_found=false, если документа нет.
+  l5::NearDupResult near_duplicates_doc(const std::string& org_id,
+                                        const std::string& key,
+                                        const l5::NearDupOptions& opt);
+  l5::NearDupResult near_duplicates_text(const std::string& org_id,
+                                         const std::string& text,
+                                         bool text_is_normalized,
+                                         const l5::NearDupOptions& opt);
+
   void delete_doc(const std::string& org_id, const std::string& key);
   std::vector<DocRow> list_docs(const std::string& org_id, int limit, int offset);
 
+  // Слияние сегментов org (tombstoned документы вычищаются из postings):
+  // all=false — size-tiered выбор (PLAGIO_COMPACT_*), all=true — все сегменты.
+  // Пустой inputs => сливать нечего. После ingest_zip вызывается в фоновом потоке.
+  l5::CompactStats compact_org(const std::string& org_id, bool all);
+
+  // segment cache (mmap + docids), живёт между запросами
+  l5::SegmentCacheStats segment_cache_stats() const;
+  void drop_org_cache(const std::string& org_id);
+  void drop_all_caches();
+
 private:
   std::filesystem::path org_root(const std::string& org) const;
   std::filesystem::path org_index_root(const std::string& org) const;
   std::filesystem::path org_sqlite(const std::string& org) const;
   std::filesystem::path org_tombstones(const std::string& org) const;
+  std::filesystem::path org_tombstones_legacy(const std::string& org) const;
+
+  // tombstones org: replay лога при первом обращении, дальше — в памяти
+  std::shared_ptr<Tombstones> tombstones_for(const std::string& org);
   std::filesystem::path org_uploads_dir(const std::string& org) const;
 
+  l5::CompactOptions compact_options() const;
+  void request_compaction(const std::string& org_id);
+  void compact_loop();
+
   static std::string utc_now_iso();
   static std::string gen_uuid_v4(); // единое имя, без *_like
 
 private:
   std::filesystem::path data_root_;
 
+  // process-wide: ключ (org_id, segment_name), бюджет PLAGIO_SEGMENT_CACHE_BYTES
+  l5::SegmentCache seg_cache_;
+
+  std::mutex tombs_mu_;
+  std::unordered_map<std::string, std::shared_ptr<Tombstones>> tombs_;
+
   // Сериализуем:
   // - build (manifest append + сегментные файлы)
-  // - tombstones append/load
+  // - delete_doc (tombstone append + deleted-битмапы сегментов)
   // Шардирование по org_id => меньше contention, чем один глобальный mutex.
   static constexpr size_t kMutexShards = 64;
 
@@ -86,4 +135,12 @@ private:
 
   std::mutex& build_mu_for(const std::string& org) { return build_mu_[shard(org)]; }
   std::mutex& tomb_mu_for (const std::string& org) { return tomb_mu_[shard(org)]; }
+
+  // фоновая compaction: очередь org (без повторов), один поток
+  l5::TieredCompactionPolicy compact_policy_;
+  std::mutex compact_mu_;
+  std::condition_variable compact_cv_;
+  std::deque<std::string> compact_queue_;
+  bool compact_stop_{false};
+  std::thread compact_thread_;
 };
@@ -305,3 +305,44 @@ void Storage::update_last_segment(const std::string& org_id, const std::vector<s
 
   sqlite3_finalize(st);
 }
+
+void Storage::reassign_segments(const std::string& org_id, const std::vector<std::string>& from_segments, const std::string& to_segment) {
+  if (from_segments.empty()) return;
+
+  auto* db = (sqlite3*)db_;
+  sqlite3_busy_timeout(db, 5000);
+
+  const char* sql = R"SQL(
+    UPDATE documents SET last_segment=? WHERE org_id=? AND last_segment=?;
+  )SQL";
+
+  sqlite3_stmt* st = nullptr;
+
+  exec(db, "BEGIN IMMEDIATE;");
+  try {
+    if (sqlite3_prepare_v2(db, sql, -1, &st, nullptr) != SQLITE_OK) {
+      throw std::runtime_error("sqlite prepare failed (reassign segments)");
+    }
+
+    for (const auto& seg : from_segments) {
+      sqlite3_reset(st);
+      sqlite3_clear_bindings(st);
+      sqlite3_bind_text(st, 1, to_segment.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_text(st, 2, org_id.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_text(st, 3, seg.c_str(), -1, SQLITE_TRANSIENT);
+
+      if (sqlite3_step(st) != SQLITE_DONE) {
+        throw std::runtime_error("sqlite step failed (reassign segments)");
+      }
+    }
+
+    sqlite3_finalize(st);
+    st = nullptr;
+
+    exec(db, "COMMIT;");
+  } catch (...) {
+    if (st) sqlite3_finalize(st);
+    try { exec(db, "ROLLBACK;"); } catch (...) {}
+    throw;
+  }
+}
@@ -33,6 +33,8 @@ public:
 
   void mark_deleted(const std::string& org_id, const std::string& key, const std::string& deleted_at_utc);
   void update_last_segment(const std::string& org_id, const std::vector<std::string>& doc_ids, const std::string& seg);
+  // compaction: last_segment из from_segments => to_segment (одной транзакцией)
+  void reassign_segments(const std::string& org_id, const std::vector<std::string>& from_segments, const std::string& to_segment);
 
 private:
   void* db_{nullptr}; // sqlite3*
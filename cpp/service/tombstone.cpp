@@ -1,27 +1,103 @@
 // src/tombstone.cpp
 #include "tombstone.h"
+
+#include "l5/tombstone_log.h"
+
 #include <fstream>
+#include <mutex>
+#include <stdexcept>
 
-Tombstones::Tombstones(std::filesystem::path file) : file_(std::move(file)) {}
+namespace fs = std::filesystem;
+
+Tombstones::Tombstones(fs::path log_file, fs::path legacy_jsonl)
+    : log_(std::move(log_file)), legacy_(std::move(legacy_jsonl)) {}
 
 void Tombstones::load() {
+  std::unique_lock<std::shared_mutex> lk(mu_);
   set_.clear();
-  std::ifstream in(file_);
-  if (!in) return;
-  std::string line;
-  while (std::getline(in, line)) {
-    if (!line.empty()) set_.insert(line);
+  order_.clear();
+
+  const auto add = [&](std::string s) {
+    auto [it, inserted] = set_.insert(std::move(s));
+    if (inserted) order_.push_back(&*it);
+  };
+
+  std::error_code ec;
+  if (!fs::exists(log_, ec)) {
+    // импорт старого формата: один раз, дальше только лог (нет ничего => лог создаст append)
+    std::ifstream in(legacy_);
+    if (!in) return;
+    std::string line;
+    while (std::getline(in, line)) {
+      if (!line.empty()) add(line);
+    }
+
+    fs::create_directories(log_.parent_path(), ec);
+    const fs::path tmp = log_.string() + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    l5::write_tombstone_log_header(out);
+    for (const auto* s : order_) l5::write_tombstone_record(out, *s);
+    out.flush();
+    if (!out) throw std::runtime_error("tombstones log write failed: " + tmp.string());
+    out.close();
+    fs::rename(tmp, log_, ec);
+    if (ec) throw std::runtime_error("tombstones log rename failed: " + log_.string());
+    return;
+  }
+
+  std::vector<std::string> ids;
+  uint64_t valid = 0;
+  std::string err;
+  if (!l5::read_tombstone_log(log_, ids, &valid, &err)) throw std::runtime_error(err);
+  for (auto& id : ids) add(std::move(id));
+
+  if (valid < l5::TOMBSTONE_LOG_HEADER_BYTES) {
+    // заголовок не дописан: append видит существующий файл и его не пишет
+    std::ofstream out(log_, std::ios::binary | std::ios::trunc);
+    l5::write_tombstone_log_header(out);
+    out.flush();
+    if (!out) throw std::runtime_error("tombstones log write failed: " + log_.string());
+    return;
   }
+  // оборванный хвост: следующий append должен лечь сразу за последней целой записью
+  if (fs::file_size(log_, ec) > valid) fs::resize_file(log_, valid, ec);
+}
+
+void Tombstones::ensure_loaded() {
+  std::call_once(loaded_, [this] { load(); });
+}
+
+bool Tombstones::append(const std::string& doc_id) {
+  std::unique_lock<std::shared_mutex> lk(mu_);
+  if (set_.count(doc_id)) return false;
+
+  std::error_code ec;
+  const bool fresh = !fs::exists(log_, ec);
+  if (fresh) fs::create_directories(log_.parent_path(), ec);
+  std::ofstream out(log_, std::ios::binary | std::ios::app);
+  if (fresh) l5::write_tombstone_log_header(out);
+  l5::write_tombstone_record(out, doc_id);
+  out.flush();
+  if (!out) throw std::runtime_error("tombstones append failed: " + log_.string());
+
+  auto it = set_.insert(doc_id).first;
+  order_.push_back(&*it);
+  return true;
 }
 
-void Tombstones::append(const std::string& key) {
-  std::filesystem::create_directories(file_.parent_path());
-  std::ofstream out(file_, std::ios::app | std::ios::binary);
-  out << key << "\n";
-  set_.insert(key);
+bool Tombstones::contains(const std::string& doc_id) const {
+  std::shared_lock<std::shared_mutex> lk(mu_);
+  return set_.find(doc_id) != set_.end();
 }
 
-bool Tombstones::contains(const std::string& key) const {
-  return set_.find(key) != set_.end();
+size_t Tombstones::size() const {
+  std::shared_lock<std::shared_mutex> lk(mu_);
+  return order_.size();
 }
 
+std::vector<std::string> Tombstones::since(size_t from) const {
+  std::shared_lock<std::shared_mutex> lk(mu_);
+  std::vector<std::string> out;
+  for (size_t i = from; i < order_.size(); ++i) out.push_back(*order_[i]);
+  return out;
+}
@@ -1,17 +1,41 @@
 // src/tombstone.h
 #pragma once
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_set>
-#include <filesystem>
+#include <vector>
 
+// Tombstones одной org: живёт в сервисе, загружается один раз (replay бинарного
+// лога) и дальше только дополняется append'ом — запросы не перечитывают файл.
+// Лог — формат l5/tombstone_log.h (его же читает l5_compact --tombstones);
+// оборванная последняя запись (падение посреди append) отрезается при загрузке.
+// Старый tombstones.jsonl (doc_id по строке) импортируется при первой загрузке,
+// если лога ещё нет.
+// Потокобезопасен: contains — под shared lock, append — под exclusive.
 class Tombstones {
 public:
-  explicit Tombstones(std::filesystem::path file);
+  Tombstones(std::filesystem::path log_file, std::filesystem::path legacy_jsonl);
+
   void load();
-  void append(const std::string& key); // doc_id
-  bool contains(const std::string& key) const;
+  // load() ровно один раз на объект; ошибка (исключение) => следующий вызов повторит
+  void ensure_loaded();
+  bool append(const std::string& doc_id); // false => уже был
+  bool contains(const std::string& doc_id) const;
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  // doc_id в порядке удаления, начиная с from (append'ы после size() == from)
+  std::vector<std::string> since(size_t from) const;
 
 private:
-  std::filesystem::path file_;
+  std::filesystem::path log_;
+  std::filesystem::path legacy_;
+
+  std::once_flag loaded_;
+  mutable std::shared_mutex mu_;
   std::unordered_set<std::string> set_;
+  std::vector<const std::string*> order_; // узлы set_ стабильны
 };
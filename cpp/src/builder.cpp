@@ -1,8 +1,11 @@
 #include "l5/builder.h"
 #include "l5/format.h"
 #include "l5/manifest.h"
-#include "l5/docinfo.h"
+#include "l5/doc_freq.h"
+#include "l5/docinfo_store.h"
 #include "l5/errors.h"
+#include "l5/mapped_segment.h"
+#include "l5/segment_writer.h"
 
 #include <algorithm>
 #include <array>
@@ -197,11 +200,8 @@ static void json_write_string(std::ostream& os, std::string_view s) {
 // --------------------
 // Posting record for intermediate + sort
 // --------------------
-struct P9 {
-    uint64_t h;
-    uint32_t did;
-    uint32_t pos;
-};
+// same layout as on-disk V2 record; SegmentWriter takes it directly
+using P9 = Posting9;
 static_assert(sizeof(P9) == 16, "P9 must be 16 bytes");
 
 // comparator by (h,did,pos)
@@ -291,7 +291,9 @@ struct HeapCmp {
     }
 };
 
-static void merge_runs_to_stream(const std::vector<fs::path>& runs, std::ofstream& out) {
+// sink(const std::vector<P9>&) receives merged records in (h,did,pos) order
+template <class Sink>
+static void merge_runs(const std::vector<fs::path>& runs, Sink&& sink) {
     std::vector<std::unique_ptr<RunReader>> rr;
     rr.reserve(runs.size());
 
@@ -311,7 +313,7 @@ static void merge_runs_to_stream(const std::vector<fs::path>& runs, std::ofstrea
 
         outbuf.push_back(it.p);
         if (outbuf.size() >= (1u << 16)) {
-            write_p9_vec(out, outbuf);
+            sink(outbuf);
             outbuf.clear();
         }
 
@@ -320,13 +322,13 @@ static void merge_runs_to_stream(const std::vector<fs::path>& runs, std::ofstrea
         if (r->has) pq.push(HeapItem{r->cur, it.ridx});
     }
 
-    if (!outbuf.empty()) write_p9_vec(out, outbuf);
+    if (!outbuf.empty()) sink(outbuf);
 }
 
 static void merge_runs_to_file(const std::vector<fs::path>& runs, const fs::path& out_path) {
     std::ofstream out(out_path, std::ios::binary);
     if (!out) throw L5Exception("cannot open merge out: " + out_path.string());
-    merge_runs_to_stream(runs, out);
+    merge_runs(runs, [&](const std::vector<P9>& v) { write_p9_vec(out, v); });
     out.flush();
     if (!out) throw L5Exception("merge write failed: " + out_path.string());
 }
@@ -346,16 +348,6 @@ struct DocResult {
     std::string preview_text;
 };
 
-struct SegCleanupOnFail {
-    fs::path p;
-    bool keep{false};
-    ~SegCleanupOnFail() {
-        if (keep) return;
-        std::error_code ec;
-        fs::remove_all(p, ec);
-    }
-};
-
 // --------------------
 // did window gate: bounded writer reorder buffer
 // --------------------
@@ -462,9 +454,9 @@ static void partition_postings_to_buckets(const std::vector<fs::path>& inputs,
     }
 }
 
-// sort one bucket -> append to index stream (bounded RAM)
+// sort one bucket -> append to index writer (bounded RAM)
 static void sort_bucket_append_to_index(const fs::path& bucket_path,
-                                        std::ofstream& index_out,
+                                        SegmentWriter& index_out,
                                         const fs::path& tmp_dir,
                                         uint64_t ram_limit_bytes,
                                         unsigned bucket_id) {
@@ -492,7 +484,7 @@ static void sort_bucket_append_to_index(const fs::path& bucket_path,
         }
 
         radix_sort_p9(a, tmp);
-        write_p9_vec(index_out, a);
+        index_out.add_postings(a.data(), a.size());
 
         std::error_code ec2;
         fs::remove(bucket_path, ec2);
@@ -573,8 +565,8 @@ static void sort_bucket_append_to_index(const fs::path& bucket_path,
         ++stage;
     }
 
-    // final merge directly into index stream
-    merge_runs_to_stream(runs, index_out);
+    // final merge directly into index writer
+    merge_runs(runs, [&](const std::vector<P9>& v) { index_out.add_postings(v.data(), v.size()); });
 
     // cleanup remaining runs
     for (const auto& p : runs) {
@@ -624,18 +616,25 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
 
     // temp paths
     const fs::path bin_fin  = seg_dir / "index_native.bin";
+    const fs::path di_fin   = seg_dir / "index_native.docinfo";
+    const fs::path dx_fin   = seg_dir / "index_native.docidx";
     const fs::path doc_fin  = seg_dir / "index_native_docids.json";
     const fs::path meta_fin = seg_dir / "index_native_meta.json";
 
     const fs::path bin_tmp  = seg_dir / "index_native.bin.tmp";
+    const fs::path di_tmp   = seg_dir / "index_native.docinfo.tmp";
+    const fs::path dx_tmp   = seg_dir / "index_native.docidx.tmp";
     const fs::path doc_tmp  = seg_dir / "index_native_docids.json.tmp";
     const fs::path meta_tmp = seg_dir / "index_native_meta.json.tmp";
 
-    const fs::path docmeta_tmp = seg_dir / "index_native_docmeta.bin.tmp";
-
     const fs::path tmp_dir = seg_dir / "_tmp_build";
     fs::create_directories(tmp_dir, ec);
 
+    // index_native.bin.tmp: docmeta from writer thread, postings after sort
+    SegmentWriter index_writer(bin_tmp, tmp_dir / "sections", opt.format_version, opt.posting_codec,
+                               HashScheme{opt.token_hash, opt.shingle_hash});
+    index_writer.count_doc_freq(opt.df_max_entries);
+
     // postings worker files
     std::vector<fs::path> postings_files;
     postings_files.reserve(num_threads);
@@ -673,20 +672,22 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
     std::vector<std::atomic<uint64_t>> postings_written(num_threads);
     for (auto& x : postings_written) x.store(0);
 
-    // writer thread: docmeta + docids.json streaming in did order (bounded ring, no unordered_map)
+    // writer thread: docmeta + docinfo (+ docids.json) streaming in did order (bounded ring, no unordered_map)
+    // (the only index_writer / docinfo_writer user until the pipeline is joined)
     std::atomic<uint32_t> docs_written{0};
+    DocInfoWriter docinfo_writer(di_tmp, dx_tmp);
 
     std::thread writer([&](){
         try {
-            std::ofstream dm(docmeta_tmp, std::ios::binary);
-            if (!dm) throw L5Exception("cannot open docmeta tmp: " + docmeta_tmp.string());
-
-            std::ofstream dj(doc_tmp, std::ios::binary);
-            if (!dj) throw L5Exception("cannot open docids tmp: " + doc_tmp.string());
+            std::ofstream dj;
+            if (opt.docids_json) {
+                dj.open(doc_tmp, std::ios::binary);
+                if (!dj) throw L5Exception("cannot open docids tmp: " + doc_tmp.string());
+            }
 
             const std::string meta_path_prefix = segment_name + "/";
 
-            dj.put('[');
+            if (opt.docids_json) dj.put('[');
             bool first = true;
 
             // ring buffer sized by window; slots keep capacity (avoid allocs)
@@ -725,39 +726,42 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
 
                     DocResult& cur = ring[s];
 
-                    // docmeta: write by fields (padding-safe)
-                    dm.write(reinterpret_cast<const char*>(&cur.meta.tok_len), sizeof(cur.meta.tok_len));
-                    dm.write(reinterpret_cast<const char*>(&cur.meta.simhash_hi), sizeof(cur.meta.simhash_hi));
-                    dm.write(reinterpret_cast<const char*>(&cur.meta.simhash_lo), sizeof(cur.meta.simhash_lo));
+                    index_writer.add_docmeta(cur.meta);
+
+                    const std::string_view external_id = cur.external_id.empty() ? cur.doc_id : cur.external_id;
+                    docinfo_writer.add(cur.doc_id, cur.organization_id, external_id, cur.source_path,
+                                       cur.source_name, meta_path_prefix, cur.preview_text);
 
                     // docids JSON object (stream)
-                    if (!first) dj.put(',');
-                    first = false;
+                    if (opt.docids_json) {
+                        if (!first) dj.put(',');
+                        first = false;
 
-                    dj.put('{');
+                        dj.put('{');
 
-                    dj << "\"doc_id\":";
-                    json_write_string(dj, cur.doc_id);
+                        dj << "\"doc_id\":";
+                        json_write_string(dj, cur.doc_id);
 
-                    dj << ",\"organization_id\":";
-                    json_write_string(dj, cur.organization_id);
+                        dj << ",\"organization_id\":";
+                        json_write_string(dj, cur.organization_id);
 
-                    dj << ",\"external_id\":";
-                    json_write_string(dj, cur.external_id.empty() ? cur.doc_id : cur.external_id);
+                        dj << ",\"external_id\":";
+                        json_write_string(dj, cur.external_id.empty() ? cur.doc_id : cur.external_id);
 
-                    dj << ",\"source_path\":";
-                    json_write_string(dj, cur.source_path);
+                        dj << ",\"source_path\":";
+                        json_write_string(dj, cur.source_path);
 
-                    dj << ",\"source_name\":";
-                    json_write_string(dj, cur.source_name);
+                        dj << ",\"source_name\":";
+                        json_write_string(dj, cur.source_name);
 
-                    dj << ",\"meta_path\":";
-                    json_write_string(dj, meta_path_prefix);
+                        dj << ",\"meta_path\":";
+                        json_write_string(dj, meta_path_prefix);
 
-                    dj << ",\"preview_text\":";
-                    json_write_string(dj, cur.preview_text);
+                        dj << ",\"preview_text\":";
+                        json_write_string(dj, cur.preview_text);
 
-                    dj.put('}');
+                        dj.put('}');
+                    }
 
                     // clear strings but keep capacity for reuse
                     cur.doc_id.clear();
@@ -776,12 +780,11 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
             }
 
             // close JSON array
-            dj.put(']');
-            dj.flush();
-            dm.flush();
-
-            if (!dj) throw L5Exception("docids write failed");
-            if (!dm) throw L5Exception("docmeta write failed");
+            if (opt.docids_json) {
+                dj.put(']');
+                dj.flush();
+                if (!dj) throw L5Exception("docids write failed");
+            }
 
             docs_written.store(expect, std::memory_order_relaxed);
 
@@ -802,12 +805,20 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
             try {
                 simdjson::dom::parser parser;
 
-                std::vector<TokenSpan> spans;
-                spans.reserve(512);
-
                 std::vector<uint64_t> token_hashes;
                 token_hashes.reserve(512);
 
+                std::vector<uint64_t> shingle_hashes;
+                shingle_hashes.reserve(512);
+
+                ShingleHashParams hash_params;
+                hash_params.k = K_SHINGLE;
+                hash_params.max_tokens = opt.max_tokens_per_doc;
+                hash_params.step = opt.shingle_stride > 0 ? opt.shingle_stride : 1;
+                hash_params.max_shingles = opt.max_shingles_per_doc;
+                hash_params.token = (TokenHash)index_writer.hash_scheme().token_hash;
+                hash_params.shingle = (ShingleHash)index_writer.hash_scheme().shingle_hash;
+
                 std::string norm;
                 norm.reserve(8 * 1024);
 
@@ -848,18 +859,9 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
                         normalize_for_shingles_simple_to(text_sv, norm);
                     }
 
-                    spans.clear();
-                    tokenize_spans(norm, spans);
-                    if (spans.empty()) continue;
-
-                    if (opt.max_tokens_per_doc > 0 && spans.size() > (size_t)opt.max_tokens_per_doc) {
-                        spans.resize((size_t)opt.max_tokens_per_doc);
-                    }
-                    if (spans.size() < (size_t)K_SHINGLE) continue;
-
-                    const int n = (int)spans.size();
-                    const int cnt = n - K_SHINGLE + 1;
-                    if (cnt <= 0) continue;
+                    // токены + шинглы одним проходом
+                    hash_text_shingles(norm, hash_params, token_hashes, shingle_hashes);
+                    if (shingle_hashes.empty()) continue; // < K_SHINGLE токенов
 
                     uint32_t did = 0;
                     if (!acquire_did_window(next_did, opt.max_docs_in_segment, did_gate, window, stop, did)) {
@@ -868,13 +870,11 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
                         continue;
                     }
 
-                    // hashes + simhash
-                    hash_tokens_bytes_spans(norm, spans, token_hashes);
                     auto [hi, lo] = simhash128_token_hashes(token_hashes);
 
                     DocResult r;
                     r.did = did;
-                    r.meta.tok_len = (uint32_t)spans.size();
+                    r.meta.tok_len = (uint32_t)token_hashes.size();
                     r.meta.simhash_hi = hi;
                     r.meta.simhash_lo = lo;
 
@@ -896,19 +896,12 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
                     }
 
                     // postings (streaming, per-thread file)
-                    const int step = (opt.shingle_stride > 0 ? opt.shingle_stride : 1);
-                    uint32_t produced = 0;
-                    const uint32_t max_sh =
-                        (opt.max_shingles_per_doc > 0) ? opt.max_shingles_per_doc : (uint32_t)cnt;
+                    const uint32_t step = (uint32_t)hash_params.step;
+                    const uint64_t local_posts = shingle_hashes.size();
 
-                    uint64_t local_posts = 0;
-
-                    for (int pos = 0; pos < cnt && produced < max_sh; pos += step) {
-                        const uint64_t h = hash_shingle_token_hashes(token_hashes, pos, K_SHINGLE);
-                        P9 p{h, did, (uint32_t)pos};
+                    for (size_t j = 0; j < shingle_hashes.size(); ++j) {
+                        P9 p{shingle_hashes[j], did, (uint32_t)j * step};
                         post_out.write(reinterpret_cast<const char*>(&p), (std::streamsize)sizeof(P9));
-                        ++produced;
-                        ++local_posts;
                     }
 
                     postings_written[t].fetch_add(local_posts, std::memory_order_relaxed);
@@ -977,18 +970,12 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
     uint64_t N_post9 = 0;
     for (unsigned t = 0; t < num_threads; ++t) N_post9 += postings_written[t].load(std::memory_order_relaxed);
 
-    // docmeta sanity: expected size = N_docs * 20 bytes
-    {
-        std::error_code ec2;
-        const uint64_t dm_bytes = (uint64_t)fs::file_size(docmeta_tmp, ec2);
-        if (!ec2) {
-            const uint64_t expect = (uint64_t)N_docs * (uint64_t)(sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t));
-            if (dm_bytes != expect) {
-                throw L5Exception("docmeta size mismatch: got=" + std::to_string(dm_bytes) +
-                                  " expect=" + std::to_string(expect));
-            }
-        }
+    // docmeta sanity: one record per committed did
+    if (index_writer.n_docs() != N_docs) {
+        throw L5Exception("docmeta count mismatch: got=" + std::to_string(index_writer.n_docs()) +
+                          " expect=" + std::to_string(N_docs));
     }
+    docinfo_writer.finish();
 
     // -------------------------
     // Partition + sort postings (bounded RAM)
@@ -1000,32 +987,6 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
     // Write final index_native.bin.tmp
     // -------------------------
     {
-        std::ofstream bout(bin_tmp, std::ios::binary);
-        if (!bout) throw L5Exception("cannot open " + bin_tmp.string());
-
-        HeaderV2 h{};
-        h.magic[0] = 'P'; h.magic[1] = 'L'; h.magic[2] = 'A'; h.magic[3] = 'G';
-        h.version = 2;
-        h.n_docs = N_docs;
-        h.n_post9 = N_post9;
-        h.n_post13 = 0;
-
-        if (!write_header_v2(bout, h)) throw L5Exception("write header failed");
-
-        // append docmeta bytes as-is
-        {
-            std::ifstream dm(docmeta_tmp, std::ios::binary);
-            if (!dm) throw L5Exception("cannot open docmeta tmp for read: " + docmeta_tmp.string());
-
-            std::vector<char> buf(1u << 20);
-            while (dm) {
-                dm.read(buf.data(), (std::streamsize)buf.size());
-                const std::streamsize got = dm.gcount();
-                if (got > 0) bout.write(buf.data(), got);
-            }
-            if (!bout) throw L5Exception("failed writing docmeta to index");
-        }
-
         // sort each bucket in order and append
         const fs::path sort_tmp_dir = tmp_dir / "sort_runs";
         fs::create_directories(sort_tmp_dir, ec);
@@ -1034,11 +995,14 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
             char name[32];
             std::snprintf(name, sizeof(name), "b_%02X.bin", b);
             const fs::path bp = bucket_dir / name;
-            sort_bucket_append_to_index(bp, bout, sort_tmp_dir, opt.ram_limit_bytes, b);
+            sort_bucket_append_to_index(bp, index_writer, sort_tmp_dir, opt.ram_limit_bytes, b);
         }
 
-        bout.flush();
-        if (!bout) throw L5Exception("write failed " + bin_tmp.string());
+        if (index_writer.n_post9() != N_post9) {
+            throw L5Exception("postings count mismatch: got=" + std::to_string(index_writer.n_post9()) +
+                              " expect=" + std::to_string(N_post9));
+        }
+        index_writer.finish();
     }
 
     // -------------------------
@@ -1056,6 +1020,13 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
         m << ",\"stats\":{";
         m << "\"docs\":" << N_docs << ",\"k9\":" << N_post9 << ",\"k13\":0";
         m << "}";
+        m << ",\"format_version\":" << index_writer.version();
+        if (index_writer.version() >= FORMAT_V3) {
+            m << ",\"n_hashes\":" << index_writer.n_hashes();
+            m << ",\"posting_codec\":" << index_writer.posting_codec();
+            m << ",\"token_hash\":" << index_writer.hash_scheme().token_hash;
+            m << ",\"shingle_hash\":" << index_writer.hash_scheme().shingle_hash;
+        }
         m << ",\"strict_text_is_normalized\":" << (strict ? 1 : 0);
         m.put('}');
         m.flush();
@@ -1064,9 +1035,17 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
 
     // atomic replace
     if (!atomic_replace_file_best_effort(bin_tmp, bin_fin)) throw L5Exception("atomic replace failed (bin)");
-    if (!atomic_replace_file_best_effort(doc_tmp, doc_fin)) throw L5Exception("atomic replace failed (docids)");
+    if (!atomic_replace_file_best_effort(di_tmp, di_fin)) throw L5Exception("atomic replace failed (docinfo)");
+    if (!atomic_replace_file_best_effort(dx_tmp, dx_fin)) throw L5Exception("atomic replace failed (docidx)");
+    if (opt.docids_json && !atomic_replace_file_best_effort(doc_tmp, doc_fin)) {
+        throw L5Exception("atomic replace failed (docids)");
+    }
     if (!atomic_replace_file_best_effort(meta_tmp, meta_fin)) throw L5Exception("atomic replace failed (meta)");
 
+    write_segment_sidecars(seg_dir, index_writer,
+                           SidecarOptions{opt.bloom_bits_per_key, opt.df_max_entries, opt.stop_df_percentile,
+                                          opt.stop_min_df});
+
     SegmentEntry e;
     e.segment_name = segment_name;
     e.path = segment_name + "/";
@@ -1075,13 +1054,23 @@ BuildStats build_segment_jsonl(const fs::path& corpus_jsonl,
     e.stats.k9 = N_post9;
     e.stats.k13 = 0;
 
+    // boilerplate out_root пересчитывается с новым сегментом до его публикации в манифесте
+    if (opt.df_max_entries > 0) {
+        Manifest m = load_manifest(out_root);
+        m.segments.push_back(e);
+        std::string err;
+        if (!merge_org_stop_hashes(out_root, m, index_writer.hash_scheme(), opt.stop_df_percentile,
+                                   opt.stop_min_df, &err)) {
+            throw L5Exception("org stop hashes: " + err);
+        }
+    }
+
     if (!append_segment_to_manifest(out_root, e)) throw L5Exception("manifest append failed");
 
     // cleanup temp dir (best effort)
     {
         std::error_code ec3;
         fs::remove_all(tmp_dir, ec3);
-        fs::remove(docmeta_tmp, ec3);
     }
 
     st.segment_name = segment_name;
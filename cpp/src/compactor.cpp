@@ -0,0 +1,372 @@
+// Back_L5/cpp/src/compactor.cpp
+#include "l5/compactor.h"
+#include "l5/doc_freq.h"
+#include "l5/docinfo_store.h"
+#include "l5/errors.h"
+#include "l5/mapped_segment.h"
+#include "l5/segment_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace l5 {
+
+namespace {
+
+constexpr uint32_t kDropped = std::numeric_limits<uint32_t>::max();
+
+// диапазоны postings входа по возрастанию h
+struct HashCursor {
+    const MappedSegment* seg{nullptr};
+    size_t k{0}; // V3: следующий хэш словаря
+    size_t l{0}, r{0};
+    uint64_t h{0};
+
+    bool next() {
+        l = r;
+        if (seg->version() == FORMAT_V3) {
+            if (k >= seg->hashes().size()) return false;
+            h = seg->hashes().h(k);
+            r = seg->starts().select(++k);
+            return true;
+        }
+        const PostingsView& p = seg->postings();
+        if (l >= p.size()) return false;
+        h = p.h(l);
+        r = l + 1;
+        while (r < p.size() && p.h(r) == h) ++r;
+        return true;
+    }
+};
+
+bool read_strict_flag(const fs::path& seg_dir) {
+    try {
+        std::ifstream in(seg_dir / "index_native_meta.json");
+        if (!in) return false;
+        json j;
+        in >> j;
+        return j.is_object() && j.value("strict_text_is_normalized", 0) != 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+void write_docinfo_json(std::ostream& os, const DocInfo& d) {
+    json j;
+    j["doc_id"] = d.doc_id;
+    j["organization_id"] = d.organization_id;
+    j["external_id"] = d.external_id;
+    j["source_path"] = d.source_path;
+    j["source_name"] = d.source_name;
+    j["meta_path"] = d.meta_path;
+    j["preview_text"] = d.preview_text;
+    os << j.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+} // namespace
+
+CompactStats compact_segments(const fs::path& out_root,
+                              const std::vector<std::string>& segment_names,
+                              const CompactOptions& opt,
+                              const CompactDropFn& drop) {
+    CompactStats st;
+
+    const Manifest man = load_manifest(out_root);
+    for (const auto& name : segment_names) {
+        if (std::find(st.inputs.begin(), st.inputs.end(), name) != st.inputs.end()) continue;
+        const bool listed = std::any_of(man.segments.begin(), man.segments.end(),
+                                        [&](const SegmentEntry& e) { return e.segment_name == name; });
+        if (!listed) throw L5Exception("segment not in manifest: " + name);
+        st.inputs.push_back(name);
+    }
+    if (st.inputs.empty()) throw L5Exception("no segments to compact");
+
+    // входы: mmap + docinfo
+    const size_t k = st.inputs.size();
+    std::vector<MappedSegment> segs(k);
+    std::vector<DocInfoStore> docs(k);
+    MapOptions mo;
+    mo.advise = false;
+    bool strict = true;
+    for (size_t i = 0; i < k; ++i) {
+        const fs::path seg_dir = out_root / st.inputs[i];
+        std::string err;
+        if (!map_segment_bin(seg_dir, segs[i], &err, mo)) throw L5Exception("compact: " + err);
+        if (!open_docinfo(seg_dir, docs[i], &err)) throw L5Exception("compact: " + err);
+        if (!segs[i].load_deleted(&err)) throw L5Exception("compact: " + err);
+        if (docs[i].size() != segs[i].n_docs()) {
+            throw L5Exception("compact: docids size mismatch in " + st.inputs[i]);
+        }
+        if (!(segs[i].hash_scheme() == segs[0].hash_scheme())) {
+            throw L5Exception("compact: hash scheme differs: " + st.inputs[i] + " vs " + st.inputs[0]);
+        }
+        strict = strict && read_strict_flag(seg_dir);
+    }
+    const HashScheme scheme = segs[0].hash_scheme();
+    if (opt.format_version != FORMAT_V3 && !(scheme == HashScheme{TOKEN_HASH_FNV1A, SHINGLE_HASH_COMBINE})) {
+        throw L5Exception("compact: V2 output needs FNV1A + COMBINE inputs");
+    }
+
+    // did входов -> did результата: по порядку входов, удалённые пропускаются
+    std::vector<std::vector<uint32_t>> remap(k);
+    uint32_t next_did = 0;
+    for (size_t i = 0; i < k; ++i) {
+        remap[i].assign(docs[i].size(), kDropped);
+        for (size_t d = 0; d < docs[i].size(); ++d) {
+            if (segs[i].deleted().test((uint32_t)d) || (drop && drop(docs[i].get((uint32_t)d)))) continue;
+            remap[i][d] = next_did++;
+        }
+        st.docs_in += docs[i].size();
+        st.post9_in += segs[i].n_post9();
+    }
+    st.docs_out = next_did;
+
+    const auto manifest_without_inputs = [&](const SegmentEntry* add) {
+        Manifest m;
+        bool added = false;
+        for (const auto& e : man.segments) {
+            if (std::find(st.inputs.begin(), st.inputs.end(), e.segment_name) == st.inputs.end()) {
+                m.segments.push_back(e);
+            } else if (add && !added) {
+                m.segments.push_back(*add);
+                added = true;
+            }
+        }
+        return m;
+    };
+    const auto publish = [&](const SegmentEntry* add) {
+        // boilerplate out_root пересчитывается до публикации, как при build
+        if (opt.df_max_entries > 0) {
+            std::string err;
+            if (!merge_org_stop_hashes(out_root, manifest_without_inputs(add), scheme, opt.stop_df_percentile,
+                                       opt.stop_min_df, &err)) {
+                throw L5Exception("org stop hashes: " + err);
+            }
+        }
+        if (!replace_segments_in_manifest(out_root, st.inputs, add)) throw L5Exception("manifest replace failed");
+    };
+    const auto remove_inputs = [&]() {
+        if (!opt.remove_inputs) return;
+        for (auto& s : segs) s.close();
+        for (auto& d : docs) d.close();
+        for (const auto& name : st.inputs) {
+            std::error_code ec;
+            fs::remove_all(out_root / name, ec);
+        }
+    };
+
+    // удалены все документы: входы просто уходят из манифеста
+    if (st.docs_out == 0) {
+        publish(nullptr);
+        remove_inputs();
+        return st;
+    }
+
+    std::string segment_name = opt.segment_name;
+    if (segment_name.empty()) {
+        const std::string base = std::string("seg_") + utc_now_compact() + "_c";
+        segment_name = base;
+        for (unsigned n = 1; fs::exists(out_root / segment_name); ++n) segment_name = base + std::to_string(n);
+    }
+    const std::string built_at = utc_now_compact();
+
+    const fs::path seg_dir = out_root / segment_name;
+    if (fs::exists(seg_dir)) throw L5Exception("segment already exists: " + seg_dir.string());
+    std::error_code ec;
+    fs::create_directories(seg_dir, ec);
+    if (ec) throw L5Exception("cannot create segment dir: " + seg_dir.string() + " err=" + ec.message());
+    SegCleanupOnFail cleanup{seg_dir};
+
+    const fs::path bin_tmp = seg_dir / "index_native.bin.tmp";
+    const fs::path di_tmp = seg_dir / "index_native.docinfo.tmp";
+    const fs::path dx_tmp = seg_dir / "index_native.docidx.tmp";
+    const fs::path doc_tmp = seg_dir / "index_native_docids.json.tmp";
+    const fs::path meta_tmp = seg_dir / "index_native_meta.json.tmp";
+    const fs::path tmp_dir = seg_dir / "_tmp_compact";
+    fs::create_directories(tmp_dir, ec);
+
+    SegmentWriter writer(bin_tmp, tmp_dir, opt.format_version, opt.posting_codec, scheme);
+    writer.count_doc_freq(opt.df_max_entries);
+
+    // docmeta + docinfo (+ docids.json) в порядке новых did
+    {
+        DocInfoWriter dw(di_tmp, dx_tmp);
+        std::ofstream dj;
+        if (opt.docids_json) {
+            dj.open(doc_tmp, std::ios::binary);
+            if (!dj) throw L5Exception("cannot open docids tmp: " + doc_tmp.string());
+            dj.put('[');
+        }
+        const std::string meta_path = segment_name + "/";
+        bool first = true;
+        for (size_t i = 0; i < k; ++i) {
+            for (size_t d = 0; d < docs[i].size(); ++d) {
+                if (remap[i][d] == kDropped) continue;
+                writer.add_docmeta(segs[i].docmeta()[d]);
+                DocInfo di = docs[i].get((uint32_t)d);
+                di.meta_path = meta_path;
+                dw.add(di);
+                if (!opt.docids_json) continue;
+                if (!first) dj.put(',');
+                first = false;
+                write_docinfo_json(dj, di);
+            }
+        }
+        dw.finish();
+        if (opt.docids_json) {
+            dj.put(']');
+            dj.flush();
+            if (!dj) throw L5Exception("docids write failed");
+        }
+    }
+
+    // k-way merge по h; при равных h входы по порядку => новые did возрастают
+    {
+        using Head = std::pair<uint64_t, uint32_t>; // (h, вход)
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+        std::vector<HashCursor> cur(k);
+        for (size_t i = 0; i < k; ++i) {
+            cur[i].seg = &segs[i];
+            if (cur[i].next()) heap.push(Head{cur[i].h, (uint32_t)i});
+        }
+
+        std::vector<uint32_t> same, dids, pos;
+        std::vector<Posting9> out;
+        out.reserve(1u << 16);
+        while (!heap.empty()) {
+            const uint64_t h = heap.top().first;
+            same.clear();
+            while (!heap.empty() && heap.top().first == h) {
+                same.push_back(heap.top().second);
+                heap.pop();
+            }
+            std::sort(same.begin(), same.end());
+
+            for (const uint32_t i : same) {
+                HashCursor& c = cur[i];
+                const size_t n = c.r - c.l;
+                dids.resize(n);
+                pos.resize(n);
+                segs[i].decode_dids(c.l, c.r, dids.data());
+                segs[i].decode_pos(c.l, c.r, pos.data());
+                const auto& rm = remap[i];
+                for (size_t j = 0; j < n; ++j) {
+                    if (dids[j] >= rm.size()) throw L5Exception("compact: posting did out of range in " + st.inputs[i]);
+                    const uint32_t nd = rm[dids[j]];
+                    if (nd != kDropped) out.push_back(Posting9{h, nd, pos[j]});
+                }
+                if (c.next()) heap.push(Head{c.h, i});
+            }
+
+            if (out.size() >= (1u << 16)) {
+                writer.add_postings(out.data(), out.size());
+                out.clear();
+            }
+        }
+        if (!out.empty()) writer.add_postings(out.data(), out.size());
+    }
+    writer.finish();
+    st.post9_out = writer.n_post9();
+
+    // meta json (те же поля, что у build + список входов)
+    {
+        json m;
+        m["segment_name"] = segment_name;
+        m["built_at_utc"] = built_at;
+        m["stats"] = {{"docs", st.docs_out}, {"k9", st.post9_out}, {"k13", 0}};
+        m["format_version"] = writer.version();
+        if (writer.version() >= FORMAT_V3) {
+            m["n_hashes"] = writer.n_hashes();
+            m["posting_codec"] = writer.posting_codec();
+            m["token_hash"] = scheme.token_hash;
+            m["shingle_hash"] = scheme.shingle_hash;
+        }
+        m["strict_text_is_normalized"] = strict ? 1 : 0;
+        m["compacted_from"] = st.inputs;
+
+        std::ofstream mf(meta_tmp, std::ios::binary);
+        if (!mf) throw L5Exception("cannot open meta tmp: " + meta_tmp.string());
+        mf << m.dump();
+        mf.flush();
+        if (!mf) throw L5Exception("meta write failed");
+    }
+
+    if (!atomic_replace_file_best_effort(bin_tmp, seg_dir / "index_native.bin")) throw L5Exception("atomic replace failed (bin)");
+    if (!atomic_replace_file_best_effort(di_tmp, seg_dir / "index_native.docinfo")) throw L5Exception("atomic replace failed (docinfo)");
+    if (!atomic_replace_file_best_effort(dx_tmp, seg_dir / "index_native.docidx")) throw L5Exception("atomic replace failed (docidx)");
+    if (opt.docids_json && !atomic_replace_file_best_effort(doc_tmp, seg_dir / "index_native_docids.json")) {
+        throw L5Exception("atomic replace failed (docids)");
+    }
+    if (!atomic_replace_file_best_effort(meta_tmp, seg_dir / "index_native_meta.json")) throw L5Exception("atomic replace failed (meta)");
+
+    write_segment_sidecars(seg_dir, writer,
+                           SidecarOptions{opt.bloom_bits_per_key, opt.df_max_entries, opt.stop_df_percentile,
+                                          opt.stop_min_df});
+
+    {
+        std::error_code ec2;
+        fs::remove_all(tmp_dir, ec2);
+    }
+
+    SegmentEntry e;
+    e.segment_name = segment_name;
+    e.path = segment_name + "/";
+    e.built_at_utc = built_at;
+    e.stats.docs = st.docs_out;
+    e.stats.k9 = st.post9_out;
+    e.stats.k13 = 0;
+    publish(&e);
+    cleanup.keep = true;
+
+    // открытые читатели держат mmap: файлы входов живут до munmap
+    remove_inputs();
+
+    st.segment_name = segment_name;
+    st.seg_dir = seg_dir;
+    st.built_at_utc = built_at;
+    return st;
+}
+
+std::vector<std::string> pick_tiered_compaction(const Manifest& m, const TieredCompactionPolicy& p) {
+    std::vector<std::string> out;
+    if (p.min_segments < 2 || m.segments.empty()) return out;
+
+    const double ratio = std::max(1.01, p.tier_ratio);
+    const auto tier_of = [&](uint64_t post9) -> uint32_t {
+        if (post9 < p.base_post9 || p.base_post9 == 0) return 0;
+        return 1 + (uint32_t)std::floor(std::log((double)post9 / (double)p.base_post9) / std::log(ratio));
+    };
+
+    std::vector<std::string> names;
+    std::vector<uint32_t> tiers;
+    for (const auto& e : m.segments) {
+        if (std::find(names.begin(), names.end(), e.segment_name) != names.end()) continue;
+        names.push_back(e.segment_name);
+        tiers.push_back(tier_of(e.stats.k9));
+    }
+
+    std::vector<uint32_t> sorted = tiers;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    for (const uint32_t t : sorted) {
+        if ((size_t)std::count(tiers.begin(), tiers.end(), t) < p.min_segments) continue;
+        const size_t cap = p.max_segments >= 2 ? p.max_segments : std::numeric_limits<size_t>::max();
+        for (size_t i = 0; i < names.size() && out.size() < cap; ++i) {
+            if (tiers[i] == t) out.push_back(names[i]);
+        }
+        break;
+    }
+    return out;
+}
+
+} // namespace l5
@@ -0,0 +1,119 @@
+// Back_L5/cpp/src/deleted_docs.cpp
+#include "l5/deleted_docs.h"
+#include "l5/format.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+// заголовок: magic, version, reserved, n_docs, n_deleted; дальше ceil(n_docs / 64) слов
+static constexpr char kDelMagic[4] = {'L', '5', 'D', 'L'};
+static constexpr uint32_t kDelVersion = 1;
+static constexpr size_t kDelHeaderBytes = 24;
+
+static void set_err(std::string* err, const std::string& s) {
+    if (err) *err = s;
+}
+
+void DeletedDocs::reset(uint32_t n_docs) {
+    n_docs_ = n_docs;
+    n_words_ = ((size_t)n_docs + 63) / 64;
+    words_.reset(n_words_ ? new std::atomic<uint64_t>[n_words_] : nullptr);
+    for (size_t i = 0; i < n_words_; ++i) words_[i].store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+}
+
+bool DeletedDocs::set(uint32_t did) {
+    if (did >= n_docs_) return false;
+    const uint64_t bit = 1ull << (did & 63);
+    if (words_[did >> 6].fetch_or(bit, std::memory_order_relaxed) & bit) return false;
+    count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool DeletedDocs::read_file(const fs::path& p, uint32_t n_docs, std::string* err) {
+    reset(n_docs);
+    std::error_code ec;
+    if (!fs::exists(p, ec)) return true;
+
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+    unsigned char hb[kDelHeaderBytes];
+    in.read(reinterpret_cast<char*>(hb), sizeof(hb));
+    uint32_t version = 0;
+    uint64_t file_docs = 0;
+    std::memcpy(&version, hb + 4, 4);
+    std::memcpy(&file_docs, hb + 8, 8);
+    if (in.gcount() != (std::streamsize)sizeof(hb) || std::memcmp(hb, kDelMagic, 4) != 0 || version != kDelVersion) {
+        set_err(err, "bad deleted header: " + p.string());
+        return false;
+    }
+    // битмап от другой сборки сегмента пометил бы чужие did
+    if (file_docs != n_docs || fs::file_size(p, ec) != kDelHeaderBytes + n_words_ * sizeof(uint64_t)) {
+        set_err(err, "deleted does not match segment: " + p.string());
+        return false;
+    }
+
+    std::vector<uint64_t> w(n_words_);
+    in.read(reinterpret_cast<char*>(w.data()), (std::streamsize)(w.size() * sizeof(uint64_t)));
+    if (!in) {
+        set_err(err, "deleted read failed: " + p.string());
+        return false;
+    }
+    uint64_t n = 0;
+    for (size_t i = 0; i < n_words_; ++i) {
+        words_[i].store(w[i], std::memory_order_relaxed);
+        n += (uint64_t)__builtin_popcountll(w[i]);
+    }
+    count_.store(n, std::memory_order_relaxed);
+    return true;
+}
+
+bool DeletedDocs::write_file(const fs::path& p, std::string* err) const {
+    std::ofstream out(p, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+    unsigned char hb[kDelHeaderBytes] = {};
+    const uint64_t n_docs = n_docs_;
+    const uint64_t n_del = count();
+    std::memcpy(hb, kDelMagic, 4);
+    std::memcpy(hb + 4, &kDelVersion, 4);
+    std::memcpy(hb + 8, &n_docs, 8);
+    std::memcpy(hb + 16, &n_del, 8);
+    out.write(reinterpret_cast<const char*>(hb), sizeof(hb));
+
+    std::vector<uint64_t> w(n_words_);
+    for (size_t i = 0; i < n_words_; ++i) w[i] = words_[i].load(std::memory_order_relaxed);
+    out.write(reinterpret_cast<const char*>(w.data()), (std::streamsize)(w.size() * sizeof(uint64_t)));
+    out.flush();
+    if (!out) {
+        set_err(err, "write failed " + p.string());
+        return false;
+    }
+    return true;
+}
+
+bool mark_deleted(const fs::path& seg_dir, DeletedDocs& del, const std::vector<uint32_t>& dids, std::string* err) {
+    bool changed = false;
+    for (const uint32_t did : dids) changed = del.set(did) || changed;
+    if (!changed) return true;
+
+    const fs::path fin = seg_dir / "index_native.deleted";
+    const fs::path tmp = seg_dir / "index_native.deleted.tmp";
+    if (!del.write_file(tmp, err)) return false;
+    if (!atomic_replace_file_best_effort(tmp, fin)) {
+        set_err(err, "atomic replace failed: " + fin.string());
+        return false;
+    }
+    return true;
+}
+
+} // namespace l5
@@ -0,0 +1,216 @@
+// Back_L5/cpp/src/doc_freq.cpp
+#include "l5/doc_freq.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+// заголовок: magic, version, token_hash, shingle_hash, n_docs, n_hashes, stop_df, reserved, n_entries
+static constexpr char kDfMagic[4] = {'L', '5', 'D', 'F'};
+static constexpr uint32_t kDfVersion = 1;
+static constexpr size_t kDfHeaderBytes = 48;
+static constexpr size_t kDfEntryBytes = 8 + 4;
+
+static void set_err(std::string* err, const std::string& s) {
+    if (err) *err = s;
+}
+
+static bool by_df_desc(const DfEntry& a, const DfEntry& b) {
+    if (a.df != b.df) return a.df > b.df;
+    return a.h < b.h;
+}
+
+void DfCounter::flush() {
+    if (!has_ || max_ == 0 || df_ < floor_) return;
+    e_.push_back(DfEntry{h_, df_});
+    if (e_.size() < 2 * max_) return;
+
+    // порядок (df desc, h asc) полный => итог совпадает с сортировкой всех entries
+    std::nth_element(e_.begin(), e_.begin() + (long)(max_ - 1), e_.end(), by_df_desc);
+    floor_ = e_[max_ - 1].df;
+    e_.resize(max_);
+}
+
+std::vector<DfEntry> DfCounter::finish() {
+    flush();
+    has_ = false;
+    std::sort(e_.begin(), e_.end(), by_df_desc);
+    if (e_.size() > max_) e_.resize(max_);
+    return std::move(e_);
+}
+
+uint32_t stop_df_threshold(const std::vector<DfEntry>& sorted, uint64_t n_hashes,
+                           double percentile, uint32_t min_df) {
+    if (sorted.empty() || !(percentile < 100.0)) return 0;
+    const double frac = (100.0 - std::max(0.0, percentile)) / 100.0;
+    const uint64_t n_top = (uint64_t)((double)n_hashes * frac);
+    if (n_top == 0) return 0;
+    const uint32_t t = sorted[(size_t)std::min<uint64_t>(n_top, sorted.size()) - 1].df;
+    return std::max(t, min_df);
+}
+
+bool write_df_file(const fs::path& p, const DfTable& t, std::string* err) {
+    std::ofstream out(p, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+
+    unsigned char hb[kDfHeaderBytes] = {};
+    const uint64_t n = t.entries.size();
+    std::memcpy(hb, kDfMagic, 4);
+    std::memcpy(hb + 4, &kDfVersion, 4);
+    std::memcpy(hb + 8, &t.scheme.token_hash, 4);
+    std::memcpy(hb + 12, &t.scheme.shingle_hash, 4);
+    std::memcpy(hb + 16, &t.n_docs, 8);
+    std::memcpy(hb + 24, &t.n_hashes, 8);
+    std::memcpy(hb + 32, &t.stop_df, 4);
+    std::memcpy(hb + 40, &n, 8);
+    out.write(reinterpret_cast<const char*>(hb), sizeof(hb));
+
+    std::vector<unsigned char> buf;
+    buf.reserve(t.entries.size() * kDfEntryBytes);
+    for (const auto& e : t.entries) {
+        unsigned char eb[kDfEntryBytes];
+        std::memcpy(eb, &e.h, 8);
+        std::memcpy(eb + 8, &e.df, 4);
+        buf.insert(buf.end(), eb, eb + sizeof(eb));
+    }
+    out.write(reinterpret_cast<const char*>(buf.data()), (std::streamsize)buf.size());
+    out.flush();
+    if (!out) {
+        set_err(err, "write failed " + p.string());
+        return false;
+    }
+    return true;
+}
+
+bool read_df_file(const fs::path& p, DfTable& t, std::string* err, bool stop_only) {
+    t = DfTable{};
+
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+
+    unsigned char hb[kDfHeaderBytes];
+    in.read(reinterpret_cast<char*>(hb), sizeof(hb));
+    if (in.gcount() != (std::streamsize)sizeof(hb) || std::memcmp(hb, kDfMagic, 4) != 0) {
+        set_err(err, "bad df header: " + p.string());
+        return false;
+    }
+    uint32_t version = 0;
+    uint64_t n = 0;
+    std::memcpy(&version, hb + 4, 4);
+    if (version != kDfVersion) {
+        set_err(err, "unsupported df version " + std::to_string(version) + ": " + p.string());
+        return false;
+    }
+    std::memcpy(&t.scheme.token_hash, hb + 8, 4);
+    std::memcpy(&t.scheme.shingle_hash, hb + 12, 4);
+    std::memcpy(&t.n_docs, hb + 16, 8);
+    std::memcpy(&t.n_hashes, hb + 24, 8);
+    std::memcpy(&t.stop_df, hb + 32, 4);
+    std::memcpy(&n, hb + 40, 8);
+
+    std::error_code ec;
+    const uintmax_t fsize = fs::file_size(p, ec);
+    if (ec || n > (fsize - kDfHeaderBytes) / kDfEntryBytes || fsize != kDfHeaderBytes + n * kDfEntryBytes) {
+        set_err(err, "df size mismatch: " + p.string());
+        return false;
+    }
+
+    // stop_only: entries по убыванию df — читаем, пока df >= stop_df
+    std::vector<unsigned char> buf;
+    uint64_t left = stop_only && t.stop_df == 0 ? 0 : n;
+    while (left > 0) {
+        const size_t chunk = (size_t)std::min<uint64_t>(left, 4096);
+        buf.resize(chunk * kDfEntryBytes);
+        in.read(reinterpret_cast<char*>(buf.data()), (std::streamsize)buf.size());
+        if (!in) {
+            set_err(err, "df read failed: " + p.string());
+            return false;
+        }
+        for (size_t i = 0; i < chunk; ++i) {
+            DfEntry e;
+            std::memcpy(&e.h, &buf[i * kDfEntryBytes], 8);
+            std::memcpy(&e.df, &buf[i * kDfEntryBytes + 8], 4);
+            if (stop_only && e.df < t.stop_df) return true;
+            t.entries.push_back(e);
+        }
+        left -= chunk;
+    }
+    return true;
+}
+
+void StopHashes::assign(const DfTable& t) {
+    scheme_ = t.scheme;
+    const size_t n = t.n_stop();
+    h_.resize(n);
+    for (size_t i = 0; i < n; ++i) h_[i] = t.entries[i].h;
+    std::sort(h_.begin(), h_.end());
+}
+
+bool merge_org_stop_hashes(const fs::path& out_root,
+                           const Manifest& m,
+                           const HashScheme& scheme,
+                           double percentile,
+                           uint32_t min_df,
+                           std::string* err) {
+    DfTable org;
+    org.scheme = scheme;
+
+    std::vector<DfEntry> all;
+    std::vector<std::string> seen; // пересобранный сегмент с тем же именем — один раз
+    for (const auto& e : m.segments) {
+        if (std::find(seen.begin(), seen.end(), e.segment_name) != seen.end()) continue;
+        seen.push_back(e.segment_name);
+        const fs::path p = out_root / e.segment_name / "index_native.df";
+        std::error_code ec;
+        if (!fs::exists(p, ec)) continue; // сегмент без DF (старый / df_max_entries = 0)
+
+        DfTable t;
+        if (!read_df_file(p, t, err)) return false;
+        if (!(t.scheme == scheme)) continue;
+        org.n_docs += t.n_docs;
+        org.n_hashes += t.n_hashes;
+        all.insert(all.end(), t.entries.begin(), t.entries.end());
+    }
+
+    std::sort(all.begin(), all.end(), [](const DfEntry& a, const DfEntry& b) { return a.h < b.h; });
+    for (const auto& e : all) {
+        if (!org.entries.empty() && org.entries.back().h == e.h) org.entries.back().df += e.df;
+        else org.entries.push_back(e);
+    }
+    std::sort(org.entries.begin(), org.entries.end(), by_df_desc);
+
+    org.stop_df = stop_df_threshold(org.entries, org.n_hashes, percentile, min_df);
+    org.entries.resize(org.n_stop());
+
+    const fs::path fin = out_root / "level5_stop_hashes.df";
+    const fs::path tmp = out_root / "level5_stop_hashes.df.tmp";
+    if (!write_df_file(tmp, org, err)) return false;
+    if (!atomic_replace_file_best_effort(tmp, fin)) {
+        set_err(err, "atomic replace failed: " + fin.string());
+        return false;
+    }
+    return true;
+}
+
+bool load_org_stop_hashes(const fs::path& out_root, StopHashes& out, std::string* err) {
+    out = StopHashes{};
+    const fs::path p = out_root / "level5_stop_hashes.df";
+    std::error_code ec;
+    if (!fs::exists(p, ec)) return true;
+
+    DfTable t;
+    if (!read_df_file(p, t, err, true)) return false;
+    out.assign(t);
+    return true;
+}
+
+} // namespace l5
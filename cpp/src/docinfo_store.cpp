@@ -0,0 +1,442 @@
+// Back_L5/cpp/src/docinfo_store.cpp
+#include "l5/docinfo_store.h"
+#include "l5/errors.h"
+#include "l5/format.h"
+#include "l5/reader.h"
+#include "text_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+static constexpr char kDocInfoMagic[4] = {'L', '5', 'D', 'I'};
+static constexpr char kDocIdxMagic[4] = {'L', '5', 'D', 'X'};
+
+static uint64_t doc_id_hash(std::string_view doc_id) {
+    return hash_token_bytes(doc_id, TokenHash::Wyhash);
+}
+
+// корзин ~ документов, не больше 2^20
+static uint32_t docidx_bits(uint32_t n) {
+    uint32_t b = 0;
+    while (b < 20 && (1ull << b) < n) ++b;
+    return b;
+}
+
+static uint32_t docidx_bucket(uint64_t h, uint32_t bits) {
+    return bits ? (uint32_t)(h >> (64 - bits)) : 0;
+}
+
+template <class T>
+static T load_at(const unsigned char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+// [u32 len][bytes] из [p, end); false => запись выходит за heap
+static bool next_str(const unsigned char*& p, const unsigned char* end, std::string_view& s) {
+    if (end - p < 4) return false;
+    const uint32_t n = load_at<uint32_t>(p);
+    p += 4;
+    if ((uint64_t)(end - p) < n) return false;
+    s = std::string_view(reinterpret_cast<const char*>(p), n);
+    p += n;
+    return true;
+}
+
+// ---------------- writer ----------------
+
+DocInfoWriter::DocInfoWriter(const fs::path& path, const fs::path& docidx_path)
+    : path_(path), docidx_path_(docidx_path) {
+    out_.open(path_, std::ios::binary | std::ios::trunc);
+    if (!out_) throw L5Exception("cannot open docinfo tmp: " + path_.string());
+    const unsigned char zero[DOCINFO_HEADER_BYTES] = {};
+    out_.write(reinterpret_cast<const char*>(zero), sizeof(zero));
+}
+
+void DocInfoWriter::put_str(std::string_view s) {
+    if (s.size() > 0xFFFFFFFFull) throw L5Exception("docinfo string too long");
+    const uint32_t n = (uint32_t)s.size();
+    out_.write(reinterpret_cast<const char*>(&n), 4);
+    out_.write(s.data(), (std::streamsize)s.size());
+    heap_bytes_ += 4 + (uint64_t)n;
+}
+
+uint32_t DocInfoWriter::intern(std::string_view s) {
+    auto it = pool_ids_.find(std::string(s));
+    if (it != pool_ids_.end()) return it->second;
+    const uint32_t id = (uint32_t)pool_.size();
+    pool_.emplace_back(s);
+    pool_ids_.emplace(pool_.back(), id);
+    return id;
+}
+
+void DocInfoWriter::add(std::string_view doc_id, std::string_view organization_id, std::string_view external_id,
+                        std::string_view source_path, std::string_view source_name, std::string_view meta_path,
+                        std::string_view preview_text) {
+    const uint64_t off = heap_bytes_;
+    ids_.emplace_back(doc_id_hash(doc_id), n_docs());
+    put_str(doc_id);
+    put_str(external_id);
+    put_str(source_path);
+    put_str(source_name);
+    put_str(preview_text);
+
+    unsigned char rec[DOCINFO_REC_BYTES];
+    const uint32_t org = intern(organization_id);
+    const uint32_t meta = intern(meta_path);
+    std::memcpy(rec, &off, 8);
+    std::memcpy(rec + 8, &org, 4);
+    std::memcpy(rec + 12, &meta, 4);
+    docs_.insert(docs_.end(), rec, rec + sizeof(rec));
+}
+
+void DocInfoWriter::finish() {
+    // pool — в конец heap, затем выравнивание таблиц
+    std::vector<unsigned char> pool_recs;
+    pool_recs.reserve(pool_.size() * DOCINFO_REC_BYTES);
+    for (const auto& s : pool_) {
+        unsigned char rec[DOCINFO_REC_BYTES] = {};
+        const uint64_t off = heap_bytes_;
+        const uint32_t len = (uint32_t)s.size();
+        std::memcpy(rec, &off, 8);
+        std::memcpy(rec + 8, &len, 4);
+        pool_recs.insert(pool_recs.end(), rec, rec + sizeof(rec));
+        out_.write(s.data(), (std::streamsize)s.size());
+        heap_bytes_ += len;
+    }
+    const uint64_t pad = align_up(heap_bytes_, 8) - heap_bytes_;
+    const char zero[8] = {};
+    out_.write(zero, (std::streamsize)pad);
+
+    out_.write(reinterpret_cast<const char*>(docs_.data()), (std::streamsize)docs_.size());
+    out_.write(reinterpret_cast<const char*>(pool_recs.data()), (std::streamsize)pool_recs.size());
+
+    unsigned char hb[DOCINFO_HEADER_BYTES] = {};
+    const uint32_t n_docs = this->n_docs();
+    const uint32_t n_pool = (uint32_t)pool_.size();
+    std::memcpy(hb, kDocInfoMagic, 4);
+    std::memcpy(hb + 4, &DOCINFO_VERSION, 4);
+    std::memcpy(hb + 8, &n_docs, 4);
+    std::memcpy(hb + 12, &n_pool, 4);
+    std::memcpy(hb + 16, &heap_bytes_, 8);
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(hb), sizeof(hb));
+    out_.flush();
+    if (!out_) throw L5Exception("docinfo write failed: " + path_.string());
+    out_.close();
+
+    write_docidx();
+}
+
+void DocInfoWriter::write_docidx() {
+    auto& ids = ids_;
+    std::sort(ids.begin(), ids.end());
+
+    const uint32_t n = (uint32_t)ids.size();
+    const uint32_t bits = docidx_bits(n);
+    std::vector<uint32_t> dir(((size_t)1 << bits) + 1, 0);
+    for (const auto& e : ids) ++dir[docidx_bucket(e.first, bits) + 1];
+    for (size_t b = 1; b < dir.size(); ++b) dir[b] += dir[b - 1];
+
+    std::ofstream out(docidx_path_, std::ios::binary | std::ios::trunc);
+    if (!out) throw L5Exception("cannot open docidx tmp: " + docidx_path_.string());
+
+    unsigned char hb[DOCIDX_HEADER_BYTES] = {};
+    std::memcpy(hb, kDocIdxMagic, 4);
+    std::memcpy(hb + 4, &DOCIDX_VERSION, 4);
+    std::memcpy(hb + 8, &n, 4);
+    std::memcpy(hb + 12, &bits, 4);
+    out.write(reinterpret_cast<const char*>(hb), sizeof(hb));
+    out.write(reinterpret_cast<const char*>(dir.data()), (std::streamsize)(dir.size() * 4));
+    const uint64_t at = DOCIDX_HEADER_BYTES + dir.size() * 4;
+    const char zero[8] = {};
+    out.write(zero, (std::streamsize)(align_up(at, 8) - at));
+
+    std::vector<uint64_t> hs(n);
+    std::vector<uint32_t> dids(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        hs[i] = ids[i].first;
+        dids[i] = ids[i].second;
+    }
+    out.write(reinterpret_cast<const char*>(hs.data()), (std::streamsize)(hs.size() * 8));
+    out.write(reinterpret_cast<const char*>(dids.data()), (std::streamsize)(dids.size() * 4));
+    out.flush();
+    if (!out) throw L5Exception("docidx write failed: " + docidx_path_.string());
+}
+
+// ---------------- store ----------------
+
+DocInfoStore::~DocInfoStore() { close(); }
+
+DocInfoStore::DocInfoStore(DocInfoStore&& o) noexcept { *this = std::move(o); }
+
+DocInfoStore& DocInfoStore::operator=(DocInfoStore&& o) noexcept {
+    if (this == &o) return *this;
+    close();
+    map_ = std::exchange(o.map_, nullptr);
+    map_len_ = std::exchange(o.map_len_, 0);
+    heap_ = std::exchange(o.heap_, nullptr);
+    heap_bytes_ = std::exchange(o.heap_bytes_, 0);
+    docs_ = std::exchange(o.docs_, nullptr);
+    pool_ = std::exchange(o.pool_, nullptr);
+    n_docs_ = std::exchange(o.n_docs_, 0);
+    n_pool_ = std::exchange(o.n_pool_, 0);
+    idx_map_ = std::exchange(o.idx_map_, nullptr);
+    idx_len_ = std::exchange(o.idx_len_, 0);
+    idx_dir_ = std::exchange(o.idx_dir_, nullptr);
+    idx_h_ = std::exchange(o.idx_h_, nullptr);
+    idx_did_ = std::exchange(o.idx_did_, nullptr);
+    idx_n_ = std::exchange(o.idx_n_, 0);
+    idx_bits_ = std::exchange(o.idx_bits_, 0);
+    json_ = std::move(o.json_);
+    return *this;
+}
+
+void DocInfoStore::close() {
+    if (map_) ::munmap(map_, map_len_);
+    map_ = nullptr;
+    map_len_ = 0;
+    heap_ = docs_ = pool_ = nullptr;
+    heap_bytes_ = 0;
+    n_docs_ = n_pool_ = 0;
+    if (idx_map_) ::munmap(idx_map_, idx_len_);
+    idx_map_ = nullptr;
+    idx_len_ = 0;
+    idx_dir_ = idx_h_ = idx_did_ = nullptr;
+    idx_n_ = idx_bits_ = 0;
+    json_.clear();
+}
+
+std::string_view DocInfoStore::pool_str(uint32_t idx) const {
+    if (idx >= n_pool_) return {};
+    const unsigned char* r = pool_ + (size_t)idx * DOCINFO_REC_BYTES;
+    const uint64_t off = load_at<uint64_t>(r);
+    const uint32_t len = load_at<uint32_t>(r + 8);
+    if (off > heap_bytes_ || heap_bytes_ - off < len) return {};
+    return std::string_view(reinterpret_cast<const char*>(heap_ + off), len);
+}
+
+std::string_view DocInfoStore::doc_id(uint32_t did) const {
+    if (!map_) return did < json_.size() ? std::string_view(json_[did].doc_id) : std::string_view();
+    if (did >= n_docs_) return {};
+    const uint64_t off = load_at<uint64_t>(docs_ + (size_t)did * DOCINFO_REC_BYTES);
+    if (off > heap_bytes_) return {};
+    const unsigned char* p = heap_ + off;
+    std::string_view s;
+    return next_str(p, heap_ + heap_bytes_, s) ? s : std::string_view();
+}
+
+void DocInfoStore::find(std::string_view doc_id, std::vector<uint32_t>& dids) const {
+    dids.clear();
+    if (!idx_map_) {
+        for (uint32_t d = 0; d < (uint32_t)size(); ++d) {
+            if (this->doc_id(d) == doc_id) dids.push_back(d);
+        }
+        return;
+    }
+
+    const uint64_t h = doc_id_hash(doc_id);
+    const uint32_t b = docidx_bucket(h, idx_bits_);
+    const uint32_t l = load_at<uint32_t>(idx_dir_ + (size_t)b * 4);
+    const uint32_t r = load_at<uint32_t>(idx_dir_ + (size_t)(b + 1) * 4);
+    for (uint32_t i = l; i < r && i < idx_n_; ++i) {
+        if (load_at<uint64_t>(idx_h_ + (size_t)i * 8) != h) continue;
+        const uint32_t did = load_at<uint32_t>(idx_did_ + (size_t)i * 4);
+        if (this->doc_id(did) == doc_id) dids.push_back(did); // коллизия хэша => чужой doc_id
+    }
+}
+
+DocInfo DocInfoStore::get(uint32_t did) const {
+    if (!map_) return did < json_.size() ? json_[did] : DocInfo{};
+
+    DocInfo di;
+    if (did >= n_docs_) return di;
+    const unsigned char* r = docs_ + (size_t)did * DOCINFO_REC_BYTES;
+    const uint64_t off = load_at<uint64_t>(r);
+    if (off > heap_bytes_) return di;
+
+    const unsigned char* p = heap_ + off;
+    const unsigned char* end = heap_ + heap_bytes_;
+    std::string_view f[5];
+    for (auto& s : f) {
+        if (!next_str(p, end, s)) break;
+    }
+    di.doc_id.assign(f[0]);
+    di.external_id.assign(f[1].empty() ? f[0] : f[1]);
+    di.source_path.assign(f[2]);
+    di.source_name.assign(f[3]);
+    di.preview_text.assign(f[4]);
+    di.organization_id.assign(pool_str(load_at<uint32_t>(r + 8)));
+    di.meta_path.assign(pool_str(load_at<uint32_t>(r + 12)));
+    return di;
+}
+
+uint64_t DocInfoStore::bytes() const {
+    if (map_) return map_len_ + idx_len_;
+    uint64_t b = (uint64_t)json_.capacity() * sizeof(DocInfo);
+    for (const auto& d : json_) {
+        b += d.doc_id.capacity() + d.organization_id.capacity() + d.external_id.capacity() +
+             d.source_path.capacity() + d.source_name.capacity() + d.meta_path.capacity() +
+             d.preview_text.capacity();
+    }
+    return b;
+}
+
+bool DocInfoStore::check(std::string* err) const {
+    if (!map_) return true;
+    const unsigned char* end = heap_ + heap_bytes_;
+    for (uint32_t i = 0; i < n_pool_; ++i) {
+        const unsigned char* r = pool_ + (size_t)i * DOCINFO_REC_BYTES;
+        const uint64_t off = load_at<uint64_t>(r);
+        if (off > heap_bytes_ || heap_bytes_ - off < load_at<uint32_t>(r + 8)) {
+            if (err) *err = "docinfo pool entry out of heap: " + std::to_string(i);
+            return false;
+        }
+    }
+    for (uint32_t did = 0; did < n_docs_; ++did) {
+        const unsigned char* r = docs_ + (size_t)did * DOCINFO_REC_BYTES;
+        const uint64_t off = load_at<uint64_t>(r);
+        bool ok = off <= heap_bytes_ && load_at<uint32_t>(r + 8) < n_pool_ && load_at<uint32_t>(r + 12) < n_pool_;
+        const unsigned char* p = heap_ + (ok ? off : 0);
+        std::string_view s;
+        for (int f = 0; ok && f < 5; ++f) ok = next_str(p, end, s);
+        if (!ok) {
+            if (err) *err = "docinfo record out of heap: did=" + std::to_string(did);
+            return false;
+        }
+    }
+
+    if (!idx_map_) return true;
+    if (idx_n_ != n_docs_) {
+        if (err) *err = "docidx size mismatch: n=" + std::to_string(idx_n_) + " docinfo=" + std::to_string(n_docs_);
+        return false;
+    }
+    const uint32_t n_buckets = 1u << idx_bits_;
+    uint32_t prev = 0;
+    for (uint32_t b = 0; b <= n_buckets; ++b) {
+        const uint32_t x = load_at<uint32_t>(idx_dir_ + (size_t)b * 4);
+        if (x < prev || x > idx_n_ || (b == n_buckets && x != idx_n_)) {
+            if (err) *err = "docidx directory broken at bucket " + std::to_string(b);
+            return false;
+        }
+        prev = x;
+    }
+    std::vector<uint8_t> seen(n_docs_, 0);
+    for (uint32_t b = 0; b < n_buckets; ++b) {
+        const uint32_t l = load_at<uint32_t>(idx_dir_ + (size_t)b * 4);
+        const uint32_t r = load_at<uint32_t>(idx_dir_ + (size_t)(b + 1) * 4);
+        for (uint32_t i = l; i < r; ++i) {
+            const uint64_t h = load_at<uint64_t>(idx_h_ + (size_t)i * 8);
+            const uint32_t did = load_at<uint32_t>(idx_did_ + (size_t)i * 4);
+            if (did >= n_docs_ || seen[did] || docidx_bucket(h, idx_bits_) != b || h != doc_id_hash(doc_id(did))) {
+                if (err) *err = "docidx entry does not match docinfo: " + std::to_string(i);
+                return false;
+            }
+            seen[did] = 1;
+        }
+    }
+    return true;
+}
+
+// read-only mmap всего файла; false => err
+static bool map_file(const fs::path& p, size_t min_len, void** map, size_t* len, std::string* err) {
+    const int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (err) *err = "cannot open " + p.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        if (err) *err = "cannot stat " + p.string() + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    const size_t file_len = (size_t)st.st_size;
+    if (file_len < min_len) {
+        if (err) *err = "truncated " + p.string();
+        ::close(fd);
+        return false;
+    }
+
+    void* m = ::mmap(nullptr, file_len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        if (err) *err = "mmap failed " + p.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    // читаются точечно: записи итоговых hit'ов / корзины doc_id
+    ::madvise(m, file_len, MADV_RANDOM);
+    *map = m;
+    *len = file_len;
+    return true;
+}
+
+bool open_docinfo(const fs::path& seg_dir, DocInfoStore& out, std::string* err) {
+    out.close();
+
+    const auto p = seg_dir / "index_native.docinfo";
+    std::error_code ec;
+    if (!fs::exists(p, ec)) return load_docids_json(seg_dir, out.json_, err);
+
+    if (!map_file(p, DOCINFO_HEADER_BYTES, &out.map_, &out.map_len_, err)) return false;
+    const size_t file_len = out.map_len_;
+
+    const auto* base = static_cast<const unsigned char*>(out.map_);
+    const uint32_t version = load_at<uint32_t>(base + 4);
+    out.n_docs_ = load_at<uint32_t>(base + 8);
+    out.n_pool_ = load_at<uint32_t>(base + 12);
+    out.heap_bytes_ = load_at<uint64_t>(base + 16);
+    if (std::memcmp(base, kDocInfoMagic, 4) != 0 || version != DOCINFO_VERSION) {
+        if (err) *err = "bad docinfo header: " + p.string();
+        out.close();
+        return false;
+    }
+    const uint64_t docs_off = DOCINFO_HEADER_BYTES + align_up(out.heap_bytes_, 8);
+    const uint64_t need = docs_off + ((uint64_t)out.n_docs_ + out.n_pool_) * DOCINFO_REC_BYTES;
+    if (out.heap_bytes_ > file_len || need != file_len) {
+        if (err) *err = "docinfo size mismatch: " + p.string() + " size=" + std::to_string(file_len);
+        out.close();
+        return false;
+    }
+    out.heap_ = base + DOCINFO_HEADER_BYTES;
+    out.docs_ = base + docs_off;
+    out.pool_ = out.docs_ + (size_t)out.n_docs_ * DOCINFO_REC_BYTES;
+
+    // docidx необязателен: без него find() перебирает сегмент
+    const auto xp = seg_dir / "index_native.docidx";
+    if (!fs::exists(xp, ec)) return true;
+    if (!map_file(xp, DOCIDX_HEADER_BYTES, &out.idx_map_, &out.idx_len_, err)) {
+        out.close();
+        return false;
+    }
+    const auto* xb = static_cast<const unsigned char*>(out.idx_map_);
+    const uint32_t xver = load_at<uint32_t>(xb + 4);
+    out.idx_n_ = load_at<uint32_t>(xb + 8);
+    out.idx_bits_ = load_at<uint32_t>(xb + 12);
+    const uint64_t dir_bytes = (out.idx_bits_ <= 20) ? (((uint64_t)1 << out.idx_bits_) + 1) * 4 : 0;
+    const uint64_t h_off = align_up(DOCIDX_HEADER_BYTES + dir_bytes, 8);
+    if (std::memcmp(xb, kDocIdxMagic, 4) != 0 || xver != DOCIDX_VERSION || dir_bytes == 0 ||
+        out.idx_n_ != out.n_docs_ || h_off + (uint64_t)out.idx_n_ * 12 != out.idx_len_) {
+        if (err) *err = "bad docidx: " + xp.string();
+        out.close();
+        return false;
+    }
+    out.idx_dir_ = xb + DOCIDX_HEADER_BYTES;
+    out.idx_h_ = xb + h_off;
+    out.idx_did_ = out.idx_h_ + (size_t)out.idx_n_ * 8;
+    return true;
+}
+
+} // namespace l5
@@ -6,6 +6,7 @@
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 namespace l5 {
 
@@ -24,6 +25,84 @@ bool read_header_v2(std::ifstream& in, HeaderV2& out) {
     return true;
 }
 
+bool parse_header_v2(const unsigned char* p, size_t n, HeaderV2& out) {
+    if (!p || n < HEADER_V2_BYTES) return false;
+
+    std::memcpy(out.magic, p, 4);
+    std::memcpy(&out.version, p + 4, sizeof(out.version));
+    std::memcpy(&out.n_docs, p + 8, sizeof(out.n_docs));
+    std::memcpy(&out.n_post9, p + 12, sizeof(out.n_post9));
+    std::memcpy(&out.n_post13, p + 20, sizeof(out.n_post13));
+
+    if (std::memcmp(out.magic, "PLAG", 4) != 0) return false;
+    if (out.version != 2) return false;
+    return true;
+}
+
+uint32_t peek_format_version(const unsigned char* p, size_t n) {
+    if (!p || n < 8) return 0;
+    if (std::memcmp(p, "PLAG", 4) != 0) return 0;
+    uint32_t v = 0;
+    std::memcpy(&v, p + 4, sizeof(v));
+    return v;
+}
+
+bool parse_header_v3(const unsigned char* p, size_t n, HeaderV3& out) {
+    if (!p || n < HEADER_V3_FIELDS_BYTES) return false;
+
+    std::memcpy(out.magic, p, 4);
+    std::memcpy(&out.version, p + 4, 4);
+    std::memcpy(&out.header_bytes, p + 8, 4);
+    std::memcpy(&out.n_docs, p + 12, 4);
+    std::memcpy(&out.n_post9, p + 16, 8);
+    std::memcpy(&out.n_hashes, p + 24, 8);
+    std::memcpy(&out.docmeta_off, p + 32, 8);
+    std::memcpy(&out.hashes_off, p + 40, 8);
+    std::memcpy(&out.starts_off, p + 48, 8);
+    std::memcpy(&out.select_off, p + 56, 8);
+    std::memcpy(&out.did_off, p + 64, 8);
+    std::memcpy(&out.pos_off, p + 72, 8);
+    std::memcpy(&out.posting_codec, p + 80, 4);
+    std::memcpy(&out.token_hash, p + 84, 4);
+    std::memcpy(&out.shingle_hash, p + 88, 4);
+    std::memcpy(&out.flags, p + 92, 4);
+    std::memcpy(&out.block_meta_off, p + 96, 8);
+    std::memcpy(&out.block_data_off, p + 104, 8);
+
+    if (std::memcmp(out.magic, "PLAG", 4) != 0) return false;
+    if (out.version != FORMAT_V3) return false;
+    if (out.header_bytes < HEADER_V3_FIELDS_BYTES || out.header_bytes > n) return false;
+    return true;
+}
+
+bool write_header_v3(std::ofstream& out, const HeaderV3& h) {
+    if (h.header_bytes < HEADER_V3_FIELDS_BYTES) return false;
+
+    std::vector<unsigned char> b(h.header_bytes, 0);
+    unsigned char* p = b.data();
+    std::memcpy(p, h.magic, 4);
+    std::memcpy(p + 4, &h.version, 4);
+    std::memcpy(p + 8, &h.header_bytes, 4);
+    std::memcpy(p + 12, &h.n_docs, 4);
+    std::memcpy(p + 16, &h.n_post9, 8);
+    std::memcpy(p + 24, &h.n_hashes, 8);
+    std::memcpy(p + 32, &h.docmeta_off, 8);
+    std::memcpy(p + 40, &h.hashes_off, 8);
+    std::memcpy(p + 48, &h.starts_off, 8);
+    std::memcpy(p + 56, &h.select_off, 8);
+    std::memcpy(p + 64, &h.did_off, 8);
+    std::memcpy(p + 72, &h.pos_off, 8);
+    std::memcpy(p + 80, &h.posting_codec, 4);
+    std::memcpy(p + 84, &h.token_hash, 4);
+    std::memcpy(p + 88, &h.shingle_hash, 4);
+    std::memcpy(p + 92, &h.flags, 4);
+    std::memcpy(p + 96, &h.block_meta_off, 8);
+    std::memcpy(p + 104, &h.block_data_off, 8);
+
+    out.write(reinterpret_cast<const char*>(p), (std::streamsize)b.size());
+    return (bool)out;
+}
+
 bool write_header_v2(std::ofstream& out, const HeaderV2& h) {
     out.write(reinterpret_cast<const char*>(h.magic), 4);
     out.write(reinterpret_cast<const char*>(&h.version), sizeof(h.version));
@@ -0,0 +1,124 @@
+// Back_L5/cpp/src/hash_filter.cpp
+#include "l5/hash_filter.h"
+#include "l5/mapped_segment.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+// заголовок index_native.bloom: magic, version, n_keys, n_blocks, reserved
+static constexpr char kBloomMagic[4] = {'L', '5', 'B', 'F'};
+static constexpr uint32_t kBloomVersion = 1;
+static constexpr size_t kBloomHeaderBytes = 32;
+
+static void set_err(std::string* err, const std::string& s) {
+    if (err) *err = s;
+}
+
+void HashFilter::init(uint64_t n_keys, uint32_t bits_per_key) {
+    n_keys_ = 0;
+    const uint64_t bits = std::max<uint64_t>(1, n_keys) * std::max<uint32_t>(1, bits_per_key);
+    const uint64_t n_blocks = std::min<uint64_t>((bits + 255) / 256, UINT32_MAX);
+    words_.assign((size_t)n_blocks * kWords, 0u);
+}
+
+void HashFilter::add(uint64_t h) {
+    const uint64_t x = mix(h);
+    uint32_t* blk = &words_[block_of(x) * kWords];
+    const uint32_t key = (uint32_t)x;
+    for (uint32_t i = 0; i < kWords; ++i) blk[i] |= bit_of(key, i);
+    ++n_keys_;
+}
+
+bool HashFilter::write_file(const fs::path& p, std::string* err) const {
+    std::ofstream out(p, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+
+    unsigned char hb[kBloomHeaderBytes] = {};
+    const uint64_t nb = n_blocks();
+    std::memcpy(hb, kBloomMagic, 4);
+    std::memcpy(hb + 4, &kBloomVersion, 4);
+    std::memcpy(hb + 8, &n_keys_, 8);
+    std::memcpy(hb + 16, &nb, 8);
+    out.write(reinterpret_cast<const char*>(hb), sizeof(hb));
+    out.write(reinterpret_cast<const char*>(words_.data()), (std::streamsize)bytes());
+    out.flush();
+    if (!out) {
+        set_err(err, "write failed " + p.string());
+        return false;
+    }
+    return true;
+}
+
+bool HashFilter::read_file(const fs::path& p, std::string* err) {
+    words_.clear();
+    n_keys_ = 0;
+
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        set_err(err, "cannot open " + p.string());
+        return false;
+    }
+
+    unsigned char hb[kBloomHeaderBytes];
+    in.read(reinterpret_cast<char*>(hb), sizeof(hb));
+    if (in.gcount() != (std::streamsize)sizeof(hb) || std::memcmp(hb, kBloomMagic, 4) != 0) {
+        set_err(err, "bad bloom header: " + p.string());
+        return false;
+    }
+    uint32_t version = 0;
+    uint64_t n_keys = 0, nb = 0;
+    std::memcpy(&version, hb + 4, 4);
+    std::memcpy(&n_keys, hb + 8, 8);
+    std::memcpy(&nb, hb + 16, 8);
+    if (version != kBloomVersion) {
+        set_err(err, "unsupported bloom version " + std::to_string(version) + ": " + p.string());
+        return false;
+    }
+
+    std::error_code ec;
+    const uintmax_t fsize = fs::file_size(p, ec);
+    if (ec || nb == 0 || nb > UINT32_MAX || fsize != kBloomHeaderBytes + nb * kWords * sizeof(uint32_t)) {
+        set_err(err, "bloom size mismatch: " + p.string());
+        return false;
+    }
+
+    std::vector<uint32_t> w((size_t)nb * kWords);
+    in.read(reinterpret_cast<char*>(w.data()), (std::streamsize)(w.size() * sizeof(uint32_t)));
+    if (!in) {
+        set_err(err, "bloom read failed: " + p.string());
+        return false;
+    }
+    words_.swap(w);
+    n_keys_ = n_keys;
+    return true;
+}
+
+void build_hash_filter(const MappedSegment& seg, HashFilter& out, uint32_t bits_per_key) {
+    if (seg.version() == FORMAT_V3) {
+        const auto& hs = seg.hashes();
+        out.init(hs.size(), bits_per_key);
+        for (size_t i = 0; i < hs.size(); ++i) out.add(hs.h(i));
+        return;
+    }
+
+    // V2: postings отсортированы по h — различные хэши идут подряд
+    const auto& ps = seg.postings();
+    uint64_t n_distinct = 0;
+    for (size_t i = 0; i < ps.size(); ++i) {
+        if (i == 0 || ps.h(i) != ps.h(i - 1)) ++n_distinct;
+    }
+    out.init(n_distinct, bits_per_key);
+    for (size_t i = 0; i < ps.size(); ++i) {
+        if (i == 0 || ps.h(i) != ps.h(i - 1)) out.add(ps.h(i));
+    }
+}
+
+} // namespace l5
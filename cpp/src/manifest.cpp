@@ -2,6 +2,7 @@
 #include "l5/manifest.h"
 #include "l5/format.h"
 
+#include <algorithm>
 #include <fstream>
 #include <nlohmann/json.hpp>
 
@@ -30,6 +31,15 @@ static bool write_text_file_tmp(const std::filesystem::path& tmp, const std::str
     return (bool)out;
 }
 
+static json entry_json(const SegmentEntry& e) {
+    json entry;
+    entry["segment_name"] = e.segment_name;
+    entry["path"] = e.path;
+    entry["built_at_utc"] = e.built_at_utc;
+    entry["stats"] = {{"docs", e.stats.docs}, {"k9", e.stats.k9}, {"k13", e.stats.k13}};
+    return entry;
+}
+
 Manifest load_manifest(const std::filesystem::path& out_root) {
     Manifest m;
     const auto p = out_root / "level5_manifest.json";
@@ -63,12 +73,36 @@ bool append_segment_to_manifest(const std::filesystem::path& out_root, const Seg
         j["segments"] = json::array();
     }
 
-    json entry;
-    entry["segment_name"] = e.segment_name;
-    entry["path"] = e.path;
-    entry["built_at_utc"] = e.built_at_utc;
-    entry["stats"] = {{"docs", e.stats.docs}, {"k9", e.stats.k9}, {"k13", e.stats.k13}};
-    j["segments"].push_back(std::move(entry));
+    j["segments"].push_back(entry_json(e));
+
+    if (!write_text_file_tmp(manifest_tmp, j.dump())) return false;
+    return atomic_replace_file_best_effort(manifest_tmp, manifest_fin);
+}
+
+bool replace_segments_in_manifest(const std::filesystem::path& out_root,
+                                  const std::vector<std::string>& remove_names,
+                                  const SegmentEntry* add) {
+    const auto manifest_fin = out_root / "level5_manifest.json";
+    const auto manifest_tmp = out_root / "level5_manifest.json.tmp";
+
+    json j = read_json_file_or_empty_object(manifest_fin);
+    json segs = json::array();
+    bool added = false;
+    if (j.contains("segments") && j["segments"].is_array()) {
+        for (auto& e : j["segments"]) {
+            const std::string name = e.is_object() ? e.value("segment_name", "") : std::string();
+            if (std::find(remove_names.begin(), remove_names.end(), name) == remove_names.end()) {
+                segs.push_back(std::move(e));
+                continue;
+            }
+            if (add && !added) {
+                segs.push_back(entry_json(*add));
+                added = true;
+            }
+        }
+    }
+    if (add && !added) segs.push_back(entry_json(*add));
+    j["segments"] = std::move(segs);
 
     if (!write_text_file_tmp(manifest_tmp, j.dump())) return false;
     return atomic_replace_file_best_effort(manifest_tmp, manifest_fin);
@@ -0,0 +1,380 @@
+// Back_L5/cpp/src/mapped_segment.cpp
+#include "l5/mapped_segment.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace l5 {
+
+MappedSegment::~MappedSegment() { close(); }
+
+MappedSegment::MappedSegment(MappedSegment&& o) noexcept { *this = std::move(o); }
+
+MappedSegment& MappedSegment::operator=(MappedSegment&& o) noexcept {
+    if (this == &o) return *this;
+    close();
+    seg_dir_ = std::move(o.seg_dir_);
+    header_ = o.header_;
+    header3_ = o.header3_;
+    docmeta_ = o.docmeta_;
+    postings_ = o.postings_;
+    blocks_ = o.blocks_;
+    hashes_ = o.hashes_;
+    starts_ = o.starts_;
+    dir_ = std::move(o.dir_);
+    filter_ = std::move(o.filter_);
+    stop_ = std::move(o.stop_);
+    deleted_ = std::move(o.deleted_);
+    map_ = o.map_;
+    map_len_ = o.map_len_;
+
+    o.header_ = HeaderV2{};
+    o.header3_ = HeaderV3{};
+    o.docmeta_ = DocMetaView{};
+    o.postings_ = PostingsView{};
+    o.blocks_ = BlockPostingsView{};
+    o.hashes_ = HashesView{};
+    o.starts_ = StartsView{};
+    o.dir_ = HashDirectory{};
+    o.filter_ = HashFilter{};
+    o.stop_ = StopHashes{};
+    o.map_ = nullptr;
+    o.map_len_ = 0;
+    return *this;
+}
+
+void MappedSegment::close() {
+    if (map_) ::munmap(map_, map_len_);
+    map_ = nullptr;
+    map_len_ = 0;
+    header_ = HeaderV2{};
+    header3_ = HeaderV3{};
+    docmeta_ = DocMetaView{};
+    postings_ = PostingsView{};
+    blocks_ = BlockPostingsView{};
+    hashes_ = HashesView{};
+    starts_ = StartsView{};
+    dir_ = HashDirectory{};
+    filter_ = HashFilter{};
+    stop_ = StopHashes{};
+    deleted_.reset();
+}
+
+void MappedSegment::build_hash_directory(unsigned bits) {
+    if (version() == FORMAT_V3) {
+        if (!hashes_.empty()) dir_.build(hashes_, bits);
+        return;
+    }
+    if (postings_.empty()) return;
+    dir_.build(postings_, bits);
+}
+
+bool MappedSegment::load_hash_filter(std::string* err) {
+    filter_ = HashFilter{};
+    const std::filesystem::path p = seg_dir_ / "index_native.bloom";
+    std::error_code ec;
+    if (!std::filesystem::exists(p, ec)) return true; // старый сегмент: без фильтра
+
+    HashFilter f;
+    if (!f.read_file(p, err)) return false;
+    // фильтр от другой сборки сегмента дал бы ложные пропуски; V2 — различные h postings
+    size_t n_keys = hashes_.size();
+    if (version() != FORMAT_V3) {
+        n_keys = 0;
+        for (size_t i = 0; i < postings_.size(); ++i) {
+            if (i == 0 || postings_.h(i) != postings_.h(i - 1)) ++n_keys;
+        }
+    }
+    if (f.n_keys() != n_keys) {
+        if (err) *err = "bloom n_keys mismatch: " + p.string();
+        return false;
+    }
+    filter_ = std::move(f);
+    return true;
+}
+
+bool MappedSegment::load_stop_hashes(std::string* err) {
+    stop_ = StopHashes{};
+    const std::filesystem::path p = seg_dir_ / "index_native.df";
+    std::error_code ec;
+    if (!std::filesystem::exists(p, ec)) return true; // старый сегмент: без DF
+
+    DfTable t;
+    if (!read_df_file(p, t, err, true)) return false;
+    if (!(t.scheme == hash_scheme()) || (version() == FORMAT_V3 && t.n_hashes != hashes_.size())) {
+        if (err) *err = "df does not match segment: " + p.string();
+        return false;
+    }
+    stop_.assign(t);
+    return true;
+}
+
+bool MappedSegment::load_deleted(std::string* err) {
+    auto d = std::make_shared<DeletedDocs>();
+    if (!d->read_file(seg_dir_ / "index_native.deleted", n_docs(), err)) return false;
+    deleted_ = std::move(d);
+    return true;
+}
+
+std::pair<size_t, size_t> MappedSegment::range_for_hash(uint64_t h) const {
+    if (version() == FORMAT_V3) {
+        // словарь уникален: lower_bound + проверка, затем диапазон по starts
+        size_t lo = 0, hi = hashes_.size();
+        if (!dir_.empty()) std::tie(lo, hi) = dir_.bucket(h);
+        const size_t i = HashDirectory::lower_bound_branchless(hashes_, lo, hi, h);
+        if (i == hi || hashes_.h(i) != h) return {0, 0};
+        return {starts_.select(i), starts_.select(i + 1)};
+    }
+
+    if (!dir_.empty()) return dir_.range(postings_, h);
+
+    // без директории: lower_bound/upper_bound по всему массиву
+    const size_t n = postings_.size();
+    const size_t l = HashDirectory::lower_bound_branchless(postings_, 0, n, h);
+    const size_t r = HashDirectory::upper_bound_branchless(postings_, l, n, h);
+    return {l, r};
+}
+
+// Галоп от lo: первый i >= lo с h(i) >= key (Upper: h(i) > key).
+// Шаги 1, 2, 4, ... пока не перескочим key, затем бинарный поиск в последнем шаге:
+// O(log gap) вместо O(log n), и обращения идут рядом с предыдущим найденным.
+template <bool Upper, class View>
+static size_t gallop_bound(const View& v, size_t lo, size_t n, uint64_t key) {
+    auto before = [&](size_t i) { return Upper ? v.h(i) <= key : v.h(i) < key; };
+    if (lo >= n || !before(lo)) return lo;
+
+    size_t prev = lo, step = 1, hi = lo + 1;
+    while (hi < n && before(hi)) {
+        prev = hi;
+        step <<= 1;
+        hi = prev + step;
+    }
+    if (hi > n) hi = n;
+    return Upper ? HashDirectory::upper_bound_branchless(v, prev + 1, hi, key)
+                 : HashDirectory::lower_bound_branchless(v, prev + 1, hi, key);
+}
+
+// ожидаемая позиция h в n равномерно распределённых хэшах
+static inline size_t interpolate_index(uint64_t h, size_t n) {
+    return (size_t)(((unsigned __int128)h * n) >> 64);
+}
+
+void MappedSegment::ranges_for_sorted_hashes(const uint64_t* hs, size_t n,
+                                             std::pair<size_t, size_t>* out) const {
+    constexpr size_t kPrefetchAhead = 16;
+    const size_t m = lookup_size();
+
+    // куда примерно попадёт хэш через kPrefetchAhead шагов: начало его бакета
+    // директории (если построена), иначе интерполяция по равномерным h
+    auto guess = [&](uint64_t h) -> size_t {
+        if (!dir_.empty()) return dir_.bucket(h).first;
+        return interpolate_index(h, m);
+    };
+
+    size_t cur = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (k + kPrefetchAhead < n) {
+            const size_t g = guess(hs[k + kPrefetchAhead]);
+            if (g < m) {
+                if (version() == FORMAT_V3) hashes_.prefetch_h(g);
+                else postings_.prefetch_h(g);
+            }
+        }
+        // галоп не должен начинаться левее бакета: дальние прыжки заменяет директория
+        if (!dir_.empty()) cur = std::max(cur, (size_t)dir_.bucket(hs[k]).first);
+
+        const uint64_t h = hs[k];
+        if (version() == FORMAT_V3) {
+            cur = gallop_bound<false>(hashes_, cur, m, h);
+            if (cur == m || hashes_.h(cur) != h) {
+                out[k] = {0, 0};
+                continue;
+            }
+            out[k] = {starts_.select(cur), starts_.select(cur + 1)};
+            ++cur;
+        } else {
+            const size_t l = gallop_bound<false>(postings_, cur, m, h);
+            const size_t r = gallop_bound<true>(postings_, l, m, h);
+            out[k] = l < r ? std::pair<size_t, size_t>{l, r} : std::pair<size_t, size_t>{0, 0};
+            cur = r;
+        }
+    }
+}
+
+static void advise_range(void* base, size_t off, size_t len, int advice) {
+    if (len == 0) return;
+    // madvise требует выровненный по странице адрес
+    static const size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+    const size_t a = off & ~(page - 1);
+    ::madvise(static_cast<unsigned char*>(base) + a, len + (off - a), advice);
+}
+
+bool MappedSegment::attach_v2(const unsigned char* base, size_t file_len,
+                              const std::filesystem::path& bin, std::string* err) {
+    HeaderV2 h{};
+    if (!parse_header_v2(base, file_len, h)) {
+        if (err) *err = "invalid header or version in " + bin.string();
+        return false;
+    }
+
+    const uint64_t docmeta_bytes = (uint64_t)h.n_docs * DOCMETA_BYTES;
+    const uint64_t postings_bytes = h.n_post9 * POSTING9_BYTES;
+    const uint64_t need = HEADER_V2_BYTES + docmeta_bytes + postings_bytes;
+    if (h.n_post9 > (UINT64_MAX - HEADER_V2_BYTES - docmeta_bytes) / POSTING9_BYTES ||
+        (uint64_t)file_len < need) {
+        if (err) *err = "truncated " + bin.string() + ": size=" + std::to_string(file_len) +
+                        " need=" + std::to_string(need);
+        return false;
+    }
+
+    header_ = h;
+    docmeta_ = DocMetaView(base + HEADER_V2_BYTES, (size_t)h.n_docs);
+    postings_ = PostingsView(base + HEADER_V2_BYTES + docmeta_bytes, (size_t)h.n_post9);
+    return true;
+}
+
+bool MappedSegment::attach_v3(const unsigned char* base, size_t file_len,
+                              const std::filesystem::path& bin, std::string* err) {
+    HeaderV3 h{};
+    if (!parse_header_v3(base, file_len, h)) {
+        if (err) *err = "invalid header or version in " + bin.string();
+        return false;
+    }
+    const bool bp128 = h.posting_codec == POSTING_CODEC_BP128;
+    if ((h.posting_codec != POSTING_CODEC_RAW && !bp128) ||
+        (h.token_hash != TOKEN_HASH_FNV1A && h.token_hash != TOKEN_HASH_WYHASH) ||
+        (h.shingle_hash != SHINGLE_HASH_COMBINE && h.shingle_hash != SHINGLE_HASH_ROLLING)) {
+        if (err) *err = "unsupported codec/hash id in " + bin.string() +
+                        ": codec=" + std::to_string(h.posting_codec) +
+                        " token_hash=" + std::to_string(h.token_hash) +
+                        " shingle_hash=" + std::to_string(h.shingle_hash);
+        return false;
+    }
+
+    // секция [off, off + count*elem) должна целиком лежать в файле
+    bool fits = h.n_hashes <= h.n_post9;
+    auto check = [&](uint64_t off, uint64_t count, uint64_t elem) {
+        if (!fits) return;
+        if (off < h.header_bytes || off > file_len || count > (file_len - off) / elem) fits = false;
+    };
+    check(h.docmeta_off, h.n_docs, DOCMETA_BYTES);
+    check(h.hashes_off, h.n_hashes, sizeof(uint64_t));
+    check(h.starts_off, (h.n_post9 + 63) / 64, sizeof(uint64_t));
+    check(h.select_off, (h.n_hashes + StartsView::kSampleRate - 1) / StartsView::kSampleRate, sizeof(uint64_t));
+    if (bp128) {
+        const uint64_t n_blocks = (h.n_post9 + bp128::kBlock - 1) / bp128::kBlock;
+        check(h.block_meta_off, n_blocks, bp128::kMetaBytes);
+        check(h.block_data_off, bp128::kTailPad, 1);
+        if (fits && n_blocks > 0) {
+            // O(1): только последний блок; остальные meta() сверяет с секцией при
+            // чтении, полная проверка блоков — в валидаторе
+            const auto m = bp128::read_meta(base + h.block_meta_off + (n_blocks - 1) * bp128::kMetaBytes);
+            const uint64_t end = m.data_off + bp128::packed_bytes(m.did_bits) +
+                                 bp128::packed_bytes(m.pos_bits) + bp128::kTailPad;
+            if (m.did_bits > 32 || m.pos_bits > 32 || end > file_len - h.block_data_off) fits = false;
+        }
+    } else {
+        check(h.did_off, h.n_post9, sizeof(uint32_t));
+        check(h.pos_off, h.n_post9, sizeof(uint32_t));
+    }
+    if (!fits) {
+        if (err) *err = "truncated " + bin.string() + ": size=" + std::to_string(file_len) +
+                        " (V3 section out of file)";
+        return false;
+    }
+
+    header_.version = h.version;
+    std::memcpy(header_.magic, h.magic, 4);
+    header_.n_docs = h.n_docs;
+    header_.n_post9 = h.n_post9;
+    header_.n_post13 = 0;
+    header3_ = h;
+
+    docmeta_ = DocMetaView(base + h.docmeta_off, (size_t)h.n_docs);
+    hashes_ = HashesView(base + h.hashes_off, (size_t)h.n_hashes);
+    starts_ = StartsView(base + h.starts_off, (size_t)h.n_post9, base + h.select_off, (size_t)h.n_hashes);
+    if (bp128) {
+        blocks_ = BlockPostingsView(base + h.block_meta_off, base + h.block_data_off, (size_t)h.n_post9,
+                                    file_len - h.block_data_off);
+    } else {
+        postings_ = PostingsView::soa(base + h.did_off, base + h.pos_off, (size_t)h.n_post9);
+    }
+    return true;
+}
+
+bool map_segment_bin(const std::filesystem::path& seg_dir,
+                     MappedSegment& out,
+                     std::string* err,
+                     const MapOptions& opt) {
+    out.close();
+    out.seg_dir_ = seg_dir;
+
+    const auto bin = seg_dir / "index_native.bin";
+    const int fd = ::open(bin.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (err) *err = "cannot open " + bin.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        if (err) *err = "cannot stat " + bin.string() + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    const size_t file_len = (size_t)st.st_size;
+    if (file_len < HEADER_V2_BYTES) {
+        if (err) *err = "invalid header or version in " + bin.string();
+        ::close(fd);
+        return false;
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (opt.populate) flags |= MAP_POPULATE;
+#endif
+
+    void* p = ::mmap(nullptr, file_len, PROT_READ, flags, fd, 0);
+    ::close(fd); // mapping держит свою ссылку на файл
+    if (p == MAP_FAILED) {
+        if (err) *err = "mmap failed " + bin.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    out.map_ = p;
+    out.map_len_ = file_len;
+
+    const auto* base = static_cast<const unsigned char*>(p);
+    const uint32_t ver = peek_format_version(base, file_len);
+
+    bool ok = false;
+    if (ver == FORMAT_V3) ok = out.attach_v3(base, file_len, bin, err);
+    else ok = out.attach_v2(base, file_len, bin, err);
+    if (!ok) {
+        out.close();
+        return false;
+    }
+
+    if (opt.advise) {
+        // header+docmeta читаются на каждый кандидат; остальное — точечные lookup
+        const size_t hot = (size_t)(ver == FORMAT_V3 ? out.header3_.docmeta_off : HEADER_V2_BYTES) +
+                           out.docmeta_.size() * DOCMETA_BYTES;
+        advise_range(p, 0, hot, MADV_WILLNEED);
+        advise_range(p, hot, file_len - hot, MADV_RANDOM);
+    }
+#ifdef MADV_HUGEPAGE
+    if (opt.huge_pages) ::madvise(p, file_len, MADV_HUGEPAGE);
+#endif
+
+    return true;
+}
+
+} // namespace l5
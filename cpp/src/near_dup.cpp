@@ -0,0 +1,63 @@
+// Back_L5/cpp/src/near_dup.cpp
+#include "l5/near_dup.h"
+#include "l5/mapped_segment.h"
+
+#include <algorithm>
+
+namespace l5 {
+
+void NearDupIndex::build(const DocMetaView& dm) {
+    n_docs_ = dm.size();
+    std::vector<uint16_t> key(n_docs_);
+    std::vector<uint32_t> cnt((size_t)1 << kBandBits);
+
+    for (uint32_t b = 0; b < kBands; ++b) {
+        std::fill(cnt.begin(), cnt.end(), 0u);
+        for (size_t i = 0; i < n_docs_; ++i) {
+            const DocMeta m = dm[i];
+            key[i] = band(m.simhash_hi, m.simhash_lo, b);
+            ++cnt[key[i]];
+        }
+        uint32_t sum = 0;
+        for (auto& c : cnt) {
+            const uint32_t x = c;
+            c = sum;
+            sum += x;
+        }
+
+        // did по возрастанию внутри значения полосы
+        keys_[b].assign(n_docs_, 0);
+        dids_[b].assign(n_docs_, 0);
+        for (size_t i = 0; i < n_docs_; ++i) {
+            const uint32_t at = cnt[key[i]]++;
+            keys_[b][at] = key[i];
+            dids_[b][at] = (uint32_t)i;
+        }
+    }
+}
+
+void NearDupIndex::find(const DocMetaView& dm, uint64_t hi, uint64_t lo, uint32_t max_hamming,
+                        std::vector<NearDupMatch>& out) const {
+    out.clear();
+    const size_t n = std::min(n_docs_, dm.size());
+    for (uint32_t b = 0; b < kBands; ++b) {
+        const uint16_t qk = band(hi, lo, b);
+        const auto& keys = keys_[b];
+        auto [l, r] = std::equal_range(keys.begin(), keys.end(), qk);
+        for (auto it = l; it != r; ++it) {
+            const uint32_t did = dids_[b][(size_t)(it - keys.begin())];
+            if (did >= n) continue;
+            const DocMeta m = dm[did];
+            const uint64_t xh = m.simhash_hi ^ hi, xl = m.simhash_lo ^ lo;
+            // кандидат уже найден в более ранней совпавшей полосе
+            bool seen = false;
+            for (uint32_t p = 0; p < b && !seen; ++p) seen = band(xh, xl, p) == 0;
+            if (seen) continue;
+            const uint32_t d = (uint32_t)(__builtin_popcountll(xh) + __builtin_popcountll(xl));
+            if (d <= max_hamming) out.push_back(NearDupMatch{did, d});
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const NearDupMatch& a, const NearDupMatch& b) { return a.did < b.did; });
+}
+
+} // namespace l5
@@ -0,0 +1,331 @@
+// Back_L5/cpp/src/posting_codec.cpp
+#include "l5/posting_codec.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define L5_BP128_X86 1
+#include <immintrin.h>
+#endif
+
+namespace l5 {
+namespace bp128 {
+
+void write_meta(const BlockMeta& m, unsigned char* p) {
+    std::memset(p, 0, kMetaBytes);
+    std::memcpy(p, &m.data_off, 8);
+    std::memcpy(p + 8, &m.did_base, 4);
+    std::memcpy(p + 12, &m.pos_base, 4);
+    p[16] = m.did_bits;
+    p[17] = m.pos_bits;
+    p[18] = m.did_delta;
+}
+
+void pack(const uint32_t* in, size_t n, unsigned b, unsigned char* out) {
+    std::memset(out, 0, packed_bytes(b));
+    if (b == 0) return;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t bit = i * b;
+        uint64_t v = (uint64_t)in[i] << (bit & 7);
+        // значение + сдвиг <= 39 бит: 5 байт
+        unsigned char* p = out + (bit >> 3);
+        const size_t nbytes = std::min<size_t>(5, packed_bytes(b) - (bit >> 3));
+        for (size_t k = 0; k < nbytes; ++k) p[k] |= (unsigned char)(v >> (8 * k));
+    }
+}
+
+// --------------------
+// scalar
+// --------------------
+static void unpack_scalar(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out) {
+    const uint64_t mask = (1ull << b) - 1;
+    for (size_t i = 0; i < kBlock; ++i) {
+        const size_t bit = i * b;
+        uint64_t w;
+        std::memcpy(&w, in + (bit >> 3), sizeof(w));
+        out[i] = base + (uint32_t)((w >> (bit & 7)) & mask);
+    }
+}
+
+static void prefix_scalar(uint32_t* v, uint32_t base) {
+    uint32_t acc = base;
+    for (size_t i = 0; i < kBlock; ++i) {
+        acc += v[i];
+        v[i] = acc;
+    }
+}
+
+#ifdef L5_BP128_X86
+// --------------------
+// SSE4.1: 4 значения за шаг. pshufb раскладывает по lane 4 байта, в которых
+// лежит значение; сдвиг вправо у каждого lane свой, поэтому сначала pmulld на
+// 2^(32-b-shift) (сдвиг влево, лишние старшие биты уходят), затем общий >> (32-b).
+// Группа из 4 значений начинается с бита 4*g*b: фаза внутри байта 0 или 4.
+// --------------------
+struct SseTables {
+    alignas(16) uint8_t shuf[kSimdMaxBits + 1][2][16];
+    alignas(16) uint32_t mult[kSimdMaxBits + 1][2][4];
+
+    SseTables() {
+        std::memset(this, 0, sizeof(*this));
+        for (unsigned b = 1; b <= kSimdMaxBits; ++b) {
+            for (unsigned ph = 0; ph < 2; ++ph) {
+                for (unsigned j = 0; j < 4; ++j) {
+                    const unsigned bit = ph * 4 + j * b;
+                    const unsigned rel = bit >> 3;
+                    for (unsigned k = 0; k < 4; ++k) shuf[b][ph][j * 4 + k] = (uint8_t)(rel + k);
+                    mult[b][ph][j] = 1u << (32 - b - (bit & 7));
+                }
+            }
+        }
+    }
+};
+
+static const SseTables& sse_tables() {
+    static const SseTables t;
+    return t;
+}
+
+__attribute__((target("sse4.1")))
+static void unpack_sse41(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out) {
+    const SseTables& t = sse_tables();
+    const __m128i vbase = _mm_set1_epi32((int)base);
+    const __m128i cnt = _mm_cvtsi32_si128((int)(32 - b));
+    const __m128i shuf0 = _mm_load_si128(reinterpret_cast<const __m128i*>(t.shuf[b][0]));
+    const __m128i shuf1 = _mm_load_si128(reinterpret_cast<const __m128i*>(t.shuf[b][1]));
+    const __m128i mult0 = _mm_load_si128(reinterpret_cast<const __m128i*>(t.mult[b][0]));
+    const __m128i mult1 = _mm_load_si128(reinterpret_cast<const __m128i*>(t.mult[b][1]));
+
+    for (size_t g = 0; g < kBlock / 4; ++g) {
+        const size_t bit = 4 * g * b;
+        const bool ph = (bit & 7) != 0;
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + (bit >> 3)));
+        x = _mm_shuffle_epi8(x, ph ? shuf1 : shuf0);
+        x = _mm_mullo_epi32(x, ph ? mult1 : mult0);
+        x = _mm_srl_epi32(x, cnt);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * g), _mm_add_epi32(x, vbase));
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void prefix_sse41(uint32_t* v, uint32_t base) {
+    __m128i carry = _mm_set1_epi32((int)base);
+    for (size_t g = 0; g < kBlock / 4; ++g) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + 4 * g));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + 4 * g), x);
+        carry = _mm_shuffle_epi32(x, 0xFF);
+    }
+}
+
+// --------------------
+// AVX2: 8 значений за шаг через gather. 8*b бит = ровно b байт, поэтому
+// смещения/сдвиги внутри группы одинаковы для всех 16 групп блока.
+// --------------------
+__attribute__((target("avx2")))
+static void unpack_avx2(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out) {
+    const __m256i j = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i bitoff = _mm256_mullo_epi32(j, _mm256_set1_epi32((int)b));
+    const __m256i byteoff = _mm256_srli_epi32(bitoff, 3);
+    const __m256i shift = _mm256_and_si256(bitoff, _mm256_set1_epi32(7));
+    const __m256i mask = _mm256_set1_epi32((int)((1u << b) - 1));
+    const __m256i vbase = _mm256_set1_epi32((int)base);
+
+    for (size_t g = 0; g < kBlock / 8; ++g) {
+        const int* p = reinterpret_cast<const int*>(in + g * b);
+        __m256i x = _mm256_i32gather_epi32(p, byteoff, 1);
+        x = _mm256_and_si256(_mm256_srlv_epi32(x, shift), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8 * g), _mm256_add_epi32(x, vbase));
+    }
+}
+#endif // L5_BP128_X86
+
+bool kernel_supported(Kernel k) {
+    switch (k) {
+    case Kernel::Scalar: return true;
+#ifdef L5_BP128_X86
+    case Kernel::Sse41: return __builtin_cpu_supports("sse4.1");
+    case Kernel::Avx2: return __builtin_cpu_supports("avx2");
+#else
+    default: return false;
+#endif
+    }
+    return false;
+}
+
+const char* kernel_name(Kernel k) {
+    switch (k) {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Sse41: return "sse41";
+    case Kernel::Avx2: return "avx2";
+    }
+    return "scalar";
+}
+
+Kernel active_kernel() {
+    static const Kernel k = [] {
+        Kernel cap = Kernel::Avx2;
+        if (const char* s = std::getenv("PLAGIO_POSTING_SIMD")) {
+            if (std::strcmp(s, "scalar") == 0) cap = Kernel::Scalar;
+            else if (std::strcmp(s, "sse41") == 0) cap = Kernel::Sse41;
+        }
+        if (cap == Kernel::Avx2 && kernel_supported(Kernel::Avx2)) return Kernel::Avx2;
+        if (cap != Kernel::Scalar && kernel_supported(Kernel::Sse41)) return Kernel::Sse41;
+        return Kernel::Scalar;
+    }();
+    return k;
+}
+
+void unpack(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out, Kernel k) {
+    if (b == 0) {
+        std::fill(out, out + kBlock, base);
+        return;
+    }
+#ifdef L5_BP128_X86
+    if (b <= kSimdMaxBits) {
+        if (k == Kernel::Avx2) return unpack_avx2(in, b, base, out);
+        if (k == Kernel::Sse41) return unpack_sse41(in, b, base, out);
+    }
+#endif
+    unpack_scalar(in, b, base, out);
+}
+
+void unpack_delta(const unsigned char* in, unsigned b, uint32_t base, uint32_t* out, Kernel k) {
+    unpack(in, b, 0, out, k);
+#ifdef L5_BP128_X86
+    if (k != Kernel::Scalar) return prefix_sse41(out, base);
+#endif
+    prefix_scalar(out, base);
+}
+
+void encode_block(const uint32_t* did, const uint32_t* pos, size_t n, bool inner_start,
+                  BlockMeta& meta, std::vector<unsigned char>& data) {
+    uint32_t dmin = did[0], dmax = did[0], pmin = pos[0], pmax = pos[0];
+    bool sorted = true;
+    uint32_t dmax_delta = 0;
+    for (size_t i = 1; i < n; ++i) {
+        dmin = std::min(dmin, did[i]);
+        dmax = std::max(dmax, did[i]);
+        pmin = std::min(pmin, pos[i]);
+        pmax = std::max(pmax, pos[i]);
+        if (did[i] < did[i - 1]) sorted = false;
+        else dmax_delta = std::max(dmax_delta, did[i] - did[i - 1]);
+    }
+
+    const unsigned for_bits = bits_for(dmax - dmin);
+    const unsigned delta_bits = bits_for(dmax_delta);
+    const bool use_delta = !inner_start && sorted && delta_bits < for_bits;
+
+    uint32_t tmp[kBlock];
+    meta.did_delta = use_delta ? 1 : 0;
+    if (use_delta) {
+        meta.did_base = did[0];
+        meta.did_bits = (uint8_t)delta_bits;
+        tmp[0] = 0;
+        for (size_t i = 1; i < n; ++i) tmp[i] = did[i] - did[i - 1];
+    } else {
+        meta.did_base = dmin;
+        meta.did_bits = (uint8_t)for_bits;
+        for (size_t i = 0; i < n; ++i) tmp[i] = did[i] - dmin;
+    }
+
+    meta.pos_base = pmin;
+    meta.pos_bits = (uint8_t)bits_for(pmax - pmin);
+
+    data.assign(packed_bytes(meta.did_bits) + packed_bytes(meta.pos_bits), 0);
+    pack(tmp, n, meta.did_bits, data.data());
+    for (size_t i = 0; i < n; ++i) tmp[i] = pos[i] - pmin;
+    pack(tmp, n, meta.pos_bits, data.data() + packed_bytes(meta.did_bits));
+}
+
+} // namespace bp128
+
+// --------------------
+// BlockPostingsView
+// --------------------
+
+// Короче этого куска блока выгоднее точечный extract, чем распаковка всех 128
+static constexpr size_t kFullDecodeMin = 16;
+
+uint32_t BlockPostingsView::did(size_t i) const {
+    const bp128::BlockMeta m = meta(i / bp128::kBlock);
+    if (!m.did_delta) return bp128::extract(data(m), m.did_bits, m.did_base, i % bp128::kBlock);
+
+    uint32_t tmp[bp128::kBlock];
+    bp128::unpack_delta(data(m), m.did_bits, m.did_base, tmp);
+    return tmp[i % bp128::kBlock];
+}
+
+void BlockPostingsView::decode_dids(size_t l, size_t r, uint32_t* out) const {
+    uint32_t tmp[bp128::kBlock];
+    while (l < r) {
+        const size_t blk = l / bp128::kBlock;
+        const size_t a = l % bp128::kBlock;
+        const size_t b = std::min(bp128::kBlock, a + (r - l));
+        const bp128::BlockMeta m = meta(blk);
+        const unsigned char* p = data(m);
+
+        if (m.did_delta) {
+            bp128::unpack_delta(p, m.did_bits, m.did_base, tmp);
+            std::memcpy(out, tmp + a, (b - a) * sizeof(uint32_t));
+        } else if (b - a >= kFullDecodeMin) {
+            bp128::unpack(p, m.did_bits, m.did_base, tmp);
+            std::memcpy(out, tmp + a, (b - a) * sizeof(uint32_t));
+        } else {
+            for (size_t k = a; k < b; ++k) out[k - a] = bp128::extract(p, m.did_bits, m.did_base, k);
+        }
+        out += b - a;
+        l += b - a;
+    }
+}
+
+void BlockPostingsView::decode_pos(size_t l, size_t r, uint32_t* out) const {
+    uint32_t tmp[bp128::kBlock];
+    while (l < r) {
+        const size_t blk = l / bp128::kBlock;
+        const size_t a = l % bp128::kBlock;
+        const size_t b = std::min(bp128::kBlock, a + (r - l));
+        const bp128::BlockMeta m = meta(blk);
+        const unsigned char* p = data(m) + bp128::packed_bytes(m.did_bits);
+
+        if (b - a >= kFullDecodeMin) {
+            bp128::unpack(p, m.pos_bits, m.pos_base, tmp);
+            std::memcpy(out, tmp + a, (b - a) * sizeof(uint32_t));
+        } else {
+            for (size_t k = a; k < b; ++k) out[k - a] = bp128::extract(p, m.pos_bits, m.pos_base, k);
+        }
+        out += b - a;
+        l += b - a;
+    }
+}
+
+void BlockPostingsView::add_hits(size_t l, size_t r, uint32_t* hits, uint32_t n_hits) const {
+    uint32_t tmp[bp128::kBlock];
+    while (l < r) {
+        const size_t blk = l / bp128::kBlock;
+        const size_t a = l % bp128::kBlock;
+        const size_t b = std::min(bp128::kBlock, a + (r - l));
+        const bp128::BlockMeta m = meta(blk);
+        const unsigned char* p = data(m);
+
+        if (m.did_delta || b - a >= kFullDecodeMin) {
+            if (m.did_delta) bp128::unpack_delta(p, m.did_bits, m.did_base, tmp);
+            else bp128::unpack(p, m.did_bits, m.did_base, tmp);
+            for (size_t k = a; k < b; ++k) {
+                const uint32_t did = tmp[k];
+                if (did < n_hits) ++hits[did];
+            }
+        } else {
+            for (size_t k = a; k < b; ++k) {
+                const uint32_t did = bp128::extract(p, m.did_bits, m.did_base, k);
+                if (did < n_hits) ++hits[did];
+            }
+        }
+        l += b - a;
+    }
+}
+
+} // namespace l5
@@ -10,29 +10,33 @@
 
 namespace l5 {
 
-QueryShingles build_query_shingles(const std::string& query_text, bool text_is_normalized) {
+static_assert((uint32_t)TokenHash::Fnv1a == TOKEN_HASH_FNV1A &&
+              (uint32_t)TokenHash::Wyhash == TOKEN_HASH_WYHASH, "token hash ids");
+static_assert((uint32_t)ShingleHash::Combine == SHINGLE_HASH_COMBINE &&
+              (uint32_t)ShingleHash::Rolling == SHINGLE_HASH_ROLLING, "shingle hash ids");
+
+QueryShingles build_query_shingles(const std::string& query_text, bool text_is_normalized,
+                                   const HashScheme& scheme) {
     std::string norm;
     if (text_is_normalized) norm = query_text;
     else norm = normalize_for_shingles_simple(query_text);
 
-    std::vector<TokenSpan> spans;
-    spans.reserve(256);
-    tokenize_spans(norm, spans);
+    ShingleHashParams hp;
+    hp.k = K_SHINGLE;
+    hp.token = (TokenHash)scheme.token_hash;
+    hp.shingle = (ShingleHash)scheme.shingle_hash;
+    std::vector<uint64_t> token_hashes, shingle_hashes;
+    hash_text_shingles(norm, hp, token_hashes, shingle_hashes);
 
     QueryShingles q;
-    if (spans.size() < (size_t)K_SHINGLE) return q;
-
-    const int n = (int)spans.size();
-    const int cnt = n - K_SHINGLE + 1;
-    if (cnt <= 0) return q;
+    if (shingle_hashes.empty()) return q;
 
     // hash -> list of positions
     std::unordered_map<uint64_t, std::vector<uint32_t>> mp;
-    mp.reserve((size_t)cnt);
+    mp.reserve(shingle_hashes.size());
 
-    for (int pos = 0; pos < cnt; ++pos) {
-        uint64_t h = hash_shingle_tokens_spans(norm, spans, pos, K_SHINGLE);
-        mp[h].push_back((uint32_t)pos);
+    for (size_t pos = 0; pos < shingle_hashes.size(); ++pos) {
+        mp[shingle_hashes[pos]].push_back((uint32_t)pos);
         q.total_shingles++;
     }
 
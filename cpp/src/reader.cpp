@@ -1,6 +1,8 @@
 // Back_L5/cpp/src/reader.cpp
 #include "l5/reader.h"
+#include "l5/mapped_segment.h"
 
+#include <algorithm>
 #include <fstream>
 #include <nlohmann/json.hpp>
 
@@ -12,46 +14,52 @@ bool load_segment_bin(const std::filesystem::path& seg_dir, SegmentData& out, st
     out = SegmentData{};
     out.seg_dir = seg_dir;
 
-    const auto bin = seg_dir / "index_native.bin";
-    std::ifstream in(bin, std::ios::binary);
-    if (!in) {
-        if (err) *err = "cannot open " + bin.string();
-        return false;
-    }
-
-    HeaderV2 h{};
-    if (!read_header_v2(in, h)) {
-        if (err) *err = "invalid header or version in " + bin.string();
-        return false;
-    }
-    out.header = h;
-
-    // docmeta: read by fields (padding-safe)
-    out.docmeta.resize(h.n_docs);
-    for (uint32_t i = 0; i < h.n_docs; ++i) {
-        DocMeta dm{};
-        in.read(reinterpret_cast<char*>(&dm.tok_len), sizeof(dm.tok_len));
-        in.read(reinterpret_cast<char*>(&dm.simhash_hi), sizeof(dm.simhash_hi));
-        in.read(reinterpret_cast<char*>(&dm.simhash_lo), sizeof(dm.simhash_lo));
-        if (!in) {
-            if (err) *err = "failed reading docmeta";
-            return false;
+    // одна копия из mmap вместо трёх in.read на запись
+    MapOptions mo;
+    mo.advise = false;
+    MappedSegment m;
+    if (!map_segment_bin(seg_dir, m, err, mo)) return false;
+
+    out.header = m.header();
+
+    const auto& dm = m.docmeta();
+    out.docmeta.resize(dm.size());
+    for (size_t i = 0; i < dm.size(); ++i) out.docmeta[i] = dm[i];
+
+    const size_t n = (size_t)m.n_post9();
+    out.postings9.resize(n);
+    if (m.version() == FORMAT_V2) {
+        const auto& ps = m.postings();
+        for (size_t i = 0; i < n; ++i) out.postings9[i] = ps[i];
+    } else {
+        std::vector<uint32_t> did(1u << 16), pos(1u << 16);
+        for (size_t l = 0; l < n; l += did.size()) {
+            const size_t r = std::min(n, l + did.size());
+            m.decode_dids(l, r, did.data());
+            m.decode_pos(l, r, pos.data());
+            for (size_t i = l; i < r; ++i) {
+                out.postings9[i].did = did[i - l];
+                out.postings9[i].pos = pos[i - l];
+            }
         }
-        out.docmeta[i] = dm;
     }
 
-    // postings9: read by fields (padding-safe)
-    out.postings9.resize((size_t)h.n_post9);
-    for (uint64_t i = 0; i < h.n_post9; ++i) {
-        Posting9 p{};
-        in.read(reinterpret_cast<char*>(&p.h), sizeof(p.h));
-        in.read(reinterpret_cast<char*>(&p.did), sizeof(p.did));
-        in.read(reinterpret_cast<char*>(&p.pos), sizeof(p.pos));
-        if (!in) {
-            if (err) *err = "failed reading postings9";
-            return false;
+    if (m.version() == FORMAT_V3) {
+        // h хранится в словаре: бит starts => следующий хэш
+        const auto& hs = m.hashes();
+        const auto& st = m.starts();
+        size_t k = 0;
+        uint64_t h = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if ((st.word(i >> 6) >> (i & 63)) & 1) {
+                if (k >= hs.size()) {
+                    if (err) *err = "starts bitmap has more ranges than hashes";
+                    return false;
+                }
+                h = hs.h(k++);
+            }
+            out.postings9[i].h = h;
         }
-        out.postings9[(size_t)i] = p;
     }
 
     return true;
@@ -7,6 +7,9 @@ nlohmann::json to_json(const SearchResult& r) {
     nlohmann::json j;
     j["query"] = r.query;
     j["segments_scanned"] = r.segments_scanned;
+    j["segments_skipped"] = r.segments_skipped;
+    j["hash_lookups"] = r.hash_lookups;
+    j["hash_lookups_skipped"] = r.hash_lookups_skipped;
 
     nlohmann::json arr = nlohmann::json::array();
     for (const auto& h : r.hits) {
@@ -53,4 +56,28 @@ nlohmann::json to_json(const SearchResult& r) {
     return j;
 }
 
+nlohmann::json to_json(const NearDupResult& r) {
+    nlohmann::json j;
+    if (!r.doc_id.empty()) j["doc_id"] = r.doc_id;
+    j["max_hamming"] = r.max_hamming;
+    j["segments_scanned"] = r.segments_scanned;
+    j["candidates"] = r.candidates;
+
+    nlohmann::json arr = nlohmann::json::array();
+    for (const auto& h : r.hits) {
+        nlohmann::json e;
+        e["doc_id"] = h.doc_id;
+        e["hamming"] = h.hamming;
+        e["organization_id"] = h.organization_id;
+        e["external_id"] = h.external_id;
+        e["meta_path"] = h.meta_path;
+        e["segment"] = h.meta_path; // alias for convenience
+        e["source_path"] = h.source_path;
+        e["source_name"] = h.source_name;
+        arr.push_back(std::move(e));
+    }
+    j["hits"] = std::move(arr);
+    return j;
+}
+
 } // namespace l5
@@ -1,43 +1,54 @@
 // Back_L5/cpp/src/search_multi.cpp
 #include "l5/search_multi.h"
+#include "l5/doc_freq.h"
 #include "l5/manifest.h"
-#include "l5/reader.h"
+#include "l5/mapped_segment.h"
 #include "l5/query.h"
+#include "l5/search_pool.h"
 #include "l5/search_segment.h"
+#include "l5/segment_cache.h"
 
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+#include "text_common.h"
 
 namespace l5 {
 
-SearchResult search_out_root(const std::filesystem::path& out_root,
-                            const std::string& query,
-                            bool query_is_normalized,
-                            const SearchOptions& opt) {
-    SearchResult res;
-    res.query = query;
+// Сегмент манифеста: из cache (scope) или загрузкой напрямую; nullptr => не загрузился.
+// near_dup — запросу нужны полосы simhash (при загрузке напрямую строятся только тогда).
+static std::shared_ptr<const LoadedSegment> get_segment(const std::filesystem::path& out_root,
+                                                        const SegmentEntry& seg,
+                                                        SegmentCache* cache,
+                                                        const std::string& scope,
+                                                        bool near_dup) {
+    std::string err;
+    if (cache) return cache->get(scope, out_root, seg, &err);
 
-    auto manifest = load_manifest(out_root);
-    QueryShingles q = build_query_shingles(query, query_is_normalized);
+    // сегмент живёт один запрос: директория не окупится, полосы — только near-dup
+    auto tmp = std::make_shared<LoadedSegment>();
+    if (!load_segment(out_root / seg.segment_name, *tmp, &err, false, near_dup)) return nullptr;
+    return tmp;
+}
 
-    // best by doc_id
+// Слияние по сегментам в порядке манифеста: лучший Hit на doc_id, затем top-k по C
+// (при равном C — по doc_id: порядок unordered_map не должен влиять на top-k).
+// hits_of(i) — hits i-го сегмента (забираются move).
+template <class HitsOf>
+static void merge_segment_hits(size_t n_seg, const std::vector<uint8_t>& seg_ok, HitsOf&& hits_of,
+                               const SearchOptions& opt, SearchResult& res) {
     std::unordered_map<std::string, Hit> best;
     best.reserve(1024);
 
-    for (const auto& seg : manifest.segments) {
-        const auto seg_dir = out_root / seg.segment_name;
-
-        SegmentData segdata;
-        std::string err;
-        if (!load_segment_bin(seg_dir, segdata, &err)) continue;
-
-        std::vector<DocInfo> docinfo;
-        if (!load_docids_json(seg_dir, docinfo, &err)) continue;
-
+    for (size_t i = 0; i < n_seg; ++i) {
+        if (!seg_ok[i]) continue;
         ++res.segments_scanned;
 
-        auto hits = search_in_segment(segdata, docinfo, q, opt);
-        for (auto& h : hits) {
+        for (auto& h : hits_of(i)) {
             auto it = best.find(h.doc_id);
             if (it == best.end() || h.C > it->second.C) {
                 best[h.doc_id] = std::move(h);
@@ -49,11 +60,456 @@ SearchResult search_out_root(const std::filesystem::path& out_root,
     for (auto& kv : best) res.hits.push_back(std::move(kv.second));
 
     std::sort(res.hits.begin(), res.hits.end(), [](const Hit& a, const Hit& b) {
-        return a.C > b.C;
+        if (a.C != b.C) return a.C > b.C;
+        return a.doc_id < b.doc_id;
     });
     if (res.hits.size() > opt.topk) res.hits.resize(opt.topk);
+}
+
+static void add_filter_stats(const HashFilterStats& fs, SearchResult& res) {
+    res.hash_lookups += fs.hashes;
+    res.hash_lookups_skipped += fs.skipped;
+    if (fs.hashes > 0 && fs.skipped == fs.hashes) ++res.segments_skipped;
+}
+
+// Различные схемы хэшей загруженных сегментов (обычно одна; больше — пока в
+// out_root есть сегменты до смены схемы). Запрос хэшируется один раз на схему.
+static std::vector<HashScheme> segment_schemes(const std::vector<std::shared_ptr<const LoadedSegment>>& segs) {
+    std::vector<HashScheme> r;
+    for (const auto& s : segs) {
+        if (s && std::find(r.begin(), r.end(), s->seg.hash_scheme()) == r.end()) r.push_back(s->seg.hash_scheme());
+    }
+    return r;
+}
+
+static size_t scheme_index(const std::vector<HashScheme>& schemes, const MappedSegment& seg) {
+    return (size_t)(std::find(schemes.begin(), schemes.end(), seg.hash_scheme()) - schemes.begin());
+}
+
+// Boilerplate out_root (level5_stop_hashes.df) при opt.use_stop_hashes; nullptr => не применять
+static std::shared_ptr<const StopHashes> org_stop_hashes(const std::filesystem::path& out_root,
+                                                         const SearchOptions& opt,
+                                                         SegmentCache* cache) {
+    if (!opt.use_stop_hashes) return nullptr;
+    if (cache) return cache->org_stop_hashes(out_root);
+    auto s = std::make_shared<StopHashes>();
+    std::string err;
+    if (!load_org_stop_hashes(out_root, *s, &err)) return nullptr;
+    return s;
+}
+
+// Хэши boilerplate убираются из запроса до обхода сегментов (total_shingles не меняется —
+// как и для stop-hash сегмента); список сравним только с запросом своей схемы.
+static void drop_stop_hashes(const StopHashes* stop, const HashScheme& scheme, QueryShingles& q) {
+    if (!stop || stop->empty() || !(stop->scheme() == scheme)) return;
+    q.items.erase(std::remove_if(q.items.begin(), q.items.end(),
+                                 [&](const QueryHash& qh) { return stop->contains(qh.h); }),
+                  q.items.end());
+}
+
+// C k-го лучшего doc_id; пока проверенных doc_id меньше k — -1 (годится любой кандидат)
+static double kth_best_c(const std::unordered_map<std::string, double>& best_c, size_t k) {
+    if (best_c.size() < k) return -1.0;
+    std::vector<double> c;
+    c.reserve(best_c.size());
+    for (const auto& kv : best_c) c.push_back(kv.second);
+    std::nth_element(c.begin(), c.begin() + (long)(k - 1), c.end(), std::greater<double>());
+    return c[k - 1];
+}
+
+static SearchResult search_impl(const std::filesystem::path& out_root,
+                                const std::string& query,
+                                bool query_is_normalized,
+                                const SearchOptions& opt,
+                                SegmentCache* cache,
+                                const std::string& scope) {
+    SearchResult res;
+    res.query = query;
+
+    auto manifest = cache ? cache->manifest(out_root) : load_manifest(out_root);
+
+    // Каждый сегмент пишет только в свой слот => merge без блокировок,
+    // затем сливаем в порядке манифеста (результат как у последовательного прохода).
+    const size_t n_seg = manifest.segments.size();
+    std::vector<std::shared_ptr<const LoadedSegment>> segs(n_seg);
+    std::vector<SegmentCandidates> seg_cand(n_seg);
+    std::vector<std::vector<Hit>> seg_hits(n_seg);
+    std::vector<uint8_t> seg_ok(n_seg, 0);
+
+    SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+        segs[i] = get_segment(out_root, manifest.segments[i], cache, scope, false);
+        seg_ok[i] = segs[i] ? 1 : 0;
+    });
+    const std::vector<HashScheme> schemes = segment_schemes(segs);
+    const auto org_stop = org_stop_hashes(out_root, opt, cache);
+    std::vector<QueryShingles> qs(schemes.size());
+    for (size_t j = 0; j < schemes.size(); ++j) {
+        qs[j] = build_query_shingles(query, query_is_normalized, schemes[j]);
+        drop_stop_hashes(org_stop.get(), schemes[j], qs[j]);
+    }
+    auto q_of = [&](size_t i) -> const QueryShingles& { return qs[scheme_index(schemes, segs[i]->seg)]; };
+
+    // Фаза 1: Stage A во всех сегментах — кандидаты и верхние границы их C
+    SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+        if (!seg_ok[i]) return;
+        seg_cand[i] = collect_candidates(segs[i]->seg, segs[i]->docinfo, q_of(i), opt);
+    });
+
+    for (size_t i = 0; i < n_seg; ++i) add_filter_stats(seg_cand[i].filter, res);
+
+    struct GlobalCand {
+        double c_upper;
+        uint32_t seg;
+        uint32_t idx;
+    };
+    std::vector<GlobalCand> all;
+    for (size_t i = 0; i < n_seg; ++i) {
+        const auto& cu = seg_cand[i].c_upper;
+        for (uint32_t k = 0; k < (uint32_t)cu.size(); ++k) {
+            if (cu[k] >= 0.0) all.push_back(GlobalCand{cu[k], (uint32_t)i, k});
+        }
+    }
+    std::sort(all.begin(), all.end(), [](const GlobalCand& a, const GlobalCand& b) {
+        if (a.c_upper != b.c_upper) return a.c_upper > b.c_upper;
+        if (a.seg != b.seg) return a.seg < b.seg;
+        return a.idx < b.idx;
+    });
+
+    // Фаза 2: spans по убыванию верхней границы, порциями (candidates_topn, затем x2).
+    // Кандидат с границей < C k-го лучшего doc_id в top-k уже не попадёт =>
+    // итог совпадает с проверкой всех кандидатов всех сегментов.
+    std::unordered_map<std::string, double> best_c;
+    std::vector<std::vector<uint32_t>> which(n_seg);
+    std::vector<uint32_t> active;
+    size_t next = 0;
+    size_t chunk = std::max<size_t>(1, opt.candidates_topn);
+
+    while (next < all.size() && opt.topk > 0) {
+        const double thr = kth_best_c(best_c, opt.topk);
+        if (all[next].c_upper < thr) break;
+
+        active.clear();
+        for (size_t end = std::min(all.size(), next + chunk); next < end && all[next].c_upper >= thr; ++next) {
+            auto& w = which[all[next].seg];
+            if (w.empty()) active.push_back(all[next].seg);
+            w.push_back(all[next].idx);
+        }
+        chunk *= 2;
+
+        std::vector<std::vector<Hit>> round_hits(active.size());
+        SearchPool::shared().parallel_for(active.size(), opt.max_parallel_segments, [&](size_t a) {
+            const uint32_t i = active[a];
+            round_hits[a] = verify_candidates(segs[i]->seg, segs[i]->docinfo, q_of(i), opt, seg_cand[i], which[i]);
+        });
+
+        for (size_t a = 0; a < active.size(); ++a) {
+            const uint32_t i = active[a];
+            which[i].clear();
+            for (auto& h : round_hits[a]) {
+                auto it = best_c.find(h.doc_id);
+                if (it == best_c.end()) best_c.emplace(h.doc_id, h.C);
+                else if (h.C > it->second) it->second = h.C;
+                seg_hits[i].push_back(std::move(h));
+            }
+        }
+    }
+
+    merge_segment_hits(n_seg, seg_ok, [&](size_t i) -> std::vector<Hit>& { return seg_hits[i]; }, opt, res);
+    return res;
+}
+
+// Проходы по batch_queries_per_pass запросов; на проход каждый сегмент
+// обрабатывает все запросы прохода сразу (search_in_segment_batch).
+// Сегменты грузим один раз и держим до конца пакета, чтобы не перечитывать их на каждом проходе.
+static void search_batch_impl(const std::filesystem::path& out_root,
+                              const std::vector<std::string>& queries,
+                              bool query_is_normalized,
+                              const SearchOptions& opt,
+                              SegmentCache* cache,
+                              const std::string& scope,
+                              const BatchResultFn& on_result) {
+    auto manifest = cache ? cache->manifest(out_root) : load_manifest(out_root);
+    const size_t n_seg = manifest.segments.size();
+    std::vector<std::shared_ptr<const LoadedSegment>> segs(n_seg);
+    std::vector<uint8_t> seg_ok(n_seg, 0);
+    SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+        segs[i] = get_segment(out_root, manifest.segments[i], cache, scope, false);
+        seg_ok[i] = segs[i] ? 1 : 0;
+    });
+
+    const std::vector<HashScheme> schemes = segment_schemes(segs);
+    const auto org_stop = org_stop_hashes(out_root, opt, cache);
+
+    const size_t per_pass = std::max<size_t>(1, opt.batch_queries_per_pass);
+    for (size_t q0 = 0; q0 < queries.size(); q0 += per_pass) {
+        const size_t nq = std::min(per_pass, queries.size() - q0);
+
+        // qs[j][k]: запрос q0 + k в схеме schemes[j]
+        std::vector<std::vector<QueryShingles>> qs(schemes.size(), std::vector<QueryShingles>(nq));
+        SearchPool::shared().parallel_for(nq * schemes.size(), 0, [&](size_t t) {
+            const size_t j = t / nq, k = t % nq;
+            qs[j][k] = build_query_shingles(queries[q0 + k], query_is_normalized, schemes[j]);
+            drop_stop_hashes(org_stop.get(), schemes[j], qs[j][k]);
+        });
+
+        // seg_hits[i][k]: hits запроса q0 + k в сегменте i
+        std::vector<std::vector<std::vector<Hit>>> seg_hits(n_seg);
+        std::vector<std::vector<HashFilterStats>> seg_fs(n_seg);
+
+        SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+            if (!seg_ok[i]) return;
+            seg_hits[i] = search_in_segment_batch(segs[i]->seg, segs[i]->docinfo, qs[scheme_index(schemes, segs[i]->seg)],
+                                                  opt, &seg_fs[i]);
+        });
+
+        for (size_t k = 0; k < nq; ++k) {
+            SearchResult res;
+            res.query = queries[q0 + k];
+            for (size_t i = 0; i < n_seg; ++i) {
+                if (seg_ok[i]) add_filter_stats(seg_fs[i][k], res);
+            }
+            merge_segment_hits(n_seg, seg_ok, [&](size_t i) -> std::vector<Hit>& { return seg_hits[i][k]; },
+                               opt, res);
+            on_result(q0 + k, std::move(res));
+        }
+    }
+}
+
+// simhash запроса для сегментов с данным token_hash (simhash сравним только внутри одной схемы токенов)
+struct NearDupQuery {
+    uint32_t token_hash;
+    uint64_t hi;
+    uint64_t lo;
+};
+
+static NearDupResult near_dup_impl(const std::filesystem::path& out_root,
+                                   const std::string& doc_id,
+                                   const std::string& text,
+                                   bool text_is_normalized,
+                                   const NearDupOptions& opt,
+                                   SegmentCache* cache,
+                                   const std::string& scope) {
+    NearDupResult res;
+    res.doc_id = doc_id;
+    res.max_hamming = opt.max_hamming;
+
+    auto manifest = cache ? cache->manifest(out_root) : load_manifest(out_root);
+    const size_t n_seg = manifest.segments.size();
+    std::vector<std::shared_ptr<const LoadedSegment>> segs(n_seg);
+    SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+        segs[i] = get_segment(out_root, manifest.segments[i], cache, scope, true);
+    });
+
+    std::vector<NearDupQuery> qs;
+    auto has_query = [&](uint32_t th) {
+        return std::any_of(qs.begin(), qs.end(), [&](const NearDupQuery& q) { return q.token_hash == th; });
+    };
+
+    if (!doc_id.empty()) {
+        // первый по манифесту живой экземпляр документа в каждой схеме токенов:
+        // удалённая копия (перезалитый документ) дала бы устаревший simhash
+        std::vector<uint32_t> dids;
+        for (const auto& s : segs) {
+            if (!s || has_query(s->seg.hash_scheme().token_hash)) continue;
+            s->docinfo.find(doc_id, dids);
+            const auto live = std::find_if(dids.begin(), dids.end(), [&](uint32_t did) {
+                return did < s->seg.n_docs() && !s->seg.deleted().test(did);
+            });
+            if (live == dids.end()) continue;
+            const DocMeta m = s->seg.docmeta()[*live];
+            qs.push_back(NearDupQuery{s->seg.hash_scheme().token_hash, m.simhash_hi, m.simhash_lo});
+        }
+        res.doc_found = !qs.empty();
+    } else {
+        std::string norm;
+        if (text_is_normalized) norm = text;
+        else normalize_for_shingles_simple_to(text, norm);
+
+        ShingleHashParams hp;
+        hp.k = K_SHINGLE;
+        hp.max_tokens = opt.max_tokens;
+        hp.max_shingles = 1; // нужны только хэши токенов
+        std::vector<uint64_t> token_hashes, shingle_hashes;
+        for (const auto& s : segs) {
+            if (!s || has_query(s->seg.hash_scheme().token_hash)) continue;
+            hp.token = (TokenHash)s->seg.hash_scheme().token_hash;
+            hash_text_shingles(norm, hp, token_hashes, shingle_hashes);
+            if (token_hashes.empty()) break;
+            auto [hi, lo] = simhash128_token_hashes(token_hashes);
+            qs.push_back(NearDupQuery{s->seg.hash_scheme().token_hash, hi, lo});
+        }
+    }
+
+    std::vector<std::vector<NearDupMatch>> seg_matches(n_seg);
+    std::vector<uint8_t> seg_ok(n_seg, 0);
+    SearchPool::shared().parallel_for(n_seg, opt.max_parallel_segments, [&](size_t i) {
+        if (!segs[i]) return;
+        for (const auto& q : qs) {
+            if (q.token_hash != segs[i]->seg.hash_scheme().token_hash) continue;
+            segs[i]->near_dup.find(segs[i]->seg.docmeta(), q.hi, q.lo, opt.max_hamming, seg_matches[i]);
+            seg_ok[i] = 1;
+        }
+    });
+
+    // лучший (минимальный) hamming на doc_id, сегменты в порядке манифеста
+    std::unordered_map<std::string, size_t> at;
+    for (size_t i = 0; i < n_seg; ++i) {
+        if (!seg_ok[i]) continue;
+        ++res.segments_scanned;
+        const auto& ls = *segs[i];
+        for (const auto& m : seg_matches[i]) {
+            if (m.did >= ls.docinfo.size() || ls.seg.deleted().test(m.did)) continue;
+            const std::string_view id = ls.docinfo.doc_id(m.did);
+            if (id == doc_id) continue;
+            ++res.candidates;
 
+            auto it = at.find(std::string(id));
+            if (it != at.end()) {
+                auto& prev = res.hits[it->second];
+                prev.hamming = std::min(prev.hamming, m.hamming);
+                continue;
+            }
+            at.emplace(std::string(id), res.hits.size());
+
+            const DocInfo di = ls.docinfo.get(m.did);
+            NearDupHit h;
+            h.doc_id = di.doc_id;
+            h.hamming = m.hamming;
+            h.organization_id = di.organization_id;
+            h.external_id = di.external_id;
+            h.meta_path = di.meta_path.empty() ? ls.segment_name + "/" : di.meta_path;
+            h.source_path = di.source_path;
+            h.source_name = di.source_name;
+            res.hits.push_back(std::move(h));
+        }
+    }
+
+    std::stable_sort(res.hits.begin(), res.hits.end(), [](const NearDupHit& a, const NearDupHit& b) {
+        return a.hamming < b.hamming;
+    });
+    if (res.hits.size() > opt.topk) res.hits.resize(opt.topk);
     return res;
 }
 
+SearchResult search_out_root(const std::filesystem::path& out_root,
+                            const std::string& query,
+                            bool query_is_normalized,
+                            const SearchOptions& opt) {
+    return search_impl(out_root, query, query_is_normalized, opt, nullptr, std::string());
+}
+
+SearchResult search_out_root(const std::filesystem::path& out_root,
+                            const std::string& query,
+                            bool query_is_normalized,
+                            const SearchOptions& opt,
+                            SegmentCache& cache,
+                            const std::string& scope) {
+    return search_impl(out_root, query, query_is_normalized, opt, &cache, scope);
+}
+
+std::vector<SearchResult> search_batch(const std::filesystem::path& out_root,
+                                       const std::vector<std::string>& queries,
+                                       bool query_is_normalized,
+                                       const SearchOptions& opt) {
+    std::vector<SearchResult> out(queries.size());
+    search_batch_impl(out_root, queries, query_is_normalized, opt, nullptr, std::string(),
+                      [&](size_t i, SearchResult&& r) { out[i] = std::move(r); });
+    return out;
+}
+
+void search_batch(const std::filesystem::path& out_root,
+                  const std::vector<std::string>& queries,
+                  bool query_is_normalized,
+                  const SearchOptions& opt,
+                  SegmentCache& cache,
+                  const std::string& scope,
+                  const BatchResultFn& on_result) {
+    search_batch_impl(out_root, queries, query_is_normalized, opt, &cache, scope, on_result);
+}
+
+NearDupResult near_duplicates_text(const std::filesystem::path& out_root,
+                                   const std::string& text,
+                                   bool text_is_normalized,
+                                   const NearDupOptions& opt) {
+    return near_dup_impl(out_root, std::string(), text, text_is_normalized, opt, nullptr, std::string());
+}
+
+NearDupResult near_duplicates_text(const std::filesystem::path& out_root,
+                                   const std::string& text,
+                                   bool text_is_normalized,
+                                   const NearDupOptions& opt,
+                                   SegmentCache& cache,
+                                   const std::string& scope) {
+    return near_dup_impl(out_root, std::string(), text, text_is_normalized, opt, &cache, scope);
+}
+
+NearDupResult near_duplicates_doc(const std::filesystem::path& out_root,
+                                  const std::string& doc_id,
+                                  const NearDupOptions& opt) {
+    return near_dup_impl(out_root, doc_id, std::string(), true, opt, nullptr, std::string());
+}
+
+NearDupResult near_duplicates_doc(const std::filesystem::path& out_root,
+                                  const std::string& doc_id,
+                                  const NearDupOptions& opt,
+                                  SegmentCache& cache,
+                                  const std::string& scope) {
+    return near_dup_impl(out_root, doc_id, std::string(), true, opt, &cache, scope);
+}
+
+bool mark_doc_deleted(const std::filesystem::path& out_root,
+                      const std::string& doc_id,
+                      SegmentCache& cache,
+                      const std::string& scope,
+                      uint64_t* marked,
+                      std::string* err) {
+    if (marked) *marked = 0;
+    bool ok = true;
+    const auto fail = [&](const std::string& seg, const std::string& e_err) {
+        if (ok && err) *err = seg + ": " + e_err;
+        ok = false;
+    };
+
+    const Manifest m = cache.manifest(out_root);
+    std::vector<uint32_t> dids;
+    for (const auto& e : m.segments) {
+        const auto seg_dir = out_root / e.segment_name;
+        std::string e_err;
+
+        // cache.get не зовём: полная загрузка каждого сегмента ради одного doc_id
+        // вытеснила бы горячие. Владельца находит docidx (mmap docinfo — O(1)).
+        const auto ls = cache.peek(scope, e);
+        DocInfoStore own;
+        if (!ls && !open_docinfo(seg_dir, own, &e_err)) {
+            fail(e.segment_name, e_err);
+            continue;
+        }
+        const DocInfoStore& docinfo = ls ? ls->docinfo : own;
+        docinfo.find(doc_id, dids);
+        if (dids.empty()) continue;
+
+        if (ls) {
+            // в кэше: бит ставится и в битмапе, по которому уже идут запросы
+            if (!ls->seg.deleted_docs()) {
+                fail(e.segment_name, "loaded segment has no deleted bitmap");
+                continue;
+            }
+            if (!mark_deleted(seg_dir, *ls->seg.deleted_docs(), dids, &e_err)) {
+                fail(e.segment_name, e_err);
+                continue;
+            }
+        } else {
+            // не в кэше: только файл; следующая загрузка прочтёт его
+            DeletedDocs del;
+            if (!del.read_file(seg_dir / "index_native.deleted", (uint32_t)docinfo.size(), &e_err) ||
+                !mark_deleted(seg_dir, del, dids, &e_err)) {
+                fail(e.segment_name, e_err);
+                continue;
+            }
+        }
+        if (marked) *marked += dids.size();
+    }
+    return ok;
+}
+
 } // namespace l5
@@ -0,0 +1,151 @@
+// Back_L5/cpp/src/search_pool.cpp
+#include "l5/search_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+
+namespace l5 {
+
+SearchPool::SearchPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    workers_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+
+    threads_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        threads_.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+SearchPool::~SearchPool() {
+    {
+        std::lock_guard<std::mutex> lk(sleep_mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+SearchPool& SearchPool::shared() {
+    static SearchPool pool([] {
+        const char* s = std::getenv("PLAGIO_SEARCH_THREADS");
+        if (s && *s) {
+            char* end = nullptr;
+            const unsigned long v = std::strtoul(s, &end, 10);
+            if (end && *end == '\0' && v > 0) return (unsigned)v;
+        }
+        const unsigned hw = std::thread::hardware_concurrency();
+        return hw == 0 ? 4u : hw;
+    }());
+    return pool;
+}
+
+void SearchPool::submit(Task t) {
+    const size_t w = rr_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+        // pending_ растёт до того, как задачу может взять воркер (иначе -- раньше ++).
+        // Порядок sleep_mu_ -> wk.mu; воркеры не держат wk.mu, беря sleep_mu_.
+        std::lock_guard<std::mutex> lk(sleep_mu_);
+        ++pending_;
+        std::lock_guard<std::mutex> wlk(workers_[w]->mu);
+        workers_[w]->q.push_back(std::move(t));
+    }
+    cv_.notify_one();
+}
+
+bool SearchPool::pop_local(size_t w, Task& out) {
+    auto& wk = *workers_[w];
+    std::lock_guard<std::mutex> lk(wk.mu);
+    if (wk.q.empty()) return false;
+    out = std::move(wk.q.back()); // LIFO у себя
+    wk.q.pop_back();
+    return true;
+}
+
+bool SearchPool::steal(size_t w, Task& out) {
+    const size_t n = workers_.size();
+    for (size_t k = 1; k < n; ++k) {
+        auto& wk = *workers_[(w + k) % n];
+        std::lock_guard<std::mutex> lk(wk.mu);
+        if (wk.q.empty()) continue;
+        out = std::move(wk.q.front()); // FIFO у соседа
+        wk.q.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void SearchPool::worker_loop(size_t w) {
+    while (true) {
+        Task t;
+        if (pop_local(w, t) || steal(w, t)) {
+            {
+                std::lock_guard<std::mutex> lk(sleep_mu_);
+                --pending_;
+            }
+            t();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(sleep_mu_);
+        cv_.wait(lk, [&] { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0) return;
+    }
+}
+
+void SearchPool::parallel_for(size_t n, unsigned max_parallel, const std::function<void(size_t)>& fn) {
+    if (n == 0) return;
+
+    unsigned par = max_parallel == 0 ? size() + 1 : max_parallel;
+    par = (unsigned)std::min<size_t>(par, n);
+    par = std::min(par, size() + 1);
+
+    if (par <= 1) {
+        for (size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+
+    // Общее состояние живёт, пока его держит хоть одна задача: задача, стартовавшая
+    // после завершения цикла, видит next >= n и не трогает fn.
+    struct State {
+        std::atomic<size_t> next{0};
+        size_t n{0};
+        const std::function<void(size_t)>* fn{nullptr};
+
+        std::mutex mu;
+        std::condition_variable cv;
+        size_t done{0};
+        std::exception_ptr err;
+    };
+    auto st = std::make_shared<State>();
+    st->n = n;
+    st->fn = &fn;
+
+    auto run = [](State& s) {
+        while (true) {
+            const size_t i = s.next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= s.n) return;
+            std::exception_ptr e;
+            try {
+                (*s.fn)(i);
+            } catch (...) {
+                e = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lk(s.mu);
+            if (e && !s.err) s.err = e;
+            if (++s.done == s.n) s.cv.notify_all();
+        }
+    };
+
+    for (unsigned k = 1; k < par; ++k) {
+        submit([st, run] { run(*st); });
+    }
+    run(*st);
+
+    std::unique_lock<std::mutex> lk(st->mu);
+    st->cv.wait(lk, [&] { return st->done == st->n; });
+    if (st->err) std::rethrow_exception(st->err);
+}
+
+} // namespace l5
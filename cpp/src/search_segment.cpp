@@ -3,41 +3,22 @@
 #include "l5/format.h"
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstdint>
-#include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace l5 {
 
-static inline std::pair<size_t, size_t> range_for_hash_safe(
-    const std::vector<Posting9>& postings,
-    uint64_t h
-) {
-    auto l_it = std::lower_bound(
-        postings.begin(), postings.end(), h,
-        [](const Posting9& p, uint64_t key) { return p.h < key; }
-    );
-
-    auto r_it = std::upper_bound(
-        l_it, postings.end(), h,
-        [](uint64_t key, const Posting9& p) { return key < p.h; }
-    );
-
-    return {
-        (size_t)std::distance(postings.begin(), l_it),
-        (size_t)std::distance(postings.begin(), r_it)
-    };
-}
-
 static inline uint32_t doc_shingles_count(uint32_t tok_len) {
     if (tok_len < (uint32_t)K_SHINGLE) return 0;
     return tok_len - (uint32_t)K_SHINGLE + 1;
 }
 
-struct Point {
+// Точка совпадения кандидата slot: шингл qpos запроса == шингл dpos документа.
+struct PointRec {
+    uint32_t slot;
     uint32_t qpos;
     uint32_t dpos;
 };
@@ -50,180 +31,432 @@ struct SpanTmp {
     uint32_t len_shingles{0};
 };
 
-static std::vector<SpanTmp> build_spans_for_doc(
-    std::vector<Point>& pts,
-    const SearchOptions& opt
-) {
-    // group by delta = dpos - qpos
-    std::unordered_map<int32_t, std::vector<Point>> by_delta;
-    by_delta.reserve(64);
+static inline unsigned bits_for_u64(uint64_t v) {
+    return v ? 64u - (unsigned)__builtin_clzll(v) : 0u;
+}
 
-    for (const auto& p : pts) {
-        int32_t delta = (int32_t)p.dpos - (int32_t)p.qpos;
-        by_delta[delta].push_back(p);
+// Порядок (slot, delta = dpos - qpos, qpos) одним u64: [slot | delta + q_max | qpos].
+// Внутри одной диагонали dpos растёт вместе с qpos => это и есть сортировка
+// по (qpos, dpos) внутри группы delta.
+struct PointKey {
+    uint32_t q_max{0};
+    unsigned q_bits{0};
+    unsigned d_bits{0};
+    unsigned total_bits{0};
+
+    PointKey(uint32_t n_slots, uint32_t q_max_, uint32_t d_max) : q_max(q_max_) {
+        q_bits = bits_for_u64(q_max);
+        d_bits = bits_for_u64((uint64_t)d_max + q_max);
+        total_bits = bits_for_u64(n_slots) + d_bits + q_bits;
     }
 
-    std::vector<SpanTmp> spans;
-    spans.reserve(16);
-
-    for (auto& kv : by_delta) {
-        auto& v = kv.second;
-        if (v.empty()) continue;
-
-        std::sort(v.begin(), v.end(), [](const Point& a, const Point& b) {
-            if (a.qpos != b.qpos) return a.qpos < b.qpos;
-            return a.dpos < b.dpos;
-        });
-
-        const uint32_t gap = opt.span_gap;
-
-        uint32_t cur_qs = v[0].qpos, cur_qe = v[0].qpos;
-        uint32_t cur_ds = v[0].dpos, cur_de = v[0].dpos;
-
-        for (size_t i = 1; i < v.size(); ++i) {
-            const auto& p = v[i];
-
-            const bool cont_q = (p.qpos <= cur_qe + 1 + gap);
-            const bool cont_d = (p.dpos <= cur_de + 1 + gap);
-
-            if (cont_q && cont_d) {
-                if (p.qpos > cur_qe) cur_qe = p.qpos;
-                if (p.dpos > cur_de) cur_de = p.dpos;
-            } else {
-                SpanTmp s;
-                s.q_start = cur_qs;
-                s.q_end = cur_qe;
-                s.d_start = cur_ds;
-                s.d_end = cur_de;
-                s.len_shingles = (cur_qe >= cur_qs) ? (cur_qe - cur_qs + 1) : 0;
-                if (s.len_shingles >= opt.span_min_len) spans.push_back(s);
-
-                cur_qs = cur_qe = p.qpos;
-                cur_ds = cur_de = p.dpos;
-            }
+    bool fits() const { return total_bits <= 64; }
+
+    uint64_t operator()(const PointRec& p) const {
+        const uint64_t d = (uint64_t)p.dpos + q_max - p.qpos;
+        return ((uint64_t)p.slot << (q_bits + d_bits)) | (d << q_bits) | p.qpos;
+    }
+};
+
+static inline int64_t point_delta(const PointRec& p) {
+    return (int64_t)p.dpos - (int64_t)p.qpos;
+}
+
+static inline bool point_less(const PointRec& a, const PointRec& b) {
+    if (a.slot != b.slot) return a.slot < b.slot;
+    const int64_t da = point_delta(a), db = point_delta(b);
+    if (da != db) return da < db;
+    return a.qpos < b.qpos;
+}
+
+// LSD radix sort по байтам ключа (только значимые байты; пустые проходы пропускаем).
+static void sort_points(std::vector<PointRec>& a, std::vector<PointRec>& tmp, const PointKey& key) {
+    if (a.size() <= 1) return;
+    if (a.size() < 256 || !key.fits()) {
+        std::sort(a.begin(), a.end(), point_less);
+        return;
+    }
+    tmp.resize(a.size());
+
+    for (unsigned sh = 0; sh < key.total_bits; sh += 8) {
+        std::array<size_t, 256> cnt{};
+        for (const auto& x : a) ++cnt[(size_t)((key(x) >> sh) & 0xFF)];
+        if (cnt[(size_t)((key(a[0]) >> sh) & 0xFF)] == a.size()) continue;
+
+        std::array<size_t, 256> off{};
+        size_t sum = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            off[i] = sum;
+            sum += cnt[i];
         }
+        for (const auto& x : a) tmp[off[(size_t)((key(x) >> sh) & 0xFF)]++] = x;
+        a.swap(tmp);
+    }
+}
+
+// Один кандидат: pts[l, r) отсортированы point_less. Соседние точки диагонали
+// склеиваются (с учётом span_gap), спаны >= span_min_len -> spans.
+static void build_spans_for_slot(
+    const std::vector<PointRec>& pts, size_t l, size_t r,
+    const SearchOptions& opt,
+    std::vector<SpanTmp>& spans
+) {
+    spans.clear();
+    const uint32_t gap = opt.span_gap;
 
+    auto emit = [&](uint32_t qs, uint32_t qe, uint32_t ds, uint32_t de) {
         SpanTmp s;
-        s.q_start = cur_qs;
-        s.q_end = cur_qe;
-        s.d_start = cur_ds;
-        s.d_end = cur_de;
-        s.len_shingles = (cur_qe >= cur_qs) ? (cur_qe - cur_qs + 1) : 0;
+        s.q_start = qs;
+        s.q_end = qe;
+        s.d_start = ds;
+        s.d_end = de;
+        s.len_shingles = (qe >= qs) ? (qe - qs + 1) : 0;
         if (s.len_shingles >= opt.span_min_len) spans.push_back(s);
+    };
+
+    uint32_t cur_qs = pts[l].qpos, cur_qe = pts[l].qpos;
+    uint32_t cur_ds = pts[l].dpos, cur_de = pts[l].dpos;
+    int64_t cur_delta = point_delta(pts[l]);
+
+    for (size_t i = l + 1; i < r; ++i) {
+        const auto& p = pts[i];
+        const int64_t delta = point_delta(p);
+
+        const bool cont = delta == cur_delta &&
+                          p.qpos <= cur_qe + 1 + gap &&
+                          p.dpos <= cur_de + 1 + gap;
+        if (cont) {
+            if (p.qpos > cur_qe) cur_qe = p.qpos;
+            if (p.dpos > cur_de) cur_de = p.dpos;
+            continue;
+        }
+
+        emit(cur_qs, cur_qe, cur_ds, cur_de);
+        cur_qs = cur_qe = p.qpos;
+        cur_ds = cur_de = p.dpos;
+        cur_delta = delta;
     }
+    emit(cur_qs, cur_qe, cur_ds, cur_de);
 
+    // d_start: детерминированный порядок при равных (len, q_start)
     std::sort(spans.begin(), spans.end(), [](const SpanTmp& a, const SpanTmp& b) {
         if (a.len_shingles != b.len_shingles) return a.len_shingles > b.len_shingles;
-        return a.q_start < b.q_start;
+        if (a.q_start != b.q_start) return a.q_start < b.q_start;
+        return a.d_start < b.d_start;
     });
 
     if (spans.size() > opt.max_spans_per_doc) spans.resize(opt.max_spans_per_doc);
-    return spans;
 }
 
-std::vector<Hit> search_in_segment(
-    const SegmentData& seg,
-    const std::vector<DocInfo>& docinfo,
-    const QueryShingles& q,
-    const SearchOptions& opt
-) {
-    std::vector<Hit> out;
+// Рабочая память поиска, переиспользуется между запросами одного потока.
+// Счётчики hits живут в массиве на n_docs, но валидны только при gen == текущему
+// поколению: новый запрос = ++gen, без обнуления. touched — did, затронутые
+// запросом, так что выбор кандидатов стоит O(postings), а не O(n_docs).
+struct SearchScratch {
+    struct DocCounter {
+        uint32_t gen;
+        uint32_t hits; // Stage A: число попаданий; Stage B: slot + 1 (0 = не кандидат)
+    };
 
-    const uint32_t n_docs = seg.header.n_docs;
-    if (n_docs == 0) return out;
-    if (seg.postings9.empty()) return out;
-    if (q.items.empty() || q.total_shingles == 0) return out;
-    if (docinfo.empty()) return out;
+    std::vector<DocCounter> docs;
+    uint32_t gen{0};
+    std::vector<uint32_t> touched;
+    std::vector<uint32_t> weight; // collect_candidates: сумма |qpos| по попаданиям did (валидно при gen)
 
-    const uint32_t n_docs_safe = std::min<uint32_t>(n_docs, (uint32_t)docinfo.size());
-    if (n_docs_safe == 0) return out;
+    std::vector<uint32_t> live; // индексы q.items с непустым диапазоном (не stop-hash)
+    std::vector<uint64_t> qhashes;
+    std::vector<std::pair<size_t, size_t>> item_ranges;
+    std::vector<uint64_t> fhashes; // прошедшие Bloom-фильтр сегмента
+    std::vector<uint32_t> fidx;
+    std::vector<std::pair<size_t, size_t>> franges;
+
+    std::vector<uint32_t> cand;
+    std::vector<uint32_t> dids;
+    std::vector<PointRec> pts;
+    std::vector<PointRec> pts_tmp;
+    std::vector<SpanTmp> spans;
+
+    // новое поколение для сегмента из n_docs документов
+    void begin(uint32_t n_docs) {
+        if (docs.size() < n_docs) docs.resize(n_docs, DocCounter{0, 0});
+        if (++gen == 0) { // переполнение: старые метки могли бы совпасть
+            for (auto& d : docs) d.gen = 0;
+            gen = 1;
+        }
+        touched.clear();
+        live.clear();
+        cand.clear();
+        pts.clear();
+    }
+
+    // большие буферы после аномального запроса не держим вечно
+    void trim() {
+        constexpr size_t kMaxKeptPoints = 4u << 20;
+        if (pts.capacity() > kMaxKeptPoints) {
+            std::vector<PointRec>().swap(pts);
+            std::vector<PointRec>().swap(pts_tmp);
+        }
+    }
+};
+
+static SearchScratch& search_scratch() {
+    thread_local SearchScratch s;
+    return s;
+}
+
+struct KeyItem {
+    uint64_t key;
+    uint32_t item;
+};
+
+// LSD radix по байтам key (как sort_points); пустые проходы (старшие нулевые байты) пропускаем
+static void sort_key_items(std::vector<KeyItem>& a, std::vector<KeyItem>& tmp) {
+    if (a.size() < 256) {
+        std::sort(a.begin(), a.end(), [](const KeyItem& x, const KeyItem& y) { return x.key < y.key; });
+        return;
+    }
+    tmp.resize(a.size());
+
+    for (unsigned sh = 0; sh < 64; sh += 8) {
+        std::array<size_t, 256> cnt{};
+        for (const auto& x : a) ++cnt[(size_t)((x.key >> sh) & 0xFF)];
+        if (cnt[(size_t)((a[0].key >> sh) & 0xFF)] == a.size()) continue;
+
+        std::array<size_t, 256> off{};
+        size_t sum = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            off[i] = sum;
+            sum += cnt[i];
+        }
+        for (const auto& x : a) tmp[off[(size_t)((x.key >> sh) & 0xFF)]++] = x;
+        a.swap(tmp);
+    }
+}
+
+// [l, r) для n возрастающих хэшей: merge-join, если хэшей много относительно словаря
+static void find_ranges(const MappedSegment& seg, const uint64_t* hs, size_t n,
+                        const SearchOptions& opt, std::pair<size_t, size_t>* out) {
+    const bool merge_join = opt.merge_join_max_gap != 0 &&
+                            (uint64_t)n * opt.merge_join_max_gap >= (uint64_t)seg.lookup_size();
+    if (merge_join) {
+        seg.ranges_for_sorted_hashes(hs, n, out);
+    } else {
+        for (size_t k = 0; k < n; ++k) out[k] = seg.range_for_hash(hs[k]);
+    }
+}
+
+// То же через Bloom-фильтр сегмента (если есть) и его stop-hash (opt.use_stop_hashes):
+// отсеянные хэши получают пустой диапазон без поиска. Возвращает число отсеянных.
+static size_t lookup_ranges(const MappedSegment& seg, const uint64_t* hs, size_t n,
+                            const SearchOptions& opt, SearchScratch& S,
+                            std::pair<size_t, size_t>* out) {
+    const HashFilter& f = seg.hash_filter();
+    const bool bloom = opt.use_hash_filter && !f.empty();
+    const StopHashes& stop = seg.stop_hashes();
+    const bool drop_stop = opt.use_stop_hashes && !stop.empty();
+    if (!bloom && !drop_stop) {
+        find_ranges(seg, hs, n, opt, out);
+        return 0;
+    }
+
+    constexpr size_t kAhead = 8;
+    S.fhashes.clear();
+    S.fidx.clear();
+    for (size_t k = 0; k < n; ++k) {
+        if (bloom && k + kAhead < n) f.prefetch(hs[k + kAhead]);
+        out[k] = {0, 0};
+        if (bloom && !f.may_contain(hs[k])) continue;
+        if (drop_stop && stop.contains(hs[k])) continue;
+        S.fhashes.push_back(hs[k]);
+        S.fidx.push_back((uint32_t)k);
+    }
+
+    const size_t m = S.fhashes.size();
+    if (m == 0) return n;
+    S.franges.resize(m);
+    find_ranges(seg, S.fhashes.data(), m, opt, S.franges.data());
+    for (size_t j = 0; j < m; ++j) out[S.fidx[j]] = S.franges[j];
+    return n - m;
+}
+
+// Postings одного запроса прямо из сегмента: dids декодируются в буфер на каждом
+// проходе, pos — точечно и только для кандидатов.
+struct SegmentPostings {
+    const MappedSegment& seg;
+    const std::vector<std::pair<size_t, size_t>>& item_ranges;
+    std::vector<uint32_t>& buf;
+
+    size_t size(uint32_t k) const { return item_ranges[k].second - item_ranges[k].first; }
+    const uint32_t* dids(uint32_t k) {
+        const auto [l, r] = item_ranges[k];
+        buf.resize(r - l);
+        seg.decode_dids(l, r, buf.data());
+        return buf.data();
+    }
+    uint32_t pos(uint32_t k, size_t j) const { return seg.pos_at(item_ranges[k].first + j); }
+};
+
+// Postings пакета: did каждого уникального хэша декодированы один раз,
+// item k запроса ссылается на уникальный хэш item_u[k]; pos — точечно, для кандидатов.
+struct BatchPostings {
+    const MappedSegment& seg;
+    const uint32_t* item_u;
+    const std::vector<std::pair<size_t, size_t>>& ur;
+    const std::vector<uint64_t>& uoff; // did хэша u: udids[uoff[u] .. uoff[u + 1])
+    const std::vector<uint32_t>& udids;
+
+    size_t size(uint32_t k) const { return (size_t)(uoff[item_u[k] + 1] - uoff[item_u[k]]); }
+    const uint32_t* dids(uint32_t k) const { return udids.data() + uoff[item_u[k]]; }
+    uint32_t pos(uint32_t k, size_t j) const { return seg.pos_at(ur[item_u[k]].first + j); }
+};
+
+// Stage A: hits per doc -> S.live и S.cand (top candidates_topn по hits).
+// S.begin() уже вызван; Postings: size(k), dids(k), pos(k, j) для q.items[k].
+// Weighted: заодно S.weight[did] = число точек Stage B у did (сумма |qpos|).
+template <bool Weighted, class Postings>
+static void select_candidates(
+    const QueryShingles& q,
+    const SearchOptions& opt,
+    uint32_t n_docs_safe,
+    const DeletedDocs& del,
+    SearchScratch& S,
+    Postings& P
+) {
+    SearchScratch::DocCounter* docs = S.docs.data();
+    uint32_t* weight = Weighted ? S.weight.data() : nullptr;
+    const uint32_t gen = S.gen;
 
     // -------------------------
     // Stage A: hits per doc
     // -------------------------
-    std::vector<uint32_t> hits(n_docs_safe, 0);
+    // Stage B проходит только по live (диапазоны уже найдены).
+    auto& live = S.live;
 
-    for (const auto& qi : q.items) {
-        auto [l, r] = range_for_hash_safe(seg.postings9, qi.h);
-        const uint64_t range_len = (uint64_t)(r - l);
+    for (uint32_t k = 0; k < (uint32_t)q.items.size(); ++k) {
+        const uint64_t range_len = (uint64_t)P.size(k);
         if (range_len == 0) continue;
         if (range_len > (uint64_t)opt.max_postings_per_hash) continue; // stop-hash
 
-        for (size_t i = l; i < r; ++i) {
-            uint32_t did = seg.postings9[i].did;
-            if (did < n_docs_safe) ++hits[did];
+        live.push_back(k);
+
+        const uint32_t n_qpos = (uint32_t)q.items[k].qpos.size();
+        const uint32_t* d = P.dids(k);
+        for (size_t j = 0; j < range_len; ++j) {
+            const uint32_t did = d[j];
+            if (did >= n_docs_safe) continue;
+            auto& c = docs[did];
+            if (c.gen != gen) {
+                c.gen = gen;
+                c.hits = 0;
+                if (Weighted) weight[did] = 0;
+                S.touched.push_back(did);
+            }
+            ++c.hits;
+            if (Weighted) weight[did] += n_qpos;
         }
     }
 
-    std::vector<uint32_t> cand;
-    cand.reserve(1024);
-    for (uint32_t did = 0; did < n_docs_safe; ++did) {
-        if (hits[did] >= opt.min_hits) cand.push_back(did);
+    // cand по возрастанию did (как при полном проходе): nth_element и итоговая
+    // сортировка по C нестабильны, от входного порядка зависит выбор при равных hits.
+    // Затронута заметная доля сегмента => линейный проход дешевле сортировки.
+    // Удалённые did кандидатами не становятся: слоты topN и Stage B — живым.
+    auto& cand = S.cand;
+    const bool has_del = del.any();
+    if ((uint64_t)S.touched.size() * 16 >= n_docs_safe) {
+        for (uint32_t did = 0; did < n_docs_safe; ++did) {
+            if (docs[did].gen == gen && docs[did].hits >= opt.min_hits && !(has_del && del.test(did))) cand.push_back(did);
+        }
+    } else {
+        for (const uint32_t did : S.touched) {
+            if (docs[did].hits >= opt.min_hits && !(has_del && del.test(did))) cand.push_back(did);
+        }
+        std::sort(cand.begin(), cand.end());
     }
-    if (cand.empty()) return out;
+    if (cand.empty()) return;
 
     const uint32_t topN = std::min<uint32_t>(opt.candidates_topn, (uint32_t)cand.size());
-    if (topN == 0) return out;
 
     // nth_element требует nth в [begin, end), а не == end
     if (cand.size() > topN) {
         std::nth_element(
             cand.begin(), cand.begin() + topN, cand.end(),
-            [&](uint32_t a, uint32_t b) { return hits[a] > hits[b]; }
+            [&](uint32_t a, uint32_t b) { return docs[a].hits > docs[b].hits; }
         );
-        cand.resize(topN);
-    } else {
-        cand.resize(topN);
     }
+    cand.resize(topN);
+}
 
-    std::unordered_set<uint32_t> cand_set;
-    cand_set.reserve(cand.size() * 2);
-    for (uint32_t did : cand) cand_set.insert(did);
+// Stage B: точки -> spans -> Hit для кандидатов S.cand по диапазонам S.live.
+template <class Postings>
+static std::vector<Hit> build_hits(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const QueryShingles& q,
+    const SearchOptions& opt,
+    uint32_t n_docs_safe,
+    SearchScratch& S,
+    Postings& P
+) {
+    std::vector<Hit> out;
+    const auto& cand = S.cand;
+    if (cand.empty()) return out;
 
-    // -------------------------
-    // Stage B: collect points and build spans
-    // -------------------------
-    std::unordered_map<uint32_t, std::vector<Point>> points_by_doc;
-    points_by_doc.reserve(cand.size() * 2);
+    SearchScratch::DocCounter* docs = S.docs.data();
+    const uint32_t gen = S.gen;
 
-    for (const auto& qi : q.items) {
-        auto [l, r] = range_for_hash_safe(seg.postings9, qi.h);
-        const uint64_t range_len = (uint64_t)(r - l);
-        if (range_len == 0) continue;
-        if (range_len > (uint64_t)opt.max_postings_per_hash) continue;
+    // hits больше не нужны: тот же счётчик => slot кандидата
+    for (const uint32_t did : S.touched) docs[did].hits = 0;
+    for (uint32_t i = 0; i < (uint32_t)cand.size(); ++i) docs[cand[i]] = SearchScratch::DocCounter{gen, i + 1};
 
-        for (size_t i = l; i < r; ++i) {
-            const auto& p = seg.postings9[i];
-            const uint32_t did = p.did;
-            if (did >= n_docs_safe) continue;
-            if (cand_set.find(did) == cand_set.end()) continue;
+    auto& pts = S.pts;
+    uint32_t q_max = 0, d_max = 0;
 
-            auto& vec = points_by_doc[did];
-            if (vec.capacity() < 64) vec.reserve(64);
+    for (const uint32_t k : S.live) {
+        const auto& qpos = q.items[k].qpos;
+        const size_t n = P.size(k);
+        const uint32_t* d = P.dids(k);
 
-            for (uint32_t qpos : qi.qpos) {
-                vec.push_back(Point{qpos, p.pos});
+        for (size_t j = 0; j < n; ++j) {
+            const uint32_t did = d[j];
+            if (did >= n_docs_safe) continue;
+            const auto& c = docs[did];
+            if (c.gen != gen || c.hits == 0) continue;
+            const uint32_t slot = c.hits - 1;
+
+            const uint32_t dpos = P.pos(k, j);
+            if (dpos > d_max) d_max = dpos;
+            for (uint32_t qp : qpos) {
+                pts.push_back(PointRec{slot, qp, dpos});
             }
+            if (!qpos.empty() && qpos.back() > q_max) q_max = qpos.back(); // qpos отсортированы
         }
     }
+    if (pts.empty()) return out;
+
+    sort_points(pts, S.pts_tmp, PointKey((uint32_t)cand.size(), q_max, d_max));
 
     out.reserve(cand.size());
+    std::vector<uint32_t> dids; // did out[i]
+    dids.reserve(cand.size());
 
-    for (uint32_t did : cand) {
-        auto it = points_by_doc.find(did);
-        if (it == points_by_doc.end()) continue;
+    auto& spans = S.spans;
 
-        auto& pts = it->second;
-        if (pts.empty()) continue;
+    for (size_t pl = 0; pl < pts.size();) {
+        const uint32_t slot = pts[pl].slot;
+        size_t pr = pl + 1;
+        while (pr < pts.size() && pts[pr].slot == slot) ++pr;
 
-        auto spans = build_spans_for_doc(pts, opt);
+        build_spans_for_slot(pts, pl, pr, opt, spans);
+        pl = pr;
         if (spans.empty()) continue;
 
+        const uint32_t did = cand[slot];
+
         uint32_t matched = 0;
         for (const auto& s : spans) matched += s.len_shingles;
 
         const uint32_t q_total = q.total_shingles;
-        const uint32_t d_total = doc_shingles_count(seg.docmeta[did].tok_len);
+        const uint32_t d_total = doc_shingles_count(seg.docmeta().tok_len(did));
 
         double cov_q = (q_total > 0) ? (double)matched / (double)q_total : 0.0;
         double cov_d = (d_total > 0) ? (double)matched / (double)d_total : 0.0;
@@ -238,17 +471,8 @@ std::vector<Hit> search_in_segment(
         if (score < 0.0) score = 0.0;
         if (score > 1.0) score = 1.0;
 
-        const auto& di = docinfo[did];
-
         Hit h;
-        h.doc_id = di.doc_id;
-        h.organization_id = di.organization_id;
-        h.external_id = di.external_id.empty() ? di.doc_id : di.external_id;
-        h.meta_path = di.meta_path.empty() ? seg.seg_dir.filename().string() + "/" : di.meta_path;
-
-        h.source_path = di.source_path;
-        h.source_name = di.source_name;
-        h.preview = di.preview_text;
+        dids.push_back(did);
 
         // debug metrics / explainability
         h.alpha = opt.alpha;
@@ -273,11 +497,241 @@ std::vector<Hit> search_in_segment(
         out.push_back(std::move(h));
     }
 
-    std::sort(out.begin(), out.end(), [](const Hit& a, const Hit& b) {
-        return a.C > b.C;
+    // порядок out меняется вместе с did: сортируем индексы
+    std::vector<uint32_t> order(out.size());
+    for (uint32_t i = 0; i < (uint32_t)order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (out[a].C != out[b].C) return out[a].C > out[b].C;
+        return dids[a] < dids[b]; // равные C — по did: порядок слотов (nth_element, c_upper) не влияет на top-k
     });
-    if (out.size() > opt.topk) out.resize(opt.topk);
+    if (order.size() > opt.topk) order.resize(opt.topk);
+
+    // DocInfo — только для вошедших в top-k
+    std::vector<Hit> top;
+    top.reserve(order.size());
+    for (const uint32_t i : order) {
+        Hit& h = out[i];
+        DocInfo di = docinfo.get(dids[i]);
+        h.doc_id = std::move(di.doc_id);
+        h.organization_id = std::move(di.organization_id);
+        h.external_id = di.external_id.empty() ? h.doc_id : std::move(di.external_id);
+        h.meta_path = di.meta_path.empty() ? seg.seg_dir().filename().string() + "/" : std::move(di.meta_path);
+        h.source_path = std::move(di.source_path);
+        h.source_name = std::move(di.source_name);
+        h.preview = std::move(di.preview_text);
+        top.push_back(std::move(h));
+    }
+    return top;
+}
+
+// Stage A + Stage B для одного запроса; S.begin() уже вызван.
+template <class Postings>
+static std::vector<Hit> score_query(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const QueryShingles& q,
+    const SearchOptions& opt,
+    uint32_t n_docs_safe,
+    SearchScratch& S,
+    Postings& P
+) {
+    select_candidates<false>(q, opt, n_docs_safe, seg.deleted(), S, P);
+    return build_hits(seg, docinfo, q, opt, n_docs_safe, S, P);
+}
+
+// Верхняя граница C (0..100) кандидата с weight точками Stage B: spans не длиннее
+// (points - 1) * (span_gap + 1) + 1, matched <= weight * (span_gap + 1).
+// < 0 => ни одного span >= span_min_len не получится.
+static double c_upper_bound(uint32_t weight, uint32_t q_total, uint32_t d_total, const SearchOptions& opt) {
+    const uint64_t step = (uint64_t)opt.span_gap + 1;
+    if (weight == 0 || ((uint64_t)weight - 1) * step + 1 < opt.span_min_len) return -1.0;
+    if (opt.alpha < 0.0 || opt.alpha > 1.0) return 100.0; // score не монотонен по matched
+
+    const double m = (double)((uint64_t)weight * step);
+    double cov_q = (q_total > 0) ? m / (double)q_total : 0.0;
+    double cov_d = (d_total > 0) ? m / (double)d_total : 0.0;
+    if (cov_q > 1.0) cov_q = 1.0;
+    if (cov_d > 1.0) cov_d = 1.0;
+
+    double score = opt.alpha * cov_q + (1.0 - opt.alpha) * cov_d;
+    if (score < 0.0) score = 0.0;
+    if (score > 1.0) score = 1.0;
+    return score * 100.0;
+}
+
+std::vector<Hit> search_in_segment(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const QueryShingles& q,
+    const SearchOptions& opt
+) {
+    const uint32_t n_docs = seg.n_docs();
+    if (n_docs == 0) return {};
+    if (seg.n_post9() == 0) return {};
+    if (q.items.empty() || q.total_shingles == 0) return {};
+    if (docinfo.empty()) return {};
+
+    const uint32_t n_docs_safe = std::min<uint32_t>(n_docs, (uint32_t)docinfo.size());
+    if (n_docs_safe == 0) return {};
 
+    SearchScratch& S = search_scratch();
+    S.begin(n_docs_safe);
+
+    // диапазоны ищем один раз: q.items отсортированы по h
+    const size_t n_items = q.items.size();
+    S.qhashes.resize(n_items);
+    for (size_t k = 0; k < n_items; ++k) S.qhashes[k] = q.items[k].h;
+    S.item_ranges.resize(n_items);
+    if (lookup_ranges(seg, S.qhashes.data(), n_items, opt, S, S.item_ranges.data()) == n_items) return {};
+
+    SegmentPostings P{seg, S.item_ranges, S.dids};
+    auto out = score_query(seg, docinfo, q, opt, n_docs_safe, S, P);
+    S.trim();
+    return out;
+}
+
+SegmentCandidates collect_candidates(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const QueryShingles& q,
+    const SearchOptions& opt
+) {
+    SegmentCandidates sc;
+
+    const uint32_t n_docs = seg.n_docs();
+    if (n_docs == 0 || seg.n_post9() == 0 || docinfo.empty()) return sc;
+    if (q.items.empty() || q.total_shingles == 0) return sc;
+    const uint32_t n_docs_safe = std::min<uint32_t>(n_docs, (uint32_t)docinfo.size());
+    if (n_docs_safe == 0) return sc;
+
+    SearchScratch& S = search_scratch();
+    S.begin(n_docs_safe);
+    if (S.weight.size() < n_docs_safe) S.weight.resize(n_docs_safe);
+
+    const size_t n_items = q.items.size();
+    S.qhashes.resize(n_items);
+    for (size_t k = 0; k < n_items; ++k) S.qhashes[k] = q.items[k].h;
+    S.item_ranges.resize(n_items);
+    sc.filter.hashes = n_items;
+    sc.filter.skipped = lookup_ranges(seg, S.qhashes.data(), n_items, opt, S, S.item_ranges.data());
+    if (sc.filter.skipped == n_items) return sc; // фильтр отсеял весь запрос
+
+    SegmentPostings P{seg, S.item_ranges, S.dids};
+    select_candidates<true>(q, opt, n_docs_safe, seg.deleted(), S, P);
+    if (S.cand.empty()) return sc;
+
+    sc.items = S.live;
+    sc.ranges.reserve(S.live.size());
+    for (const uint32_t k : S.live) sc.ranges.push_back(S.item_ranges[k]);
+
+    sc.dids = S.cand;
+    sc.c_upper.reserve(S.cand.size());
+    for (const uint32_t did : S.cand) {
+        const uint32_t d_total = doc_shingles_count(seg.docmeta().tok_len(did));
+        sc.c_upper.push_back(c_upper_bound(S.weight[did], q.total_shingles, d_total, opt));
+    }
+    return sc;
+}
+
+std::vector<Hit> verify_candidates(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const QueryShingles& q,
+    const SearchOptions& opt,
+    const SegmentCandidates& sc,
+    const std::vector<uint32_t>& which
+) {
+    if (which.empty() || sc.items.empty()) return {};
+    const uint32_t n_docs_safe = std::min<uint32_t>(seg.n_docs(), (uint32_t)docinfo.size());
+
+    SearchScratch& S = search_scratch();
+    S.begin(n_docs_safe);
+
+    // диапазоны из Stage A; остальные items в Stage B не участвуют
+    S.item_ranges.assign(q.items.size(), {0, 0});
+    for (size_t i = 0; i < sc.items.size(); ++i) S.item_ranges[sc.items[i]] = sc.ranges[i];
+    S.live = sc.items;
+    for (const uint32_t i : which) S.cand.push_back(sc.dids[i]);
+
+    SegmentPostings P{seg, S.item_ranges, S.dids};
+    auto out = build_hits(seg, docinfo, q, opt, n_docs_safe, S, P);
+    S.trim();
+    return out;
+}
+
+std::vector<std::vector<Hit>> search_in_segment_batch(
+    const MappedSegment& seg,
+    const DocInfoStore& docinfo,
+    const std::vector<QueryShingles>& qs,
+    const SearchOptions& opt,
+    std::vector<HashFilterStats>* filter_stats
+) {
+    std::vector<std::vector<Hit>> out(qs.size());
+    if (filter_stats) filter_stats->assign(qs.size(), HashFilterStats{});
+
+    const uint32_t n_docs = seg.n_docs();
+    if (n_docs == 0 || seg.n_post9() == 0 || docinfo.empty()) return out;
+    const uint32_t n_docs_safe = std::min<uint32_t>(n_docs, (uint32_t)docinfo.size());
+    if (n_docs_safe == 0) return out;
+
+    SearchScratch& S = search_scratch();
+
+    // диапазоны каждого запроса (как в search_in_segment); сквозной индекс item
+    std::vector<size_t> item_base(qs.size() + 1, 0);
+    for (size_t i = 0; i < qs.size(); ++i) item_base[i + 1] = item_base[i] + qs[i].items.size();
+    const size_t total_items = item_base.back();
+    if (total_items == 0) return out;
+
+    std::vector<std::pair<size_t, size_t>> item_ranges(total_items);
+    for (size_t i = 0; i < qs.size(); ++i) {
+        const auto& items = qs[i].items;
+        S.qhashes.resize(items.size());
+        for (size_t k = 0; k < items.size(); ++k) S.qhashes[k] = items[k].h;
+        const size_t skipped = lookup_ranges(seg, S.qhashes.data(), items.size(), opt, S,
+                                             item_ranges.data() + item_base[i]);
+        if (filter_stats) (*filter_stats)[i] = HashFilterStats{items.size(), skipped};
+    }
+
+    // общие хэши запросов = одинаковые диапазоны: группируем найденные по l
+    // (radix по смещению postings — только значимые байты), уникальный диапазон => u
+    std::vector<KeyItem> found, found_tmp;
+    for (size_t t = 0; t < total_items; ++t) {
+        const size_t len = item_ranges[t].second - item_ranges[t].first;
+        if (len == 0 || len > opt.max_postings_per_hash) continue; // пусто / stop-hash
+        found.push_back(KeyItem{(uint64_t)item_ranges[t].first, (uint32_t)t});
+    }
+    sort_key_items(found, found_tmp);
+
+    // ненайденные и stop-hash указывают на последний u — пустой диапазон
+    std::vector<std::pair<size_t, size_t>> ur;
+    std::vector<uint32_t> item_u(total_items, UINT32_MAX);
+    for (const auto& e : found) {
+        if (ur.empty() || ur.back().first != e.key) ur.push_back(item_ranges[e.item]);
+        item_u[e.item] = (uint32_t)(ur.size() - 1);
+    }
+    const uint32_t u_none = (uint32_t)ur.size();
+    ur.push_back({0, 0});
+    for (auto& u : item_u) {
+        if (u == UINT32_MAX) u = u_none;
+    }
+
+    // один проход по postings: did каждого уникального диапазона декодируются один раз
+    std::vector<uint64_t> uoff(ur.size() + 1, 0);
+    for (size_t u = 0; u < ur.size(); ++u) uoff[u + 1] = uoff[u] + (ur[u].second - ur[u].first);
+    std::vector<uint32_t> udids((size_t)uoff.back());
+    for (size_t u = 0; u < u_none; ++u) {
+        seg.decode_dids(ur[u].first, ur[u].second, udids.data() + uoff[u]);
+    }
+
+    for (size_t i = 0; i < qs.size(); ++i) {
+        const auto& q = qs[i];
+        if (q.items.empty() || q.total_shingles == 0) continue;
+
+        S.begin(n_docs_safe);
+        BatchPostings P{seg, item_u.data() + item_base[i], ur, uoff, udids};
+        out[i] = score_query(seg, docinfo, q, opt, n_docs_safe, S, P);
+    }
+    S.trim();
     return out;
 }
 
@@ -0,0 +1,230 @@
+// Back_L5/cpp/src/segment_cache.cpp
+#include "l5/segment_cache.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace l5 {
+
+bool load_segment(const std::filesystem::path& seg_dir,
+                  LoadedSegment& out,
+                  std::string* err,
+                  bool hash_directory,
+                  bool near_dup) {
+    out.segment_name = seg_dir.filename().string();
+    if (!map_segment_bin(seg_dir, out.seg, err)) return false;
+    if (!open_docinfo(seg_dir, out.docinfo, err)) return false;
+    {
+        // bloom и stop-hash — только ускорение: без них сегмент ищется так же
+        std::string f_err;
+        if (!out.seg.load_hash_filter(&f_err)) std::cerr << "[l5] bloom ignored: " << f_err << "\n";
+        if (!out.seg.load_stop_hashes(&f_err)) std::cerr << "[l5] df ignored: " << f_err << "\n";
+    }
+    if (!out.seg.load_deleted(err)) return false;
+    if (hash_directory) out.seg.build_hash_directory();
+    if (near_dup) out.near_dup.build(out.seg.docmeta());
+    out.bytes = (uint64_t)out.seg.mapped_bytes() + out.seg.hash_directory().bytes() +
+                out.seg.hash_filter().bytes() + out.seg.stop_hashes().bytes() + out.seg.deleted().bytes() + out.near_dup.bytes() +
+                out.docinfo.bytes();
+    return true;
+}
+
+static std::string cache_key(const std::string& scope, const SegmentEntry& e) {
+    std::string key;
+    key.reserve(scope.size() + e.segment_name.size() + e.built_at_utc.size() + 2);
+    key += scope;
+    key.push_back('\0');
+    key += e.segment_name;
+    key.push_back('\0');
+    key += e.built_at_utc; // пересозданный сегмент с тем же именем => другой ключ
+    return key;
+}
+
+SegmentCache::SegmentCache(uint64_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+std::shared_ptr<const LoadedSegment> SegmentCache::get(const std::string& scope,
+                                                       const std::filesystem::path& out_root,
+                                                       const SegmentEntry& e,
+                                                       std::string* err) {
+    std::string key = cache_key(scope, e);
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = map_.find(key);
+        if (it != map_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+            ++st_.hits;
+            return it->second.seg;
+        }
+        ++st_.misses;
+    }
+
+    // грузим вне lock: mmap O(1), но директория/near_dup (и docids.json старых сегментов) строятся долго
+    auto ls = std::make_shared<LoadedSegment>();
+    if (!load_segment(out_root / e.segment_name, *ls, err)) {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++st_.load_failures;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+        // параллельный запрос успел первым — отдаём его копию
+        lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+        return it->second.seg;
+    }
+
+    lru_.push_front(key);
+    Entry en;
+    en.seg = ls;
+    en.lru_it = lru_.begin();
+    en.scope = scope;
+    bytes_ += ls->bytes;
+    map_.emplace(std::move(key), std::move(en));
+
+    evict_locked();
+    return ls;
+}
+
+std::shared_ptr<const LoadedSegment> SegmentCache::peek(const std::string& scope, const SegmentEntry& e) const {
+    const std::string key = cache_key(scope, e);
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = map_.find(key);
+    return it != map_.end() ? it->second.seg : nullptr;
+}
+
+Manifest SegmentCache::manifest(const std::filesystem::path& out_root) {
+    const auto p = out_root / "level5_manifest.json";
+    const std::string key = out_root.string();
+
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(p, ec);
+    const uintmax_t size = ec ? 0 : std::filesystem::file_size(p, ec);
+    if (ec) {
+        std::lock_guard<std::mutex> lk(mu_);
+        manifests_.erase(key);
+        return Manifest{};
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = manifests_.find(key);
+        if (it != manifests_.end() && it->second.mtime == mtime && it->second.size == size) {
+            ++st_.manifest_hits;
+            return it->second.m;
+        }
+    }
+
+    Manifest m = load_manifest(out_root);
+
+    std::lock_guard<std::mutex> lk(mu_);
+    ++st_.manifest_loads;
+    auto& me = manifests_[key];
+    me.mtime = mtime;
+    me.size = size;
+    me.m = m;
+    return m;
+}
+
+std::shared_ptr<const StopHashes> SegmentCache::org_stop_hashes(const std::filesystem::path& out_root) {
+    const auto p = out_root / "level5_stop_hashes.df";
+    const std::string key = out_root.string();
+
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(p, ec);
+    const uintmax_t size = ec ? 0 : std::filesystem::file_size(p, ec);
+    if (ec) {
+        std::lock_guard<std::mutex> lk(mu_);
+        org_stops_.erase(key);
+        return std::make_shared<const StopHashes>();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = org_stops_.find(key);
+        if (it != org_stops_.end() && it->second.mtime == mtime && it->second.size == size) return it->second.stop;
+    }
+
+    auto stop = std::make_shared<StopHashes>();
+    std::string err;
+    if (!load_org_stop_hashes(out_root, *stop, &err)) *stop = StopHashes{};
+
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& se = org_stops_[key];
+    se.mtime = mtime;
+    se.size = size;
+    se.stop = stop;
+    return stop;
+}
+
+void SegmentCache::invalidate_scope(const std::string& scope) {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto it = map_.begin(); it != map_.end();) {
+        if (it->second.scope == scope) {
+            bytes_ -= it->second.seg->bytes;
+            lru_.erase(it->second.lru_it);
+            it = map_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SegmentCache::invalidate_segments(const std::string& scope, const std::vector<std::string>& segment_names) {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto it = map_.begin(); it != map_.end();) {
+        // ключ = scope \0 segment_name \0 built_at_utc
+        const std::string& key = it->first;
+        const size_t b = scope.size() + 1;
+        const size_t e = key.find('\0', b);
+        const bool hit = it->second.scope == scope && e != std::string::npos &&
+                         std::find(segment_names.begin(), segment_names.end(), key.substr(b, e - b)) != segment_names.end();
+        if (hit) {
+            bytes_ -= it->second.seg->bytes;
+            lru_.erase(it->second.lru_it);
+            it = map_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SegmentCache::clear() {
+    std::lock_guard<std::mutex> lk(mu_);
+    map_.clear();
+    lru_.clear();
+    manifests_.clear();
+    org_stops_.clear();
+    bytes_ = 0;
+}
+
+void SegmentCache::set_budget(uint64_t budget_bytes) {
+    std::lock_guard<std::mutex> lk(mu_);
+    budget_bytes_ = budget_bytes;
+    evict_locked();
+}
+
+SegmentCacheStats SegmentCache::stats() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    SegmentCacheStats s = st_;
+    s.entries = map_.size();
+    s.bytes = bytes_;
+    s.budget_bytes = budget_bytes_;
+    return s;
+}
+
+void SegmentCache::evict_locked() {
+    // самый свежий сегмент не вытесняем, даже если он один больше бюджета
+    while (bytes_ > budget_bytes_ && lru_.size() > 1) {
+        auto it = map_.find(lru_.back());
+        lru_.pop_back();
+        if (it == map_.end()) continue;
+        bytes_ -= it->second.seg->bytes;
+        map_.erase(it);
+        ++st_.evictions;
+    }
+}
+
+} // namespace l5
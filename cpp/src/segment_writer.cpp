@@ -0,0 +1,288 @@
+// Back_L5/cpp/src/segment_writer.cpp
+#include "l5/segment_writer.h"
+#include "l5/errors.h"
+#include "l5/hash_filter.h"
+#include "l5/mapped_segment.h"
+
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+void SegmentWriter::Section::open(const fs::path& p) {
+    path = p;
+    out.open(p, std::ios::binary | std::ios::trunc);
+    if (!out) throw L5Exception("cannot open section tmp: " + p.string());
+    buf.reserve(1u << 20);
+}
+
+void SegmentWriter::Section::flush() {
+    if (buf.empty()) return;
+    out.write(reinterpret_cast<const char*>(buf.data()), (std::streamsize)buf.size());
+    if (!out) throw L5Exception("section write failed: " + path.string());
+    buf.clear();
+}
+
+void SegmentWriter::Section::close() {
+    if (!out.is_open()) return;
+    flush();
+    out.close();
+}
+
+SegmentWriter::SegmentWriter(const fs::path& bin_path, const fs::path& tmp_dir,
+                             uint32_t version, uint32_t posting_codec, HashScheme hash_scheme)
+    : bin_path_(bin_path), version_(version), codec_(version == FORMAT_V2 ? POSTING_CODEC_RAW : posting_codec),
+      scheme_(version == FORMAT_V2 ? HashScheme{} : hash_scheme) {
+    if (version_ != FORMAT_V2 && version_ != FORMAT_V3) {
+        throw L5Exception("unsupported index format version: " + std::to_string(version_));
+    }
+    if (codec_ != POSTING_CODEC_RAW && codec_ != POSTING_CODEC_BP128) {
+        throw L5Exception("unsupported posting codec: " + std::to_string(codec_));
+    }
+    if ((scheme_.token_hash != TOKEN_HASH_FNV1A && scheme_.token_hash != TOKEN_HASH_WYHASH) ||
+        (scheme_.shingle_hash != SHINGLE_HASH_COMBINE && scheme_.shingle_hash != SHINGLE_HASH_ROLLING)) {
+        throw L5Exception("unsupported hash scheme: token_hash=" + std::to_string(scheme_.token_hash) +
+                          " shingle_hash=" + std::to_string(scheme_.shingle_hash));
+    }
+
+    std::error_code ec;
+    fs::create_directories(tmp_dir, ec);
+
+    const std::string pfx = bin_path.filename().string() + ".";
+    docmeta_.open(tmp_dir / (pfx + "docmeta"));
+    if (version_ == FORMAT_V2) {
+        post9_.open(tmp_dir / (pfx + "post9"));
+    } else {
+        hashes_.open(tmp_dir / (pfx + "hashes"));
+        starts_.open(tmp_dir / (pfx + "starts"));
+        select_.open(tmp_dir / (pfx + "select"));
+        if (codec_ == POSTING_CODEC_BP128) {
+            blkmeta_.open(tmp_dir / (pfx + "blkmeta"));
+            blkdata_.open(tmp_dir / (pfx + "blkdata"));
+        } else {
+            did_.open(tmp_dir / (pfx + "did"));
+            pos_.open(tmp_dir / (pfx + "pos"));
+        }
+    }
+}
+
+SegmentWriter::~SegmentWriter() {
+    for (Section* s : {&docmeta_, &post9_, &hashes_, &starts_, &select_, &did_, &pos_, &blkmeta_, &blkdata_}) {
+        if (s->out.is_open()) s->out.close();
+        if (s->path.empty()) continue;
+        std::error_code ec;
+        fs::remove(s->path, ec);
+    }
+}
+
+void SegmentWriter::add_docmeta(const DocMeta& dm) {
+    // по полям (padding-safe)
+    docmeta_.put(&dm.tok_len, sizeof(dm.tok_len));
+    docmeta_.put(&dm.simhash_hi, sizeof(dm.simhash_hi));
+    docmeta_.put(&dm.simhash_lo, sizeof(dm.simhash_lo));
+    ++n_docs_;
+}
+
+void SegmentWriter::add_postings(const Posting9* p, size_t n) {
+    if (finished_) throw L5Exception("SegmentWriter: add after finish");
+
+    for (size_t i = 0; i < n; ++i) {
+        const Posting9& x = p[i];
+
+        const bool new_hash = !has_last_ || x.h != last_.h;
+        if (has_last_) {
+            const bool ordered = x.h > last_.h ||
+                                 (x.h == last_.h && (x.did > last_.did ||
+                                                     (x.did == last_.did && x.pos >= last_.pos)));
+            if (!ordered) throw L5Exception("SegmentWriter: postings not sorted by (h,did,pos)");
+        }
+        last_ = x;
+        has_last_ = true;
+        if (df_on_) df_.add(x.h, x.did);
+
+        if (version_ == FORMAT_V2) {
+            post9_.put(&x.h, sizeof(x.h));
+            post9_.put(&x.did, sizeof(x.did));
+            post9_.put(&x.pos, sizeof(x.pos));
+            ++n_post9_;
+            continue;
+        }
+
+        if (new_hash) {
+            if (n_hashes_ % StartsView::kSampleRate == 0) select_.put(&n_post9_, sizeof(n_post9_));
+            hashes_.put(&x.h, sizeof(x.h));
+            start_word_ |= 1ull << (n_post9_ & 63);
+            ++n_hashes_;
+        }
+        if (codec_ == POSTING_CODEC_BP128) {
+            if (new_hash && blk_n_ > 0) blk_inner_start_ = true;
+            blk_did_[blk_n_] = x.did;
+            blk_pos_[blk_n_] = x.pos;
+            if (++blk_n_ == bp128::kBlock) flush_block();
+        } else {
+            did_.put(&x.did, sizeof(x.did));
+            pos_.put(&x.pos, sizeof(x.pos));
+        }
+
+        ++n_post9_;
+        if ((n_post9_ & 63) == 0) {
+            starts_.put(&start_word_, sizeof(start_word_));
+            start_word_ = 0;
+        }
+    }
+}
+
+void SegmentWriter::flush_block() {
+    if (blk_n_ == 0) return;
+
+    bp128::BlockMeta m;
+    bp128::encode_block(blk_did_, blk_pos_, blk_n_, blk_inner_start_, m, blk_buf_);
+    m.data_off = blkdata_.bytes;
+
+    unsigned char mb[bp128::kMetaBytes];
+    bp128::write_meta(m, mb);
+    blkmeta_.put(mb, sizeof(mb));
+    blkdata_.put(blk_buf_.data(), blk_buf_.size());
+
+    blk_n_ = 0;
+    blk_inner_start_ = false;
+}
+
+void SegmentWriter::append_section(std::ofstream& out, Section& s, uint64_t off, uint64_t& cur) {
+    static const char zeros[V3_SECTION_ALIGN] = {};
+    if (off < cur || off - cur > V3_SECTION_ALIGN) throw L5Exception("SegmentWriter: bad section offset");
+    out.write(zeros, (std::streamsize)(off - cur));
+    cur = off;
+
+    s.close();
+    if (s.bytes == 0) return;
+
+    std::ifstream in(s.path, std::ios::binary);
+    if (!in) throw L5Exception("cannot open section tmp for read: " + s.path.string());
+
+    std::vector<char> buf(1u << 20);
+    uint64_t copied = 0;
+    while (in) {
+        in.read(buf.data(), (std::streamsize)buf.size());
+        const std::streamsize got = in.gcount();
+        if (got > 0) {
+            out.write(buf.data(), got);
+            copied += (uint64_t)got;
+        }
+    }
+    if (!out) throw L5Exception("failed writing section to " + bin_path_.string());
+    if (copied != s.bytes) throw L5Exception("section size mismatch: " + s.path.string());
+    cur += copied;
+}
+
+void SegmentWriter::finish() {
+    if (finished_) return;
+    finished_ = true;
+
+    if (df_on_) {
+        df_table_.scheme = scheme_;
+        df_table_.n_docs = n_docs_;
+        df_table_.entries = df_.finish();
+        df_table_.n_hashes = df_.n_hashes();
+    }
+
+    std::ofstream out(bin_path_, std::ios::binary | std::ios::trunc);
+    if (!out) throw L5Exception("cannot open " + bin_path_.string());
+
+    if (version_ == FORMAT_V2) {
+        HeaderV2 h{};
+        std::memcpy(h.magic, "PLAG", 4);
+        h.version = FORMAT_V2;
+        h.n_docs = n_docs_;
+        h.n_post9 = n_post9_;
+        h.n_post13 = 0;
+        if (!write_header_v2(out, h)) throw L5Exception("write header failed");
+
+        uint64_t cur = HEADER_V2_BYTES;
+        append_section(out, docmeta_, cur, cur);
+        append_section(out, post9_, cur, cur);
+    } else {
+        if ((n_post9_ & 63) != 0) starts_.put(&start_word_, sizeof(start_word_));
+        if (codec_ == POSTING_CODEC_BP128) {
+            flush_block();
+            static const unsigned char pad[bp128::kTailPad] = {};
+            blkdata_.put(pad, sizeof(pad)); // декодеры читают за концом блока
+        }
+
+        HeaderV3 h{};
+        std::memcpy(h.magic, "PLAG", 4);
+        h.version = FORMAT_V3;
+        h.header_bytes = (uint32_t)HEADER_V3_BYTES;
+        h.n_docs = n_docs_;
+        h.n_post9 = n_post9_;
+        h.n_hashes = n_hashes_;
+        h.posting_codec = codec_;
+        h.token_hash = scheme_.token_hash;
+        h.shingle_hash = scheme_.shingle_hash;
+
+        h.docmeta_off = HEADER_V3_BYTES;
+        h.hashes_off = align_up(h.docmeta_off + docmeta_.bytes, V3_SECTION_ALIGN);
+        h.starts_off = align_up(h.hashes_off + hashes_.bytes, V3_SECTION_ALIGN);
+        h.select_off = align_up(h.starts_off + starts_.bytes, V3_SECTION_ALIGN);
+        const uint64_t posting_start = align_up(h.select_off + select_.bytes, V3_SECTION_ALIGN);
+        if (codec_ == POSTING_CODEC_BP128) {
+            h.block_meta_off = posting_start;
+            h.block_data_off = align_up(h.block_meta_off + blkmeta_.bytes, V3_SECTION_ALIGN);
+        } else {
+            h.did_off = posting_start;
+            h.pos_off = align_up(h.did_off + did_.bytes, V3_SECTION_ALIGN);
+        }
+
+        if (!write_header_v3(out, h)) throw L5Exception("write header failed");
+
+        uint64_t cur = HEADER_V3_BYTES;
+        append_section(out, docmeta_, h.docmeta_off, cur);
+        append_section(out, hashes_, h.hashes_off, cur);
+        append_section(out, starts_, h.starts_off, cur);
+        append_section(out, select_, h.select_off, cur);
+        if (codec_ == POSTING_CODEC_BP128) {
+            append_section(out, blkmeta_, h.block_meta_off, cur);
+            append_section(out, blkdata_, h.block_data_off, cur);
+        } else {
+            append_section(out, did_, h.did_off, cur);
+            append_section(out, pos_, h.pos_off, cur);
+        }
+    }
+
+    out.flush();
+    if (!out) throw L5Exception("write failed " + bin_path_.string());
+}
+
+void write_segment_sidecars(const fs::path& seg_dir, const SegmentWriter& writer, const SidecarOptions& opt) {
+    // bloom: по готовому index_native.bin (различные хэши = словарь V3)
+    if (opt.bloom_bits_per_key > 0) {
+        MapOptions mo;
+        mo.advise = false;
+        MappedSegment m;
+        std::string err;
+        if (!map_segment_bin(seg_dir, m, &err, mo)) throw L5Exception("bloom: " + err);
+
+        HashFilter f;
+        build_hash_filter(m, f, opt.bloom_bits_per_key);
+        const fs::path bloom_tmp = seg_dir / "index_native.bloom.tmp";
+        if (!f.write_file(bloom_tmp, &err)) throw L5Exception("bloom: " + err);
+        if (!atomic_replace_file_best_effort(bloom_tmp, seg_dir / "index_native.bloom")) {
+            throw L5Exception("atomic replace failed (bloom)");
+        }
+    }
+
+    // DF + stop-hash: посчитаны по ходу записи отсортированных postings
+    if (opt.df_max_entries > 0) {
+        DfTable dt = writer.doc_freq();
+        dt.stop_df = stop_df_threshold(dt.entries, dt.n_hashes, opt.stop_df_percentile, opt.stop_min_df);
+        std::string err;
+        const fs::path df_tmp = seg_dir / "index_native.df.tmp";
+        if (!write_df_file(df_tmp, dt, &err)) throw L5Exception("df: " + err);
+        if (!atomic_replace_file_best_effort(df_tmp, seg_dir / "index_native.df")) {
+            throw L5Exception("atomic replace failed (df)");
+        }
+    }
+}
+
+} // namespace l5
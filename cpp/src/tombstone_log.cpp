@@ -0,0 +1,74 @@
+// Back_L5/cpp/src/tombstone_log.cpp
+#include "l5/tombstone_log.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace l5 {
+
+static constexpr char kTombMagic[4] = {'L', '5', 'T', 'B'};
+
+void write_tombstone_log_header(std::ostream& out) {
+    out.write(kTombMagic, 4);
+    out.write(reinterpret_cast<const char*>(&TOMBSTONE_LOG_VERSION), 4);
+}
+
+void write_tombstone_record(std::ostream& out, std::string_view doc_id) {
+    const uint32_t n = (uint32_t)doc_id.size();
+    out.write(reinterpret_cast<const char*>(&n), 4);
+    out.write(doc_id.data(), (std::streamsize)doc_id.size());
+}
+
+bool read_tombstone_log(const fs::path& p, std::vector<std::string>& doc_ids, uint64_t* valid_bytes,
+                        std::string* err) {
+    doc_ids.clear();
+    if (valid_bytes) *valid_bytes = 0;
+
+    std::error_code ec;
+    const uint64_t file_bytes = fs::file_size(p, ec);
+    std::ifstream in(p, std::ios::binary);
+    if (ec || !in) {
+        if (err) *err = "cannot open " + p.string();
+        return false;
+    }
+
+    char want[TOMBSTONE_LOG_HEADER_BYTES];
+    std::memcpy(want, kTombMagic, 4);
+    std::memcpy(want + 4, &TOMBSTONE_LOG_VERSION, 4);
+
+    char hb[TOMBSTONE_LOG_HEADER_BYTES];
+    in.read(hb, sizeof(hb));
+    const size_t got = (size_t)in.gcount();
+    if (got < sizeof(hb)) {
+        // падение в первом append (заголовок + запись одним потоком): пустой или
+        // недописанный заголовок — оборванный хвост с нулевой длиной, а не чужой файл
+        if (std::memcmp(hb, want, got) == 0) return true;
+        if (err) *err = "bad tombstones log: " + p.string();
+        return false;
+    }
+    if (std::memcmp(hb, want, sizeof(hb)) != 0) {
+        if (err) *err = "bad tombstones log: " + p.string();
+        return false;
+    }
+
+    uint64_t valid = TOMBSTONE_LOG_HEADER_BYTES;
+    std::string s;
+    while (true) {
+        uint32_t n = 0;
+        in.read(reinterpret_cast<char*>(&n), 4);
+        if (in.gcount() != 4) break;
+        // длина за концом файла — тот же оборванный хвост (не верим ей при resize)
+        if (n > file_bytes - valid - 4) break;
+        s.resize(n);
+        in.read(s.data(), (std::streamsize)n);
+        if (in.gcount() != (std::streamsize)n) break;
+        doc_ids.push_back(s);
+        valid += 4 + (uint64_t)n;
+    }
+    if (valid_bytes) *valid_bytes = valid;
+    return true;
+}
+
+} // namespace l5
@@ -1,19 +1,22 @@
 // Back_L5/cpp/src/validator.cpp
 #include "l5/validator.h"
 #include "l5/reader.h"
+#include "l5/mapped_segment.h"
 #include "l5/manifest.h"
 #include "l5/format.h"
 #include "l5/docinfo.h"
+#include "l5/docinfo_store.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <sstream>
 
 namespace l5 {
 
-static bool is_sorted_postings(const std::vector<Posting9>& p) {
+static bool is_sorted_postings(const PostingsView& p) {
     for (size_t i = 1; i < p.size(); ++i) {
-        const auto& a = p[i - 1];
-        const auto& b = p[i];
+        const Posting9 a = p[i - 1];
+        const Posting9 b = p[i];
         if (a.h > b.h) return false;
         if (a.h == b.h && a.did > b.did) return false;
         if (a.h == b.h && a.did == b.did && a.pos > b.pos) return false;
@@ -21,48 +24,192 @@ static bool is_sorted_postings(const std::vector<Posting9>& p) {
     return true;
 }
 
+static bool is_start(const StartsView& st, size_t i) { return (st.word(i >> 6) >> (i & 63)) & 1; }
+
+// V3: starts согласован с n_hashes и select, словарь строго возрастает.
+static bool check_v3_dictionary(const MappedSegment& seg, bool check_sorted, std::vector<std::string>& errors) {
+    const auto& hs = seg.hashes();
+    const auto& st = seg.starts();
+    const size_t n = (size_t)seg.n_post9();
+
+    if (n > 0 && !is_start(st, 0)) {
+        errors.push_back("starts bitmap: posting 0 does not start a range");
+        return false;
+    }
+
+    uint64_t ones = 0;
+    const size_t words = (n + 63) / 64;
+    for (size_t w = 0; w < words; ++w) {
+        const uint64_t x = st.word(w);
+        const size_t tail = n - w * 64;
+        if (tail < 64 && (x >> tail)) {
+            errors.push_back("starts bitmap: bits set past n_post9");
+            return false;
+        }
+        ones += (uint64_t)__builtin_popcountll(x);
+    }
+    if (ones != hs.size()) {
+        errors.push_back("starts bitmap popcount != n_hashes");
+        return false;
+    }
+
+    // select-сэмплы: первая позиция каждого блока из 64 хэшей
+    if (!st.check_samples()) {
+        errors.push_back("select samples: not increasing, past n_post9 or not on a range start");
+        return false;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!is_start(st, i)) continue;
+        if (k % StartsView::kSampleRate == 0 && st.select(k) != i) {
+            errors.push_back("select samples inconsistent with starts bitmap");
+            return false;
+        }
+        ++k;
+    }
+
+    if (check_sorted) {
+        for (size_t k2 = 1; k2 < hs.size(); ++k2) {
+            if (hs.h(k2 - 1) >= hs.h(k2)) {
+                errors.push_back("hash dictionary is not strictly increasing");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// BP128: блоки идут подряд, ширины <= 32, delta только без начала h внутри блока.
+// Проверяется до декодирования: битые смещения иначе читают за пределами файла.
+static bool check_bp128_blocks(const MappedSegment& seg, std::vector<std::string>& errors) {
+    const auto& bv = seg.blocks();
+    const auto& st = seg.starts();
+    const size_t n = bv.size();
+
+    uint64_t off = 0;
+    for (size_t blk = 0; blk < bv.blocks(); ++blk) {
+        const auto m = bv.stored_meta(blk);
+        if (m.did_bits > 32 || m.pos_bits > 32) {
+            errors.push_back("bp128 block " + std::to_string(blk) + ": bit width > 32");
+            return false;
+        }
+        if (m.data_off != off) {
+            errors.push_back("bp128 block " + std::to_string(blk) + ": data offset mismatch");
+            return false;
+        }
+        off += bp128::packed_bytes(m.did_bits) + bp128::packed_bytes(m.pos_bits);
+
+        if (m.did_delta) {
+            const size_t b = blk * bp128::kBlock;
+            const size_t e = std::min(n, b + bp128::kBlock);
+            for (size_t i = b + 1; i < e; ++i) {
+                if (is_start(st, i)) {
+                    errors.push_back("bp128 block " + std::to_string(blk) + ": delta block spans hash ranges");
+                    return false;
+                }
+            }
+        }
+    }
+    if (off + bp128::kTailPad > bv.data_bytes()) {
+        errors.push_back("bp128 blocks run past the data section");
+        return false;
+    }
+    return true;
+}
+
 ValidationResult validate_segment(const std::filesystem::path& seg_dir, bool check_sorted) {
     ValidationResult vr;
-    SegmentData seg;
+    MappedSegment seg;
     std::string err;
 
-    if (!load_segment_bin(seg_dir, seg, &err)) {
+    MapOptions mo;
+    mo.advise = false; // полный последовательный проход
+    if (!map_segment_bin(seg_dir, seg, &err, mo)) {
         vr.errors.push_back(err);
         vr.ok = false;
         return vr;
     }
 
-    std::vector<DocInfo> docinfo;
-    if (!load_docids_json(seg_dir, docinfo, &err)) {
+    // то, что читает поиск: index_native.docinfo (или json старых сегментов)
+    DocInfoStore docinfo;
+    if (!open_docinfo(seg_dir, docinfo, &err) || !docinfo.check(&err)) {
         vr.errors.push_back(err);
     }
 
-    if (docinfo.size() != seg.header.n_docs) {
+    if (docinfo.size() != seg.n_docs()) {
         std::ostringstream oss;
         oss << "docids size mismatch: docinfo=" << docinfo.size()
-            << " header.n_docs=" << seg.header.n_docs;
+            << " header.n_docs=" << seg.n_docs();
         vr.errors.push_back(oss.str());
     }
 
-    if (check_sorted && !is_sorted_postings(seg.postings9)) {
-        vr.errors.push_back("postings9 is not sorted by (h,did,pos)");
+    // json-экспорт рядом с бинарным docinfo должен описывать те же документы
+    if (docinfo.is_mapped() && std::filesystem::exists(seg_dir / "index_native_docids.json")) {
+        std::vector<DocInfo> exported;
+        if (!load_docids_json(seg_dir, exported, &err)) {
+            vr.errors.push_back(err);
+        } else if (exported.size() != docinfo.size()) {
+            std::ostringstream oss;
+            oss << "docids json size mismatch: json=" << exported.size()
+                << " docinfo=" << docinfo.size();
+            vr.errors.push_back(oss.str());
+        }
     }
 
-    // did bounds and pos bounds
-    for (const auto& p : seg.postings9) {
-        if (p.did >= seg.header.n_docs) {
-            vr.errors.push_back("posting did out of range");
-            break;
+    const bool v3 = seg.version() == FORMAT_V3;
+    if (v3) {
+        if (!check_v3_dictionary(seg, check_sorted, vr.errors)) {
+            vr.ok = false;
+            return vr;
         }
-        const auto tok_len = seg.docmeta[p.did].tok_len;
-        if (tok_len < (uint32_t)K_SHINGLE) {
-            vr.errors.push_back("doc tok_len < K (invalid docmeta)");
-            break;
+        if (seg.posting_codec() == POSTING_CODEC_BP128 && !check_bp128_blocks(seg, vr.errors)) {
+            vr.ok = false;
+            return vr;
         }
-        const uint32_t max_pos = tok_len - (uint32_t)K_SHINGLE;
-        if (p.pos > max_pos) {
-            vr.errors.push_back("posting pos out of range");
-            break;
+    } else if (check_sorted && !is_sorted_postings(seg.postings())) {
+        vr.errors.push_back("postings9 is not sorted by (h,did,pos)");
+    }
+
+    // did/pos bounds (+ V3: порядок (did,pos) внутри диапазона h), чанками
+    const size_t n = (size_t)seg.n_post9();
+    std::vector<uint32_t> did(1u << 16), pos(1u << 16);
+    uint32_t prev_did = 0, prev_pos = 0;
+    bool sorted_ok = true;
+
+    for (size_t l = 0; l < n; l += did.size()) {
+        const size_t r = std::min(n, l + did.size());
+        seg.decode_dids(l, r, did.data());
+        seg.decode_pos(l, r, pos.data());
+
+        for (size_t i = l; i < r; ++i) {
+            const uint32_t d = did[i - l];
+            const uint32_t p = pos[i - l];
+
+            if (v3 && check_sorted && sorted_ok && i > 0 && !is_start(seg.starts(), i) &&
+                (d < prev_did || (d == prev_did && p < prev_pos))) {
+                vr.errors.push_back("postings9 is not sorted by (h,did,pos)");
+                sorted_ok = false;
+            }
+            prev_did = d;
+            prev_pos = p;
+
+            if (d >= seg.n_docs()) {
+                vr.errors.push_back("posting did out of range");
+                vr.ok = false;
+                return vr;
+            }
+            const auto tok_len = seg.docmeta().tok_len(d);
+            if (tok_len < (uint32_t)K_SHINGLE) {
+                vr.errors.push_back("doc tok_len < K (invalid docmeta)");
+                vr.ok = false;
+                return vr;
+            }
+            const uint32_t max_pos = tok_len - (uint32_t)K_SHINGLE;
+            if (p > max_pos) {
+                vr.errors.push_back("posting pos out of range");
+                vr.ok = false;
+                return vr;
+            }
         }
     }
 
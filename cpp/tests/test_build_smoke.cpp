@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <iostream>
 #include <ctime>
 
 #include "l5/builder.h"
+#include "l5/docinfo_store.h"
+#include "l5/reader.h"
 #include "l5/validator.h"
 
 static std::filesystem::path mk_tmp_dir() {
@@ -34,8 +37,39 @@ int main() {
     assert(std::filesystem::exists(out_root / st.segment_name / "index_native.bin"));
     assert(std::filesystem::exists(out_root / st.segment_name / "index_native_docids.json"));
     assert(std::filesystem::exists(out_root / st.segment_name / "index_native_meta.json"));
+    assert(std::filesystem::exists(out_root / st.segment_name / "index_native.docinfo"));
     assert(std::filesystem::exists(out_root / "level5_manifest.json"));
 
+    // бинарный docinfo == json-экспорт
+    {
+        std::string err;
+        std::vector<l5::DocInfo> js;
+        l5::DocInfoStore ds;
+        assert(l5::load_docids_json(out_root / st.segment_name, js, &err));
+        assert(l5::open_docinfo(out_root / st.segment_name, ds, &err) && ds.is_mapped());
+        assert(ds.size() == js.size() && ds.check(&err));
+        assert(ds.has_docidx());
+        std::vector<uint32_t> dids;
+        ds.find("no_such_doc", dids);
+        assert(dids.empty());
+        for (uint32_t d = 0; d < (uint32_t)js.size(); ++d) {
+            const l5::DocInfo di = ds.get(d);
+            assert(ds.doc_id(d) == js[d].doc_id);
+            ds.find(js[d].doc_id, dids);
+            assert(std::find(dids.begin(), dids.end(), d) != dids.end());
+            assert(di.doc_id == js[d].doc_id && di.organization_id == js[d].organization_id &&
+                   di.external_id == js[d].external_id && di.source_path == js[d].source_path &&
+                   di.source_name == js[d].source_name && di.meta_path == js[d].meta_path &&
+                   di.preview_text == js[d].preview_text);
+        }
+    }
+
+    // без json-экспорта сегмент полноценный
+    opt.segment_name = "seg_test_build_nojson";
+    opt.docids_json = false;
+    auto st2 = l5::build_segment_jsonl(corpus, out_root, opt);
+    assert(!std::filesystem::exists(out_root / st2.segment_name / "index_native_docids.json"));
+
     auto vr = l5::validate_out_root(out_root);
     if (!vr.ok) {
         for (auto& e : vr.errors) std::cerr << e << "\n";
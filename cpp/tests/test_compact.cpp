@@ -0,0 +1,158 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "l5/builder.h"
+#include "l5/compactor.h"
+#include "l5/manifest.h"
+#include "l5/reader.h"
+#include "l5/tombstone_log.h"
+#include "l5/validator.h"
+
+static std::filesystem::path mk_tmp_dir(const char* tag) {
+    auto base = std::filesystem::temp_directory_path();
+    auto p = base / ("l5_test_" + std::string(tag) + "_" + std::to_string((uint64_t)std::time(nullptr)));
+    std::filesystem::remove_all(p);
+    std::filesystem::create_directories(p);
+    return p;
+}
+
+static std::filesystem::path test_data_file(const char* name) {
+#ifndef L5_TEST_DATA_DIR
+    return std::filesystem::path("cpp/tests/data") / name;
+#else
+    return std::filesystem::path(L5_TEST_DATA_DIR) / name;
+#endif
+}
+
+static std::string read_file(const std::filesystem::path& p) {
+    std::ifstream in(p, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main() {
+    const auto corpus = test_data_file("tiny.jsonl");
+    const auto out_root = mk_tmp_dir("compact");
+    const auto ref_root = mk_tmp_dir("compact_ref");
+
+    l5::BuildOptions opt;
+    opt.segment_name = "seg_a";
+    l5::build_segment_jsonl(corpus, out_root, opt);
+    opt.segment_name = "seg_b";
+    opt.posting_codec = l5::POSTING_CODEC_RAW; // входы с разными кодеками
+    l5::build_segment_jsonl(corpus, out_root, opt);
+
+    // эталон: тот же корпус дважды, без первого документа второй копии
+    const auto ref_corpus = ref_root / "corpus.jsonl";
+    {
+        const std::string text = read_file(corpus);
+        std::ofstream out(ref_corpus, std::ios::binary);
+        out << text << text.substr(text.find('\n') + 1);
+    }
+    opt.segment_name = "seg_ref";
+    opt.posting_codec = l5::POSTING_CODEC_BP128;
+    const auto ref = l5::build_segment_jsonl(ref_corpus, ref_root, opt);
+
+    l5::CompactOptions copt;
+    copt.segment_name = "seg_c";
+    const auto st = l5::compact_segments(out_root, {"seg_a", "seg_b"}, copt, [](const l5::DocInfo& d) {
+        return d.meta_path == "seg_b/" && d.doc_id == "d001";
+    });
+
+    if (st.docs_in != 100 || st.docs_out != 99 || st.docs_out != ref.docs || st.post9_out != ref.post9) {
+        std::cerr << "FAIL: docs " << st.docs_in << " -> " << st.docs_out << " post9 " << st.post9_out
+                  << " (ref " << ref.docs << " / " << ref.post9 << ")\n";
+        return 2;
+    }
+
+    // did и postings совпадают с пересборкой => побайтно тот же index_native.bin
+    if (read_file(out_root / "seg_c" / "index_native.bin") != read_file(ref_root / "seg_ref" / "index_native.bin")) {
+        std::cerr << "FAIL: compacted index_native.bin differs from rebuild\n";
+        return 3;
+    }
+
+    const auto m = l5::load_manifest(out_root);
+    if (m.segments.size() != 1 || m.segments[0].segment_name != "seg_c" || m.segments[0].stats.docs != 99 ||
+        std::filesystem::exists(out_root / "seg_a") || std::filesystem::exists(out_root / "seg_b")) {
+        std::cerr << "FAIL: manifest / inputs not replaced\n";
+        return 4;
+    }
+
+    std::vector<l5::DocInfo> docs;
+    std::string err;
+    if (!l5::load_docids_json(out_root / "seg_c", docs, &err) || docs.size() != 99 ||
+        docs[50].doc_id != "d002" || docs[50].meta_path != "seg_c/") {
+        std::cerr << "FAIL: docids " << err << "\n";
+        return 5;
+    }
+
+    const auto vr = l5::validate_out_root(out_root);
+    if (!vr.ok) {
+        std::cerr << "FAIL: validate: " << (vr.errors.empty() ? "" : vr.errors[0]) << "\n";
+        return 6;
+    }
+
+    // size-tiered: сливается нижний ярус, набравший min_segments
+    l5::Manifest tm;
+    for (int i = 0; i < 5; ++i) {
+        l5::SegmentEntry e;
+        e.segment_name = "small" + std::to_string(i);
+        e.stats.k9 = 1000;
+        tm.segments.push_back(e);
+    }
+    l5::SegmentEntry big;
+    big.segment_name = "big";
+    big.stats.k9 = 100ull << 20;
+    tm.segments.insert(tm.segments.begin() + 2, big);
+
+    l5::TieredCompactionPolicy pol;
+    pol.min_segments = 4;
+    pol.max_segments = 4;
+    const auto pick = l5::pick_tiered_compaction(tm, pol);
+    if (pick.size() != 4 || pick[0] != "small0" || pick[2] != "small2") {
+        std::cerr << "FAIL: tiered pick size=" << pick.size() << "\n";
+        return 7;
+    }
+    pol.min_segments = 6;
+    if (!l5::pick_tiered_compaction(tm, pol).empty()) {
+        std::cerr << "FAIL: tiered pick below min_segments\n";
+        return 8;
+    }
+
+    // tombstones.log сервиса (l5_compact --tombstones): оборванный хвост не читается
+    {
+        const auto log = out_root / "tombstones.log";
+        {
+            std::ofstream out(log, std::ios::binary);
+            l5::write_tombstone_log_header(out);
+            l5::write_tombstone_record(out, "d001");
+            l5::write_tombstone_record(out, "d002");
+            const uint32_t torn = 1000; // длина есть, данных нет
+            out.write(reinterpret_cast<const char*>(&torn), 4);
+            out << "x";
+        }
+        std::vector<std::string> ids;
+        uint64_t valid = 0;
+        if (!l5::read_tombstone_log(log, ids, &valid, &err) || ids.size() != 2 || ids[1] != "d002" ||
+            valid != l5::TOMBSTONE_LOG_HEADER_BYTES + 2 * (4 + 4)) {
+            std::cerr << "FAIL: tombstones log ids=" << ids.size() << " valid=" << valid << " " << err << "\n";
+            return 9;
+        }
+
+        // падение в первом append: заголовок не дописан => пустой лог, не ошибка
+        std::filesystem::resize_file(log, 3);
+        if (!l5::read_tombstone_log(log, ids, &valid, &err) || !ids.empty() || valid != 0) {
+            std::cerr << "FAIL: short tombstones log ids=" << ids.size() << " valid=" << valid << " " << err << "\n";
+            return 9;
+        }
+    }
+
+    std::filesystem::remove_all(out_root);
+    std::filesystem::remove_all(ref_root);
+    std::cout << "OK\n";
+    return 0;
+}
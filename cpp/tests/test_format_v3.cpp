@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <ctime>
+
+#include "l5/builder.h"
+#include "l5/doc_freq.h"
+#include "l5/mapped_segment.h"
+#include "l5/reader.h"
+#include "l5/search_multi.h"
+#include "l5/validator.h"
+
+static std::filesystem::path mk_tmp_dir() {
+    auto base = std::filesystem::temp_directory_path();
+    auto p = base / ("l5_test_" + std::to_string((uint64_t)std::time(nullptr) + 4));
+    std::filesystem::create_directories(p);
+    return p;
+}
+
+static std::filesystem::path test_data_file(const char* name) {
+#ifndef L5_TEST_DATA_DIR
+    return std::filesystem::path("cpp/tests/data") / name;
+#else
+    return std::filesystem::path(L5_TEST_DATA_DIR) / name;
+#endif
+}
+
+int main() {
+    auto tmp = mk_tmp_dir();
+    auto corpus = test_data_file("tiny.jsonl");
+    const auto root2 = tmp / "v2";
+    const auto root3 = tmp / "v3";
+
+    l5::BuildOptions opt;
+    opt.segment_name = "seg_fmt";
+    opt.format_version = l5::FORMAT_V2;
+    l5::build_segment_jsonl(corpus, root2, opt);
+    opt.format_version = l5::FORMAT_V3;
+    opt.token_hash = l5::TOKEN_HASH_FNV1A; // как у V2: сравниваем раскладку, не хэши
+    opt.shingle_hash = l5::SHINGLE_HASH_COMBINE;
+    l5::build_segment_jsonl(corpus, root3, opt);
+
+    if (!l5::validate_out_root(root2).ok || !l5::validate_out_root(root3).ok) {
+        std::cerr << "FAIL: validation\n";
+        return 2;
+    }
+
+    // одинаковые postings после разворота V3 в (h,did,pos)
+    l5::SegmentData s2, s3;
+    std::string err;
+    if (!l5::load_segment_bin(root2 / "seg_fmt", s2, &err) || !l5::load_segment_bin(root3 / "seg_fmt", s3, &err)) {
+        std::cerr << "FAIL: load " << err << "\n";
+        return 3;
+    }
+    if (s2.header.version != 2 || s3.header.version != 3 || s2.postings9.empty() ||
+        s2.postings9.size() != s3.postings9.size() || s2.docmeta.size() != s3.docmeta.size()) {
+        std::cerr << "FAIL: headers/sizes differ\n";
+        return 4;
+    }
+    for (size_t i = 0; i < s2.postings9.size(); ++i) {
+        const auto& a = s2.postings9[i];
+        const auto& b = s3.postings9[i];
+        if (a.h != b.h || a.did != b.did || a.pos != b.pos) {
+            std::cerr << "FAIL: posting " << i << " differs\n";
+            return 5;
+        }
+    }
+    for (size_t i = 0; i < s2.docmeta.size(); ++i) {
+        if (s2.docmeta[i].tok_len != s3.docmeta[i].tok_len ||
+            s2.docmeta[i].simhash_hi != s3.docmeta[i].simhash_hi ||
+            s2.docmeta[i].simhash_lo != s3.docmeta[i].simhash_lo) {
+            std::cerr << "FAIL: docmeta " << i << " differs\n";
+            return 6;
+        }
+    }
+
+    // merge-join по отсортированным хэшам == независимые range_for_hash (с директорией и без)
+    for (const auto& root : {root2, root3}) {
+        l5::MappedSegment seg;
+        if (!l5::map_segment_bin(root / "seg_fmt", seg, &err)) {
+            std::cerr << "FAIL: map " << err << "\n";
+            return 9;
+        }
+        std::vector<uint64_t> hs;
+        for (const auto& p : s2.postings9) {
+            if (hs.empty() || hs.back() != p.h) hs.push_back(p.h);
+            hs.push_back(p.h + 1); // чаще всего промах
+        }
+        std::sort(hs.begin(), hs.end());
+        hs.erase(std::unique(hs.begin(), hs.end()), hs.end());
+
+        for (int with_dir = 0; with_dir < 2; ++with_dir) {
+            if (with_dir) seg.build_hash_directory();
+            std::vector<std::pair<size_t, size_t>> got(hs.size());
+            seg.ranges_for_sorted_hashes(hs.data(), hs.size(), got.data());
+            for (size_t k = 0; k < hs.size(); ++k) {
+                const auto want = seg.range_for_hash(hs[k]);
+                const bool empty = want.first == want.second;
+                if (empty != (got[k].first == got[k].second) || (!empty && want != got[k])) {
+                    std::cerr << "FAIL: sorted lookup v" << seg.version() << " k=" << k << "\n";
+                    return 10;
+                }
+            }
+        }
+
+        // index_native.bloom: все хэши сегмента проходят, промахи почти все отсеиваются
+        if (!seg.load_hash_filter(&err) || seg.hash_filter().empty()) {
+            std::cerr << "FAIL: bloom v" << seg.version() << " " << err << "\n";
+            return 11;
+        }
+        size_t passed_miss = 0, n_miss = 0;
+        for (const uint64_t h : hs) {
+            const bool present = seg.range_for_hash(h).first != seg.range_for_hash(h).second;
+            const bool may = seg.hash_filter().may_contain(h);
+            if (present && !may) {
+                std::cerr << "FAIL: bloom false negative v" << seg.version() << "\n";
+                return 12;
+            }
+            if (!present) {
+                ++n_miss;
+                passed_miss += may ? 1 : 0;
+            }
+        }
+        if (passed_miss * 10 > n_miss) {
+            std::cerr << "FAIL: bloom false positives " << passed_miss << "/" << n_miss << "\n";
+            return 13;
+        }
+
+        // index_native.df: DF == число различных did хэша по postings, по убыванию df
+        std::vector<l5::DfEntry> want_df;
+        for (size_t i = 0; i < s2.postings9.size(); ++i) {
+            const auto& p = s2.postings9[i];
+            if (i == 0 || p.h != s2.postings9[i - 1].h) want_df.push_back(l5::DfEntry{p.h, 1});
+            else if (p.did != s2.postings9[i - 1].did) ++want_df.back().df;
+        }
+        const uint64_t n_distinct = want_df.size();
+        want_df.erase(std::remove_if(want_df.begin(), want_df.end(), [](const l5::DfEntry& e) { return e.df < 2; }),
+                      want_df.end());
+        std::sort(want_df.begin(), want_df.end(), [](const l5::DfEntry& a, const l5::DfEntry& b) {
+            return a.df != b.df ? a.df > b.df : a.h < b.h;
+        });
+        l5::DfTable dt;
+        if (!l5::read_df_file(root / "seg_fmt" / "index_native.df", dt, &err) || dt.n_hashes != n_distinct ||
+            dt.entries.size() != want_df.size() || !seg.load_stop_hashes(&err)) {
+            std::cerr << "FAIL: df v" << seg.version() << " " << err << "\n";
+            return 14;
+        }
+        for (size_t i = 0; i < want_df.size(); ++i) {
+            if (dt.entries[i].h != want_df[i].h || dt.entries[i].df != want_df[i].df) {
+                std::cerr << "FAIL: df entry " << i << " v" << seg.version() << "\n";
+                return 14;
+            }
+        }
+    }
+
+    l5::SearchOptions sopt;
+    sopt.min_hits = 1;
+    sopt.span_min_len = 2;
+    const std::string query =
+        "Это длинный тестовый документ для шингловой системы и поиска. "
+        "Он нужен чтобы построить много шинглов k девять и проверить совпадения.";
+
+    auto r2 = l5::search_out_root(root2, query, true, sopt);
+    auto r3 = l5::search_out_root(root3, query, true, sopt);
+    if (r2.hits.empty() || r2.hits.size() != r3.hits.size()) {
+        std::cerr << "FAIL: search hits v2=" << r2.hits.size() << " v3=" << r3.hits.size() << "\n";
+        return 7;
+    }
+    for (size_t i = 0; i < r2.hits.size(); ++i) {
+        if (r2.hits[i].doc_id != r3.hits[i].doc_id || r2.hits[i].C != r3.hits[i].C) {
+            std::cerr << "FAIL: hit " << i << " differs\n";
+            return 8;
+        }
+    }
+
+    // stop-hash: все хэши с df >= 2 (перцентиль 0) отбрасываются до lookup'а —
+    // в сегменте и в boilerplate out_root
+    opt.segment_name = "seg_stop";
+    opt.stop_df_percentile = 0.0;
+    opt.stop_min_df = 2;
+    l5::build_segment_jsonl(corpus, tmp / "stop", opt);
+    l5::StopHashes org;
+    if (!l5::load_org_stop_hashes(tmp / "stop", org, &err) || org.size() == 0) {
+        std::cerr << "FAIL: org stop hashes " << err << "\n";
+        return 15;
+    }
+    auto sopt_stop = sopt;
+    sopt_stop.use_stop_hashes = true;
+    sopt_stop.use_hash_filter = false;
+    const std::string shared = "что второй документ содержит похожие слова для теста поиска по шинглам."; // в 4 документах
+    auto rs = l5::search_out_root(tmp / "stop", shared, true, sopt_stop);
+    auto rn = l5::search_out_root(tmp / "stop", shared, true, sopt);
+    if (rs.hash_lookups != rs.hash_lookups_skipped || !rs.hits.empty() || rn.hits.empty()) {
+        std::cerr << "FAIL: stop hashes not dropped\n";
+        return 15;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(tmp, ec);
+    std::cout << "OK\n";
+    return 0;
+}
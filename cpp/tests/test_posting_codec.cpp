@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "l5/posting_codec.h"
+
+using namespace l5;
+
+// Все ядра распаковки дают то же, что упаковали, на любых ширинах 0..32.
+int main() {
+    std::mt19937_64 rng(7);
+    const bp128::Kernel kernels[] = {bp128::Kernel::Scalar, bp128::Kernel::Sse41, bp128::Kernel::Avx2};
+
+    for (unsigned b = 0; b <= 32; ++b) {
+        for (size_t n : {(size_t)1, (size_t)77, bp128::kBlock}) {
+            std::vector<uint32_t> v(bp128::kBlock, 0);
+            for (size_t i = 0; i < n; ++i) {
+                const uint64_t r = rng();
+                v[i] = b == 0 ? 0u : (uint32_t)(b == 32 ? r : (r & ((1ull << b) - 1)));
+            }
+
+            std::vector<unsigned char> buf(bp128::packed_bytes(b) + bp128::kTailPad, 0);
+            bp128::pack(v.data(), n, b, buf.data());
+
+            const uint32_t base = 1000;
+            for (auto k : kernels) {
+                if (!bp128::kernel_supported(k)) continue;
+                uint32_t out[bp128::kBlock];
+                bp128::unpack(buf.data(), b, base, out, k);
+                for (size_t i = 0; i < n; ++i) {
+                    if (out[i] != v[i] + base || bp128::extract(buf.data(), b, base, i) != out[i]) {
+                        std::cerr << "FAIL: unpack kernel=" << bp128::kernel_name(k) << " b=" << b
+                                  << " n=" << n << " i=" << i << "\n";
+                        return 2;
+                    }
+                }
+            }
+        }
+    }
+
+    // блок целиком в одном диапазоне h => delta; с началом h внутри => FOR
+    std::vector<uint32_t> did(bp128::kBlock), pos(bp128::kBlock);
+    uint32_t d = 500000;
+    for (size_t i = 0; i < bp128::kBlock; ++i) {
+        d += (uint32_t)(rng() % 40);
+        did[i] = d;
+        pos[i] = (uint32_t)(rng() % 90000);
+    }
+    for (bool inner : {false, true}) {
+        bp128::BlockMeta m;
+        std::vector<unsigned char> data;
+        bp128::encode_block(did.data(), pos.data(), did.size(), inner, m, data);
+        if ((m.did_delta != 0) == inner) {
+            std::cerr << "FAIL: delta mode inner_start=" << inner << "\n";
+            return 3;
+        }
+        data.resize(data.size() + bp128::kTailPad, 0);
+
+        for (auto k : kernels) {
+            if (!bp128::kernel_supported(k)) continue;
+            uint32_t od[bp128::kBlock], op[bp128::kBlock];
+            if (m.did_delta) bp128::unpack_delta(data.data(), m.did_bits, m.did_base, od, k);
+            else bp128::unpack(data.data(), m.did_bits, m.did_base, od, k);
+            bp128::unpack(data.data() + bp128::packed_bytes(m.did_bits), m.pos_bits, m.pos_base, op, k);
+            for (size_t i = 0; i < bp128::kBlock; ++i) {
+                if (od[i] != did[i] || op[i] != pos[i]) {
+                    std::cerr << "FAIL: block kernel=" << bp128::kernel_name(k) << " i=" << i << "\n";
+                    return 4;
+                }
+            }
+        }
+    }
+
+    std::cout << "OK (" << bp128::kernel_name(bp128::active_kernel()) << ")\n";
+    return 0;
+}
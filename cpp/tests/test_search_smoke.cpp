@@ -1,10 +1,16 @@
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <ctime>
+#include <string>
+#include <vector>
 
 #include "l5/builder.h"
 #include "l5/search_multi.h"
 
+#include <nlohmann/json.hpp>
+
 static std::filesystem::path mk_tmp_dir() {
     auto base = std::filesystem::temp_directory_path();
     auto p = base / ("l5_test_" + std::to_string((uint64_t)std::time(nullptr) + 2));
@@ -50,6 +56,186 @@ int main() {
         return 3;
     }
 
+    // near-duplicates: текст документа находит сам документ с hamming 0,
+    // полосы LSH при max_hamming <= 7 == полный перебор simhash
+    {
+        std::ifstream in(corpus);
+        std::string line;
+        std::getline(in, line);
+        const auto d0 = nlohmann::json::parse(line);
+        l5::NearDupOptions nopt;
+        nopt.max_hamming = 0;
+        auto nd = l5::near_duplicates_text(out_root, d0["text"].get<std::string>(), true, nopt);
+        if (nd.hits.empty() || nd.hits[0].doc_id != d0["doc_id"].get<std::string>() || nd.hits[0].hamming != 0) {
+            std::cerr << "FAIL: near_duplicates_text does not find the document itself\n";
+            return 7;
+        }
+        if (l5::near_duplicates_doc(out_root, "no_such_doc", nopt).doc_found) {
+            std::cerr << "FAIL: near_duplicates_doc found a missing doc\n";
+            return 7;
+        }
+
+        l5::LoadedSegment ls;
+        std::string err;
+        if (!l5::load_segment(out_root / opt.segment_name, ls, &err)) {
+            std::cerr << "FAIL: load_segment: " << err << "\n";
+            return 7;
+        }
+        const auto& dm = ls.seg.docmeta();
+        std::vector<l5::NearDupMatch> got;
+        for (size_t q = 0; q < dm.size(); ++q) {
+            for (uint64_t flip : {0ull, 0x0101010101010101ull}) {
+                const uint64_t hi = dm[q].simhash_hi ^ flip, lo = dm[q].simhash_lo;
+                ls.near_dup.find(dm, hi, lo, 7, got);
+                size_t want = 0;
+                for (size_t d = 0; d < dm.size(); ++d) {
+                    want += __builtin_popcountll(dm[d].simhash_hi ^ hi) + __builtin_popcountll(dm[d].simhash_lo ^ lo) <= 7;
+                }
+                if (got.size() != want) {
+                    std::cerr << "FAIL: near_dup index " << got.size() << " != brute force " << want << "\n";
+                    return 7;
+                }
+            }
+        }
+    }
+
+    // сегмент в старой схеме хэшей: запрос хэшируется под схему сегмента
+    opt.token_hash = l5::TOKEN_HASH_FNV1A;
+    opt.shingle_hash = l5::SHINGLE_HASH_COMBINE;
+    opt.segment_name = "seg_test_search_combine";
+    l5::build_segment_jsonl(corpus, out_root / "combine", opt);
+    auto rc = l5::search_out_root(out_root / "combine", query, true, sopt);
+    if (rc.hits.empty() || rc.hits[0].C != r.hits[0].C) {
+        std::cerr << "FAIL: old hash scheme segment result differs\n";
+        return 6;
+    }
+
+    // второй сегмент с теми же документами (схемы разные): дубли doc_id между сегментами
+    opt.segment_name = "seg_test_search_2";
+    l5::build_segment_jsonl(corpus, out_root, opt);
+
+    // пакет (Stage B по всем кандидатам каждого сегмента) == отдельные запросы
+    // (глобальный отбор кандидатов), в т.ч. пустой и без совпадений; проходы по 2 запроса
+    const std::vector<std::string> batch = {
+        query,
+        "",
+        "совершенно посторонний текст без каких либо совпадений с корпусом вообще никак",
+        query.substr(0, query.size() / 2),
+        query,
+    };
+    for (const uint32_t topk : {5u, 1u}) {
+        auto qopt = sopt;
+        qopt.topk = topk;
+        auto bopt = qopt;
+        bopt.batch_queries_per_pass = 2;
+        auto br = l5::search_batch(out_root, batch, true, bopt);
+        if (br.size() != batch.size()) {
+            std::cerr << "FAIL: batch size\n";
+            return 4;
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto one = l5::search_out_root(out_root, batch[i], true, qopt);
+            bool same = one.hits.size() == br[i].hits.size() && one.segments_scanned == br[i].segments_scanned;
+            for (size_t k = 0; same && k < one.hits.size(); ++k) {
+                same = one.hits[k].doc_id == br[i].hits[k].doc_id && one.hits[k].C == br[i].hits[k].C &&
+                       one.hits[k].match_spans.size() == br[i].hits[k].match_spans.size();
+            }
+            if (!same) {
+                std::cerr << "FAIL: batch result " << i << " differs from single search (topk=" << topk << ")\n";
+                return 5;
+            }
+        }
+    }
+
+    // равные C: top-k по did, а не по порядку слотов (verify_candidates получает
+    // кандидатов по убыванию c_upper — здесь нарочно в обратном порядке did)
+    {
+        const auto dup_root = out_root / "dups";
+        std::filesystem::create_directories(dup_root);
+        const auto dup_corpus = dup_root / "dups.jsonl";
+        {
+            std::ofstream dc(dup_corpus);
+            for (const char* id : {"dup_a", "dup_b", "dup_c", "dup_d"}) {
+                nlohmann::json j;
+                j["doc_id"] = id;
+                j["organization_id"] = "org_demo";
+                j["text"] = query;
+                dc << j.dump() << "\n";
+            }
+        }
+        l5::BuildOptions dopt;
+        dopt.segment_name = "seg_dups";
+        l5::build_segment_jsonl(dup_corpus, dup_root, dopt);
+
+        l5::LoadedSegment ls;
+        std::string err;
+        if (!l5::load_segment(dup_root / dopt.segment_name, ls, &err)) {
+            std::cerr << "FAIL: load_segment: " << err << "\n";
+            return 8;
+        }
+        auto dq = l5::build_query_shingles(query, true, ls.seg.hash_scheme());
+        auto sc = l5::collect_candidates(ls.seg, ls.docinfo, dq, sopt);
+        std::vector<uint32_t> which;
+        for (uint32_t i = (uint32_t)sc.dids.size(); i-- > 0;) which.push_back(i);
+        uint32_t min_did = UINT32_MAX;
+        for (const uint32_t did : sc.dids) min_did = std::min(min_did, did);
+
+        auto topk1 = sopt;
+        topk1.topk = 1;
+        auto vh = l5::verify_candidates(ls.seg, ls.docinfo, dq, topk1, sc, which);
+        if (sc.dids.size() != 4 || vh.size() != 1 || vh[0].doc_id != ls.docinfo.doc_id(min_did)) {
+            std::cerr << "FAIL: equal-C tie is not broken by did (candidates=" << sc.dids.size() << ")\n";
+            return 8;
+        }
+    }
+
+    // near-dup по doc_id: запрос — simhash живой копии; удалённая копия
+    // перезалитого документа (другой текст) запросом не становится
+    {
+        std::vector<std::string> texts;
+        {
+            std::ifstream in(corpus);
+            std::string line;
+            while (texts.size() < 2 && std::getline(in, line)) {
+                texts.push_back(nlohmann::json::parse(line)["text"].get<std::string>());
+            }
+        }
+        const auto re_root = out_root / "reupload";
+        std::filesystem::create_directories(re_root);
+        auto write_corpus = [&](const std::filesystem::path& p, const char* twin, const std::string& text) {
+            std::ofstream out(p);
+            for (const char* id : {"re_doc", twin}) {
+                nlohmann::json j;
+                j["doc_id"] = id;
+                j["organization_id"] = "org_demo";
+                j["text"] = text;
+                out << j.dump() << "\n";
+            }
+        };
+        write_corpus(re_root / "old.jsonl", "old_twin", texts[0]);
+        write_corpus(re_root / "new.jsonl", "new_twin", texts[1]);
+
+        l5::BuildOptions ropt;
+        ropt.segment_name = "seg_old";
+        l5::build_segment_jsonl(re_root / "old.jsonl", re_root, ropt);
+        l5::SegmentCache cache(1ull << 30);
+        std::string err;
+        if (!l5::mark_doc_deleted(re_root, "re_doc", cache, "org", nullptr, &err)) {
+            std::cerr << "FAIL: mark_doc_deleted: " << err << "\n";
+            return 9;
+        }
+        ropt.segment_name = "seg_new";
+        l5::build_segment_jsonl(re_root / "new.jsonl", re_root, ropt);
+
+        l5::NearDupOptions nopt;
+        nopt.max_hamming = 0;
+        auto nd = l5::near_duplicates_doc(re_root, "re_doc", nopt);
+        if (!nd.doc_found || nd.hits.size() != 1 || nd.hits[0].doc_id != "new_twin") {
+            std::cerr << "FAIL: near_duplicates_doc used a deleted copy (hits=" << nd.hits.size() << ")\n";
+            return 9;
+        }
+    }
+
     std::cout << "Top hit: " << r.hits[0].doc_id
               << " C=" << r.hits[0].C
               << " spans=" << r.hits[0].match_spans.size() << "\n";
@@ -0,0 +1,123 @@
+#include <filesystem>
+#include <iostream>
+#include <ctime>
+
+#include "l5/builder.h"
+#include "l5/search_multi.h"
+#include "l5/segment_cache.h"
+
+static std::filesystem::path mk_tmp_dir() {
+    auto base = std::filesystem::temp_directory_path();
+    auto p = base / ("l5_test_" + std::to_string((uint64_t)std::time(nullptr) + 3));
+    std::filesystem::create_directories(p);
+    return p;
+}
+
+static std::filesystem::path test_data_file(const char* name) {
+#ifndef L5_TEST_DATA_DIR
+    return std::filesystem::path("cpp/tests/data") / name;
+#else
+    return std::filesystem::path(L5_TEST_DATA_DIR) / name;
+#endif
+}
+
+int main() {
+    auto out_root = mk_tmp_dir();
+    auto corpus = test_data_file("tiny.jsonl");
+
+    l5::BuildOptions opt;
+    opt.segment_name = "seg_cache_a";
+    l5::build_segment_jsonl(corpus, out_root, opt);
+    opt.segment_name = "seg_cache_b";
+    l5::build_segment_jsonl(corpus, out_root, opt);
+
+    l5::SearchOptions sopt;
+    sopt.min_hits = 1;
+    sopt.span_min_len = 2;
+
+    const std::string query =
+        "Это длинный тестовый документ для шингловой системы и поиска. "
+        "Он нужен чтобы построить много шинглов k девять и проверить совпадения.";
+
+    auto plain = l5::search_out_root(out_root, query, true, sopt);
+
+    l5::SegmentCache cache(1ull << 30);
+    auto r1 = l5::search_out_root(out_root, query, true, sopt, cache, "org");
+    auto r2 = l5::search_out_root(out_root, query, true, sopt, cache, "org");
+
+    auto st = cache.stats();
+    if (st.misses != 2 || st.hits != 2 || st.entries != 2) {
+        std::cerr << "FAIL: misses=" << st.misses << " hits=" << st.hits << " entries=" << st.entries << "\n";
+        return 2;
+    }
+    if (st.manifest_loads != 1 || st.manifest_hits != 1) {
+        std::cerr << "FAIL: manifest_loads=" << st.manifest_loads << " manifest_hits=" << st.manifest_hits << "\n";
+        return 3;
+    }
+    if (r1.hits.size() != plain.hits.size() || r2.hits.size() != plain.hits.size() || plain.hits.empty()) {
+        std::cerr << "FAIL: cached search differs from plain search\n";
+        return 4;
+    }
+    for (size_t i = 0; i < plain.hits.size(); ++i) {
+        if (r2.hits[i].doc_id != plain.hits[i].doc_id || r2.hits[i].C != plain.hits[i].C) {
+            std::cerr << "FAIL: hit " << i << " differs\n";
+            return 5;
+        }
+    }
+
+    // budget меньше одного сегмента => остаётся только последний
+    cache.set_budget(1);
+    st = cache.stats();
+    if (st.entries != 1 || st.evictions != 1) {
+        std::cerr << "FAIL: entries=" << st.entries << " evictions=" << st.evictions << "\n";
+        return 6;
+    }
+
+    cache.invalidate_scope("org");
+    if (cache.stats().entries != 0) {
+        std::cerr << "FAIL: invalidate_scope left entries\n";
+        return 7;
+    }
+
+    // удалённый документ не занимает место в top-k: Stage A его не выбирает
+    const std::string shared_query = "что второй документ содержит похожие слова для теста поиска по шинглам.";
+    sopt.topk = 1;
+    auto before = l5::search_out_root(out_root, shared_query, true, sopt, cache, "org");
+    if (before.hits.size() != 1) {
+        std::cerr << "FAIL: shared query has no hits\n";
+        return 8;
+    }
+    const std::string victim = before.hits[0].doc_id;
+    uint64_t marked = 0;
+    std::string err;
+    if (!l5::mark_doc_deleted(out_root, victim, cache, "org", &marked, &err) || marked != 2 ||
+        !std::filesystem::exists(out_root / "seg_cache_a" / "index_native.deleted")) {
+        std::cerr << "FAIL: mark_doc_deleted marked=" << marked << " err=" << err << "\n";
+        return 9;
+    }
+    auto r3 = l5::search_out_root(out_root, shared_query, true, sopt, cache, "org");
+    auto r4 = l5::search_out_root(out_root, shared_query, true, sopt); // без кэша: битмап с диска
+    if (r3.hits.size() != 1 || r4.hits.size() != 1 || r3.hits[0].doc_id == victim ||
+        r4.hits[0].doc_id != r3.hits[0].doc_id) {
+        std::cerr << "FAIL: deleted doc still in results\n";
+        return 10;
+    }
+
+    // сегменты не в кэше: помечается только файл, кэш не загружает их ради удаления
+    const std::string victim2 = r3.hits[0].doc_id;
+    l5::SegmentCache cold(1ull << 30);
+    if (!l5::mark_doc_deleted(out_root, victim2, cold, "org", &marked, &err) || marked != 2 ||
+        cold.stats().entries != 0 || cold.stats().misses != 0) {
+        std::cerr << "FAIL: cold mark_doc_deleted marked=" << marked << " entries=" << cold.stats().entries
+                  << " err=" << err << "\n";
+        return 11;
+    }
+    auto r5 = l5::search_out_root(out_root, shared_query, true, sopt, cold, "org");
+    if (!r5.hits.empty() && (r5.hits[0].doc_id == victim || r5.hits[0].doc_id == victim2)) {
+        std::cerr << "FAIL: cold-deleted doc still in results\n";
+        return 12;
+    }
+
+    std::cout << "OK\n";
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "text_common.h"
+
+// Исходный simhash: ±1 на каждый бит каждого токена
+static std::pair<uint64_t, uint64_t> simhash_ref(const std::vector<uint64_t>& th) {
+    int v0[64] = {0};
+    int v1[64] = {0};
+    for (uint64_t a : th) {
+        const uint64_t b = a ^ 0xD6E8FEB86659FD93ULL;
+        for (int i = 0; i < 64; ++i) v0[i] += ((a >> i) & 1ULL) ? 1 : -1;
+        for (int i = 0; i < 64; ++i) v1[i] += ((b >> i) & 1ULL) ? 1 : -1;
+    }
+    uint64_t hi = 0, lo = 0;
+    for (int i = 0; i < 64; ++i) {
+        if (v0[i] > 0) hi |= 1ULL << i;
+        if (v1[i] > 0) lo |= 1ULL << i;
+    }
+    return {hi, lo};
+}
+
+// SIMD-ядра normalize_for_shingles_simple_to побайтно совпадают со scalar;
+// hash_text_shingles совпадает с tokenize_spans + хэшами по отдельным токенам;
+// ядра simhash128_token_hashes совпадают с исходным подсчётом.
+int main() {
+    const NormalizeKernel kernels[] = {NormalizeKernel::Sse42, NormalizeKernel::Avx2};
+
+    // куски, из которых собираются строки: границы блоков попадают куда угодно
+    const std::vector<std::string> parts = {
+        "a", "Z", "0", " ", "  ", "\t\n", ".,;", "-", "_",
+        "Привет", "ЁЛКА", "Ійк", "АЯаяРС", "ӘҒҚҢӨҰҮҺ", "әғқңөұүһ", "Ԁԯ", "\xD4\xB0", "ՁՂ",
+        "\xC2\xA0", "é", "—", "«»", "€", "😀", "ß",
+        "\xD0", "\xD1", "\xD0\x41", "\x80", "\xBF\xBF", "\xE2\x80", "\xF0\x9F", "\xC0\xAF", "\xFF",
+    };
+
+    std::mt19937 rng(11);
+    std::string ref, got;
+    for (int it = 0; it < 20000; ++it) {
+        std::string s;
+        const size_t n_parts = rng() % 60;
+        for (size_t p = 0; p < n_parts; ++p) s += parts[rng() % parts.size()];
+        if (it % 7 == 0) {
+            for (char& c : s) {
+                if (rng() % 20 == 0) c = (char)(rng() & 0xFF);
+            }
+        }
+
+        normalize_for_shingles_simple_to(s, ref, NormalizeKernel::Scalar);
+        for (auto k : kernels) {
+            if (!normalize_kernel_supported(k)) continue;
+            normalize_for_shingles_simple_to(s, got, k);
+            if (got != ref) {
+                std::cerr << "FAIL: kernel=" << normalize_kernel_name(k) << " it=" << it
+                          << " len=" << s.size() << "\n";
+                return 2;
+            }
+        }
+    }
+
+    if (normalize_for_shingles_simple(" Съешь же ещё ЭТИХ мягких французских булок, да выпей чаю! ") !=
+        "съешь же ещё этих мягких французских булок да выпей чаю") {
+        std::cerr << "FAIL: sample\n";
+        return 3;
+    }
+
+    // однопроходные хэши против старой цепочки, с лимитами и шагом
+    std::string text = "  ";
+    for (int i = 0; i < 400; ++i) text += "w" + std::to_string(rng() % 50) + (rng() % 5 ? " " : "   ");
+    for (int len = 1; len < 120; len += 7) text += std::string((size_t)len, (char)('a' + len % 26)) + " ";
+    std::vector<TokenSpan> spans{TokenSpan{0, 3}};
+    std::vector<uint64_t> ref_th, th, sh;
+    hash_tokens_bytes_spans("abc", spans, ref_th);
+    if (hash_token_bytes("abc", TokenHash::Fnv1a) != ref_th[0]) {
+        std::cerr << "FAIL: fnv1a token hash\n";
+        return 5;
+    }
+
+    for (size_t max_tokens : {(size_t)0, (size_t)5, (size_t)9, (size_t)100}) {
+        for (int step : {1, 3}) {
+            for (size_t max_shingles : {(size_t)0, (size_t)7}) {
+                for (int scheme_id = 0; scheme_id < 4; ++scheme_id) {
+                    const TokenHash token = (TokenHash)(scheme_id & 1);
+                    const ShingleHash scheme = (ShingleHash)(scheme_id >> 1);
+                    ShingleHashParams hp;
+                    hp.k = 9;
+                    hp.token = token;
+                    hp.shingle = scheme;
+                    hp.max_tokens = max_tokens;
+                    hp.step = step;
+                    hp.max_shingles = max_shingles;
+                    hash_text_shingles(text, hp, th, sh);
+
+                    tokenize_spans(text, spans);
+                    if (max_tokens && spans.size() > max_tokens) spans.resize(max_tokens);
+                    ref_th.clear();
+                    for (const auto& sp : spans) {
+                        ref_th.push_back(hash_token_bytes(std::string_view(text).substr(sp.start, sp.len), token));
+                    }
+                    size_t j = 0;
+                    bool ok = th == ref_th;
+                    for (int pos = 0; ok && pos + hp.k <= (int)spans.size(); pos += step, ++j) {
+                        if (max_shingles && j == max_shingles) break;
+                        const uint64_t h = scheme == ShingleHash::Rolling ? hash_shingle_rolling(ref_th, pos, hp.k)
+                                                                          : hash_shingle_token_hashes(ref_th, pos, hp.k);
+                        ok = j < sh.size() && sh[j] == h;
+                    }
+                    if (!ok || j != sh.size()) {
+                        std::cerr << "FAIL: hash_text_shingles scheme=" << scheme_id << " max_tokens=" << max_tokens
+                                  << " step=" << step << " max_shingles=" << max_shingles << "\n";
+                        return 4;
+                    }
+                }
+            }
+        }
+    }
+
+    // длины вокруг сброса 8-битных счётчиков (255), смещённые биты и ничьи (v == 0)
+    for (size_t n : {(size_t)0, (size_t)1, (size_t)2, (size_t)254, (size_t)255, (size_t)256, (size_t)511, (size_t)5000}) {
+        for (int skew = 0; skew < 3; ++skew) {
+            std::vector<uint64_t> hs(n);
+            for (auto& h : hs) {
+                h = ((uint64_t)rng() << 32) | rng();
+                if (skew == 1) h |= 0xF0F0F0F000000000ULL;
+                if (skew == 2) h &= 0x00000000FFFF0000ULL;
+            }
+            const auto want = simhash_ref(hs);
+            for (auto k : {SimhashKernel::Scalar, SimhashKernel::Avx2}) {
+                if (!simhash_kernel_supported(k)) continue;
+                if (simhash128_token_hashes(hs, k) != want) {
+                    std::cerr << "FAIL: simhash kernel=" << (int)k << " n=" << n << " skew=" << skew << "\n";
+                    return 6;
+                }
+            }
+        }
+    }
+
+    std::cout << "OK active=" << normalize_kernel_name(normalize_active_kernel()) << "\n";
+    return 0;
+}
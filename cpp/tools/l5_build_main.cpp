@@ -13,7 +13,7 @@ static std::string arg_value(int& i, int argc, char** argv) {
 
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cerr << "Usage: l5_build <corpus_jsonl> <out_root_dir> [--segment-name NAME]\n";
+        std::cerr << "Usage: l5_build <corpus_jsonl> <out_root_dir> [--segment-name NAME] [--format 2|3] [--codec raw|bp128] [--bloom-bits N] [--token-hash fnv1a|wyhash] [--shingle-hash combine|rolling] [--df-entries N] [--stop-percentile P] [--stop-min-df N] [--no-docids-json]\n";
         return 1;
     }
 
@@ -24,6 +24,24 @@ int main(int argc, char** argv) {
     for (int i = 3; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--segment-name") opt.segment_name = arg_value(i, argc, argv);
+        else if (a == "--format") opt.format_version = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--codec") {
+            const std::string c = arg_value(i, argc, argv);
+            opt.posting_codec = (c == "raw") ? l5::POSTING_CODEC_RAW : l5::POSTING_CODEC_BP128;
+        }
+        else if (a == "--bloom-bits") opt.bloom_bits_per_key = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--token-hash") {
+            const std::string h = arg_value(i, argc, argv);
+            opt.token_hash = (h == "fnv1a") ? l5::TOKEN_HASH_FNV1A : l5::TOKEN_HASH_WYHASH;
+        }
+        else if (a == "--shingle-hash") {
+            const std::string h = arg_value(i, argc, argv);
+            opt.shingle_hash = (h == "combine") ? l5::SHINGLE_HASH_COMBINE : l5::SHINGLE_HASH_ROLLING;
+        }
+        else if (a == "--df-entries") opt.df_max_entries = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--stop-percentile") opt.stop_df_percentile = std::stod(arg_value(i, argc, argv));
+        else if (a == "--stop-min-df") opt.stop_min_df = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--no-docids-json") opt.docids_json = false;
     }
 
     try {
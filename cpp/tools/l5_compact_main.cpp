@@ -0,0 +1,128 @@
+// Back_L5/cpp/tools/l5_compact_main.cpp
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <filesystem>
+#include <unordered_set>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include "l5/compactor.h"
+#include "l5/manifest.h"
+#include "l5/tombstone_log.h"
+
+static std::string arg_value(int& i, int argc, char** argv) {
+    if (i + 1 >= argc) return "";
+    return argv[++i];
+}
+
+static std::vector<std::string> split_csv(const std::string& s) {
+    std::vector<std::string> out;
+    size_t b = 0;
+    while (b <= s.size()) {
+        size_t e = s.find(',', b);
+        if (e == std::string::npos) e = s.size();
+        if (e > b) out.push_back(s.substr(b, e - b));
+        b = e + 1;
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: l5_compact <out_root_dir> [--segments A,B,...|--all|--tiered] [--segment-name NAME] [--tombstones FILE] [--tombstones-jsonl FILE] [--keep-inputs] [--no-docids-json] [--format 2|3] [--codec raw|bp128] [--bloom-bits N] [--df-entries N] [--stop-percentile P] [--stop-min-df N] [--min-segments N] [--max-segments N]\n";
+        return 1;
+    }
+
+    std::filesystem::path out_root = argv[1];
+
+    l5::CompactOptions opt;
+    l5::TieredCompactionPolicy policy;
+    std::vector<std::string> segments;
+    bool all = false;
+    std::string tombstones;
+    std::string tombstones_jsonl;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--segments") segments = split_csv(arg_value(i, argc, argv));
+        else if (a == "--all") all = true;
+        else if (a == "--tiered") {
+            all = false;
+            segments.clear();
+        }
+        else if (a == "--segment-name") opt.segment_name = arg_value(i, argc, argv);
+        else if (a == "--tombstones") tombstones = arg_value(i, argc, argv);
+        else if (a == "--tombstones-jsonl") tombstones_jsonl = arg_value(i, argc, argv);
+        else if (a == "--keep-inputs") opt.remove_inputs = false;
+        else if (a == "--no-docids-json") opt.docids_json = false;
+        else if (a == "--format") opt.format_version = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--codec") {
+            const std::string c = arg_value(i, argc, argv);
+            opt.posting_codec = (c == "raw") ? l5::POSTING_CODEC_RAW : l5::POSTING_CODEC_BP128;
+        }
+        else if (a == "--bloom-bits") opt.bloom_bits_per_key = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--df-entries") opt.df_max_entries = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--stop-percentile") opt.stop_df_percentile = std::stod(arg_value(i, argc, argv));
+        else if (a == "--stop-min-df") opt.stop_min_df = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--min-segments") policy.min_segments = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--max-segments") policy.max_segments = (uint32_t)std::stoul(arg_value(i, argc, argv));
+    }
+
+    // tombstones.log сервиса (оборванный хвост не читается, файл не меняется)
+    std::unordered_set<std::string> dead;
+    if (!tombstones.empty()) {
+        std::vector<std::string> ids;
+        std::string err;
+        if (!l5::read_tombstone_log(tombstones, ids, nullptr, &err)) {
+            std::cerr << "l5_compact failed: " << err << "\n";
+            return 2;
+        }
+        for (auto& id : ids) dead.insert(std::move(id));
+    }
+    // старый tombstones.jsonl: doc_id по строке
+    if (!tombstones_jsonl.empty()) {
+        std::ifstream in(tombstones_jsonl);
+        if (!in) {
+            std::cerr << "l5_compact failed: cannot open " << tombstones_jsonl << "\n";
+            return 2;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty()) dead.insert(line);
+        }
+    }
+
+    const l5::Manifest m = l5::load_manifest(out_root);
+    if (all) {
+        for (const auto& e : m.segments) segments.push_back(e.segment_name);
+    } else if (segments.empty()) {
+        segments = l5::pick_tiered_compaction(m, policy);
+    }
+
+    nlohmann::json j;
+    if (segments.empty()) {
+        j["compacted"] = false;
+        std::cout << j.dump() << "\n";
+        return 0;
+    }
+
+    try {
+        const auto st = l5::compact_segments(out_root, segments, opt, [&](const l5::DocInfo& d) {
+            return dead.count(d.doc_id) != 0;
+        });
+        j["compacted"] = true;
+        j["segment_name"] = st.segment_name;
+        j["seg_dir"] = st.seg_dir.string();
+        j["inputs"] = st.inputs;
+        j["docs_in"] = st.docs_in;
+        j["docs_out"] = st.docs_out;
+        j["post9_in"] = st.post9_in;
+        j["post9_out"] = st.post9_out;
+        j["built_at_utc"] = st.built_at_utc;
+        std::cout << j.dump() << "\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "l5_compact failed: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -1,7 +1,9 @@
 // Back_L5/cpp/tools/l5_search_main.cpp
 #include <iostream>
 #include <filesystem>
+#include <fstream>
 #include <string>
+#include <vector>
 
 #include "l5/search_multi.h"
 #include <nlohmann/json.hpp>
@@ -13,21 +15,43 @@ static std::string arg_value(int& i, int argc, char** argv) {
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: l5_search <out_root_dir> --query \"...\" [--topk N] [--normalized 0|1]\n";
+        std::cerr << "Usage: l5_search <out_root_dir> --query \"...\" [--topk N] [--normalized 0|1] [--parallel N] [--no-bloom] [--stop-hashes]\n"
+                  << "       l5_search <out_root_dir> --batch <queries.txt> [...]   (one query per line => NDJSON)\n";
         return 1;
     }
 
     std::filesystem::path out_root = argv[1];
     std::string query;
+    std::string batch_file;
     bool normalized = false;
     l5::SearchOptions opt;
 
     for (int i = 2; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--query") query = arg_value(i, argc, argv);
+        else if (a == "--batch") batch_file = arg_value(i, argc, argv);
         else if (a == "--topk") opt.topk = (uint32_t)std::stoul(arg_value(i, argc, argv));
         else if (a == "--min-hits") opt.min_hits = (uint32_t)std::stoul(arg_value(i, argc, argv));
+        else if (a == "--parallel") opt.max_parallel_segments = (uint32_t)std::stoul(arg_value(i, argc, argv));
         else if (a == "--normalized") normalized = (arg_value(i, argc, argv) == "1");
+        else if (a == "--no-bloom") opt.use_hash_filter = false;
+        else if (a == "--stop-hashes") opt.use_stop_hashes = true;
+    }
+
+    if (!batch_file.empty()) {
+        std::ifstream in(batch_file);
+        if (!in) {
+            std::cerr << "Cannot open " << batch_file << "\n";
+            return 2;
+        }
+        std::vector<std::string> queries;
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty()) queries.push_back(line);
+        }
+        for (const auto& r : l5::search_batch(out_root, queries, normalized, opt)) {
+            std::cout << l5::to_json(r).dump() << "\n";
+        }
+        return 0;
     }
 
     if (query.empty()) {